@@ -0,0 +1,264 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * batch.c: Batches of requests answered with one aggregated reply
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a packet is too small to carry more than a few requests, therefore, the
+ * batch request only announces how many of the following requests of the
+ * client form the batch. brickd dispatches them to the hardware right away,
+ * but holds back their responses until all responses arrived or the deadline
+ * passed. then it sends the held back responses in order, followed by the
+ * batch response that has an error code for each item. a client can send the
+ * batch request and all items at once and gets all responses at once.
+ *
+ * every item is dispatched with the response expected flag set, so brickd can
+ * report its error code. the client only gets the responses it asked for.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/log.h>
+#include <daemonlib/node.h>
+#include <daemonlib/utils.h>
+
+#include "batch.h"
+
+#include "hardware.h"
+#include "network.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+// the pending requests of unanswered items are removed, so late responses
+// are dropped instead of being sent to the client
+static void batch_remove_pending_requests(Batch *batch) {
+	Node *pending_request_client_node = batch->client->pending_request_sentinel.next;
+	Node *next_pending_request_client_node;
+	PendingRequest *pending_request;
+
+	while (pending_request_client_node != &batch->client->pending_request_sentinel) {
+		next_pending_request_client_node = pending_request_client_node->next;
+		pending_request = containerof(pending_request_client_node, PendingRequest, client_node);
+
+		if (pending_request->batch == batch) {
+			pending_request_remove_and_free(pending_request);
+		}
+
+		pending_request_client_node = next_pending_request_client_node;
+	}
+}
+
+static void batch_finish(Batch *batch) {
+	BatchRequestsResponse response;
+	int i;
+
+	if (timer_configure(&batch->timer, 0, 0) < 0) {
+		log_error("Could not stop batch timer: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+
+	batch_remove_pending_requests(batch);
+
+	for (i = 0; i < batch->items_received; ++i) {
+		if (batch->response_expected[i] && batch->response_received[i]) {
+			client_dispatch_response(batch->client, NULL, &batch->responses[i], true, false);
+		}
+	}
+
+	memset(&response, 0, sizeof(response));
+
+	response.header = batch->header;
+	response.header.length = sizeof(response);
+	response.item_count = (uint8_t)batch->items_received;
+
+	memcpy(response.error_codes, batch->error_codes, batch->items_received);
+
+	packet_header_set_error_code(&response.header, PACKET_E_SUCCESS);
+
+	log_debug("Finished batch of %d request(s) for client ("CLIENT_SIGNATURE_FORMAT"), %d response(s) missing",
+	          batch->items_received, client_expand_signature(batch->client),
+	          batch->responses_pending);
+
+	// the batch response is sent even if the client did not ask for it,
+	// because it ends the batch. without a pending request it is forced
+	client_dispatch_response(batch->client, NULL, (Packet *)&response,
+	                         !packet_header_get_response_expected(&batch->header), false);
+
+	batch->active = false;
+}
+
+static void batch_handle_timeout(void *opaque) {
+	Batch *batch = opaque;
+
+	if (batch->active) {
+		batch_finish(batch);
+	}
+}
+
+Batch *batch_create(Client *client) {
+	Batch *batch;
+
+	batch = calloc(1, sizeof(Batch));
+
+	if (batch == NULL) {
+		log_error("Could not allocate batch: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return NULL;
+	}
+
+	batch->client = client;
+	batch->active = false;
+
+	if (timer_create_(&batch->timer, batch_handle_timeout, batch) < 0) {
+		log_error("Could not create batch timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		free(batch);
+
+		return NULL;
+	}
+
+	return batch;
+}
+
+void batch_destroy(Batch *batch) {
+	Node *pending_request_client_node;
+	PendingRequest *pending_request;
+
+	// the pending requests stay with the client, which might hand them over
+	// to a zombie, but they are not part of a batch anymore
+	if (batch->active) {
+		pending_request_client_node = batch->client->pending_request_sentinel.next;
+
+		while (pending_request_client_node != &batch->client->pending_request_sentinel) {
+			pending_request = containerof(pending_request_client_node, PendingRequest, client_node);
+
+			if (pending_request->batch == batch) {
+				pending_request->batch = NULL;
+			}
+
+			pending_request_client_node = pending_request_client_node->next;
+		}
+	}
+
+	timer_destroy(&batch->timer);
+	free(batch);
+}
+
+PacketE batch_begin(Batch *batch, BatchRequestsRequest *request) {
+	uint16_t timeout = uint16_from_le(request->timeout);
+
+	if (batch->active) {
+		log_warn("Client ("CLIENT_SIGNATURE_FORMAT") started a batch while another one is still active",
+		         client_expand_signature(batch->client));
+
+		return PACKET_E_INVALID_PARAMETER;
+	}
+
+	if (request->item_count < 1 || request->item_count > BATCH_MAX_ITEMS) {
+		return PACKET_E_INVALID_PARAMETER;
+	}
+
+	if (timeout == 0) {
+		timeout = BATCH_DEFAULT_TIMEOUT;
+	}
+
+	if (timer_configure(&batch->timer, (uint64_t)timeout * 1000, 0) < 0) {
+		log_error("Could not start batch timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return PACKET_E_UNKNOWN_ERROR;
+	}
+
+	batch->active = true;
+	batch->header = request->header;
+	batch->item_count = request->item_count;
+	batch->items_received = 0;
+	batch->responses_pending = 0;
+
+	memset(batch->response_received, 0, sizeof(batch->response_received));
+
+	log_debug("Client ("CLIENT_SIGNATURE_FORMAT") started a batch of %d request(s) with a timeout of %u msec",
+	          client_expand_signature(batch->client), batch->item_count, timeout);
+
+	return PACKET_E_SUCCESS;
+}
+
+bool batch_is_collecting(Batch *batch) {
+	return batch->active && batch->items_received < batch->item_count;
+}
+
+void batch_add_request(Batch *batch, Packet *request) {
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+	int i = batch->items_received++;
+	PendingRequest *pending_request;
+
+	if (uint32_from_le(request->header.uid) == UID_BRICK_DAEMON) {
+		log_warn("Client ("CLIENT_SIGNATURE_FORMAT") added brickd request (%s) to a batch, rejecting it",
+		         client_expand_signature(batch->client),
+		         packet_get_request_signature(packet_signature, request));
+
+		batch->error_codes[i] = BATCH_ITEM_E_REJECTED;
+	} else {
+		batch->response_expected[i] = packet_header_get_response_expected(&request->header);
+
+		packet_header_set_response_expected(&request->header, true);
+
+		pending_request = network_client_expects_response(batch->client, request);
+
+		if (pending_request != NULL) {
+			pending_request->batch = batch;
+			pending_request->batch_index = i;
+
+			batch->error_codes[i] = BATCH_ITEM_E_TIMEOUT;
+
+			++batch->responses_pending;
+		} else {
+			// dispatch it anyway, but its outcome is unknown
+			batch->error_codes[i] = PACKET_E_UNKNOWN_ERROR;
+		}
+
+		hardware_dispatch_request(request);
+	}
+
+	if (!batch_is_collecting(batch) && batch->responses_pending == 0) {
+		batch_finish(batch);
+	}
+}
+
+void batch_dispatch_response(Batch *batch, PendingRequest *pending_request, Packet *response) {
+	int i = pending_request->batch_index;
+
+	memcpy(&batch->responses[i], response, response->header.length);
+
+	batch->response_received[i] = true;
+
+	batch->error_codes[i] = packet_header_get_error_code(&response->header);
+
+	pending_request_remove_and_free(pending_request);
+
+	--batch->responses_pending;
+
+	if (!batch_is_collecting(batch) && batch->responses_pending == 0) {
+		batch_finish(batch);
+	}
+}
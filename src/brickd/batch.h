@@ -0,0 +1,82 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * batch.h: Batches of requests answered with one aggregated reply
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_BATCH_H
+#define BRICKD_BATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <daemonlib/packet.h>
+#include <daemonlib/timer.h>
+
+#include "client.h"
+
+// brickd function, called with UID 1
+#define FUNCTION_BATCH_REQUESTS 9
+
+#define BATCH_MAX_ITEMS 64
+#define BATCH_DEFAULT_TIMEOUT 2500 // milliseconds
+
+// item error codes 0 to 3 are the error codes of the item responses
+#define BATCH_ITEM_E_TIMEOUT 4 // no response before the deadline
+#define BATCH_ITEM_E_REJECTED 5 // requests for brickd cannot be batched
+
+#include <daemonlib/packed_begin.h>
+
+typedef struct {
+	PacketHeader header;
+	uint8_t item_count; // number of following requests that form the batch
+	uint16_t timeout; // in milliseconds, 0 for the default
+} ATTRIBUTE_PACKED BatchRequestsRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t item_count;
+	uint8_t error_codes[BATCH_MAX_ITEMS];
+} ATTRIBUTE_PACKED BatchRequestsResponse;
+
+#include <daemonlib/packed_end.h>
+
+struct _Batch {
+	Client *client;
+	bool active;
+	PacketHeader header; // of the batch request
+	int item_count;
+	int items_received;
+	int responses_pending;
+	Timer timer;
+	bool response_expected[BATCH_MAX_ITEMS];
+	bool response_received[BATCH_MAX_ITEMS];
+	uint8_t error_codes[BATCH_MAX_ITEMS];
+	Packet responses[BATCH_MAX_ITEMS];
+};
+
+Batch *batch_create(Client *client);
+void batch_destroy(Batch *batch);
+
+PacketE batch_begin(Batch *batch, BatchRequestsRequest *request);
+bool batch_is_collecting(Batch *batch);
+void batch_add_request(Batch *batch, Packet *request);
+
+void batch_dispatch_response(Batch *batch, PendingRequest *pending_request, Packet *response);
+
+#endif // BRICKD_BATCH_H
@@ -0,0 +1,291 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * callback_history.c: Recent callbacks per device for replay on connect
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * the last few callbacks of each (UID, function ID) pair are kept in a ring,
+ * so a client that just connected can get the current state of all devices
+ * from memory, instead of waiting for the next callback period or sending
+ * getter requests to the hardware. the entries are kept sorted by UID and
+ * function ID, so a callback finds its ring by binary search and all rings
+ * of one device are next to each other.
+ *
+ * the number of pairs is bounded. if a new pair doesn't fit anymore then the
+ * pair that got its last callback the longest time ago is evicted. a replay
+ * is split into pages of bounded size, so a client connection doesn't get the
+ * whole history in one burst.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/array.h>
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "callback_history.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+typedef struct {
+	uint32_t uid; // little endian
+	uint8_t function_id;
+	int first; // index of the oldest callback
+	int used;
+	uint64_t recorded_at; // value of _record_count at the last callback
+	Packet *callbacks; // ring of _length callbacks
+} CallbackHistoryEntry;
+
+static int _length = 0; // 0 if disabled
+static Array _entries;
+static uint64_t _record_count = 0;
+
+static void callback_history_destroy_entry(CallbackHistoryEntry *entry) {
+	free(entry->callbacks);
+}
+
+static int callback_history_compare(CallbackHistoryEntry *entry, uint32_t uid,
+                                    uint8_t function_id) {
+	if (entry->uid != uid) {
+		return entry->uid < uid ? -1 : 1;
+	}
+
+	if (entry->function_id != function_id) {
+		return entry->function_id < function_id ? -1 : 1;
+	}
+
+	return 0;
+}
+
+// returns the index of the first entry that is not less than the given pair
+static int callback_history_find(uint32_t uid, uint8_t function_id) {
+	int lower = 0;
+	int upper = _entries.count;
+	int middle;
+
+	while (lower < upper) {
+		middle = lower + (upper - lower) / 2;
+
+		if (callback_history_compare(array_get(&_entries, middle), uid, function_id) < 0) {
+			lower = middle + 1;
+		} else {
+			upper = middle;
+		}
+	}
+
+	return lower;
+}
+
+// removes the entry that got its last callback the longest time ago. returns
+// its index
+static int callback_history_evict(void) {
+	CallbackHistoryEntry *entry;
+	uint64_t oldest_recorded_at = UINT64_MAX;
+	int oldest = 0;
+	int i;
+
+	for (i = 0; i < _entries.count; ++i) {
+		entry = array_get(&_entries, i);
+
+		if (entry->recorded_at < oldest_recorded_at) {
+			oldest_recorded_at = entry->recorded_at;
+			oldest = i;
+		}
+	}
+
+	entry = array_get(&_entries, oldest);
+
+	log_debug("Callback history is full, evicting history of function ID %u of UID %u",
+	          entry->function_id, uint32_from_le(entry->uid));
+
+	array_remove(&_entries, oldest, (ItemDestroyFunction)callback_history_destroy_entry);
+
+	return oldest;
+}
+
+static CallbackHistoryEntry *callback_history_insert(int i, uint32_t uid, uint8_t function_id) {
+	Packet *callbacks;
+	CallbackHistoryEntry *entry;
+
+	if (_entries.count >= CALLBACK_HISTORY_MAX_ENTRIES && callback_history_evict() < i) {
+		--i;
+	}
+
+	callbacks = calloc(_length, sizeof(Packet));
+
+	if (callbacks == NULL) {
+		log_error("Could not allocate callback history: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return NULL;
+	}
+
+	if (array_append(&_entries) == NULL) {
+		log_error("Could not append to callback history array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		free(callbacks);
+
+		return NULL;
+	}
+
+	// move the following entries up to keep the array sorted
+	entry = array_get(&_entries, i);
+
+	if (i < _entries.count - 1) {
+		memmove(array_get(&_entries, i + 1), entry,
+		        (_entries.count - 1 - i) * sizeof(CallbackHistoryEntry));
+	}
+
+	entry->uid = uid;
+	entry->function_id = function_id;
+	entry->first = 0;
+	entry->used = 0;
+	entry->recorded_at = 0;
+	entry->callbacks = callbacks;
+
+	return entry;
+}
+
+int callback_history_init(int length) {
+	log_debug("Initializing callback history subsystem");
+
+	_length = length;
+
+	// the CallbackHistoryEntry struct is relocatable, because the callbacks
+	// are stored in a separate allocation
+	if (array_create(&_entries, 32, sizeof(CallbackHistoryEntry), true) < 0) {
+		log_error("Could not create callback history array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	if (_length > 0) {
+		log_info("Keeping the last %d callback(s) per device and function for replay", _length);
+	}
+
+	return 0;
+}
+
+void callback_history_exit(void) {
+	log_debug("Shutting down callback history subsystem");
+
+	array_destroy(&_entries, (ItemDestroyFunction)callback_history_destroy_entry);
+}
+
+void callback_history_record(Packet *callback) {
+	uint32_t uid = callback->header.uid;
+	uint8_t function_id = callback->header.function_id;
+	CallbackHistoryEntry *entry;
+	int i;
+	int k;
+
+	if (_length == 0) {
+		return;
+	}
+
+	i = callback_history_find(uid, function_id);
+
+	if (i < _entries.count &&
+	    callback_history_compare(array_get(&_entries, i), uid, function_id) == 0) {
+		entry = array_get(&_entries, i);
+	} else {
+		entry = callback_history_insert(i, uid, function_id);
+
+		if (entry == NULL) {
+			return;
+		}
+	}
+
+	// overwrite the oldest callback if the ring is full
+	if (entry->used < _length) {
+		k = (entry->first + entry->used) % _length;
+
+		++entry->used;
+	} else {
+		k = entry->first;
+
+		entry->first = (entry->first + 1) % _length;
+	}
+
+	memcpy(&entry->callbacks[k], callback, callback->header.length);
+
+	entry->recorded_at = ++_record_count;
+}
+
+// the history of a device is stale once it (re)connects or disconnects
+void callback_history_forget(uint32_t uid) {
+	int i;
+
+	if (_length == 0) {
+		return;
+	}
+
+	i = callback_history_find(uid, 0);
+
+	while (i < _entries.count &&
+	       ((CallbackHistoryEntry *)array_get(&_entries, i))->uid == uid) {
+		array_remove(&_entries, i, (ItemDestroyFunction)callback_history_destroy_entry);
+	}
+}
+
+// calls the function for each recorded callback of the given device, or of
+// all devices if the UID is 0, oldest first per (UID, function ID) pair. the
+// first offset callbacks are skipped and at most CALLBACK_HISTORY_MAX_REPLAY_COUNT
+// callbacks are replayed. returns the number of replayed callbacks and stores
+// the number of callbacks that are left for the next page in remaining
+int callback_history_replay(uint32_t uid, uint32_t offset, CallbackHistoryFunction function,
+                            void *opaque, uint32_t *remaining) {
+	CallbackHistoryEntry *entry;
+	uint32_t skipped = 0;
+	int count = 0;
+	int i;
+	int k;
+
+	*remaining = 0;
+
+	if (_length == 0) {
+		return 0;
+	}
+
+	for (i = uid == 0 ? 0 : callback_history_find(uid, 0); i < _entries.count; ++i) {
+		entry = array_get(&_entries, i);
+
+		if (uid != 0 && entry->uid != uid) {
+			break;
+		}
+
+		for (k = 0; k < entry->used; ++k) {
+			if (skipped < offset) {
+				++skipped;
+			} else if (count < CALLBACK_HISTORY_MAX_REPLAY_COUNT) {
+				function(&entry->callbacks[(entry->first + k) % _length], opaque);
+
+				++count;
+			} else {
+				++*remaining;
+			}
+		}
+	}
+
+	return count;
+}
@@ -0,0 +1,65 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * callback_history.h: Recent callbacks per device for replay on connect
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_CALLBACK_HISTORY_H
+#define BRICKD_CALLBACK_HISTORY_H
+
+#include <stdint.h>
+
+#include <daemonlib/packet.h>
+
+// brickd function, called with UID 1
+#define FUNCTION_REPLAY_CALLBACK_HISTORY 8
+
+#define CALLBACK_HISTORY_MAX_ENTRIES 1024 // (UID, function ID) pairs
+#define CALLBACK_HISTORY_MAX_REPLAY_COUNT 256 // callbacks per replay request
+
+#include <daemonlib/packed_begin.h>
+
+typedef struct {
+	PacketHeader header;
+	uint32_t uid; // only callbacks of this device, 0 for all devices
+	uint32_t offset; // number of callbacks to skip, to request the next page
+} ATTRIBUTE_PACKED ReplayCallbackHistoryRequest;
+
+// if remaining_count is not 0 then the replay was cut off. the next page is
+// requested with the offset increased by callback_count. the history might
+// have changed between the requests
+typedef struct {
+	PacketHeader header;
+	uint16_t callback_count; // number of callbacks sent before this response
+	uint32_t remaining_count; // number of callbacks left for the next pages
+} ATTRIBUTE_PACKED ReplayCallbackHistoryResponse;
+
+#include <daemonlib/packed_end.h>
+
+typedef void (*CallbackHistoryFunction)(Packet *callback, void *opaque);
+
+int callback_history_init(int length);
+void callback_history_exit(void);
+
+void callback_history_record(Packet *callback);
+void callback_history_forget(uint32_t uid);
+
+int callback_history_replay(uint32_t uid, uint32_t offset, CallbackHistoryFunction function,
+                            void *opaque, uint32_t *remaining);
+
+#endif // BRICKD_CALLBACK_HISTORY_H
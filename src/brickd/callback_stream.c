@@ -0,0 +1,285 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * callback_stream.c: UDP stream of callbacks for loss-tolerant clients
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a client can register a UDP destination for the callbacks it would receive
+ * otherwise over its connection. the callbacks are sent as datagrams without
+ * any retransmission or backlog, so a slow receiver loses callbacks instead
+ * of delaying them. responses are still sent over the connection.
+ */
+
+#define _GNU_SOURCE // for sendmmsg
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "callback_stream.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+static Node _flush_sentinel;
+static bool _flush_sentinel_initialized = false;
+
+static const uint8_t _ipv4_mapped_prefix[12] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF
+};
+
+static void callback_stream_flush(CallbackStream *stream) {
+#ifdef __linux__
+	struct mmsghdr messages[CALLBACK_STREAM_MAX_QUEUED_DATAGRAMS];
+#endif
+	struct iovec iovecs[CALLBACK_STREAM_MAX_QUEUED_DATAGRAMS];
+	int offset = 0;
+	int rc;
+	int i;
+
+	if (stream->flush_node_linked) {
+		node_remove(&stream->flush_node);
+
+		stream->flush_node_linked = false;
+	}
+
+	for (i = 0; i < stream->queue_used; ++i) {
+		iovecs[i].iov_base = &stream->queue[i];
+		iovecs[i].iov_len = stream->queue_lengths[i];
+
+#ifdef __linux__
+		memset(&messages[i], 0, sizeof(messages[i]));
+
+		messages[i].msg_hdr.msg_iov = &iovecs[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+#endif
+	}
+
+	// if the socket buffer is full or the destination is unreachable then the
+	// remaining datagrams are dropped. the receiver notices this by the gap in
+	// the sequence numbers
+	while (offset < stream->queue_used) {
+#ifdef __linux__
+		rc = sendmmsg(stream->handle, messages + offset, stream->queue_used - offset, 0);
+#else
+		rc = send(stream->handle, iovecs[offset].iov_base, iovecs[offset].iov_len, 0) < 0 ? -1 : 1;
+#endif
+
+		if (rc < 0) {
+			if (errno_interrupted()) {
+				continue;
+			}
+
+			break;
+		}
+
+		offset += rc;
+	}
+
+	stream->sent += offset;
+	stream->dropped += stream->queue_used - offset;
+	stream->queue_used = 0;
+}
+
+// sets error_code if the request is invalid or the stream cannot be created
+CallbackStream *callback_stream_create(SetCallbackStreamRequest *request, PacketE *error_code) {
+	CallbackStream *stream;
+	struct sockaddr_in *address4;
+	struct sockaddr_in6 *address6;
+	bool multicast;
+	int hop_limit = request->hop_limit;
+	int rc;
+
+	stream = calloc(1, sizeof(CallbackStream));
+
+	if (stream == NULL) {
+		log_error("Could not allocate callback stream: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		*error_code = PACKET_E_UNKNOWN_ERROR;
+
+		return NULL;
+	}
+
+	if (memcmp(request->address, _ipv4_mapped_prefix, sizeof(_ipv4_mapped_prefix)) == 0) {
+		address4 = (struct sockaddr_in *)&stream->address;
+		address4->sin_family = AF_INET;
+		address4->sin_port = htons(uint16_from_le(request->port));
+
+		memcpy(&address4->sin_addr, request->address + sizeof(_ipv4_mapped_prefix), 4);
+
+		stream->address_length = sizeof(*address4);
+		multicast = IN_MULTICAST(ntohl(address4->sin_addr.s_addr));
+	} else {
+		address6 = (struct sockaddr_in6 *)&stream->address;
+		address6->sin6_family = AF_INET6;
+		address6->sin6_port = htons(uint16_from_le(request->port));
+
+		memcpy(&address6->sin6_addr, request->address, 16);
+
+		stream->address_length = sizeof(*address6);
+		multicast = IN6_IS_ADDR_MULTICAST(&address6->sin6_addr);
+	}
+
+	stream->handle = socket(stream->address.ss_family, SOCK_DGRAM, 0);
+
+	if (stream->handle < 0) {
+		log_error("Could not create UDP socket for callback stream: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		free(stream);
+
+		*error_code = PACKET_E_UNKNOWN_ERROR;
+
+		return NULL;
+	}
+
+	// a full socket buffer has to drop datagrams instead of blocking brickd
+	rc = fcntl(stream->handle, F_GETFL, 0);
+
+	if (rc < 0 || fcntl(stream->handle, F_SETFL, rc | O_NONBLOCK) < 0) {
+		log_error("Could not enable non-blocking mode for callback stream: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto error;
+	}
+
+	if (multicast && hop_limit > 0) {
+		if (stream->address.ss_family == AF_INET) {
+			rc = setsockopt(stream->handle, IPPROTO_IP, IP_MULTICAST_TTL,
+			                &hop_limit, sizeof(hop_limit));
+		} else {
+			rc = setsockopt(stream->handle, IPPROTO_IPV6, IPV6_MULTICAST_HOPS,
+			                &hop_limit, sizeof(hop_limit));
+		}
+
+		if (rc < 0) {
+			log_error("Could not set multicast hop limit for callback stream: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			goto error;
+		}
+	}
+
+	// connecting a UDP socket only fixes its destination, so the datagrams
+	// can be sent without an address
+	if (connect(stream->handle, (struct sockaddr *)&stream->address, stream->address_length) < 0) {
+		log_error("Could not connect UDP socket for callback stream: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		*error_code = PACKET_E_INVALID_PARAMETER;
+
+		close(stream->handle);
+		free(stream);
+
+		return NULL;
+	}
+
+	stream->uid = request->uid;
+
+	if (!_flush_sentinel_initialized) {
+		node_reset(&_flush_sentinel);
+
+		_flush_sentinel_initialized = true;
+	}
+
+	*error_code = PACKET_E_SUCCESS;
+
+	return stream;
+
+error:
+	close(stream->handle);
+	free(stream);
+
+	*error_code = PACKET_E_UNKNOWN_ERROR;
+
+	return NULL;
+}
+
+void callback_stream_destroy(CallbackStream *stream) {
+	callback_stream_flush(stream);
+
+	log_debug("Destroying callback stream (handle: %d), sent %llu and dropped %llu datagram(s)",
+	          stream->handle, (unsigned long long)stream->sent,
+	          (unsigned long long)stream->dropped);
+
+	close(stream->handle);
+	free(stream);
+}
+
+// enumerate callbacks are not streamed, because a client cannot afford to
+// miss a device (dis)connecting
+bool callback_stream_is_matching(CallbackStream *stream, Packet *callback) {
+	return callback->header.function_id != CALLBACK_ENUMERATE &&
+	       (stream->uid == 0 || stream->uid == callback->header.uid);
+}
+
+// the timestamp callback is optional and can be NULL
+void callback_stream_enqueue(CallbackStream *stream, Packet *callback, Packet *timestamp_callback) {
+	CallbackStreamDatagram *datagram;
+	uint8_t *packet;
+
+	if (stream->queue_used >= CALLBACK_STREAM_MAX_QUEUED_DATAGRAMS) {
+		callback_stream_flush(stream);
+	}
+
+	datagram = &stream->queue[stream->queue_used];
+	datagram->sequence_number = uint32_to_le(stream->sequence_number++);
+	packet = (uint8_t *)&datagram->packet;
+
+	if (timestamp_callback != NULL) {
+		memcpy(packet, timestamp_callback, timestamp_callback->header.length);
+
+		packet += timestamp_callback->header.length;
+	}
+
+	memcpy(packet, callback, callback->header.length);
+
+	stream->queue_lengths[stream->queue_used++] =
+		(int)(packet + callback->header.length - (uint8_t *)datagram);
+
+	if (!stream->flush_node_linked) {
+		node_insert_before(&_flush_sentinel, &stream->flush_node);
+
+		stream->flush_node_linked = true;
+	}
+}
+
+// sends the datagrams that got queued during this event loop iteration
+void callback_stream_flush_all(void) {
+	CallbackStream *stream;
+
+	if (!_flush_sentinel_initialized) {
+		return;
+	}
+
+	while (_flush_sentinel.next != &_flush_sentinel) {
+		stream = containerof(_flush_sentinel.next, CallbackStream, flush_node);
+
+		callback_stream_flush(stream); // unlinks the stream
+	}
+}
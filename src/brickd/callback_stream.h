@@ -0,0 +1,90 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * callback_stream.h: UDP stream of callbacks for loss-tolerant clients
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_CALLBACK_STREAM_H
+#define BRICKD_CALLBACK_STREAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <daemonlib/node.h>
+#include <daemonlib/packet.h>
+
+// brickd function, called with UID 1. only supported if an authentication
+// secret is configured
+#define FUNCTION_SET_CALLBACK_STREAM 5
+
+// datagrams queued during one event loop iteration are sent with one system
+// call. if more callbacks arrive then the queue is sent early
+#define CALLBACK_STREAM_MAX_QUEUED_DATAGRAMS 64
+
+#include <daemonlib/packed_begin.h>
+
+typedef struct {
+	PacketHeader header;
+	uint8_t address[16]; // IPv6 address, IPv4 address as ::ffff:a.b.c.d
+	uint16_t port; // 0 to remove the stream
+	uint8_t hop_limit; // for multicast, 0 for the system default
+	uint32_t uid; // only callbacks of this device, 0 for all devices
+} ATTRIBUTE_PACKED SetCallbackStreamRequest;
+
+typedef struct {
+	PacketHeader header;
+} ATTRIBUTE_PACKED SetCallbackStreamResponse;
+
+// each datagram carries one callback packet. if the client enabled ingress
+// timestamps then the ingress timestamp callback comes first and the callback
+// follows it in the same datagram, so both are lost or received together. the
+// sequence number counts up by one per datagram, a gap tells the receiver that
+// datagrams got lost
+typedef struct {
+	uint32_t sequence_number;
+	Packet packet;
+	uint8_t following_packet[sizeof(Packet)];
+} ATTRIBUTE_PACKED CallbackStreamDatagram;
+
+#include <daemonlib/packed_end.h>
+
+typedef struct {
+	int handle;
+	struct sockaddr_storage address;
+	socklen_t address_length;
+	uint32_t uid; // little endian, 0 for all devices
+	uint32_t sequence_number;
+	CallbackStreamDatagram queue[CALLBACK_STREAM_MAX_QUEUED_DATAGRAMS];
+	int queue_lengths[CALLBACK_STREAM_MAX_QUEUED_DATAGRAMS]; // in bytes
+	int queue_used;
+	Node flush_node;
+	bool flush_node_linked;
+	uint64_t sent;
+	uint64_t dropped;
+} CallbackStream;
+
+CallbackStream *callback_stream_create(SetCallbackStreamRequest *request, PacketE *error_code);
+void callback_stream_destroy(CallbackStream *stream);
+
+bool callback_stream_is_matching(CallbackStream *stream, Packet *callback);
+void callback_stream_enqueue(CallbackStream *stream, Packet *callback, Packet *timestamp_callback);
+
+void callback_stream_flush_all(void);
+
+#endif // BRICKD_CALLBACK_STREAM_H
@@ -28,24 +28,27 @@
 #include <daemonlib/config.h>
 #include <daemonlib/event.h>
 #include <daemonlib/log.h>
+#include <daemonlib/socket.h>
 #include <daemonlib/utils.h>
 
 #include "client.h"
 
+#include "batch.h"
+#include "callback_history.h"
 #include "hardware.h"
 #include "hmac.h"
 #include "network.h"
 #ifdef BRICKD_WITH_RED_BRICK
 	#include "red_usb_gadget.h"
 #endif
+#include "tuning.h"
+#include "websocket.h"
 #include "zombie.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
 extern uint8_t _redapid_version[3];
 
-#define UID_BRICK_DAEMON 1
-
 static void client_handle_get_authentication_nonce_request(Client *client, GetAuthenticationNonceRequest *request) {
 	GetAuthenticationNonceResponse response;
 
@@ -146,10 +149,245 @@ static void client_handle_authenticate_request(Client *client, AuthenticateReque
 	}
 }
 
+// brickd functions other than the authentication are only available to a
+// client that is authenticated or doesn't need to be. requests of other
+// clients are dropped
+static bool client_is_authenticated(Client *client, Packet *request) {
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+
+	if (client->authentication_state == CLIENT_AUTHENTICATION_STATE_DISABLED ||
+	    client->authentication_state == CLIENT_AUTHENTICATION_STATE_DONE) {
+		return true;
+	}
+
+	log_packet_debug("Client ("CLIENT_SIGNATURE_FORMAT") is not authenticated, dropping request (%s)",
+	                 client_expand_signature(client),
+	                 packet_get_request_signature(packet_signature, request));
+
+	return false;
+}
+
+static void client_handle_get_tuning_parameter_request(Client *client, GetTuningParameterRequest *request) {
+	GetTuningParameterResponse response;
+	PacketE error_code;
+	uint32_t value = 0;
+
+	if (!client_is_authenticated(client, (Packet *)request)) {
+		return;
+	}
+
+	error_code = tuning_get_parameter(request->parameter, &value);
+
+	if (packet_header_get_response_expected(&request->header)) {
+		response.header = request->header;
+		response.header.length = sizeof(response);
+		response.value = uint32_to_le(value);
+
+		packet_header_set_error_code(&response.header, error_code);
+
+		client_dispatch_response(client, NULL, (Packet *)&response, false, false);
+	}
+}
+
+static void client_handle_set_tuning_parameter_request(Client *client, SetTuningParameterRequest *request) {
+	SetTuningParameterResponse response;
+	PacketE error_code;
+
+	if (client->authentication_state == CLIENT_AUTHENTICATION_STATE_DISABLED) {
+		// without authentication every client could change the parameters,
+		// only allow this if an authentication secret is configured
+		log_warn("Client ("CLIENT_SIGNATURE_FORMAT") tries to change a tuning parameter, but authentication is disabled, ignoring request",
+		         client_expand_signature(client));
+
+		error_code = PACKET_E_FUNCTION_NOT_SUPPORTED;
+	} else if (!client_is_authenticated(client, (Packet *)request)) {
+		return;
+	} else {
+		error_code = tuning_set_parameter(request->parameter,
+		                                  uint32_from_le(request->value),
+		                                  request->persist != 0);
+	}
+
+	if (packet_header_get_response_expected(&request->header)) {
+		response.header = request->header;
+		response.header.length = sizeof(response);
+
+		packet_header_set_error_code(&response.header, error_code);
+
+		client_dispatch_response(client, NULL, (Packet *)&response, false, false);
+	}
+}
+
+#ifndef _WIN32
+
+static void client_set_callback_stream(Client *client, SetCallbackStreamRequest *request,
+                                       PacketE *error_code) {
+	CallbackStream *callback_stream;
+	char hostname[NI_MAXHOST];
+	char port[NI_MAXSERV];
+
+	if (client->callback_stream != NULL) {
+		callback_stream_destroy(client->callback_stream);
+
+		client->callback_stream = NULL;
+	}
+
+	if (request->port == 0) {
+		log_info("Client ("CLIENT_SIGNATURE_FORMAT") receives callbacks over its connection again",
+		         client_expand_signature(client));
+	} else {
+		callback_stream = callback_stream_create(request, error_code);
+
+		if (callback_stream != NULL) {
+			if (socket_address_to_hostname((struct sockaddr *)&callback_stream->address,
+			                               callback_stream->address_length,
+			                               hostname, sizeof(hostname),
+			                               port, sizeof(port)) < 0) {
+				string_copy(hostname, sizeof(hostname), "<unknown>");
+				string_copy(port, sizeof(port), "<unknown>");
+			}
+
+			log_info("Client ("CLIENT_SIGNATURE_FORMAT") receives callbacks as UDP datagrams sent to %s port %s",
+			         client_expand_signature(client), hostname, port);
+
+			client->callback_stream = callback_stream;
+		}
+	}
+}
+
+static void client_handle_set_callback_stream_request(Client *client, SetCallbackStreamRequest *request) {
+	SetCallbackStreamResponse response;
+	PacketE error_code = PACKET_E_SUCCESS;
+
+	if (client->authentication_state == CLIENT_AUTHENTICATION_STATE_DISABLED) {
+		// without authentication every client could make brickd send UDP
+		// datagrams to an arbitrary host, only allow this if an
+		// authentication secret is configured
+		log_warn("Client ("CLIENT_SIGNATURE_FORMAT") tries to set a callback stream, but authentication is disabled, ignoring request",
+		         client_expand_signature(client));
+
+		error_code = PACKET_E_FUNCTION_NOT_SUPPORTED;
+	} else if (!client_is_authenticated(client, (Packet *)request)) {
+		return;
+	} else {
+		client_set_callback_stream(client, request, &error_code);
+	}
+
+	if (packet_header_get_response_expected(&request->header)) {
+		response.header = request->header;
+		response.header.length = sizeof(response);
+
+		packet_header_set_error_code(&response.header, error_code);
+
+		client_dispatch_response(client, NULL, (Packet *)&response, false, false);
+	}
+}
+
+#endif
+
+static void client_handle_set_ingress_timestamps_request(Client *client, SetIngressTimestampsRequest *request) {
+	SetIngressTimestampsResponse response;
+	bool enabled = request->enabled != 0;
+
+	if (!client_is_authenticated(client, (Packet *)request)) {
+		return;
+	}
+
+	if (client->ingress_timestamps != enabled) {
+		log_debug("Client ("CLIENT_SIGNATURE_FORMAT") %s ingress timestamps",
+		          client_expand_signature(client), enabled ? "enabled" : "disabled");
+
+		client->ingress_timestamps = enabled;
+
+		network_change_ingress_timestamp_clients(enabled ? 1 : -1);
+	}
+
+	if (packet_header_get_response_expected(&request->header)) {
+		response.header = request->header;
+		response.header.length = sizeof(response);
+
+		packet_header_set_error_code(&response.header, PACKET_E_SUCCESS);
+
+		client_dispatch_response(client, NULL, (Packet *)&response, false, false);
+	}
+}
+
+static void client_handle_batch_requests_request(Client *client, BatchRequestsRequest *request) {
+	BatchRequestsResponse response;
+	PacketE error_code;
+
+	if (!client_is_authenticated(client, (Packet *)request)) {
+		return;
+	}
+
+	if (client->batch == NULL) {
+		client->batch = batch_create(client);
+	}
+
+	if (client->batch == NULL) {
+		error_code = PACKET_E_UNKNOWN_ERROR;
+	} else {
+		error_code = batch_begin(client->batch, request);
+	}
+
+	// on success the response is sent once the batch is finished
+	if (error_code != PACKET_E_SUCCESS &&
+	    packet_header_get_response_expected(&request->header)) {
+		memset(&response, 0, sizeof(response));
+
+		response.header = request->header;
+		response.header.length = sizeof(response);
+
+		packet_header_set_error_code(&response.header, error_code);
+
+		client_dispatch_response(client, NULL, (Packet *)&response, false, false);
+	}
+}
+
+static void client_replay_callback(Packet *callback, void *opaque) {
+	client_dispatch_response(opaque, NULL, callback, true, false);
+}
+
+// the recorded callbacks are sent before the response, so the response marks
+// the end of the replayed page
+static void client_handle_replay_callback_history_request(Client *client, ReplayCallbackHistoryRequest *request) {
+	ReplayCallbackHistoryResponse response;
+	uint32_t remaining;
+	int count;
+
+	if (!client_is_authenticated(client, (Packet *)request)) {
+		return;
+	}
+
+	count = callback_history_replay(request->uid, uint32_from_le(request->offset),
+	                                client_replay_callback, client, &remaining);
+
+	log_debug("Replayed %d callback(s) to client ("CLIENT_SIGNATURE_FORMAT"), %u remaining",
+	          count, client_expand_signature(client), remaining);
+
+	if (packet_header_get_response_expected(&request->header)) {
+		response.header = request->header;
+		response.header.length = sizeof(response);
+		response.callback_count = uint16_to_le((uint16_t)MIN(count, UINT16_MAX));
+		response.remaining_count = uint32_to_le(remaining);
+
+		packet_header_set_error_code(&response.header, PACKET_E_SUCCESS);
+
+		client_dispatch_response(client, NULL, (Packet *)&response, false, false);
+	}
+}
+
 static void client_handle_request(Client *client, Packet *request) {
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 	EmptyResponse response;
 
+	// requests that follow a batch request are part of the batch
+	if (client->batch != NULL && batch_is_collecting(client->batch)) {
+		batch_add_request(client->batch, request);
+
+		return;
+	}
+
 	// handle requests meant for brickd
 	if (uint32_from_le(request->header.uid) == UID_BRICK_DAEMON) {
 		// add as pending request if response is expected
@@ -181,6 +419,80 @@ static void client_handle_request(Client *client, Packet *request) {
 			}
 
 			client_handle_authenticate_request(client, (AuthenticateRequest *)request);
+		} else if (request->header.function_id == FUNCTION_GET_TUNING_PARAMETER) {
+			if (request->header.length != sizeof(GetTuningParameterRequest)) {
+				log_error("Received tuning request (%s) from client ("CLIENT_SIGNATURE_FORMAT") with wrong length, disconnecting client",
+				          packet_get_request_signature(packet_signature, request),
+				          client_expand_signature(client));
+
+				client->disconnected = true;
+
+				return;
+			}
+
+			client_handle_get_tuning_parameter_request(client, (GetTuningParameterRequest *)request);
+		} else if (request->header.function_id == FUNCTION_SET_TUNING_PARAMETER) {
+			if (request->header.length != sizeof(SetTuningParameterRequest)) {
+				log_error("Received tuning request (%s) from client ("CLIENT_SIGNATURE_FORMAT") with wrong length, disconnecting client",
+				          packet_get_request_signature(packet_signature, request),
+				          client_expand_signature(client));
+
+				client->disconnected = true;
+
+				return;
+			}
+
+			client_handle_set_tuning_parameter_request(client, (SetTuningParameterRequest *)request);
+#ifndef _WIN32
+		} else if (request->header.function_id == FUNCTION_SET_CALLBACK_STREAM) {
+			if (request->header.length != sizeof(SetCallbackStreamRequest)) {
+				log_error("Received callback stream request (%s) from client ("CLIENT_SIGNATURE_FORMAT") with wrong length, disconnecting client",
+				          packet_get_request_signature(packet_signature, request),
+				          client_expand_signature(client));
+
+				client->disconnected = true;
+
+				return;
+			}
+
+			client_handle_set_callback_stream_request(client, (SetCallbackStreamRequest *)request);
+#endif
+		} else if (request->header.function_id == FUNCTION_SET_INGRESS_TIMESTAMPS) {
+			if (request->header.length != sizeof(SetIngressTimestampsRequest)) {
+				log_error("Received ingress timestamp request (%s) from client ("CLIENT_SIGNATURE_FORMAT") with wrong length, disconnecting client",
+				          packet_get_request_signature(packet_signature, request),
+				          client_expand_signature(client));
+
+				client->disconnected = true;
+
+				return;
+			}
+
+			client_handle_set_ingress_timestamps_request(client, (SetIngressTimestampsRequest *)request);
+		} else if (request->header.function_id == FUNCTION_REPLAY_CALLBACK_HISTORY) {
+			if (request->header.length != sizeof(ReplayCallbackHistoryRequest)) {
+				log_error("Received callback history request (%s) from client ("CLIENT_SIGNATURE_FORMAT") with wrong length, disconnecting client",
+				          packet_get_request_signature(packet_signature, request),
+				          client_expand_signature(client));
+
+				client->disconnected = true;
+
+				return;
+			}
+
+			client_handle_replay_callback_history_request(client, (ReplayCallbackHistoryRequest *)request);
+		} else if (request->header.function_id == FUNCTION_BATCH_REQUESTS) {
+			if (request->header.length != sizeof(BatchRequestsRequest)) {
+				log_error("Received batch request (%s) from client ("CLIENT_SIGNATURE_FORMAT") with wrong length, disconnecting client",
+				          packet_get_request_signature(packet_signature, request),
+				          client_expand_signature(client));
+
+				client->disconnected = true;
+
+				return;
+			}
+
+			client_handle_batch_requests_request(client, (BatchRequestsRequest *)request);
 		} else {
 			response.header = request->header;
 			response.header.length = sizeof(response);
@@ -212,84 +524,89 @@ static void client_handle_read(void *opaque) {
 	const char *message = NULL;
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 
-	length = io_read(client->io, (uint8_t *)&client->request + client->request_used,
-	                 sizeof(Packet) - client->request_used);
+	// a WebSocket can have more payload buffered than fits into the request
+	// buffer, e.g. after decompressing a message. the socket doesn't become
+	// readable again for this, therefore, read until the buffer is drained
+	do {
+		length = io_read(client->io, (uint8_t *)&client->request + client->request_used,
+		                 sizeof(Packet) - client->request_used);
 
-	if (length == 0) {
-		log_info("Client ("CLIENT_SIGNATURE_FORMAT") disconnected by peer",
-		         client_expand_signature(client));
+		if (length == 0) {
+			log_info("Client ("CLIENT_SIGNATURE_FORMAT") disconnected by peer",
+			         client_expand_signature(client));
 
-		client->disconnected = true;
+			client->disconnected = true;
 
-		return;
-	}
+			return;
+		}
 
-	if (length < 0) {
-		if (length == IO_CONTINUE) {
-			// no actual data received
-		} else if (errno_interrupted()) {
-			log_debug("Receiving from client ("CLIENT_SIGNATURE_FORMAT") was interrupted, retrying",
-			          client_expand_signature(client));
-		} else if (errno_would_block()) {
-			log_debug("Receiving from client ("CLIENT_SIGNATURE_FORMAT") would block, retrying",
-			          client_expand_signature(client));
-		} else {
-			log_error("Could not receive from client ("CLIENT_SIGNATURE_FORMAT"), disconnecting client: %s (%d)",
-			          client_expand_signature(client), get_errno_name(errno), errno);
+		if (length < 0) {
+			if (length == IO_CONTINUE) {
+				// no actual data received
+			} else if (errno_interrupted()) {
+				log_debug("Receiving from client ("CLIENT_SIGNATURE_FORMAT") was interrupted, retrying",
+				          client_expand_signature(client));
+			} else if (errno_would_block()) {
+				log_debug("Receiving from client ("CLIENT_SIGNATURE_FORMAT") would block, retrying",
+				          client_expand_signature(client));
+			} else {
+				log_error("Could not receive from client ("CLIENT_SIGNATURE_FORMAT"), disconnecting client: %s (%d)",
+				          client_expand_signature(client), get_errno_name(errno), errno);
 
-			client->disconnected = true;
+				client->disconnected = true;
+			}
+
+			return;
 		}
 
-		return;
-	}
+		client->request_used += length;
 
-	client->request_used += length;
+		while (!client->disconnected && client->request_used > 0) {
+			if (client->request_used < (int)sizeof(PacketHeader)) {
+				// wait for complete header
+				break;
+			}
 
-	while (!client->disconnected && client->request_used > 0) {
-		if (client->request_used < (int)sizeof(PacketHeader)) {
-			// wait for complete header
-			break;
-		}
+			if (!client->request_header_checked) {
+				if (!packet_header_is_valid_request(&client->request.header, &message)) {
+					// FIXME: include packet_get_content_dump output in the error message
+					log_error("Received invalid request (%s) from client ("CLIENT_SIGNATURE_FORMAT"), disconnecting client: %s",
+					          packet_get_request_signature(packet_signature, &client->request),
+					          client_expand_signature(client), message);
 
-		if (!client->request_header_checked) {
-			if (!packet_header_is_valid_request(&client->request.header, &message)) {
-				// FIXME: include packet_get_content_dump output in the error message
-				log_error("Received invalid request (%s) from client ("CLIENT_SIGNATURE_FORMAT"), disconnecting client: %s",
-				          packet_get_request_signature(packet_signature, &client->request),
-				          client_expand_signature(client), message);
+					client->disconnected = true;
 
-				client->disconnected = true;
+					return;
+				}
 
-				return;
+				client->request_header_checked = true;
 			}
 
-			client->request_header_checked = true;
-		}
-
-		length = client->request.header.length;
+			length = client->request.header.length;
 
-		if (client->request_used < length) {
-			// wait for complete packet
-			break;
-		}
+			if (client->request_used < length) {
+				// wait for complete packet
+				break;
+			}
 
-		if (client->request.header.function_id == FUNCTION_DISCONNECT_PROBE) {
-			log_packet_debug("Received disconnect probe from client ("CLIENT_SIGNATURE_FORMAT"), dropping request",
-			                 client_expand_signature(client));
-		} else {
-			log_packet_debug("Received request (%s) from client ("CLIENT_SIGNATURE_FORMAT")",
-			                 packet_get_request_signature(packet_signature, &client->request),
-			                 client_expand_signature(client));
+			if (client->request.header.function_id == FUNCTION_DISCONNECT_PROBE) {
+				log_packet_debug("Received disconnect probe from client ("CLIENT_SIGNATURE_FORMAT"), dropping request",
+				                 client_expand_signature(client));
+			} else {
+				log_packet_debug("Received request (%s) from client ("CLIENT_SIGNATURE_FORMAT")",
+				                 packet_get_request_signature(packet_signature, &client->request),
+				                 client_expand_signature(client));
 
-			client_handle_request(client, &client->request);
-		}
+				client_handle_request(client, &client->request);
+			}
 
-		memmove(&client->request, (uint8_t *)&client->request + length,
-		        client->request_used - length);
+			memmove(&client->request, (uint8_t *)&client->request + length,
+			        client->request_used - length);
 
-		client->request_used -= length;
-		client->request_header_checked = false;
-	}
+			client->request_used -= length;
+			client->request_header_checked = false;
+		}
+	} while (!client->disconnected && websocket_has_received_data(client->io));
 }
 
 void pending_request_remove_and_free(PendingRequest *pending_request) {
@@ -349,6 +666,11 @@ int client_create(Client *client, const char *name, IO *io,
 	client->authentication_state = CLIENT_AUTHENTICATION_STATE_DISABLED;
 	client->authentication_nonce = authentication_nonce;
 	client->destroy_done = destroy_done;
+#ifndef _WIN32
+	client->callback_stream = NULL;
+#endif
+	client->ingress_timestamps = false;
+	client->batch = NULL;
 
 	if (config_get_option_value("authentication.secret")->string != NULL) {
 		client->authentication_state = CLIENT_AUTHENTICATION_STATE_ENABLED;
@@ -376,6 +698,10 @@ void client_destroy(Client *client) {
 	bool destroy_pending_requests = false;
 	PendingRequest *pending_request;
 
+	if (client->batch != NULL) {
+		batch_destroy(client->batch);
+	}
+
 	if (client->pending_request_count > 0) {
 		log_warn("Destroying client ("CLIENT_SIGNATURE_FORMAT") while %d request(s) are still pending",
 		         client_expand_signature(client), client->pending_request_count);
@@ -390,6 +716,16 @@ void client_destroy(Client *client) {
 
 	writer_destroy(&client->response_writer);
 
+	if (client->ingress_timestamps) {
+		network_change_ingress_timestamp_clients(-1);
+	}
+
+#ifndef _WIN32
+	if (client->callback_stream != NULL) {
+		callback_stream_destroy(client->callback_stream);
+	}
+#endif
+
 	event_remove_source(client->io->handle, EVENT_SOURCE_TYPE_GENERIC);
 	io_destroy(client->io);
 	free(client->io);
@@ -447,6 +783,13 @@ void client_dispatch_response(Client *client, PendingRequest *pending_request,
 		}
 	}
 
+	// responses to batched requests are held back until the batch is finished
+	if (pending_request != NULL && pending_request->batch != NULL) {
+		batch_dispatch_response(pending_request->batch, pending_request, response);
+
+		return;
+	}
+
 	if (client->disconnected) {
 		log_debug("Ignoring disconnected client ("CLIENT_SIGNATURE_FORMAT")",
 		          client_expand_signature(client));
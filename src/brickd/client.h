@@ -36,11 +36,15 @@
 #include <daemonlib/packet.h>
 #include <daemonlib/writer.h>
 
+#ifndef _WIN32
+	#include "callback_stream.h"
+#endif
+
 #define CLIENT_MAX_NAME_LENGTH 128
-#define CLIENT_MAX_PENDING_REQUESTS 32768
 
 typedef struct _Client Client;
 typedef struct _Zombie Zombie;
+typedef struct _Batch Batch;
 
 typedef enum {
 	CLIENT_AUTHENTICATION_STATE_DISABLED = 0,
@@ -58,6 +62,8 @@ struct _PendingRequest {
 	Node client_node; // also used as zombie_node
 	Client *client;
 	Zombie *zombie;
+	Batch *batch; // NULL if the request is not part of a batch
+	int batch_index;
 	PacketHeader header;
 #ifdef BRICKD_WITH_PROFILING
 	uint64_t arrival_time; // in usec
@@ -77,6 +83,11 @@ struct _Client {
 	ClientAuthenticationState authentication_state;
 	uint32_t authentication_nonce; // server
 	ClientDestroyDoneFunction destroy_done;
+#ifndef _WIN32
+	CallbackStream *callback_stream; // NULL if callbacks are sent over io
+#endif
+	bool ingress_timestamps; // send an ingress timestamp before each callback
+	Batch *batch; // NULL until the client sends its first batch request
 };
 
 #define CLIENT_SIGNATURE_FORMAT "N: %s, T: %s, H: %d, A: %s"
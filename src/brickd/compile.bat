@@ -65,6 +65,8 @@
 
 %CC% /FIfixes_msvc.h^
  base64.c^
+ batch.c^
+ callback_history.c^
  client.c^
  config_options.c^
  event_winapi.c^
@@ -77,11 +79,13 @@
  service.c^
  sha1.c^
  stack.c^
+ tuning.c^
  usb.c^
  usb_stack.c^
  usb_transfer.c^
  usb_winapi.c^
  websocket.c^
+ websocket_mask.c^
  zombie.c
 
 %RC% /folog_messages.res log_messages.rc
@@ -23,6 +23,8 @@
 #include <daemonlib/enum.h>
 #ifdef BRICKD_WITH_RED_BRICK
 	#include <daemonlib/red_led.h>
+
+	#include "realtime.h"
 #endif
 
 #ifdef BRICKD_WITH_RED_BRICK
@@ -45,6 +47,21 @@ static const char *config_format_red_led_trigger(int value) {
 	return enum_get_name(_red_led_trigger_enum_value_names, value, "<unknown>");
 }
 
+static EnumValueName _realtime_policy_enum_value_names[] = {
+	{ REALTIME_POLICY_OTHER, "other" },
+	{ REALTIME_POLICY_FIFO,  "fifo" },
+	{ REALTIME_POLICY_RR,    "rr" },
+	{ -1,                    NULL }
+};
+
+static int config_parse_realtime_policy(const char *string, int *value) {
+	return enum_get_value(_realtime_policy_enum_value_names, string, value, true);
+}
+
+static const char *config_format_realtime_policy(int value) {
+	return enum_get_name(_realtime_policy_enum_value_names, value, "<unknown>");
+}
+
 #endif
 
 ConfigOption config_options[] = {
@@ -52,14 +69,43 @@ ConfigOption config_options[] = {
 	CONFIG_OPTION_INTEGER_INITIALIZER("listen.plain_port", 1, UINT16_MAX, 4223),
 	CONFIG_OPTION_INTEGER_INITIALIZER("listen.websocket_port", 0, UINT16_MAX, 0), // default to enable: 4280
 	CONFIG_OPTION_BOOLEAN_INITIALIZER("listen.dual_stack", false),
+#ifndef _WIN32
+	CONFIG_OPTION_STRING_INITIALIZER("listen.unix_socket_path", 0, -1, NULL), // default to enable: /var/run/brickd.sock
+#endif
 	CONFIG_OPTION_STRING_INITIALIZER("authentication.secret", 0, 64, NULL),
+#ifndef _WIN32
+	CONFIG_OPTION_BOOLEAN_INITIALIZER("authentication.unix_socket_bypass", false),
+#endif
 	CONFIG_OPTION_SYMBOL_INITIALIZER("log.level", config_parse_log_level, config_format_log_level, LOG_LEVEL_INFO),
 	CONFIG_OPTION_STRING_INITIALIZER("log.debug_filter", 0, -1, NULL),
+	CONFIG_OPTION_INTEGER_INITIALIZER("queue_limit.usb_writes", 1, 1048576, 32768), // requests per USB device
+	CONFIG_OPTION_INTEGER_INITIALIZER("queue_limit.client_pending_requests", 1, 1048576, 32768), // requests per client
+	CONFIG_OPTION_INTEGER_INITIALIZER("websocket.compression_level", 0, 9, 1), // 0 to disable
+	CONFIG_OPTION_INTEGER_INITIALIZER("websocket.compression_min_frame_size", 0, 65535, 64), // bytes
+	CONFIG_OPTION_INTEGER_INITIALIZER("callback_history.length", 0, 64, 1), // callbacks per device and function, 0 to disable
+#ifndef _WIN32
+	CONFIG_OPTION_STRING_INITIALIZER("remote.hosts", 0, -1, NULL), // host[:port] separated by spaces or commas
+#endif
 #ifdef BRICKD_WITH_RED_BRICK
 	CONFIG_OPTION_SYMBOL_INITIALIZER("led_trigger.green", config_parse_red_led_trigger, config_format_red_led_trigger, RED_LED_TRIGGER_HEARTBEAT),
 	CONFIG_OPTION_SYMBOL_INITIALIZER("led_trigger.red", config_parse_red_led_trigger, config_format_red_led_trigger, RED_LED_TRIGGER_OFF),
-	CONFIG_OPTION_INTEGER_INITIALIZER("poll_delay.spi", 50, INT32_MAX, 50), // microseconds
+	CONFIG_OPTION_INTEGER_INITIALIZER("poll_delay.spi", 50, 1000000, 50), // microseconds
+	CONFIG_OPTION_INTEGER_INITIALIZER("poll_delay.spi_idle_max", 50, 1000000, 1000), // microseconds
+	CONFIG_OPTION_INTEGER_INITIALIZER("poll_burst.spi", 1, 255, 8),
 	CONFIG_OPTION_INTEGER_INITIALIZER("poll_delay.rs485", 50, INT32_MAX, 4000), // microseconds
+	CONFIG_OPTION_INTEGER_INITIALIZER("poll_delay.rs485_idle_max", 50, 10000000, 20000), // microseconds
+	CONFIG_OPTION_STRING_INITIALIZER("rs485.serial_device.0", 1, -1, "/dev/ttyS0"),
+	CONFIG_OPTION_STRING_INITIALIZER("rs485.serial_device.1", 1, -1, "/dev/ttyS1"),
+	CONFIG_OPTION_BOOLEAN_INITIALIZER("rs485.rx_enable_gpio.0", true),
+	CONFIG_OPTION_BOOLEAN_INITIALIZER("rs485.rx_enable_gpio.1", true),
+	CONFIG_OPTION_BOOLEAN_INITIALIZER("realtime.lock_memory", false),
+	CONFIG_OPTION_SYMBOL_INITIALIZER("realtime.spi.policy", config_parse_realtime_policy, config_format_realtime_policy, REALTIME_POLICY_OTHER),
+	CONFIG_OPTION_INTEGER_INITIALIZER("realtime.spi.priority", 1, 99, 50),
+	CONFIG_OPTION_INTEGER_INITIALIZER("realtime.spi.cpu", -1, 1023, -1),
+	CONFIG_OPTION_SYMBOL_INITIALIZER("realtime.rs485.policy", config_parse_realtime_policy, config_format_realtime_policy, REALTIME_POLICY_OTHER),
+	CONFIG_OPTION_INTEGER_INITIALIZER("realtime.rs485.priority", 1, 99, 50),
+	CONFIG_OPTION_INTEGER_INITIALIZER("realtime.rs485.cpu", -1, 1023, -1),
+	CONFIG_OPTION_BOOLEAN_INITIALIZER("redapid.shared_memory", false),
 #endif
 	CONFIG_OPTION_NULL_INITIALIZER // end of list
 };
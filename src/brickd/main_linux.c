@@ -44,8 +44,10 @@
 
 #include "hardware.h"
 #include "network.h"
+#include "remote_stack.h"
 #ifdef BRICKD_WITH_RED_BRICK
 	#include "redapid.h"
+	#include "realtime.h"
 	#include "red_stack.h"
 	#include "red_usb_gadget.h"
     #include "red_extension.h"
@@ -53,6 +55,7 @@
 #ifdef BRICKD_WITH_LIBUDEV
 	#include "udev.h"
 #endif
+#include "tuning.h"
 #include "usb.h"
 #include "version.h"
 
@@ -206,6 +209,9 @@ int main(int argc, char **argv) {
 #ifdef BRICKD_WITH_LIBUDEV
 	bool initialized_udev = false;
 #endif
+#ifdef BRICKD_WITH_RED_BRICK
+	uint64_t red_brick_init_at;
+#endif
 
 	for (i = 1; i < argc; ++i) {
 		if (strcmp(argv[i], "--help") == 0) {
@@ -253,6 +259,7 @@ int main(int argc, char **argv) {
 	}
 
 	config_init(_config_filename);
+	tuning_init(_config_filename);
 
 	if (config_has_error()) {
 		fprintf(stderr, "Error(s) occurred while reading config file '%s'\n",
@@ -319,7 +326,15 @@ int main(int argc, char **argv) {
 		goto error_network;
 	}
 
+	if (remote_stack_init() < 0) {
+		goto error_remote_stack;
+	}
+
 #ifdef BRICKD_WITH_RED_BRICK
+	red_brick_init_at = microseconds();
+
+	realtime_init();
+
 	if (gpio_init() < 0) {
 		goto error_gpio;
 	}
@@ -342,6 +357,11 @@ int main(int argc, char **argv) {
 
 	red_led_set_trigger(RED_LED_GREEN, config_get_option_value("led_trigger.green")->symbol);
 	red_led_set_trigger(RED_LED_RED, config_get_option_value("led_trigger.red")->symbol);
+
+	// The SPI stack reset and the extension EEPROM reads continue in the
+	// background, their stacks are added as soon as they are ready
+	log_debug("Initialized RED Brick subsystems in %u msec",
+	          (uint32_t)((microseconds() - red_brick_init_at) / 1000));
 #endif
 
 	if (event_run(network_cleanup_clients_and_zombies) < 0) {
@@ -374,6 +394,9 @@ error_redapid:
 
 error_gpio:
 #endif
+	remote_stack_exit();
+
+error_remote_stack:
 	network_exit();
 
 error_network:
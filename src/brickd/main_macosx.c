@@ -40,6 +40,8 @@
 #include "hardware.h"
 #include "iokit.h"
 #include "network.h"
+#include "remote_stack.h"
+#include "tuning.h"
 #include "usb.h"
 #include "version.h"
 
@@ -124,6 +126,7 @@ int main(int argc, char **argv) {
 	}
 
 	config_init(CONFIG_FILENAME);
+	tuning_init(CONFIG_FILENAME);
 
 	if (config_has_error()) {
 		fprintf(stderr, "Error(s) occurred while reading config file '%s'\n",
@@ -184,6 +187,10 @@ int main(int argc, char **argv) {
 		goto error_network;
 	}
 
+	if (remote_stack_init() < 0) {
+		goto error_remote_stack;
+	}
+
 	if (event_run(network_cleanup_clients_and_zombies) < 0) {
 		goto error_run;
 	}
@@ -191,6 +198,9 @@ int main(int argc, char **argv) {
 	exit_code = EXIT_SUCCESS;
 
 error_run:
+	remote_stack_exit();
+
+error_remote_stack:
 	network_exit();
 
 error_network:
@@ -61,6 +61,7 @@ BOOL WINAPI Process32Next(HANDLE hSnapshot, PROCESSENTRY32 *lppe);
 #include "hardware.h"
 #include "network.h"
 #include "service.h"
+#include "tuning.h"
 #include "usb.h"
 #include "version.h"
 
@@ -1070,6 +1071,7 @@ int main(int argc, char **argv) {
 		printf("Starting...\n");
 
 		config_init(_config_filename);
+		tuning_init(_config_filename);
 
 		log_init();
 
@@ -20,14 +20,19 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#define _GNU_SOURCE // for struct ucred
+
 #include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #ifndef _WIN32
 	#include <netdb.h>
 	#include <unistd.h>
+	#include <sys/stat.h>
+	#include <sys/un.h>
 #endif
 
 #include <daemonlib/array.h>
@@ -42,6 +47,7 @@
 
 #include "network.h"
 
+#include "callback_history.h"
 #include "hmac.h"
 #include "websocket.h"
 #include "zombie.h"
@@ -54,9 +60,82 @@ static Socket _plain_server_socket;
 static bool _plain_server_socket_open = false;
 static Socket _websocket_server_socket;
 static bool _websocket_server_socket_open = false;
+#ifndef _WIN32
+static Socket _unix_server_socket;
+static bool _unix_server_socket_open = false;
+#endif
 static uint32_t _next_authentication_nonce = 0;
 static Node _pending_request_sentinel;
 
+// configurable with brickd.conf option queue_limit.client_pending_requests
+// and at runtime by the tuning API
+static int _max_pending_requests = 32768;
+
+// number of clients that enabled ingress timestamps. the SPI and RS485
+// threads read this to skip capturing timestamps nobody asked for
+static int _ingress_timestamp_clients = 0;
+
+#ifndef _WIN32
+
+// sets errno on error
+static int network_get_peer_credentials(Socket *socket, uid_t *uid, pid_t *pid) {
+#ifdef __linux__
+	struct ucred credentials;
+	socklen_t length = sizeof(credentials);
+
+	if (getsockopt(socket->base.handle, SOL_SOCKET, SO_PEERCRED,
+	               &credentials, &length) < 0) {
+		return -1;
+	}
+
+	*uid = credentials.uid;
+	*pid = credentials.pid;
+#else
+	gid_t gid;
+
+	if (getpeereid(socket->base.handle, uid, &gid) < 0) {
+		return -1;
+	}
+
+	*pid = -1; // unknown
+#endif
+
+	return 0;
+}
+
+// formats the client name from the peer credentials. a peer running as root
+// or as the same user as brickd is trusted, if enabled by the config
+static void network_get_unix_peer(Socket *client_socket, char *name, int length,
+                                  bool *trusted) {
+	const char *path = config_get_option_value("listen.unix_socket_path")->string;
+	uid_t uid;
+	pid_t pid;
+
+	*trusted = false;
+
+	if (network_get_peer_credentials(client_socket, &uid, &pid) < 0) {
+		log_warn("Could not get peer credentials of client (socket: %d): %s (%d)",
+		         client_socket->base.handle, get_errno_name(errno), errno);
+
+		snprintf(name, length, "%s", path);
+
+		return;
+	}
+
+	if (pid >= 0) {
+		snprintf(name, length, "%s (pid: %d, uid: %u)", path, (int)pid, (unsigned int)uid);
+	} else {
+		snprintf(name, length, "%s (uid: %u)", path, (unsigned int)uid);
+	}
+
+	if (config_get_option_value("authentication.unix_socket_bypass")->boolean &&
+	    (uid == 0 || uid == geteuid())) {
+		*trusted = true;
+	}
+}
+
+#endif
+
 static void network_handle_accept(void *opaque) {
 	Socket *server_socket = opaque;
 	Socket *client_socket;
@@ -66,6 +145,7 @@ static void network_handle_accept(void *opaque) {
 	char port[NI_MAXSERV];
 	char buffer[NI_MAXHOST + NI_MAXSERV + 4]; // 4 == strlen("[]:") + 1
 	char *name = "<unknown>";
+	bool trusted = false;
 	Client *client;
 
 	// accept new client socket
@@ -80,6 +160,13 @@ static void network_handle_accept(void *opaque) {
 		return;
 	}
 
+#ifndef _WIN32
+	if (address.ss_family == AF_UNIX) {
+		network_get_unix_peer(client_socket, buffer, sizeof(buffer), &trusted);
+
+		name = buffer;
+	} else
+#endif
 	if (socket_address_to_hostname((struct sockaddr *)&address, length,
 	                               hostname, sizeof(hostname),
 	                               port, sizeof(port)) < 0) {
@@ -105,6 +192,15 @@ static void network_handle_accept(void *opaque) {
 		return;
 	}
 
+	// a trusted local peer runs as root or as the brickd user, it could read
+	// the authentication secret from the config file anyway
+	if (trusted && client->authentication_state == CLIENT_AUTHENTICATION_STATE_ENABLED) {
+		log_info("Client ("CLIENT_SIGNATURE_FORMAT") is a trusted local peer, skipping authentication",
+		         client_expand_signature(client));
+
+		client->authentication_state = CLIENT_AUTHENTICATION_STATE_DONE;
+	}
+
 #ifdef BRICKD_WITH_RED_BRICK
 	client_send_red_brick_enumerate(client, ENUMERATION_TYPE_CONNECTED);
 #endif
@@ -243,6 +339,114 @@ cleanup:
 	return phase == 3 ? 0 : -1;
 }
 
+#ifndef _WIN32
+
+static int network_open_unix_server_socket(Socket *server_socket, const char *path) {
+	int phase = 0;
+	struct sockaddr_un address;
+	struct stat st;
+
+	log_debug("Opening Unix domain server socket at '%s'", path);
+
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		log_error("Unix domain socket path '%s' is too long", path);
+
+		goto cleanup;
+	}
+
+	// remove a socket left over by a previous brickd run, but don't remove
+	// anything else that happens to be at the given path
+	if (lstat(path, &st) >= 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			log_error("Could not create Unix domain socket at '%s', path exists already and is not a socket",
+			          path);
+
+			goto cleanup;
+		}
+
+		if (unlink(path) < 0) {
+			log_error("Could not remove stale Unix domain socket at '%s': %s (%d)",
+			          path, get_errno_name(errno), errno);
+
+			goto cleanup;
+		}
+	}
+
+	// create socket
+	if (socket_create(server_socket) < 0) {
+		log_error("Could not create socket: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	if (socket_open(server_socket, AF_UNIX, SOCK_STREAM, 0) < 0) {
+		log_error("Could not open Unix domain server socket: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	// bind socket and start to listen
+	memset(&address, 0, sizeof(address));
+
+	address.sun_family = AF_UNIX;
+
+	string_copy(address.sun_path, sizeof(address.sun_path), path);
+
+	if (socket_bind(server_socket, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		log_error("Could not bind Unix domain server socket to '%s': %s (%d)",
+		          path, get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	// every local user can connect, the same as to the TCP/IP socket.
+	// clients that are not trusted have to authenticate as usual
+	if (chmod(path, 0666) < 0) {
+		log_error("Could not change permissions of Unix domain socket '%s': %s (%d)",
+		          path, get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	if (socket_listen(server_socket, 10, socket_create_allocated) < 0) {
+		log_error("Could not listen to Unix domain server socket bound to '%s': %s (%d)",
+		          path, get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	log_debug("Started listening to Unix domain socket '%s'", path);
+
+	if (event_add_source(server_socket->base.handle, EVENT_SOURCE_TYPE_GENERIC,
+	                     EVENT_READ, network_handle_accept, server_socket) < 0) {
+		goto cleanup;
+	}
+
+	phase = 3;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 2:
+		unlink(path);
+
+	case 1:
+		socket_destroy(server_socket);
+
+	default:
+		break;
+	}
+
+	return phase == 3 ? 0 : -1;
+}
+
+#endif
+
 // drop all pending requests for the given UID from the global list
 static void network_drop_pending_requests(uint32_t uid) {
 	Node *pending_request_global_node = _pending_request_sentinel.next;
@@ -273,9 +477,14 @@ static void network_drop_pending_requests(uint32_t uid) {
 int network_init(void) {
 	uint16_t plain_port = (uint16_t)config_get_option_value("listen.plain_port")->integer;
 	uint16_t websocket_port = (uint16_t)config_get_option_value("listen.websocket_port")->integer;
+#ifndef _WIN32
+	const char *unix_socket_path = config_get_option_value("listen.unix_socket_path")->string;
+#endif
 
 	log_debug("Initializing network subsystem");
 
+	_max_pending_requests = config_get_option_value("queue_limit.client_pending_requests")->integer;
+
 	node_reset(&_pending_request_sentinel);
 
 	if (config_get_option_value("authentication.secret")->string != NULL) {
@@ -304,6 +513,13 @@ int network_init(void) {
 		return -1;
 	}
 
+	if (callback_history_init(config_get_option_value("callback_history.length")->integer) < 0) {
+		array_destroy(&_zombies, (ItemDestroyFunction)zombie_destroy);
+		array_destroy(&_clients, (ItemDestroyFunction)client_destroy);
+
+		return -1;
+	}
+
 	if (network_open_server_socket(&_plain_server_socket, plain_port,
 	                               socket_create_allocated) >= 0) {
 		_plain_server_socket_open = true;
@@ -314,15 +530,30 @@ int network_init(void) {
 			log_warn("WebSocket support is enabled without authentication");
 		}
 
+		websocket_set_compression(config_get_option_value("websocket.compression_level")->integer,
+		                          config_get_option_value("websocket.compression_min_frame_size")->integer);
+
 		if (network_open_server_socket(&_websocket_server_socket, websocket_port,
 		                               websocket_create_allocated) >= 0) {
 			_websocket_server_socket_open = true;
 		}
 	}
 
+#ifndef _WIN32
+	if (unix_socket_path != NULL) {
+		if (network_open_unix_server_socket(&_unix_server_socket, unix_socket_path) >= 0) {
+			_unix_server_socket_open = true;
+		}
+	}
+
+	if (!_plain_server_socket_open && !_websocket_server_socket_open &&
+	    !_unix_server_socket_open) {
+#else
 	if (!_plain_server_socket_open && !_websocket_server_socket_open) {
+#endif
 		log_error("Could not open any socket to listen to");
 
+		callback_history_exit();
 		array_destroy(&_zombies, (ItemDestroyFunction)zombie_destroy);
 		array_destroy(&_clients, (ItemDestroyFunction)client_destroy);
 
@@ -338,6 +569,8 @@ void network_exit(void) {
 	array_destroy(&_clients, (ItemDestroyFunction)client_destroy); // might call network_create_zombie
 	array_destroy(&_zombies, (ItemDestroyFunction)zombie_destroy);
 
+	callback_history_exit();
+
 	if (_plain_server_socket_open) {
 		event_remove_source(_plain_server_socket.base.handle, EVENT_SOURCE_TYPE_GENERIC);
 		socket_destroy(&_plain_server_socket);
@@ -347,6 +580,14 @@ void network_exit(void) {
 		event_remove_source(_websocket_server_socket.base.handle, EVENT_SOURCE_TYPE_GENERIC);
 		socket_destroy(&_websocket_server_socket);
 	}
+
+#ifndef _WIN32
+	if (_unix_server_socket_open) {
+		event_remove_source(_unix_server_socket.base.handle, EVENT_SOURCE_TYPE_GENERIC);
+		socket_destroy(&_unix_server_socket);
+		unlink(config_get_option_value("listen.unix_socket_path")->string);
+	}
+#endif
 }
 
 Client *network_create_client(const char *name, IO *io) {
@@ -406,6 +647,14 @@ void network_cleanup_clients_and_zombies(void) {
 	Client *client;
 	Zombie *zombie;
 
+	// send the packets that got batched for WebSocket clients and callback
+	// streams during this event loop iteration, before disconnected clients
+	// are removed
+	websocket_flush_all();
+#ifndef _WIN32
+	callback_stream_flush_all();
+#endif
+
 	// iterate backwards for simpler index handling
 	for (i = _clients.count - 1; i >= 0; --i) {
 		client = array_get(&_clients, i);
@@ -430,19 +679,43 @@ void network_cleanup_clients_and_zombies(void) {
 	}
 }
 
-void network_client_expects_response(Client *client, Packet *request) {
+int network_get_max_pending_requests(void) {
+	return _max_pending_requests;
+}
+
+// a lower limit is applied to a client the next time a request of it gets
+// added to its pending requests list
+void network_set_max_pending_requests(int max_pending_requests) {
+	_max_pending_requests = max_pending_requests;
+}
+
+// returns NULL if the pending request could not be added
+PendingRequest *network_client_expects_response(Client *client, Packet *request) {
+	Node *pending_request_client_node;
+	Node *next_pending_request_client_node;
 	PendingRequest *pending_request;
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 
-	if (client->pending_request_count >= CLIENT_MAX_PENDING_REQUESTS) {
+	if (client->pending_request_count >= _max_pending_requests) {
 		log_warn("Pending requests list for client ("CLIENT_SIGNATURE_FORMAT") is full, dropping %d pending request(s)",
 		         client_expand_signature(client),
-		         client->pending_request_count - CLIENT_MAX_PENDING_REQUESTS + 1);
+		         client->pending_request_count - _max_pending_requests + 1);
 
-		while (client->pending_request_count >= CLIENT_MAX_PENDING_REQUESTS) {
-			pending_request = containerof(client->pending_request_sentinel.next, PendingRequest, client_node);
+		// the pending requests of an active batch are kept, otherwise their
+		// responses would silently turn into timeouts. a batch has a limited
+		// number of items and a deadline, so they cannot pile up
+		pending_request_client_node = client->pending_request_sentinel.next;
 
-			pending_request_remove_and_free(pending_request);
+		while (client->pending_request_count >= _max_pending_requests &&
+		       pending_request_client_node != &client->pending_request_sentinel) {
+			next_pending_request_client_node = pending_request_client_node->next;
+			pending_request = containerof(pending_request_client_node, PendingRequest, client_node);
+
+			if (pending_request->batch == NULL) {
+				pending_request_remove_and_free(pending_request);
+			}
+
+			pending_request_client_node = next_pending_request_client_node;
 		}
 	}
 
@@ -452,7 +725,7 @@ void network_client_expects_response(Client *client, Packet *request) {
 		log_error("Could not allocate pending request: %s (%d)",
 		          get_errno_name(ENOMEM), ENOMEM);
 
-		return;
+		return NULL;
 	}
 
 	node_reset(&pending_request->global_node);
@@ -465,6 +738,7 @@ void network_client_expects_response(Client *client, Packet *request) {
 
 	pending_request->client = client;
 	pending_request->zombie = NULL;
+	pending_request->batch = NULL;
 
 	memcpy(&pending_request->header, &request->header, sizeof(PacketHeader));
 
@@ -475,15 +749,47 @@ void network_client_expects_response(Client *client, Packet *request) {
 	log_packet_debug("Added pending request (%s) for client ("CLIENT_SIGNATURE_FORMAT")",
 	                 packet_get_request_signature(packet_signature, request),
 	                 client_expand_signature(client));
+
+	return pending_request;
 }
 
 void network_dispatch_response(Packet *response) {
+	network_dispatch_timestamped_response(response, 0);
+}
+
+static void network_prepare_ingress_timestamp(IngressTimestampCallback *callback,
+                                              Packet *response, uint64_t ingress_timestamp) {
+	uint8_t *timestamp = (uint8_t *)&callback->timestamp;
+	int i;
+
+	memset(callback, 0, sizeof(*callback));
+
+	callback->header.uid = uint32_to_le(UID_BRICK_DAEMON);
+	callback->header.length = sizeof(*callback);
+	callback->header.function_id = CALLBACK_INGRESS_TIMESTAMP;
+	callback->uid = response->header.uid;
+	callback->function_id = response->header.function_id;
+
+	packet_header_set_sequence_number(&callback->header, 0);
+	packet_header_set_response_expected(&callback->header, true);
+
+	for (i = 0; i < (int)sizeof(callback->timestamp); ++i) {
+		timestamp[i] = (uint8_t)(ingress_timestamp >> (i * 8)); // little endian
+	}
+}
+
+// the ingress timestamp is taken when the response left the hardware, it is
+// 0 if it was not captured
+void network_dispatch_timestamped_response(Packet *response, uint64_t ingress_timestamp) {
 	EnumerateCallback *enumerate_callback;
+	IngressTimestampCallback timestamp_callback;
+	bool timestamp_callback_prepared = false;
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 	int i;
 	Client *client;
 	Node *pending_request_global_node;
 	PendingRequest *pending_request;
+	bool streamed;
 
 	if (packet_header_get_sequence_number(&response->header) == 0) {
 		if (response->header.function_id == CALLBACK_ENUMERATE) {
@@ -492,7 +798,11 @@ void network_dispatch_response(Packet *response) {
 			if (enumerate_callback->enumeration_type == ENUMERATION_TYPE_CONNECTED ||
 			    enumerate_callback->enumeration_type == ENUMERATION_TYPE_DISCONNECTED) {
 				network_drop_pending_requests(response->header.uid);
+				callback_history_forget(response->header.uid);
 			}
+		} else {
+			// record even without clients, to have a history for the next one
+			callback_history_record(response);
 		}
 
 		if (_clients.count == 0) {
@@ -510,6 +820,41 @@ void network_dispatch_response(Packet *response) {
 
 		for (i = 0; i < _clients.count; ++i) {
 			client = array_get(&_clients, i);
+			streamed = false;
+
+#ifndef _WIN32
+			streamed = client->callback_stream != NULL && !client->disconnected &&
+			           callback_stream_is_matching(client->callback_stream, response);
+#endif
+
+			if (client->ingress_timestamps && !timestamp_callback_prepared) {
+				// not captured by the source of the response
+				if (ingress_timestamp == 0) {
+					ingress_timestamp = network_get_ingress_timestamp();
+				}
+
+				network_prepare_ingress_timestamp(&timestamp_callback, response,
+				                                  ingress_timestamp);
+
+				timestamp_callback_prepared = true;
+			}
+
+#ifndef _WIN32
+			// the timestamp goes into the same datagram as the callback, so
+			// they cannot be lost or reordered independently of each other
+			if (streamed) {
+				callback_stream_enqueue(client->callback_stream, response,
+				                        client->ingress_timestamps ? (Packet *)&timestamp_callback : NULL);
+
+				continue;
+			}
+#endif
+
+			// over the connection the timestamp is sent right before the
+			// callback, the connection keeps them in order
+			if (client->ingress_timestamps) {
+				client_dispatch_response(client, NULL, (Packet *)&timestamp_callback, true, false);
+			}
 
 			client_dispatch_response(client, NULL, response, true, false);
 		}
@@ -551,6 +896,36 @@ void network_dispatch_response(Packet *response) {
 	}
 }
 
+bool network_wants_ingress_timestamps(void) {
+#ifdef BRICKD_WITH_RED_BRICK
+	return __atomic_load_n(&_ingress_timestamp_clients, __ATOMIC_RELAXED) > 0;
+#else
+	return _ingress_timestamp_clients > 0;
+#endif
+}
+
+void network_change_ingress_timestamp_clients(int delta) {
+#ifdef BRICKD_WITH_RED_BRICK
+	__atomic_add_fetch(&_ingress_timestamp_clients, delta, __ATOMIC_RELAXED);
+#else
+	_ingress_timestamp_clients += delta;
+#endif
+}
+
+// returns microseconds of a monotonic clock. this can be called from any
+// thread
+uint64_t network_get_ingress_timestamp(void) {
+#ifdef _WIN32
+	return microseconds();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#endif
+}
+
 #ifdef BRICKD_WITH_RED_BRICK
 
 void network_announce_red_brick_disconnect(void) {
@@ -23,10 +23,41 @@
 #ifndef BRICKD_NETWORK_H
 #define BRICKD_NETWORK_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include <daemonlib/packet.h>
 
 #include "client.h"
 
+#define UID_BRICK_DAEMON 1
+
+// brickd function and callback, called with UID 1
+#define FUNCTION_SET_INGRESS_TIMESTAMPS 6
+#define CALLBACK_INGRESS_TIMESTAMP 7
+
+#include <daemonlib/packed_begin.h>
+
+typedef struct {
+	PacketHeader header;
+	uint8_t enabled;
+} ATTRIBUTE_PACKED SetIngressTimestampsRequest;
+
+typedef struct {
+	PacketHeader header;
+} ATTRIBUTE_PACKED SetIngressTimestampsResponse;
+
+// sent to a client that enabled ingress timestamps right before each callback.
+// for a callback stream both are sent in the same datagram
+typedef struct {
+	PacketHeader header;
+	uint32_t uid; // of the following callback
+	uint8_t function_id; // of the following callback
+	uint64_t timestamp; // microseconds, monotonic clock of the brickd host
+} ATTRIBUTE_PACKED IngressTimestampCallback;
+
+#include <daemonlib/packed_end.h>
+
 int network_init(void);
 void network_exit(void);
 
@@ -35,8 +66,16 @@ int network_create_zombie(Client *client);
 
 void network_cleanup_clients_and_zombies(void);
 
-void network_client_expects_response(Client *client, Packet *request);
+int network_get_max_pending_requests(void);
+void network_set_max_pending_requests(int max_pending_requests);
+
+PendingRequest *network_client_expects_response(Client *client, Packet *request);
 void network_dispatch_response(Packet *response);
+void network_dispatch_timestamped_response(Packet *response, uint64_t ingress_timestamp);
+
+bool network_wants_ingress_timestamps(void);
+void network_change_ingress_timestamp_clients(int delta);
+uint64_t network_get_ingress_timestamp(void);
 
 #ifdef BRICKD_WITH_RED_BRICK
 
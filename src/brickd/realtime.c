@@ -0,0 +1,182 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * realtime.c: Real-time scheduling support for RED Brick I/O threads
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE // for pthread_setaffinity_np
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <daemonlib/config.h>
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "realtime.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define REALTIME_STACK_PREFAULT_SIZE    (64 * 1024)
+#define REALTIME_STACK_PREFAULT_STRIDE  1024
+#define REALTIME_JITTER_REPORT_INTERVAL 10000000 // microseconds
+
+static bool _memory_locked = false;
+
+// Touches the first part of the stack of the calling thread, so that its pages
+// are already faulted in (and locked, if memory is locked) before the thread
+// enters its time critical loop
+static void realtime_prefault_stack(void) {
+	volatile uint8_t stack[REALTIME_STACK_PREFAULT_SIZE];
+	int i;
+
+	for (i = 0; i < REALTIME_STACK_PREFAULT_SIZE; i += REALTIME_STACK_PREFAULT_STRIDE) {
+		stack[i] = 0;
+	}
+
+	(void)stack;
+}
+
+void realtime_init(void) {
+	if (!config_get_option_value("realtime.lock_memory")->boolean) {
+		return;
+	}
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		log_warn("Could not lock memory, I/O threads might suffer from page faults: %s (%d)",
+		         get_errno_name(errno), errno);
+
+		return;
+	}
+
+	_memory_locked = true;
+
+	log_info("Locked memory to avoid page faults in I/O threads");
+}
+
+// Applies the realtime.<name>.* options to the calling thread. Failures are
+// not fatal, the thread just keeps running with normal scheduling
+void realtime_setup_thread(const char *name) {
+	char option[64];
+	int policy;
+	int priority;
+	int cpu;
+	int rc;
+	cpu_set_t cpu_set;
+	struct sched_param param;
+
+	robust_snprintf(option, sizeof(option), "realtime.%s.policy", name);
+	policy = config_get_option_value(option)->symbol;
+
+	robust_snprintf(option, sizeof(option), "realtime.%s.priority", name);
+	priority = config_get_option_value(option)->integer;
+
+	robust_snprintf(option, sizeof(option), "realtime.%s.cpu", name);
+	cpu = config_get_option_value(option)->integer;
+
+	if (cpu >= 0) {
+		CPU_ZERO(&cpu_set);
+		CPU_SET(cpu, &cpu_set);
+
+		rc = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+
+		if (rc != 0) {
+			log_warn("Could not pin %s thread to CPU %d: %s (%d)",
+			         name, cpu, get_errno_name(rc), rc);
+		} else {
+			log_info("Pinned %s thread to CPU %d", name, cpu);
+		}
+	}
+
+	if (policy != REALTIME_POLICY_OTHER) {
+		memset(&param, 0, sizeof(param));
+
+		param.sched_priority = priority;
+
+		rc = pthread_setschedparam(pthread_self(),
+		                           policy == REALTIME_POLICY_FIFO ? SCHED_FIFO : SCHED_RR,
+		                           &param);
+
+		if (rc != 0) {
+			log_warn("Could not set %s scheduling with priority %d for %s thread: %s (%d)",
+			         policy == REALTIME_POLICY_FIFO ? "FIFO" : "RR", priority,
+			         name, get_errno_name(rc), rc);
+		} else {
+			log_info("Running %s thread with %s scheduling at priority %d",
+			         name, policy == REALTIME_POLICY_FIFO ? "FIFO" : "RR", priority);
+		}
+	}
+
+	if (policy != REALTIME_POLICY_OTHER || _memory_locked) {
+		realtime_prefault_stack();
+	}
+}
+
+void realtime_jitter_init(RealtimeJitter *jitter, const char *name) {
+	memset(jitter, 0, sizeof(RealtimeJitter));
+
+	jitter->name = name;
+}
+
+// Records how late a thread woke up compared to its target wakeup time. Both
+// times are in microseconds. Statistics are logged every 10 seconds on debug
+// level
+void realtime_jitter_add(RealtimeJitter *jitter, uint64_t target, uint64_t now) {
+	uint32_t late = now > target ? (uint32_t)(now - target) : 0;
+
+	++jitter->count;
+	jitter->sum += late;
+
+	if (late > jitter->max) {
+		jitter->max = late;
+	}
+
+	++jitter->total_count;
+	jitter->total_sum += late;
+
+	if (late > jitter->total_max) {
+		jitter->total_max = late;
+	}
+
+	if (jitter->report_at == 0) {
+		jitter->report_at = now + REALTIME_JITTER_REPORT_INTERVAL;
+	} else if (now >= jitter->report_at) {
+		log_debug("%s cycle jitter: avg %u usec, max %u usec over %u cycle(s)",
+		          jitter->name, (uint32_t)(jitter->sum / jitter->count),
+		          jitter->max, jitter->count);
+
+		jitter->count = 0;
+		jitter->sum = 0;
+		jitter->max = 0;
+		jitter->report_at = now + REALTIME_JITTER_REPORT_INTERVAL;
+	}
+}
+
+void realtime_jitter_report(RealtimeJitter *jitter) {
+	if (jitter->total_count == 0) {
+		return;
+	}
+
+	log_info("%s cycle jitter: avg %u usec, max %u usec over %llu cycle(s)",
+	         jitter->name, (uint32_t)(jitter->total_sum / jitter->total_count),
+	         jitter->total_max, (unsigned long long)jitter->total_count);
+}
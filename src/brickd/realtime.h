@@ -0,0 +1,56 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * realtime.h: Real-time scheduling support for RED Brick I/O threads
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_REALTIME_H
+#define BRICKD_REALTIME_H
+
+#include <stdint.h>
+
+typedef enum {
+	REALTIME_POLICY_OTHER = 0,
+	REALTIME_POLICY_FIFO,
+	REALTIME_POLICY_RR
+} RealtimePolicy;
+
+typedef struct {
+	const char *name;
+
+	// statistics since the last periodic report
+	uint64_t report_at;
+	uint32_t count;
+	uint64_t sum;
+	uint32_t max;
+
+	// statistics since the start of the thread
+	uint64_t total_count;
+	uint64_t total_sum;
+	uint32_t total_max;
+} RealtimeJitter;
+
+void realtime_init(void);
+
+void realtime_setup_thread(const char *name);
+
+void realtime_jitter_init(RealtimeJitter *jitter, const char *name);
+void realtime_jitter_add(RealtimeJitter *jitter, uint64_t target, uint64_t now);
+void realtime_jitter_report(RealtimeJitter *jitter);
+
+#endif // BRICKD_REALTIME_H
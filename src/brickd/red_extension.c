@@ -21,24 +21,30 @@
  */
 
 #include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #include <daemonlib/conf_file.h>
+#include <daemonlib/event.h>
 #include <daemonlib/log.h>
 #include <daemonlib/red_i2c_eeprom.h>
 #include <daemonlib/red_gpio.h>
+#include <daemonlib/threads.h>
+#include <daemonlib/utils.h>
 
 #include "red_extension.h"
 
 #include "red_rs485_extension.h"
+#include "red_stack.h"
 #include "red_ethernet_extension.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
 #define EEPROM_SIZE 8192
 
-#define EXTENSION_NUM_MAX 2
 #define EXTENSION_EEPROM_TYPE_LOCATION 0
 #define EXTENSION_EEPROM_TYPE_SIZE 4
 
@@ -117,6 +123,14 @@ static ExtensionPinConfigurationArray extension_ethernet_pin_config = {7, {
 // Discovered extension types (for both extensions)
 static ExtensionType _red_extension_type[EXTENSION_NUM_MAX] = {EXTENSION_TYPE_NONE, EXTENSION_TYPE_NONE};
 
+// The EEPROMs are read by the probe thread. Afterwards the brickd event thread
+// initializes the extensions from the configs found in the EEPROMs
+static ExtensionBaseConfig _red_extension_base_config[EXTENSION_NUM_MAX];
+static Thread _red_extension_probe_thread;
+static bool _red_extension_probing = false; // only accessed by the brickd event thread
+static int _red_extension_probe_done_event = -1;
+static uint64_t _red_extension_init_at = 0;
+
 
 static void red_extension_configure_pin(ExtensionPinConfiguration *config, int extension) {
 	gpio_mux_configure(config->pin[extension], config->mux);
@@ -468,10 +482,11 @@ int red_extension_read_ethernet_config(I2CEEPROM *i2c_eeprom, ExtensionEthernetC
 	return 0;
 }
 
-int red_extension_init(void) {
+// Reads the extension configs from the EEPROMs and saves them to the
+// filesystem. This runs in the probe thread
+static void red_extension_probe(void) {
 	uint8_t buf[4];
 	int i, j, ret;
-	ExtensionBaseConfig base_config[2];
 
 	// First we remove the Ethernet Extension kernel module (if there is one)
 	// to make sure that there isn't a collision between SPI select and I2C select.
@@ -491,11 +506,11 @@ int red_extension_init(void) {
 		int eeprom_length = 0;
 		uint8_t eeprom_buffer[EEPROM_SIZE];
 
-		base_config[i].extension = i;
-		base_config[i].type = EXTENSION_TYPE_NONE;
+		_red_extension_base_config[i].extension = i;
+		_red_extension_base_config[i].type = EXTENSION_TYPE_NONE;
 
 		if (i2c_eeprom_create(&i2c_eeprom, i) < 0) {
-			return -1;
+			return;
 		}
 
 		if ((eeprom_length = red_extension_read_eeprom_from_fs(eeprom_buffer, i)) > 2) {
@@ -526,25 +541,25 @@ int red_extension_init(void) {
 			continue;
 		}
 
-		base_config[i].type = (buf[0] << 0) | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
+		_red_extension_base_config[i].type = (buf[0] << 0) | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
 
 		// If there is an extension that is either not configured (Extension type NONE)
 		// Or that we currently don't support (WIFI), we will log it, but try to
 		// continue finding extensions. We can support an extension at position 1 if
 		// there is an unsupported extension at position 0.
-		if (base_config[i].type == EXTENSION_TYPE_NONE) {
+		if (_red_extension_base_config[i].type == EXTENSION_TYPE_NONE) {
 			log_warn("Could not find Extension at position %d (Type None)", i);
 			continue;
 		}
 
-		if ((base_config[i].type != EXTENSION_TYPE_ETHERNET) && (base_config[i].type != EXTENSION_TYPE_RS485)) {
-			log_warn("Extension at position %d not supported (type %d)", i, base_config[i].type);
+		if ((_red_extension_base_config[i].type != EXTENSION_TYPE_ETHERNET) && (_red_extension_base_config[i].type != EXTENSION_TYPE_RS485)) {
+			log_warn("Extension at position %d not supported (type %d)", i, _red_extension_base_config[i].type);
 			continue;
 		}
 
-		switch (base_config[i].type) {
+		switch (_red_extension_base_config[i].type) {
 		case EXTENSION_TYPE_RS485:
-			ret = red_extension_read_rs485_config(&i2c_eeprom, (ExtensionRS485Config *) &base_config[i]);
+			ret = red_extension_read_rs485_config(&i2c_eeprom, (ExtensionRS485Config *) &_red_extension_base_config[i]);
 			i2c_eeprom_destroy(&i2c_eeprom);
 
 			if (ret < 0) {
@@ -553,14 +568,14 @@ int red_extension_init(void) {
 				continue;
 			}
 
-			if (red_extension_save_rs485_config_to_fs((ExtensionRS485Config *) &base_config[i]) < 0) {
+			if (red_extension_save_rs485_config_to_fs((ExtensionRS485Config *) &_red_extension_base_config[i]) < 0) {
 				log_warn("Could not save RS485 config. RS485 Extension at position %d will not show up in Brick Viewer", i);
 			}
 
 			break;
 
 		case EXTENSION_TYPE_ETHERNET:
-			ret = red_extension_read_ethernet_config(&i2c_eeprom, (ExtensionEthernetConfig *) &base_config[i]);
+			ret = red_extension_read_ethernet_config(&i2c_eeprom, (ExtensionEthernetConfig *) &_red_extension_base_config[i]);
 			i2c_eeprom_destroy(&i2c_eeprom);
 
 			if (ret < 0) {
@@ -569,25 +584,77 @@ int red_extension_init(void) {
 				continue;
 			}
 
-			if (red_extension_save_ethernet_config_to_fs((ExtensionEthernetConfig *) &base_config[i]) < 0) {
+			if (red_extension_save_ethernet_config_to_fs((ExtensionEthernetConfig *) &_red_extension_base_config[i]) < 0) {
 				log_warn("Could not save Ethernet config. Ethernet Extension at position %d will not show up in Brick Viewer", i);
 			}
 
 			break;
 		}
 	}
+}
+
+static void red_extension_probe_thread(void *opaque) {
+	eventfd_t ev = 1;
+
+	(void)opaque;
+
+	// The extension pins share PIO ports with the stack reset pin, don't
+	// change them while the SPI thread is pulsing the reset pin
+	red_stack_lock_gpio();
+	red_extension_probe();
+	red_stack_unlock_gpio();
+
+	log_debug("Read extension EEPROMs after %u msec",
+	          (uint32_t)((microseconds() - _red_extension_init_at) / 1000));
+
+	if (eventfd_write(_red_extension_probe_done_event, ev) < 0) {
+		log_error("Could not write to extension probe event: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+}
+
+static void red_extension_stop_probe(void) {
+	thread_join(&_red_extension_probe_thread);
+	thread_destroy(&_red_extension_probe_thread);
+
+	event_remove_source(_red_extension_probe_done_event, EVENT_SOURCE_TYPE_GENERIC);
+	close(_red_extension_probe_done_event);
+
+	_red_extension_probing = false;
+}
+
+// Initializes the extensions found by the probe thread. This runs in the
+// brickd event thread, because the extensions add stacks and event sources
+static void red_extension_handle_probe_done(void *opaque) {
+	eventfd_t ev;
+	int i, j;
+
+	(void)opaque;
+
+	if (eventfd_read(_red_extension_probe_done_event, &ev) < 0) {
+		log_error("Could not read from extension probe event: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return;
+	}
+
+	red_extension_stop_probe();
 
 	// Configure the pins and initialize extensions
 	for (i = 0; i < EXTENSION_NUM_MAX; i++) {
-		switch (base_config[i].type) {
+		switch (_red_extension_base_config[i].type) {
 		case EXTENSION_TYPE_RS485:
 			log_info("Found RS485 Extension at position %d", i);
 
+			red_stack_lock_gpio();
+
 			for (j = 0; j < extension_rs485_pin_config.num_configs; j++) {
 				red_extension_configure_pin(&extension_rs485_pin_config.config[j], i);
 			}
 
-			if (red_rs485_extension_init((ExtensionRS485Config *) &base_config[i]) < 0) {
+			red_stack_unlock_gpio();
+
+			if (red_rs485_extension_init((ExtensionRS485Config *) &_red_extension_base_config[i]) < 0) {
 				continue;
 			}
 
@@ -597,11 +664,15 @@ int red_extension_init(void) {
 		case EXTENSION_TYPE_ETHERNET:
 			log_info("Found Ethernet Extension at position %d", i);
 
+			red_stack_lock_gpio();
+
 			for (j = 0; j < extension_ethernet_pin_config.num_configs; j++) {
 				red_extension_configure_pin(&extension_ethernet_pin_config.config[j], i);
 			}
 
-			if (red_ethernet_extension_init((ExtensionEthernetConfig *) &base_config[i]) < 0) {
+			red_stack_unlock_gpio();
+
+			if (red_ethernet_extension_init((ExtensionEthernetConfig *) &_red_extension_base_config[i]) < 0) {
 				continue;
 			}
 
@@ -610,16 +681,68 @@ int red_extension_init(void) {
 		}
 	}
 
-	return 0;
+	log_info("Extensions ready after %u msec",
+	         (uint32_t)((microseconds() - _red_extension_init_at) / 1000));
+}
+
+int red_extension_init(void) {
+	int phase = 0;
+
+	_red_extension_init_at = microseconds();
+
+	if ((_red_extension_probe_done_event = eventfd(0, 0)) < 0) {
+		log_error("Could not create extension probe event: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	if (event_add_source(_red_extension_probe_done_event, EVENT_SOURCE_TYPE_GENERIC,
+	                     EVENT_READ, red_extension_handle_probe_done, NULL) < 0) {
+		log_error("Could not add extension probe event as event source");
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	// Reading the EEPROMs over I2C and writing the configs to the filesystem
+	// takes a while, do this in a thread to not block the brickd startup
+	thread_create(&_red_extension_probe_thread, red_extension_probe_thread, NULL);
+
+	_red_extension_probing = true;
+
+	phase = 3;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 2:
+		event_remove_source(_red_extension_probe_done_event, EVENT_SOURCE_TYPE_GENERIC);
+
+	case 1:
+		close(_red_extension_probe_done_event);
+
+	default:
+		break;
+	}
+
+	return phase == 3 ? 0 : -1;
 }
 
 void red_extension_exit(void) {
 	int i;
 
+	// Extensions found by a probe that is still running are not initialized
+	if (_red_extension_probing) {
+		red_extension_stop_probe();
+	}
+
 	for (i = 0; i < EXTENSION_NUM_MAX; i++) {
 		switch (_red_extension_type[i]) {
 		case EXTENSION_TYPE_RS485:
-			red_rs485_extension_exit();
+			red_rs485_extension_exit(i);
 
 			break;
 
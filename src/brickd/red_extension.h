@@ -24,6 +24,7 @@
 
 #include <stdint.h>
 
+#define EXTENSION_NUM_MAX           2
 #define EXTENSION_CONFIG_SIZE_MAX   256
 
 #define EXTENSION_RS485_SLAVES_MAX  32
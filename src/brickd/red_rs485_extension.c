@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <linux/types.h>
 #include <linux/serial.h>
 #include <sys/eventfd.h>
@@ -40,16 +41,20 @@
 #include <daemonlib/config.h>
 #include <daemonlib/event.h>
 #include <daemonlib/log.h>
+#include <daemonlib/macros.h>
 #include <daemonlib/packet.h>
 #include <daemonlib/pipe.h>
 #include <daemonlib/red_gpio.h>
 #include <daemonlib/red_i2c_eeprom.h>
 #include <daemonlib/threads.h>
+#include <daemonlib/utils.h>
 
 #include "red_rs485_extension.h"
 
 #include "hardware.h"
 #include "network.h"
+#include "realtime.h"
+#include "spsc_ring.h"
 #include "stack.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
@@ -58,15 +63,15 @@ static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
 // Serial interface config stuffs
 #define RECEIVE_BUFFER_SIZE                                             170 // 85x2 = 170 bytes
-#define RS485_EXTENSION_SERIAL_DEVICE                                   "/dev/ttyS0"
+
+// Responses handed from the RS485 thread to the brickd event thread
+#define RS485_EXTENSION_RESPONSE_RING_SIZE                              64 // Must be a power of two
 
 // Time related constants
-static uint64_t TIMEOUT = 0;
-// delay between polls in nanoseconds. configurable with brickd.conf option poll_delay.rs485 in microseconds
-static uint64_t MASTER_POLL_SLAVE_INTERVAL = 40000000;
+// delay between polls in microseconds. configurable with brickd.conf option
+// poll_delay.rs485 and at runtime by the tuning API, only accessed atomically
+static uint32_t MASTER_POLL_SLAVE_INTERVAL = 40000;
 static uint32_t TIMEOUT_BYTES = 86;
-static uint64_t last_timer_enable_at_uS = 0;
-static uint64_t time_passed_from_last_timer_enable = 0;
 
 // Packet related constants
 #define RS485_PACKET_HEADER_LENGTH      3
@@ -78,6 +83,10 @@ static uint64_t time_passed_from_last_timer_enable = 0;
 #define RS485_PACKET_OVERHEAD           RS485_PACKET_HEADER_LENGTH+RS485_PACKET_FOOTER_LENGTH
 #define RS485_PACKET_MAX_LENGTH         TF_PACKET_MAX_LENGTH+RS485_PACKET_OVERHEAD
 
+// Round trip time estimation, see RFC 6298
+#define RS485_RTT_GRANULARITY           1000 // microseconds, covers scheduling delays of the RS485 thread
+#define RS485_RTT_TIMEOUT_MAX_FACTOR    4 // upper limit for the response timeout as multiple of the initial timeout
+
 // Table of CRC values for high-order byte
 static const uint8_t table_crc_hi[] = {
 	0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0,
@@ -142,68 +151,126 @@ static const uint8_t table_crc_lo[] = {
 typedef struct {
 	Packet packet;
 	uint8_t tries_left;
+	// Responses to retried packets are ambiguous, they are not used for the
+	// round trip time estimation
+	bool retried;
 } RS485ExtensionPacket;
 
+typedef struct {
+	Packet packet;
+	uint8_t address;
+	uint64_t ingress_timestamp; // 0 if no client wants ingress timestamps
+} RS485ExtensionResponse;
+
 typedef struct {
 	uint8_t address;
 	uint8_t sequence;
 	Queue packet_queue;
+	// A slave without queued requests is polled when its next poll is due.
+	// The gap between polls grows while the slave has no data to return
+	uint64_t next_poll_at; // microseconds
+	uint32_t poll_gap; // microseconds
+	// The response timeout of a slave follows its smoothed round trip time
+	// and round trip time variation
+	bool rtt_measured;
+	uint32_t srtt; // microseconds
+	uint32_t rttvar; // microseconds
+	uint32_t timeout; // microseconds
+	// Protected by the statistics mutex
+	uint32_t timeouts;
+	uint32_t retries;
 } RS485Slave;
 
+// Each extension position runs its own RS485 bus with its own stack, serial
+// interface and RS485 thread
 typedef struct {
 	Stack base;
+	int extension;
+	char name[32]; // for display purpose
+	bool initialized;
+
 	RS485Slave slaves[EXTENSION_RS485_SLAVES_MAX];
 	int slave_num;
-    Packet dispatch_packet;
+	// Protects the packet queues of all slaves. They are filled by the brickd
+	// event thread and drained by the RS485 thread
+	Mutex queue_mutex;
+	// Protects the round trip time estimates, response timeouts and retry
+	// statistics of all slaves against red_rs485_extension_get_slave_statistics.
+	// They are only written by the RS485 thread, which reads them without lock
+	Mutex statistics_mutex;
 
 	uint32_t baudrate;
 	uint8_t parity;
 	uint8_t stopbits;
 	uint32_t address;
-} RS485Extension;
-
-static RS485Extension _red_rs485_extension;
-static char packet_signature[PACKET_MAX_SIGNATURE_LENGTH] = {0};
-static int _red_rs485_serial_fd = -1; // Serial interface file descriptor
 
-// Variables tracking current states
-static char current_request_as_byte_array[sizeof(Packet) + RS485_PACKET_OVERHEAD] = {0};
-static int master_current_slave_to_process = -1; // Only used used by master
-
-// Receive buffer
-static uint8_t receive_buffer[RECEIVE_BUFFER_SIZE] = {0};
-static int current_receive_buffer_index = 0;
-
-// Events
-static int _master_timer_event = 0;
-
-// Timers
-static struct itimerspec master_timer;
-
-// Used as boolean
-static bool _initialized = false;
-static uint8_t sent_ack_of_data_packet = 0;
-static uint8_t send_verify_flag = 0;
-static bool master_poll_interval = false;
+	const char *serial_device;
+	int serial_fd;
+	bool rx_enable_gpio;
+	GPIOPin rx_pin; // Active low
+
+	// response timeout in nanoseconds for a packet of maximum length, used
+	// until the round trip time of a slave has been measured
+	uint64_t timeout;
+	// time to send and receive a packet of maximum length in microseconds.
+	// lower limit for the response timeout of a slave
+	uint32_t timeout_min;
+	// upper limit for the response timeout of a slave in microseconds
+	uint32_t timeout_max;
+	// maximum delay between two polls of the same idle slave in microseconds.
+	// configurable with brickd.conf option poll_delay.rs485_idle_max
+	uint32_t poll_gap_max;
+
+	// Variables tracking current states
+	uint8_t current_request[sizeof(Packet) + RS485_PACKET_OVERHEAD];
+	int current_slave; // index of the slave currently processed
+	uint8_t receive_buffer[RECEIVE_BUFFER_SIZE];
+	int receive_buffer_index;
+	bool sent_ack_of_data_packet;
+	bool send_verify_flag;
+	uint64_t request_sent_at; // microseconds
+	bool request_retried;
+
+	// Master timer, used for the response timeout and the poll interval
+	int master_timer_event;
+	struct itimerspec master_timer;
+	bool master_poll_interval;
+	uint64_t master_poll_interval_duration; // nanoseconds
+	uint64_t master_response_timeout_duration; // nanoseconds
+	uint64_t last_timer_enable_at; // microseconds
+	// set while no slave is due. protected by the queue mutex, so a request
+	// queued by the brickd event thread can reliably wake up the RS485 thread
+	bool master_idle;
+	bool master_idle_wait; // only accessed by the RS485 thread
+
+	// The RS485 master runs in its own thread, so that its poll cycle
+	// doesn't depend on the load of the brickd event thread
+	Thread thread;
+	int stop_event;
+	int wakeup_event;
+	int response_event;
+	SPSCRing response_ring;
+	uint32_t dropped_responses; // only accessed by the RS485 thread
+	RealtimeJitter jitter;
+} RS485Extension;
 
-// RX GPIO pin definitions
-static GPIOPin _rx_pin; // Active low
+static RS485Extension _red_rs485_extensions[EXTENSION_NUM_MAX];
 
 // Function prototypes
 uint16_t crc16(uint8_t*, uint16_t);
-int serial_interface_init(const char*);
-void verify_buffer(uint8_t*);
-void send_packet(void);
-void init_rxe_pin_state(int);
-void serial_data_available_handler(void*);
-void master_poll_slave(void);
-void master_timeout_handler(void*);
+int serial_interface_init(RS485Extension*);
+void verify_buffer(RS485Extension*);
+void send_packet(RS485Extension*);
+void init_rxe_pin_state(RS485Extension*);
+void serial_data_available_handler(RS485Extension*);
+void master_poll_slave(RS485Extension*);
+void master_timeout_handler(RS485Extension*);
 int red_rs485_extension_dispatch_to_rs485(Stack*, Packet*, Recipient*);
-void disable_master_timer(void);
-void pop_packet_from_slave_queue(void);
-bool is_current_request_empty(void);
-void seq_pop_poll(void);
-void arm_master_poll_slave_interval_timer(void);
+void disable_master_timer(RS485Extension*);
+void pop_packet_from_slave_queue(RS485Extension*);
+bool is_current_request_empty(RS485Extension*);
+void seq_pop_poll(RS485Extension*);
+void arm_master_poll_slave_interval_timer(RS485Extension*);
 
 // CRC16 function
 uint16_t crc16(uint8_t *buffer, uint16_t buffer_length) {
@@ -222,13 +289,14 @@ uint16_t crc16(uint8_t *buffer, uint16_t buffer_length) {
 }
 
 // Function for initializing the serial interface
-int serial_interface_init(const char *serial_interface) {
+int serial_interface_init(RS485Extension *rs485) {
 	// Device file opening flags
 	int flags = O_RDWR | O_NOCTTY | O_NDELAY | O_EXCL | ASYNC_SPD_CUST | ASYNC_LOW_LATENCY;
 
 	// Opening device file
-	if ((_red_rs485_serial_fd = open(serial_interface, flags)) < 0) {
-		log_error("Serial device open failed");
+	if ((rs485->serial_fd = open(rs485->serial_device, flags)) < 0) {
+		log_error("Could not open serial device '%s' for %s: %s (%d)",
+		          rs485->serial_device, rs485->name, get_errno_name(errno), errno);
 
 		return -1;
 	}
@@ -238,7 +306,7 @@ int serial_interface_init(const char *serial_interface) {
 	// Serial interface config struct
 	struct termios serial_interface_config;
 	struct serial_struct serial_config;
-	tcgetattr(_red_rs485_serial_fd, &(serial_interface_config));
+	tcgetattr(rs485->serial_fd, &(serial_interface_config));
 	memset(&serial_interface_config, 0, sizeof(serial_interface_config));
 	memset(&serial_config, 0, sizeof(serial_config));
 
@@ -247,30 +315,30 @@ int serial_interface_init(const char *serial_interface) {
 	serial_interface_config.c_cflag &= ~CSIZE;
 	serial_interface_config.c_cflag |= CS8; // Setting data bits
 
-	if (_red_rs485_extension.stopbits == 1) {
+	if (rs485->stopbits == 1) {
 		serial_interface_config.c_cflag &=~ CSTOPB; // Setting one stop bits
-	} else if (_red_rs485_extension.stopbits == 2) {
+	} else if (rs485->stopbits == 2) {
 		serial_interface_config.c_cflag |= CSTOPB; // Setting two stop bits
 	} else {
 		log_error("Error in serial stop bits config");
-		close(_red_rs485_serial_fd);
+		close(rs485->serial_fd);
 
 		return -1;
 	}
 
-	if (_red_rs485_extension.parity == RS485_EXTENSION_SERIAL_PARITY_NONE) {
+	if (rs485->parity == RS485_EXTENSION_SERIAL_PARITY_NONE) {
 		serial_interface_config.c_cflag &=~ PARENB; // parity disabled
-	} else if (_red_rs485_extension.parity == RS485_EXTENSION_SERIAL_PARITY_EVEN) {
+	} else if (rs485->parity == RS485_EXTENSION_SERIAL_PARITY_EVEN) {
 		/* Even */
 		serial_interface_config.c_cflag |= PARENB;
 		serial_interface_config.c_cflag &=~ PARODD;
-	} else if (_red_rs485_extension.parity == RS485_EXTENSION_SERIAL_PARITY_ODD){
+	} else if (rs485->parity == RS485_EXTENSION_SERIAL_PARITY_ODD){
 		/* Odd */
 		serial_interface_config.c_cflag |= PARENB;
 		serial_interface_config.c_cflag |= PARODD;
 	} else {
 		log_error("Error in serial parity config");
-		close(_red_rs485_serial_fd);
+		close(rs485->serial_fd);
 
 		return -1;
 	}
@@ -278,30 +346,39 @@ int serial_interface_init(const char *serial_interface) {
 	// Setting the baudrate
 	serial_config.reserved_char[0] = 0;
 
-	if (ioctl(_red_rs485_serial_fd, TIOCGSERIAL, &serial_config) < 0) {
-		log_error("Error setting RS485 serial baudrate");
+	if (ioctl(rs485->serial_fd, TIOCGSERIAL, &serial_config) < 0) {
+		if (errno != ENOTTY && errno != EINVAL) {
+			log_error("Error setting RS485 serial baudrate");
+			close(rs485->serial_fd);
 
-		return -1;
-	}
+			return -1;
+		}
 
-	serial_config.flags &= ~ASYNC_SPD_MASK;
-	serial_config.flags |= ASYNC_SPD_CUST;
-	serial_config.custom_divisor = (serial_config.baud_base + (_red_rs485_extension.baudrate / 2)) /
-	                                _red_rs485_extension.baudrate;
+		// Not an UART, for example a pseudo terminal of the RS485 bus
+		// simulator. There is no baudrate to configure
+		log_warn("Serial device %s does not support custom baudrates, using it as is",
+		         rs485->serial_device);
+	} else {
+		serial_config.flags &= ~ASYNC_SPD_MASK;
+		serial_config.flags |= ASYNC_SPD_CUST;
+		serial_config.custom_divisor = (serial_config.baud_base + (rs485->baudrate / 2)) /
+		                                rs485->baudrate;
 
-	if (serial_config.custom_divisor < 1) {
-		serial_config.custom_divisor = 1;
-	}
+		if (serial_config.custom_divisor < 1) {
+			serial_config.custom_divisor = 1;
+		}
 
-	if (ioctl(_red_rs485_serial_fd, TIOCSSERIAL, &serial_config) < 0) {
-		log_error("Error setting serial baudrate");
+		if (ioctl(rs485->serial_fd, TIOCSSERIAL, &serial_config) < 0) {
+			log_error("Error setting serial baudrate");
+			close(rs485->serial_fd);
 
-		return -1;
-	}
+			return -1;
+		}
 
-	log_info("Baudrate configured = %d, Effective baudrate = %f",
-	         _red_rs485_extension.baudrate,
-	         (float)serial_config.baud_base / serial_config.custom_divisor);
+		log_info("Baudrate configured = %d, Effective baudrate = %f",
+		         rs485->baudrate,
+		         (float)serial_config.baud_base / serial_config.custom_divisor);
+	}
 
 	cfsetispeed(&serial_interface_config, B38400);
 	cfsetospeed(&serial_interface_config, B38400);
@@ -310,7 +387,7 @@ int serial_interface_init(const char *serial_interface) {
 	serial_interface_config.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG); // Raw input
 
 	// Input options
-	if (_red_rs485_extension.parity == RS485_EXTENSION_SERIAL_PARITY_NONE) {
+	if (rs485->parity == RS485_EXTENSION_SERIAL_PARITY_NONE) {
 		serial_interface_config.c_iflag &= ~INPCK; // Input check disabled
 	} else {
 		serial_interface_config.c_iflag |= INPCK; // Input check enabled
@@ -325,27 +402,91 @@ int serial_interface_init(const char *serial_interface) {
 	serial_interface_config.c_cc[VMIN] = 0;
 	serial_interface_config.c_cc[VTIME] = 0;
 
-	tcsetattr(_red_rs485_serial_fd, TCSANOW, &serial_interface_config);
+	tcsetattr(rs485->serial_fd, TCSANOW, &serial_interface_config);
 
 	// Flushing the buffer
-	tcflush(_red_rs485_serial_fd, TCIOFLUSH);
+	tcflush(rs485->serial_fd, TCIOFLUSH);
 
 	log_info("Serial interface initialized");
 
 	return 0;
 }
 
+// Updates the round trip time estimate and the response timeout of the current
+// slave after a valid response. Responses to retried requests are ignored,
+// because it is unknown which of the tries they belong to
+static void update_round_trip_time(RS485Extension *rs485) {
+	RS485Slave *slave = &rs485->slaves[rs485->current_slave];
+	uint32_t rtt;
+	uint32_t delta;
+
+	if (rs485->request_retried) {
+		return;
+	}
+
+	rtt = (uint32_t)(microseconds() - rs485->request_sent_at);
+
+	mutex_lock(&rs485->statistics_mutex);
+
+	if (!slave->rtt_measured) {
+		slave->srtt = rtt;
+		slave->rttvar = rtt / 2;
+		slave->rtt_measured = true;
+	} else {
+		delta = slave->srtt > rtt ? slave->srtt - rtt : rtt - slave->srtt;
+		slave->rttvar = (3 * slave->rttvar + delta) / 4;
+		slave->srtt = (7 * slave->srtt + rtt) / 8;
+	}
+
+	slave->timeout = slave->srtt + MAX(RS485_RTT_GRANULARITY, 4 * slave->rttvar);
+	slave->timeout = MAX(slave->timeout, rs485->timeout_min);
+	slave->timeout = MIN(slave->timeout, rs485->timeout_max);
+
+	mutex_unlock(&rs485->statistics_mutex);
+}
+
+// Hands a received response over to the brickd event thread. If the brickd
+// event thread did not keep up and the ring is full the response is dropped
+static void queue_response(RS485Extension *rs485, uint8_t *packet, uint8_t length, uint8_t address,
+                           uint64_t ingress_timestamp) {
+	RS485ExtensionResponse *response = spsc_ring_reserve(&rs485->response_ring);
+	eventfd_t ev = 1;
+
+	if (response == NULL) {
+		++rs485->dropped_responses;
+
+		log_warn("Response queue is full, dropping response from slave %d, %u dropped in total",
+		         address, rs485->dropped_responses);
+
+		return;
+	}
+
+	memset(&response->packet, 0, sizeof(Packet));
+	memcpy(&response->packet, packet, length);
+	response->address = address;
+	response->ingress_timestamp = ingress_timestamp;
+
+	spsc_ring_commit(&rs485->response_ring);
+
+	if (eventfd_write(rs485->response_event, ev) < 0) {
+		log_error("Could not write to RS485 response event: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+}
+
 // Verify packet
-void verify_buffer(uint8_t *receive_buffer) {
+void verify_buffer(RS485Extension *rs485) {
+	uint8_t *receive_buffer = rs485->receive_buffer;
 	int packet_end_index = 0;
 	uint32_t uid_from_packet;
 	uint16_t crc16_calculated;
 	uint16_t crc16_on_packet;
 	RS485ExtensionPacket* queue_packet;
+	uint64_t ingress_timestamp = 0;
 	int i;
 
 	// Check if length byte is available
-	if (current_receive_buffer_index < 8) {
+	if (rs485->receive_buffer_index < 8) {
 		log_packet_debug("Partial packet received. Length byte not available");
 
 		return;
@@ -355,67 +496,74 @@ void verify_buffer(uint8_t *receive_buffer) {
 	packet_end_index = 7+((receive_buffer[RS485_PACKET_LENGTH_INDEX] - 5) + RS485_PACKET_FOOTER_LENGTH);
 
 	// Check if complete packet is available
-	if (current_receive_buffer_index <= packet_end_index) {
+	if (rs485->receive_buffer_index <= packet_end_index) {
 		log_packet_debug("Partial packet received");
 
 		return;
 	}
 
+	// Take the timestamp as soon as the packet is complete, if a client wants it
+	if (network_wants_ingress_timestamps()) {
+		ingress_timestamp = network_get_ingress_timestamp();
+	}
+
 	// If send verify flag was set
-	if (send_verify_flag) {
+	if (rs485->send_verify_flag) {
 		for (i = 0; i <= packet_end_index; i++) {
-			if (receive_buffer[i] != current_request_as_byte_array[i]) {
+			if (receive_buffer[i] != rs485->current_request[i]) {
 				// Move on to next slave
-				disable_master_timer();
+				disable_master_timer(rs485);
 				log_error("Send verification failed");
-				seq_pop_poll();
+				seq_pop_poll(rs485);
 
 				return;
 			}
 		}
 
 		// Send verify successful. Reset flag
-		send_verify_flag = 0;
+		rs485->send_verify_flag = false;
 		log_packet_debug("Send verification done");
 
-		if (sent_ack_of_data_packet) {
+		if (rs485->sent_ack_of_data_packet) {
 			// Request processing done. Move on to next slave
-			disable_master_timer();
+			disable_master_timer(rs485);
 			log_packet_debug("Processed current request");
-			++_red_rs485_extension.slaves[master_current_slave_to_process].sequence;
-			queue_pop(&_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue, NULL);
+			++rs485->slaves[rs485->current_slave].sequence;
+			mutex_lock(&rs485->queue_mutex);
+			queue_pop(&rs485->slaves[rs485->current_slave].packet_queue, NULL);
+			mutex_unlock(&rs485->queue_mutex);
 
 			// Poll next slave after the configured timeout
-			arm_master_poll_slave_interval_timer();
+			arm_master_poll_slave_interval_timer(rs485);
 
 			return;
-		} else if (current_receive_buffer_index == packet_end_index+1) {
+		} else if (rs485->receive_buffer_index == packet_end_index+1) {
 			// Everything OK. Wait for response now
 			log_packet_debug("No more Data. Waiting for response");
-			current_receive_buffer_index = 0;
+			rs485->receive_buffer_index = 0;
 			memset(receive_buffer, 0, RECEIVE_BUFFER_SIZE);
 
 			return;
-		} else if (current_receive_buffer_index > packet_end_index+1) {
+		} else if (rs485->receive_buffer_index > packet_end_index+1) {
 			// More data in the receive buffer
 			log_packet_debug("Potential partial data in the buffer. Verifying");
 
 			memmove(&receive_buffer[0], &receive_buffer[packet_end_index+1],
-			        current_receive_buffer_index - (packet_end_index+1));
+			        rs485->receive_buffer_index - (packet_end_index+1));
 
-			current_receive_buffer_index = current_receive_buffer_index - (packet_end_index+1);
+			rs485->receive_buffer_index = rs485->receive_buffer_index - (packet_end_index+1);
 
 			// A recursive call to handle the remaining bytes in the buffer
-			if (current_receive_buffer_index >= 8) {
-				verify_buffer(receive_buffer);
+			if (rs485->receive_buffer_index >= 8) {
+				verify_buffer(rs485);
 			}
 
 			return;
 		} else {
 			// Undefined state
-			disable_master_timer();
+			disable_master_timer(rs485);
 			log_error("Undefined receive buffer state");
-			seq_pop_poll();
+			seq_pop_poll(rs485);
 
 			return;
 		}
@@ -427,31 +575,31 @@ void verify_buffer(uint8_t *receive_buffer) {
 	// Received empty packet from the other side (UID=0, LEN=8, FID=0)
 	if (uid_from_packet == 0 && receive_buffer[RS485_PACKET_LENGTH_INDEX] == 8 && receive_buffer[8] == 0) {
 		// Checking address
-		if (receive_buffer[0] != current_request_as_byte_array[0]){
+		if (receive_buffer[0] != rs485->current_request[0]){
 			// Move on to next slave
-			disable_master_timer();
+			disable_master_timer(rs485);
 			log_error("Wrong address in received empty packet. Moving on");
-			seq_pop_poll();
+			seq_pop_poll(rs485);
 
 			return;
 		}
 
 		// Checking function code
-		if (receive_buffer[1] != current_request_as_byte_array[1]) {
+		if (receive_buffer[1] != rs485->current_request[1]) {
 			// Move on to next slave
-			disable_master_timer();
+			disable_master_timer(rs485);
 			log_error("Wrong function code in received empty packet. Moving on");
-			seq_pop_poll();
+			seq_pop_poll(rs485);
 
 			return;
 		}
 
 		// Checking current sequence number
-		if (receive_buffer[2] != current_request_as_byte_array[2]) {
+		if (receive_buffer[2] != rs485->current_request[2]) {
 			// Move on to next slave
-			disable_master_timer();
+			disable_master_timer(rs485);
 			log_error("Wrong sequence number in received empty packet. Moving on");
-			seq_pop_poll();
+			seq_pop_poll(rs485);
 
 			return;
 		}
@@ -463,54 +611,57 @@ void verify_buffer(uint8_t *receive_buffer) {
 
 		if (crc16_calculated != crc16_on_packet) {
 			// Move on to next slave
-			disable_master_timer();
+			disable_master_timer(rs485);
 			log_error("Wrong CRC16 checksum in received empty packet. Moving on");
-			seq_pop_poll();
+			seq_pop_poll(rs485);
 
 			return;
 		}
 
-		disable_master_timer();
+		disable_master_timer(rs485);
+		update_round_trip_time(rs485);
 
 		log_packet_debug("Received empty packet");
 
 		// Updating sequence number
-		++_red_rs485_extension.slaves[master_current_slave_to_process].sequence;
+		++rs485->slaves[rs485->current_slave].sequence;
 
 		// Popping slave's packet queue
-		queue_pop(&_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue, NULL);
+		mutex_lock(&rs485->queue_mutex);
+		queue_pop(&rs485->slaves[rs485->current_slave].packet_queue, NULL);
+		mutex_unlock(&rs485->queue_mutex);
 
 		// Poll next slave after the configured timeout
-		arm_master_poll_slave_interval_timer();
+		arm_master_poll_slave_interval_timer(rs485);
 	}
 	// Received data packet from the other side
 	else if (uid_from_packet != 0 && receive_buffer[8] != 0) {
 		// Checking address
-		if (receive_buffer[0] != current_request_as_byte_array[0]) {
+		if (receive_buffer[0] != rs485->current_request[0]) {
 			// Move on to next slave
-			disable_master_timer();
+			disable_master_timer(rs485);
 			log_error("Wrong address in received data packet. Moving on");
-			seq_pop_poll();
+			seq_pop_poll(rs485);
 
 			return;
 		}
 
 		// Checking function code
-		if (receive_buffer[1] != current_request_as_byte_array[1]) {
+		if (receive_buffer[1] != rs485->current_request[1]) {
 			// Move on to next slave
-			disable_master_timer();
+			disable_master_timer(rs485);
 			log_error("Wrong function code in received data packet. Moving on");
-			seq_pop_poll();
+			seq_pop_poll(rs485);
 
 			return;
 		}
 
 		// Checking current sequence number
-		if (receive_buffer[2] != current_request_as_byte_array[2]) {
+		if (receive_buffer[2] != rs485->current_request[2]) {
 			// Move on to next slave
-			disable_master_timer();
+			disable_master_timer(rs485);
 			log_error("Wrong sequence number in received data packet. Moving on");
-			seq_pop_poll();
+			seq_pop_poll(rs485);
 
 			return;
 		}
@@ -522,59 +673,77 @@ void verify_buffer(uint8_t *receive_buffer) {
 
 		if (crc16_calculated != crc16_on_packet) {
 			// Move on to next slave
-			disable_master_timer();
+			disable_master_timer(rs485);
 			log_error("Wrong CRC16 checksum in received empty packet. Moving on");
-			seq_pop_poll();
+			seq_pop_poll(rs485);
 
 			return;
 		}
 
 		log_packet_debug("Data packet received");
 
-		// Send message into brickd dispatcher
-		memset(&_red_rs485_extension.dispatch_packet, 0, sizeof(Packet));
-		memcpy(&_red_rs485_extension.dispatch_packet, &receive_buffer[3], receive_buffer[RS485_PACKET_LENGTH_INDEX]);
-		network_dispatch_response(&_red_rs485_extension.dispatch_packet);
+		update_round_trip_time(rs485);
 
-		stack_add_recipient(&_red_rs485_extension.base, uid_from_packet, receive_buffer[0]);
+		// Send message into brickd dispatcher
+		queue_response(rs485, &receive_buffer[3], receive_buffer[RS485_PACKET_LENGTH_INDEX], receive_buffer[0],
+		               ingress_timestamp);
 
-		queue_packet = queue_peek(&_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue);
+		mutex_lock(&rs485->queue_mutex);
+		queue_packet = queue_peek(&rs485->slaves[rs485->current_slave].packet_queue);
+		mutex_unlock(&rs485->queue_mutex);
 
 		// Replace head of slave queue with an ACK
 		memset(queue_packet, 0, sizeof(RS485ExtensionPacket));
 		queue_packet->tries_left = RS485_PACKET_TRIES_EMPTY;
+		queue_packet->retried = false;
 		queue_packet->packet.header.length = 8;
 
-		current_receive_buffer_index = 0;
-		sent_ack_of_data_packet = 1;
+		rs485->receive_buffer_index = 0;
+		rs485->sent_ack_of_data_packet = true;
 		memset(receive_buffer, 0, RECEIVE_BUFFER_SIZE);
 
 		log_packet_debug("Sending ACK of the data packet");
 
-		send_packet();
+		send_packet(rs485);
 	} else {
 		// Undefined packet
-		disable_master_timer();
+		disable_master_timer(rs485);
 		log_error("Undefined packet");
-		seq_pop_poll();
+		seq_pop_poll(rs485);
 	}
 }
 
+// Arms the master timer to wait the given duration in nanoseconds for the
+// response of the current slave
+static void arm_master_response_timer(RS485Extension *rs485, uint64_t duration) {
+	rs485->master_response_timeout_duration = duration;
+
+	rs485->master_timer.it_interval.tv_sec = 0;
+	rs485->master_timer.it_interval.tv_nsec = 0;
+	rs485->master_timer.it_value.tv_sec = duration / 1000000000;
+	rs485->master_timer.it_value.tv_nsec = duration % 1000000000;
+	timerfd_settime(rs485->master_timer_event, 0, &rs485->master_timer, NULL);
+	rs485->last_timer_enable_at = microseconds();
+}
+
 // Send packet
-void send_packet(void) {
+void send_packet(RS485Extension *rs485) {
 	uint16_t packet_crc16 = 0;
 	uint8_t crc16_first_byte_index = 0;
 	RS485Slave* current_slave = NULL;
 	RS485ExtensionPacket* packet_to_send = NULL;
 
-	current_slave = &_red_rs485_extension.slaves[master_current_slave_to_process];
+	current_slave = &rs485->slaves[rs485->current_slave];
+
+	mutex_lock(&rs485->queue_mutex);
 	packet_to_send = queue_peek(&current_slave->packet_queue);
+	mutex_unlock(&rs485->queue_mutex);
 
 	if (packet_to_send == NULL) {
 		// Slave's packet queue is empty. Move on to next slave
 		log_packet_debug("Slave packet queue empty. Moving on");
 		// Poll next slave after the configured timeout
-		arm_master_poll_slave_interval_timer();
+		arm_master_poll_slave_interval_timer(rs485);
 		return;
 	}
 
@@ -599,165 +768,240 @@ void send_packet(void) {
 	rs485_packet[++crc16_first_byte_index] = packet_crc16 & 0x00FF;
 
 	// Sending packet
-	if ((write(_red_rs485_serial_fd, &rs485_packet, sizeof(rs485_packet))) <= 0) {
+	rs485->request_sent_at = microseconds();
+	rs485->request_retried = packet_to_send->retried;
+
+	if ((write(rs485->serial_fd, &rs485_packet, sizeof(rs485_packet))) <= 0) {
 		log_error("Error sending packet on interface, %s (%d)",
 		          get_errno_name(errno), errno);
 
 		// Poll next slave after the configured timeout
-		arm_master_poll_slave_interval_timer();
+		arm_master_poll_slave_interval_timer(rs485);
 
 		return;
 	}
 
 	// Save the packet as byte array
-	memcpy(&current_request_as_byte_array, &rs485_packet, sizeof(rs485_packet));
+	memcpy(rs485->current_request, &rs485_packet, sizeof(rs485_packet));
 
 	// Set send verify flag
-	send_verify_flag = 1;
+	rs485->send_verify_flag = true;
 
 	log_packet_debug("Sent packet");
 
 	// Start the master timer
-	master_timer.it_interval.tv_sec = 0;
-	master_timer.it_interval.tv_nsec = 0;
-	master_timer.it_value.tv_sec = 0;
-	master_timer.it_value.tv_nsec = TIMEOUT;
-	timerfd_settime(_master_timer_event, 0, &master_timer, NULL);
-	last_timer_enable_at_uS = microseconds();
+	arm_master_response_timer(rs485, (uint64_t)current_slave->timeout * 1000);
 }
 
 // Initialize RX state
-void init_rxe_pin_state(int extension) {
-	switch (extension) {
+void init_rxe_pin_state(RS485Extension *rs485) {
+	switch (rs485->extension) {
 	case 0:
-		_rx_pin.port_index = GPIO_PORT_B;
-		_rx_pin.pin_index = GPIO_PIN_13;
+		rs485->rx_pin.port_index = GPIO_PORT_B;
+		rs485->rx_pin.pin_index = GPIO_PIN_13;
 
 		break;
 
 	case 1:
-		_rx_pin.port_index = GPIO_PORT_G;
-		_rx_pin.pin_index = GPIO_PIN_2;
+		rs485->rx_pin.port_index = GPIO_PORT_G;
+		rs485->rx_pin.pin_index = GPIO_PIN_2;
 
 		break;
 	}
 
-	gpio_mux_configure(_rx_pin, GPIO_MUX_OUTPUT);
-	gpio_output_clear(_rx_pin);
+	gpio_mux_configure(rs485->rx_pin, GPIO_MUX_OUTPUT);
+	gpio_output_clear(rs485->rx_pin);
 	log_info("Initialized RS485 RXE state");
 }
 
-void disable_master_timer(void) {
+void disable_master_timer(RS485Extension *rs485) {
 	uint64_t dummy_read_buffer = 0;
-	if ((read(_master_timer_event, &dummy_read_buffer, sizeof(uint64_t))) < 0) {}
-	master_timer.it_interval.tv_sec = 0;
-	master_timer.it_interval.tv_nsec = 0;
-	master_timer.it_value.tv_sec = 0;
-	master_timer.it_value.tv_nsec = 0;
-	timerfd_settime(_master_timer_event, 0, &master_timer, NULL);
+	if ((read(rs485->master_timer_event, &dummy_read_buffer, sizeof(uint64_t))) < 0) {}
+	rs485->master_timer.it_interval.tv_sec = 0;
+	rs485->master_timer.it_interval.tv_nsec = 0;
+	rs485->master_timer.it_value.tv_sec = 0;
+	rs485->master_timer.it_value.tv_nsec = 0;
+	timerfd_settime(rs485->master_timer_event, 0, &rs485->master_timer, NULL);
 	log_debug("Disabled master timer");
 }
 
 // New data available event handler
-void serial_data_available_handler(void* opaque) {
-	(void)opaque;
-
+void serial_data_available_handler(RS485Extension *rs485) {
 	// Check if there is space in the receive buffer
-	if (current_receive_buffer_index >= RECEIVE_BUFFER_SIZE) {
+	if (rs485->receive_buffer_index >= RECEIVE_BUFFER_SIZE) {
 		log_warn("No more space in the receive buffer. Aborting current request");
 
 		// Poll next slave after the configured timeout
-		arm_master_poll_slave_interval_timer();
+		arm_master_poll_slave_interval_timer(rs485);
 
 		return;
 	}
 
 	// Put newly received bytes on the specific index in receive buffer
-	int bytes_received = read(_red_rs485_serial_fd,
-	                          &receive_buffer[current_receive_buffer_index],
-	                          (RECEIVE_BUFFER_SIZE - current_receive_buffer_index));
+	int bytes_received = read(rs485->serial_fd,
+	                          &rs485->receive_buffer[rs485->receive_buffer_index],
+	                          (RECEIVE_BUFFER_SIZE - rs485->receive_buffer_index));
 
 	if (bytes_received < 0) {
 		return;
 	}
 
-	current_receive_buffer_index += bytes_received;
-	verify_buffer(receive_buffer);
+	rs485->receive_buffer_index += bytes_received;
+	verify_buffer(rs485);
+}
+
+// Arms the master timer for the poll interval with the given duration in
+// nanoseconds
+static void arm_master_poll_interval_timer(RS485Extension *rs485, uint64_t duration) {
+	rs485->master_poll_interval = true;
+	rs485->master_poll_interval_duration = duration;
+
+	rs485->master_timer.it_interval.tv_sec = 0;
+	rs485->master_timer.it_interval.tv_nsec = 0;
+	rs485->master_timer.it_value.tv_sec = duration / 1000000000;
+	rs485->master_timer.it_value.tv_nsec = duration % 1000000000;
+	timerfd_settime(rs485->master_timer_event, 0, &rs485->master_timer, NULL);
+	rs485->last_timer_enable_at = microseconds();
+}
+
+// Picks the slave to exchange data with next. Slaves with queued requests are
+// served first, in turn. Otherwise the slave that is overdue the longest is
+// polled. Returns -1 if no slave is due and stores the time the next slave is
+// due at in next_due_at. Must be called with the queue mutex locked
+static int master_select_slave(RS485Extension *rs485, uint64_t now, uint64_t *next_due_at) {
+	RS485Slave *slave;
+	int selected = -1;
+	int i, k;
+
+	for (k = 1; k <= rs485->slave_num; k++) {
+		i = (rs485->current_slave + k) % rs485->slave_num;
+
+		if (queue_peek(&rs485->slaves[i].packet_queue) != NULL) {
+			return i;
+		}
+	}
+
+	*next_due_at = UINT64_MAX;
+
+	for (i = 0; i < rs485->slave_num; i++) {
+		slave = &rs485->slaves[i];
+
+		if (slave->next_poll_at <= now) {
+			if (selected < 0 || slave->next_poll_at < rs485->slaves[selected].next_poll_at) {
+				selected = i;
+			}
+		} else if (slave->next_poll_at < *next_due_at) {
+			*next_due_at = slave->next_poll_at;
+		}
+	}
+
+	return selected;
 }
 
 // Master polling slave event handler
-void master_poll_slave(void) {
+void master_poll_slave(RS485Extension *rs485) {
 	RS485ExtensionPacket* slave_queue_packet;
-	sent_ack_of_data_packet = 0;
-	current_receive_buffer_index = 0;
-	memset(receive_buffer, 0, RECEIVE_BUFFER_SIZE);
+	uint64_t now;
+	uint64_t next_due_at;
+	int slave;
+
+	rs485->sent_ack_of_data_packet = false;
+	rs485->receive_buffer_index = 0;
+	memset(rs485->receive_buffer, 0, RECEIVE_BUFFER_SIZE);
+	rs485->master_idle_wait = false;
+
+	mutex_lock(&rs485->queue_mutex);
 
 	// Updating current slave to process
-	if (++master_current_slave_to_process >= _red_rs485_extension.slave_num) {
-		master_current_slave_to_process = 0;
+	now = microseconds();
+	slave = master_select_slave(rs485, now, &next_due_at);
+
+	if (slave < 0) {
+		// No slave is due. Wait for the next one, unless a request gets
+		// queued in the meantime
+		rs485->master_idle = true;
+		rs485->master_idle_wait = true;
+
+		mutex_unlock(&rs485->queue_mutex);
+
+		log_debug("No RS485 slave due, waiting %u usec", (uint32_t)(next_due_at - now));
+
+		arm_master_poll_interval_timer(rs485, (next_due_at - now) * 1000);
+
+		return;
 	}
 
+	rs485->master_idle = false;
+	rs485->current_slave = slave;
+
 	log_debug("Updated current RS485 slave's index");
 
-	if ((queue_peek(&_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue)) == NULL) {
+	if ((queue_peek(&rs485->slaves[rs485->current_slave].packet_queue)) == NULL) {
 		// Nothing to send in the slave's queue. So send a poll packet
-		slave_queue_packet = queue_push(&_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue);
+		slave_queue_packet = queue_push(&rs485->slaves[rs485->current_slave].packet_queue);
+
+		if (slave_queue_packet != NULL) {
+			slave_queue_packet->tries_left = RS485_PACKET_TRIES_EMPTY;
+			slave_queue_packet->retried = false;
+			slave_queue_packet->packet.header.length = 8;
+		}
+
+		mutex_unlock(&rs485->queue_mutex);
 
 		if (slave_queue_packet == NULL) {
 			log_error("Could not push empty request to packet queue for slave %d: %s (%d)",
-			          _red_rs485_extension.slaves[master_current_slave_to_process].address,
+			          rs485->slaves[rs485->current_slave].address,
 			          get_errno_name(errno), errno);
 
 			return;
 		}
 
-		slave_queue_packet->tries_left = RS485_PACKET_TRIES_EMPTY;
-		slave_queue_packet->packet.header.length = 8;
-
 		log_packet_debug("Sending empty packet to slave ID = %d, Sequence number = %d",
-		                 _red_rs485_extension.slaves[master_current_slave_to_process].address,
-		                 _red_rs485_extension.slaves[master_current_slave_to_process].sequence);
+		                 rs485->slaves[rs485->current_slave].address,
+		                 rs485->slaves[rs485->current_slave].sequence);
 
 		// The timer will be fired by the send function
-		send_packet();
+		send_packet(rs485);
 	} else {
+		mutex_unlock(&rs485->queue_mutex);
+
 		log_packet_debug("Sending packet from queue to slave ID = %d, Sequence number = %d",
-		                 _red_rs485_extension.slaves[master_current_slave_to_process].address,
-		                 _red_rs485_extension.slaves[master_current_slave_to_process].sequence);
+		                 rs485->slaves[rs485->current_slave].address,
+		                 rs485->slaves[rs485->current_slave].sequence);
 
 		// Slave's packet queue if not empty. Send the packet that is at the head of the queue
 
 		// The timer will be fired by the send function
-		send_packet();
+		send_packet(rs485);
 	}
 }
 
 // Master timer event handler
-void master_timeout_handler(void* opaque) {
-	(void)opaque;
+void master_timeout_handler(RS485Extension *rs485) {
+	uint64_t time_passed_from_last_timer_enable;
+	RS485Slave *slave;
 
-	disable_master_timer();
+	disable_master_timer(rs485);
 
-	if (master_poll_interval) {
+	if (rs485->master_poll_interval) {
 		// For some unknown reason the timer randomly times out or this timeout function is called
 		// much long before the actual timeout. This is a fix to this problem
 		// until we find the real problem
-		time_passed_from_last_timer_enable = (microseconds() - last_timer_enable_at_uS) * 1000;
+		time_passed_from_last_timer_enable = (microseconds() - rs485->last_timer_enable_at) * 1000;
 
-		if (time_passed_from_last_timer_enable < MASTER_POLL_SLAVE_INTERVAL) {
-			master_timer.it_interval.tv_sec = 0;
-			master_timer.it_interval.tv_nsec = 0;
-			master_timer.it_value.tv_sec = 0;
-			master_timer.it_value.tv_nsec = MASTER_POLL_SLAVE_INTERVAL;
-			timerfd_settime(_master_timer_event, 0, &master_timer, NULL);
-			last_timer_enable_at_uS = microseconds();
+		if (time_passed_from_last_timer_enable < rs485->master_poll_interval_duration) {
+			arm_master_poll_interval_timer(rs485, rs485->master_poll_interval_duration);
 
 			return;
 		}
 
+		realtime_jitter_add(&rs485->jitter,
+		                    rs485->last_timer_enable_at + rs485->master_poll_interval_duration / 1000,
+		                    microseconds());
+
 		log_debug("Master poll slave interval timed out... time to poll next slave");
-		master_poll_interval = false;
-		master_poll_slave();
+		rs485->master_poll_interval = false;
+		master_poll_slave(rs485);
 
 		return;
 	}
@@ -767,124 +1011,219 @@ void master_timeout_handler(void* opaque) {
 	// For some unknown reason the timer randomly times out or this timeout function is called
 	// much long before the actual timeout. This is a fix to this problem
 	// until we find the real problem
-	time_passed_from_last_timer_enable = (microseconds() - last_timer_enable_at_uS) * 1000;
+	time_passed_from_last_timer_enable = (microseconds() - rs485->last_timer_enable_at) * 1000;
 
-	if (time_passed_from_last_timer_enable < TIMEOUT) {
-		master_timer.it_interval.tv_sec = 0;
-		master_timer.it_interval.tv_nsec = 0;
-		master_timer.it_value.tv_sec = 0;
-		master_timer.it_value.tv_nsec = TIMEOUT;
-		timerfd_settime(_master_timer_event, 0, &master_timer, NULL);
-		last_timer_enable_at_uS = microseconds();
+	if (time_passed_from_last_timer_enable < rs485->master_response_timeout_duration) {
+		arm_master_response_timer(rs485, rs485->master_response_timeout_duration);
 
 		return;
 	}
 
+	slave = &rs485->slaves[rs485->current_slave];
+
+	log_debug("Request to slave %d timed out after %u usec (%u timeout(s) so far)",
+	          slave->address, slave->timeout, slave->timeouts + 1);
+
+	mutex_lock(&rs485->statistics_mutex);
+
+	++slave->timeouts;
+
+	// Back off, the slave might be slower than estimated
+	slave->timeout = MIN(slave->timeout * 2, rs485->timeout_max);
+
+	mutex_unlock(&rs485->statistics_mutex);
+
 	// Current request timedout. Move on to next slave
-	if (is_current_request_empty()) {
-		++_red_rs485_extension.slaves[master_current_slave_to_process].sequence;
+	if (is_current_request_empty(rs485)) {
+		++rs485->slaves[rs485->current_slave].sequence;
 	}
 
-	pop_packet_from_slave_queue();
+	pop_packet_from_slave_queue(rs485);
 
 	// Poll next slave after the configured timeout
-	arm_master_poll_slave_interval_timer();
+	arm_master_poll_slave_interval_timer(rs485);
 }
 
-void pop_packet_from_slave_queue(void) {
+void pop_packet_from_slave_queue(RS485Extension *rs485) {
 	RS485ExtensionPacket* current_slave_queue_packet;
-	current_slave_queue_packet = queue_peek(&_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue);
 
-	if (current_slave_queue_packet != NULL && --current_slave_queue_packet->tries_left == 0) {
-		queue_pop(&_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue, NULL);
+	mutex_lock(&rs485->queue_mutex);
+
+	current_slave_queue_packet = queue_peek(&rs485->slaves[rs485->current_slave].packet_queue);
+
+	if (current_slave_queue_packet != NULL) {
+		if (--current_slave_queue_packet->tries_left == 0) {
+			queue_pop(&rs485->slaves[rs485->current_slave].packet_queue, NULL);
+		} else {
+			current_slave_queue_packet->retried = true;
+
+			mutex_lock(&rs485->statistics_mutex);
+			++rs485->slaves[rs485->current_slave].retries;
+			mutex_unlock(&rs485->statistics_mutex);
+		}
 	}
+
+	mutex_unlock(&rs485->queue_mutex);
 }
 
-bool is_current_request_empty(void) {
+bool is_current_request_empty(RS485Extension *rs485) {
 	uint32_t uid;
-	memcpy(&uid, &current_request_as_byte_array[3], sizeof(uint32_t));
+	memcpy(&uid, &rs485->current_request[3], sizeof(uint32_t));
 
-	if (uid == 0 && current_request_as_byte_array[7] == 8 &&
-	    current_request_as_byte_array[8] == 0) {
+	if (uid == 0 && rs485->current_request[7] == 8 &&
+	    rs485->current_request[8] == 0) {
 		return true;
 	} else {
 		return false;
 	}
 }
 
-void seq_pop_poll(void) {
-	if (is_current_request_empty()) {
+void seq_pop_poll(RS485Extension *rs485) {
+	if (is_current_request_empty(rs485)) {
 		log_debug("Updating sequence");
 
-		++_red_rs485_extension.slaves[master_current_slave_to_process].sequence;
+		++rs485->slaves[rs485->current_slave].sequence;
 	}
 
-	pop_packet_from_slave_queue();
+	pop_packet_from_slave_queue(rs485);
 
 	// Poll next slave after the configured timeout
-	arm_master_poll_slave_interval_timer();
+	arm_master_poll_slave_interval_timer(rs485);
 }
 
-void arm_master_poll_slave_interval_timer(void) {
+// Returns true if a slave has a queued request that was not tried yet
+static bool master_has_fresh_request(RS485Extension *rs485) {
+	RS485ExtensionPacket *queued_request;
+	bool fresh = false;
+	int i;
+
+	mutex_lock(&rs485->queue_mutex);
+
+	for (i = 0; i < rs485->slave_num; i++) {
+		queued_request = queue_peek(&rs485->slaves[i].packet_queue);
+
+		if (queued_request != NULL && !queued_request->retried) {
+			fresh = true;
+
+			break;
+		}
+	}
+
+	mutex_unlock(&rs485->queue_mutex);
+
+	return fresh;
+}
+
+// Called after each exchange with the current slave. A queued request is
+// served right away. Retries wait for the poll delay, to give a slave that
+// failed to answer some time to recover
+void arm_master_poll_slave_interval_timer(RS485Extension *rs485) {
+	uint32_t interval = __atomic_load_n(&MASTER_POLL_SLAVE_INTERVAL, __ATOMIC_RELAXED);
+	RS485Slave *slave;
+
+	if (rs485->current_slave >= 0) {
+		slave = &rs485->slaves[rs485->current_slave];
+
+		// A slave that just returned data is likely to have more, poll it
+		// again soon. Otherwise back off, up to the configured maximum gap
+		if (rs485->sent_ack_of_data_packet) {
+			slave->poll_gap = interval;
+		} else {
+			// The poll delay might have been raised above the maximum gap
+			// at runtime, never back off below it
+			slave->poll_gap = MIN(slave->poll_gap * 2, MAX(rs485->poll_gap_max, interval));
+		}
+
+		slave->next_poll_at = microseconds() + slave->poll_gap;
+	}
+
+	if (master_has_fresh_request(rs485)) {
+		log_debug("Requests queued, polling next slave right away");
+
+		// A zero duration would disarm the timer
+		arm_master_poll_interval_timer(rs485, 1);
+
+		return;
+	}
+
 	log_debug("Waiting before polling next slave");
-	master_poll_interval = true;
-
-	master_timer.it_interval.tv_sec = 0;
-	master_timer.it_interval.tv_nsec = 0;
-	master_timer.it_value.tv_sec = 0;
-	master_timer.it_value.tv_nsec = MASTER_POLL_SLAVE_INTERVAL;
-	timerfd_settime(_master_timer_event, 0, &master_timer, NULL);
-	last_timer_enable_at_uS = microseconds();
+
+	arm_master_poll_interval_timer(rs485, (uint64_t)interval * 1000);
+}
+
+// Wakes up the RS485 thread if it is waiting for the next slave to be due.
+// Must be called with the queue mutex locked
+static void red_rs485_extension_wakeup(RS485Extension *rs485) {
+	eventfd_t ev = 1;
+
+	if (!rs485->master_idle) {
+		return;
+	}
+
+	rs485->master_idle = false;
+
+	if (eventfd_write(rs485->wakeup_event, ev) < 0) {
+		log_error("Could not write to RS485 wakeup event: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
 }
 
 // New packet from brickd event loop is queued to be sent via RS485 interface
 int red_rs485_extension_dispatch_to_rs485(Stack *stack, Packet *request, Recipient *recipient) {
+	RS485Extension *rs485 = containerof(stack, RS485Extension, base);
 	RS485ExtensionPacket* queued_request;
 	int i;
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 
-	(void)stack;
+	mutex_lock(&rs485->queue_mutex);
 
 	if (request->header.uid == 0 || recipient == NULL) {
 		log_packet_debug("Broadcasting to all available slaves");
 
-		for (i = 0; i < _red_rs485_extension.slave_num; i++) {
-			queued_request = queue_push(&_red_rs485_extension.slaves[i].packet_queue);
+		for (i = 0; i < rs485->slave_num; i++) {
+			queued_request = queue_push(&rs485->slaves[i].packet_queue);
 
 			if (queued_request == NULL) {
 				log_error("Could not push request (%s) to packet queue for slave %d, dropping request: %s (%d)",
 				          packet_get_request_signature(packet_signature, request),
-				          _red_rs485_extension.slaves[i].address,
+				          rs485->slaves[i].address,
 				          get_errno_name(errno), errno);
 
+				mutex_unlock(&rs485->queue_mutex);
+
 				return -1;
 			}
 
 			queued_request->tries_left = RS485_PACKET_TRIES_DATA;
+			queued_request->retried = false;
 			memcpy(&queued_request->packet, request, request->header.length);
 
 			log_packet_debug("Broadcast... Packet is queued to be sent to slave %d. Function signature = (%s)",
-			                 _red_rs485_extension.slaves[i].address,
+			                 rs485->slaves[i].address,
 			                 packet_get_request_signature(packet_signature, request));
 		}
 	} else if (recipient != NULL) {
-		for (i = 0; i < _red_rs485_extension.slave_num; i++) {
-			if (_red_rs485_extension.slaves[i].address == recipient->opaque) {
-				queued_request = queue_push(&_red_rs485_extension.slaves[i].packet_queue);
+		for (i = 0; i < rs485->slave_num; i++) {
+			if (rs485->slaves[i].address == recipient->opaque) {
+				queued_request = queue_push(&rs485->slaves[i].packet_queue);
 
 				if (queued_request == NULL) {
 					log_error("Could not push request (%s) to packet queue for slave %d, dropping request: %s (%d)",
 					          packet_get_request_signature(packet_signature, request),
-					          _red_rs485_extension.slaves[i].address,
+					          rs485->slaves[i].address,
 					          get_errno_name(errno), errno);
 
+					mutex_unlock(&rs485->queue_mutex);
+
 					return -1;
 				}
 
 				queued_request->tries_left = RS485_PACKET_TRIES_DATA;
+				queued_request->retried = false;
 				memcpy(&queued_request->packet, request, request->header.length);
 
 				log_packet_debug("Packet is queued to be sent to slave %d over. Function signature = (%s)",
-				                 _red_rs485_extension.slaves[i].address,
+				                 rs485->slaves[i].address,
 				                 packet_get_request_signature(packet_signature, request));
 
 				break;
@@ -892,21 +1231,155 @@ int red_rs485_extension_dispatch_to_rs485(Stack *stack, Packet *request, Recipie
 		}
 	}
 
+	red_rs485_extension_wakeup(rs485);
+
+	mutex_unlock(&rs485->queue_mutex);
+
 	return 0;
 }
 
+// New responses from the RS485 thread are send into brickd event loop
+static void red_rs485_extension_dispatch_from_rs485(void *opaque) {
+	RS485Extension *rs485 = opaque;
+	eventfd_t ev;
+	RS485ExtensionResponse *response;
+
+	if (eventfd_read(rs485->response_event, &ev) < 0) {
+		log_error("Could not read from RS485 response event: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return;
+	}
+
+	while ((response = spsc_ring_peek(&rs485->response_ring)) != NULL) {
+		network_dispatch_timestamped_response(&response->packet, response->ingress_timestamp);
+		stack_add_recipient(&rs485->base, response->packet.header.uid,
+		                    response->address);
+
+		spsc_ring_pop(&rs485->response_ring);
+	}
+}
+
+// The RS485 thread waits for serial data, for the master timer and for the
+// stop event. It drives the whole master state machine
+static void red_rs485_extension_thread(void *opaque) {
+	RS485Extension *rs485 = opaque;
+	struct pollfd pollfds[4];
+	eventfd_t ev;
+	int ready;
+
+	realtime_setup_thread("rs485");
+
+	pollfds[0].fd = rs485->serial_fd;
+	pollfds[0].events = POLLIN;
+	pollfds[1].fd = rs485->master_timer_event;
+	pollfds[1].events = POLLIN;
+	pollfds[2].fd = rs485->stop_event;
+	pollfds[2].events = POLLIN;
+	pollfds[3].fd = rs485->wakeup_event;
+	pollfds[3].events = POLLIN;
+
+	// Get things going
+	master_poll_slave(rs485);
+
+	for (;;) {
+		ready = poll(pollfds, 4, -1);
+
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			log_error("Could not poll %s thread events: %s (%d)",
+			          rs485->name, get_errno_name(errno), errno);
+
+			break;
+		}
+
+		if ((pollfds[2].revents & POLLIN) != 0) {
+			break;
+		}
+
+		if ((pollfds[0].revents & POLLIN) != 0) {
+			serial_data_available_handler(rs485);
+		}
+
+		if ((pollfds[1].revents & POLLIN) != 0) {
+			master_timeout_handler(rs485);
+		}
+
+		// A request got queued while no slave was due. If the master timer
+		// already fired the master is busy with an exchange again, the
+		// request will be picked up afterwards
+		if ((pollfds[3].revents & POLLIN) != 0) {
+			if (eventfd_read(rs485->wakeup_event, &ev) < 0) {} // ignore return value
+
+			if (rs485->master_idle_wait) {
+				disable_master_timer(rs485);
+				rs485->master_poll_interval = false;
+				master_poll_slave(rs485);
+			}
+		}
+	}
+
+	log_debug("%s thread stopped", rs485->name);
+}
+
 // Init function called from central brickd code
 int red_rs485_extension_init(ExtensionRS485Config *rs485_config) {
+	RS485Extension *rs485 = &_red_rs485_extensions[rs485_config->extension];
+	char option[64];
+	char name[64];
 	int phase = 0;
 	bool cleanup_return_zero = false;
 	int i;
 
-	log_info("Initializing extension subsystem");
+	memset(rs485, 0, sizeof(RS485Extension));
 
-	MASTER_POLL_SLAVE_INTERVAL = (uint64_t)config_get_option_value("poll_delay.rs485")->integer * 1000;
+	rs485->extension = rs485_config->extension;
+	rs485->serial_fd = -1;
+	rs485->current_slave = -1;
+	rs485->stop_event = -1;
+	rs485->wakeup_event = -1;
+	rs485->response_event = -1;
+
+	robust_snprintf(rs485->name, sizeof(rs485->name), "RS485 Extension %d", rs485->extension);
+	robust_snprintf(option, sizeof(option), "rs485.serial_device.%d", rs485->extension);
+
+	rs485->serial_device = config_get_option_value(option)->string;
+
+	robust_snprintf(option, sizeof(option), "rs485.rx_enable_gpio.%d", rs485->extension);
+
+	rs485->rx_enable_gpio = config_get_option_value(option)->boolean;
+
+	log_info("Initializing %s on serial device %s", rs485->name, rs485->serial_device);
+
+	// Each bus needs its own UART. On the RED Brick both extension positions
+	// are wired to the same UART by default
+	for (i = 0; i < EXTENSION_NUM_MAX; i++) {
+		if (_red_rs485_extensions[i].initialized &&
+		    strcmp(_red_rs485_extensions[i].serial_device, rs485->serial_device) == 0) {
+			log_error("Cannot initialize %s, serial device %s is already used by %s",
+			          rs485->name, rs485->serial_device, _red_rs485_extensions[i].name);
+
+			return -1;
+		}
+	}
+
+	__atomic_store_n(&MASTER_POLL_SLAVE_INTERVAL, config_get_option_value("poll_delay.rs485")->integer, __ATOMIC_RELAXED);
+	rs485->poll_gap_max = config_get_option_value("poll_delay.rs485_idle_max")->integer;
+
+	if (rs485->poll_gap_max < MASTER_POLL_SLAVE_INTERVAL) {
+		log_warn("Option poll_delay.rs485_idle_max (%u) is less than poll_delay.rs485 (%u), disabling RS485 idle back off",
+		         rs485->poll_gap_max, MASTER_POLL_SLAVE_INTERVAL);
+
+		rs485->poll_gap_max = MASTER_POLL_SLAVE_INTERVAL;
+	}
 
 	// Create base stack
-	if (stack_create(&_red_rs485_extension.base, "red_rs485_extension",
+	robust_snprintf(name, sizeof(name), "red_rs485_extension_%d", rs485->extension);
+
+	if (stack_create(&rs485->base, name,
 	                 red_rs485_extension_dispatch_to_rs485) < 0) {
 		log_error("Could not create base stack for extension, %s (%d)",
 		          get_errno_name(errno), errno);
@@ -917,29 +1390,42 @@ int red_rs485_extension_init(ExtensionRS485Config *rs485_config) {
 	phase = 1;
 
 	// Add to stacks array
-	if (hardware_add_stack(&_red_rs485_extension.base) < 0) {
+	if (hardware_add_stack(&rs485->base) < 0) {
 		goto cleanup;
 	}
 
 	phase = 2;
 
 	// Saving eeprom config
-	_red_rs485_extension.address = rs485_config->address;
-	_red_rs485_extension.baudrate = rs485_config->baudrate;
+	rs485->address = rs485_config->address;
+	rs485->baudrate = rs485_config->baudrate;
 
-	_red_rs485_extension.parity = rs485_config->parity;
-	_red_rs485_extension.stopbits = rs485_config->stopbits;
+	rs485->parity = rs485_config->parity;
+	rs485->stopbits = rs485_config->stopbits;
 
 	if (rs485_config->address == 0) {
-		_red_rs485_extension.slave_num = rs485_config->slave_num;
+		rs485->slave_num = rs485_config->slave_num;
+
+		mutex_create(&rs485->queue_mutex);
+		mutex_create(&rs485->statistics_mutex);
 
-		for (i = 0; i < _red_rs485_extension.slave_num; i++) {
-			_red_rs485_extension.slaves[i].address = rs485_config->slave_address[i];
-			_red_rs485_extension.slaves[i].sequence = 0;
+		for (i = 0; i < rs485->slave_num; i++) {
+			rs485->slaves[i].address = rs485_config->slave_address[i];
+			rs485->slaves[i].sequence = 0;
+			rs485->slaves[i].next_poll_at = 0;
+			rs485->slaves[i].poll_gap = MASTER_POLL_SLAVE_INTERVAL;
 
-			if (queue_create(&_red_rs485_extension.slaves[i].packet_queue, sizeof(RS485ExtensionPacket)) < 0) {
+			if (queue_create(&rs485->slaves[i].packet_queue, sizeof(RS485ExtensionPacket)) < 0) {
 				log_error("Could not create slave queue, %s (%d)",
 				          get_errno_name(errno), errno);
+
+				while (--i >= 0) {
+					queue_destroy(&rs485->slaves[i].packet_queue, NULL);
+				}
+
+				mutex_destroy(&rs485->statistics_mutex);
+				mutex_destroy(&rs485->queue_mutex);
+
 				goto cleanup;
 			}
 		}
@@ -949,54 +1435,105 @@ int red_rs485_extension_init(ExtensionRS485Config *rs485_config) {
 		goto cleanup;
 	}
 
+	phase = 3;
+
 	// Calculate time to send number of bytes of max packet length and to receive the same amount
-	TIMEOUT = (((double)(TIMEOUT_BYTES /
-	           (double)(_red_rs485_extension.baudrate / 8)) *
+	rs485->timeout = (((double)(TIMEOUT_BYTES /
+	           (double)(rs485->baudrate / 8)) *
 	           (double)1000000000) * (double)2) + (double)8000000;
+	rs485->timeout_min = (rs485->timeout - 8000000) / 1000;
+	rs485->timeout_max = rs485->timeout * RS485_RTT_TIMEOUT_MAX_FACTOR / 1000;
+
+	for (i = 0; i < rs485->slave_num; i++) {
+		rs485->slaves[i].rtt_measured = false;
+		rs485->slaves[i].srtt = 0;
+		rs485->slaves[i].rttvar = 0;
+		rs485->slaves[i].timeout = rs485->timeout / 1000;
+		rs485->slaves[i].timeouts = 0;
+		rs485->slaves[i].retries = 0;
+	}
 
 	// Configuring serial interface from the configs
-	if (serial_interface_init(RS485_EXTENSION_SERIAL_DEVICE) < 0) {
+	if (serial_interface_init(rs485) < 0) {
 		goto cleanup;
 	}
 
-	// Initial RS485 RX state
-	init_rxe_pin_state(rs485_config->extension);
+	// Initial RS485 RX state. The receiver of the RS485 Extension is enabled
+	// by a GPIO, other RS485 transceivers don't need this
+	if (rs485->rx_enable_gpio) {
+		init_rxe_pin_state(rs485);
+	}
 
-	phase = 3;
+	phase = 4;
 
-	// Adding serial data available event
-	if (event_add_source(_red_rs485_serial_fd, EVENT_SOURCE_TYPE_GENERIC,
-	                     EVENT_READ, serial_data_available_handler, NULL) < 0) {
-		log_error("Could not add new serial data event");
+	// Responses are handed over from the RS485 thread to the event thread
+	if (spsc_ring_create(&rs485->response_ring, RS485_EXTENSION_RESPONSE_RING_SIZE,
+	                     sizeof(RS485ExtensionResponse)) < 0) {
+		log_error("Could not create RS485 response ring: %s (%d)",
+		          get_errno_name(errno), errno);
 
 		goto cleanup;
 	}
 
-	phase = 4;
+	phase = 5;
 
-	// Setup master timer
-	_master_timer_event = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if ((rs485->response_event = eventfd(0, 0)) < 0) {
+		log_error("Could not create RS485 response event: %s (%d)",
+		          get_errno_name(errno), errno);
 
-	if (!(_master_timer_event < 0)) {
-		if (event_add_source(_master_timer_event, EVENT_SOURCE_TYPE_GENERIC,
-		                     EVENT_READ, master_timeout_handler, NULL) < 0) {
-			log_error("Could not add RS485 master timer notification pipe as event source");
+		goto cleanup;
+	}
 
-			goto cleanup;
-		}
-	} else {
+	phase = 6;
+
+	if (event_add_source(rs485->response_event, EVENT_SOURCE_TYPE_GENERIC,
+	                     EVENT_READ, red_rs485_extension_dispatch_from_rs485, rs485) < 0) {
+		log_error("Could not add RS485 response event as event source");
+
+		goto cleanup;
+	}
+
+	phase = 7;
+
+	// Setup master timer
+	rs485->master_timer_event = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+
+	if (rs485->master_timer_event < 0) {
 		log_error("Could not create RS485 master timer");
 
 		goto cleanup;
 	}
 
-	phase = 5;
+	phase = 8;
+
+	if ((rs485->stop_event = eventfd(0, EFD_NONBLOCK)) < 0) {
+		log_error("Could not create RS485 stop event: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 9;
+
+	// The wakeup event is used to interrupt the RS485 thread while no slave
+	// is due
+	if ((rs485->wakeup_event = eventfd(0, EFD_NONBLOCK)) < 0) {
+		log_error("Could not create RS485 wakeup event: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 10;
 
 	// Get things going in case of a master with slaves configured
-	if (_red_rs485_extension.slave_num > 0) {
-		_initialized = true;
-		log_info("Initialized as master");
-		master_poll_slave();
+	if (rs485->slave_num > 0) {
+		realtime_jitter_init(&rs485->jitter, rs485->name);
+
+		rs485->initialized = true;
+		log_info("Initialized %s as master", rs485->name);
+
+		thread_create(&rs485->thread, red_rs485_extension_thread, rs485);
 	} else {
 		log_warn("No slaves configured");
 		cleanup_return_zero = true;
@@ -1004,30 +1541,44 @@ int red_rs485_extension_init(ExtensionRS485Config *rs485_config) {
 		goto cleanup;
 	}
 
-	phase = 6;
+	phase = 11;
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
+	case 10:
+		close(rs485->wakeup_event);
+
+	case 9:
+		close(rs485->stop_event);
+
+	case 8:
+		close(rs485->master_timer_event);
+
+	case 7:
+		event_remove_source(rs485->response_event, EVENT_SOURCE_TYPE_GENERIC);
+
+	case 6:
+		close(rs485->response_event);
+
 	case 5:
-		close(_master_timer_event);
-		event_remove_source(_master_timer_event, EVENT_SOURCE_TYPE_GENERIC);
+		spsc_ring_destroy(&rs485->response_ring);
 
 	case 4:
-		close(_red_rs485_serial_fd);
-		event_remove_source(_red_rs485_serial_fd, EVENT_SOURCE_TYPE_GENERIC);
+		close(rs485->serial_fd);
 
 	case 3:
-		if (_red_rs485_extension.address == 0) {
-			for (i = 0; i < _red_rs485_extension.slave_num; i++) {
-				queue_destroy(&_red_rs485_extension.slaves[i].packet_queue, NULL);
-			}
+		for (i = 0; i < rs485->slave_num; i++) {
+			queue_destroy(&rs485->slaves[i].packet_queue, NULL);
 		}
 
+		mutex_destroy(&rs485->statistics_mutex);
+		mutex_destroy(&rs485->queue_mutex);
+
 	case 2:
-		hardware_remove_stack(&_red_rs485_extension.base);
+		hardware_remove_stack(&rs485->base);
 
 	case 1:
-		stack_destroy(&_red_rs485_extension.base);
+		stack_destroy(&rs485->base);
 
 	default:
 		break;
@@ -1037,32 +1588,118 @@ cleanup:
 		return 0;
 	}
 
-	return phase == 6 ? 0 : -1;
+	return phase == 11 ? 0 : -1;
 }
 
 // Exit function called from central brickd code
-void red_rs485_extension_exit(void) {
+void red_rs485_extension_exit(int extension) {
+	RS485Extension *rs485 = &_red_rs485_extensions[extension];
+	eventfd_t ev = 1;
 	int i;
 
-	if (!_initialized) {
+	if (!rs485->initialized) {
 		return;
 	}
 
+	// Stop the RS485 thread before tearing down what it uses
+	if (eventfd_write(rs485->stop_event, ev) < 0) {
+		log_error("Could not write to %s stop event: %s (%d)",
+		          rs485->name, get_errno_name(errno), errno);
+	}
+
+	thread_join(&rs485->thread);
+	thread_destroy(&rs485->thread);
+
+	realtime_jitter_report(&rs485->jitter);
+
+	for (i = 0; i < rs485->slave_num; i++) {
+		log_info("%s slave %d: response timeout %u usec, round trip time %u usec, %u timeout(s), %u retry(s)",
+		         rs485->name, rs485->slaves[i].address, rs485->slaves[i].timeout,
+		         rs485->slaves[i].srtt, rs485->slaves[i].timeouts,
+		         rs485->slaves[i].retries);
+	}
+
 	// Remove event as possible poll source
-	event_remove_source(_red_rs485_serial_fd, EVENT_SOURCE_TYPE_GENERIC);
-	event_remove_source(_master_timer_event, EVENT_SOURCE_TYPE_GENERIC);
+	event_remove_source(rs485->response_event, EVENT_SOURCE_TYPE_GENERIC);
 
 	// We can also free the queue and stack now, nobody will use them anymore
-	hardware_remove_stack(&_red_rs485_extension.base);
-	stack_destroy(&_red_rs485_extension.base);
+	hardware_remove_stack(&rs485->base);
+	stack_destroy(&rs485->base);
 
 	// Close file descriptors
-	close(_red_rs485_serial_fd);
-	close(_master_timer_event);
+	close(rs485->serial_fd);
+	close(rs485->master_timer_event);
+	close(rs485->response_event);
+	close(rs485->stop_event);
+	close(rs485->wakeup_event);
+
+	spsc_ring_destroy(&rs485->response_ring);
+
+	if (rs485->address == 0) {
+		for (i = 0; i < rs485->slave_num; i++) {
+			queue_destroy(&rs485->slaves[i].packet_queue, NULL);
+		}
+
+		mutex_destroy(&rs485->queue_mutex);
+		mutex_destroy(&rs485->statistics_mutex);
+	}
+
+	rs485->initialized = false;
+}
+
+// Copies the response timeout and retry statistics of up to max_count slaves
+// of the RS485 Extension at the given position, returns the number of slaves
+// copied
+int red_rs485_extension_get_slave_statistics(int extension,
+                                             RS485ExtensionSlaveStatistics *statistics,
+                                             int max_count) {
+	RS485Extension *rs485 = &_red_rs485_extensions[extension];
+	RS485Slave *slave;
+	int i;
+
+	if (!rs485->initialized || rs485->address != 0) {
+		return 0;
+	}
+
+	mutex_lock(&rs485->statistics_mutex);
+
+	for (i = 0; i < rs485->slave_num && i < max_count; i++) {
+		slave = &rs485->slaves[i];
+
+		statistics[i].address = slave->address;
+		statistics[i].timeout = slave->timeout;
+		statistics[i].round_trip_time = slave->srtt;
+		statistics[i].timeouts = slave->timeouts;
+		statistics[i].retries = slave->retries;
+	}
+
+	mutex_unlock(&rs485->statistics_mutex);
+
+	return i;
+}
+
+// Returns the delay between polls in microseconds
+int red_rs485_extension_get_poll_delay(void) {
+	return (int)__atomic_load_n(&MASTER_POLL_SLAVE_INTERVAL, __ATOMIC_RELAXED);
+}
+
+// Changes the delay between polls of all RS485 masters. A master that is
+// waiting for the next slave to be due is woken up to pick up the new delay
+void red_rs485_extension_set_poll_delay(int poll_delay) {
+	RS485Extension *rs485;
+	int i;
+
+	__atomic_store_n(&MASTER_POLL_SLAVE_INTERVAL, (uint32_t)poll_delay, __ATOMIC_RELAXED);
 
-	if (_red_rs485_extension.address == 0) {
-		for (i = 0; i < _red_rs485_extension.slave_num; i++) {
-			queue_destroy(&_red_rs485_extension.slaves[i].packet_queue, NULL);
+	for (i = 0; i < EXTENSION_NUM_MAX; i++) {
+		rs485 = &_red_rs485_extensions[i];
+
+		if (!rs485->initialized || rs485->address != 0) {
+			continue;
 		}
+
+		mutex_lock(&rs485->queue_mutex);
+		red_rs485_extension_wakeup(rs485);
+		mutex_unlock(&rs485->queue_mutex);
 	}
 }
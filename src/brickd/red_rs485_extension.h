@@ -24,6 +24,8 @@
 #ifndef BRICKD_RS485_EXTENSION_H
 #define BRICKD_RS485_EXTENSION_H
 
+#include <stdint.h>
+
 #include <daemonlib/io.h>
 
 #include "red_extension.h"
@@ -32,7 +34,22 @@
 #define RS485_EXTENSION_SERIAL_PARITY_EVEN 101
 #define RS485_EXTENSION_SERIAL_PARITY_ODD  111
 
+typedef struct {
+	uint8_t address;
+	uint32_t timeout; // microseconds
+	uint32_t round_trip_time; // smoothed, microseconds
+	uint32_t timeouts;
+	uint32_t retries;
+} RS485ExtensionSlaveStatistics;
+
 int red_rs485_extension_init(ExtensionRS485Config *rs485_config);
-void red_rs485_extension_exit(void);
+void red_rs485_extension_exit(int extension);
+
+int red_rs485_extension_get_slave_statistics(int extension,
+                                             RS485ExtensionSlaveStatistics *statistics,
+                                             int max_count);
+
+int red_rs485_extension_get_poll_delay(void);
+void red_rs485_extension_set_poll_delay(int poll_delay);
 
 #endif // BRICKD_RS485_STACK_H
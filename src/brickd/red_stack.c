@@ -20,7 +20,10 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#define _GNU_SOURCE // for ppoll
+
 #include <errno.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <unistd.h>
@@ -42,85 +45,43 @@
 #include <daemonlib/pipe.h>
 #include <daemonlib/red_gpio.h>
 #include <daemonlib/threads.h>
+#include <daemonlib/utils.h>
 
 #include "red_stack.h"
 
 #include "hardware.h"
 #include "network.h"
+#include "realtime.h"
+#include "red_stack_spi.h"
 #include "red_usb_gadget.h"
+#include "spsc_ring.h"
 #include "stack.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
-// We use the Pearson Hash for fast hashing
-// See: http://en.wikipedia.org/wiki/Pearson_hashing
-// the permutation table is taken from the original paper:
-// "Fast Hashing of Variable-Length Text Strings" by Peter K. Pearson,
-// pp. 677-680, CACM 33(6), June 1990.
-
-#define RED_STACK_SPI_PEARSON_PERMUTATION_SIZE 256
-static const uint8_t _red_stack_spi_pearson_permutation[RED_STACK_SPI_PEARSON_PERMUTATION_SIZE] = {
-    1, 87, 49, 12, 176, 178, 102, 166, 121, 193, 6, 84, 249, 230, 44, 163,
-    14, 197, 213, 181, 161, 85, 218, 80, 64, 239, 24, 226, 236, 142, 38, 200,
-    110, 177, 104, 103, 141, 253, 255, 50, 77, 101, 81, 18, 45, 96, 31, 222,
-    25, 107, 190, 70, 86, 237, 240, 34, 72, 242, 20, 214, 244, 227, 149, 235,
-    97, 234, 57, 22, 60, 250, 82, 175, 208, 5, 127, 199, 111, 62, 135, 248,
-    174, 169, 211, 58, 66, 154, 106, 195, 245, 171, 17, 187, 182, 179, 0, 243,
-    132, 56, 148, 75, 128, 133, 158, 100, 130, 126, 91, 13, 153, 246, 216, 219,
-    119, 68, 223, 78, 83, 88, 201, 99, 122, 11, 92, 32, 136, 114, 52, 10,
-    138, 30, 48, 183, 156, 35, 61, 26, 143, 74, 251, 94, 129, 162, 63, 152,
-    170, 7, 115, 167, 241, 206, 3, 150, 55, 59, 151, 220, 90, 53, 23, 131,
-    125, 173, 15, 238, 79, 95, 89, 16, 105, 137, 225, 224, 217, 160, 37, 123,
-    118, 73, 2, 157, 46, 116, 9, 145, 134, 228, 207, 212, 202, 215, 69, 229,
-    27, 188, 67, 124, 168, 252, 42, 4, 29, 108, 21, 247, 19, 205, 39, 203,
-    233, 40, 186, 147, 198, 192, 155, 33, 164, 191, 98, 204, 165, 180, 117, 76,
-    140, 36, 210, 172, 41, 54, 159, 8, 185, 232, 113, 196, 231, 47, 146, 120,
-    51, 65, 28, 144, 254, 221, 93, 189, 194, 139, 112, 43, 71, 109, 184, 209
-};
-#define PEARSON(cur, next) do { cur = _red_stack_spi_pearson_permutation[cur ^ next]; } while(0)
-
-#define RED_STACK_SPI_PACKET_SIZE       84
-#define RED_STACK_SPI_PACKET_EMPTY_SIZE 4
-#define RED_STACK_SPI_PREAMBLE_VALUE    0xAA
-#define RED_STACK_SPI_PREAMBLE          0
-#define RED_STACK_SPI_LENGTH            1
-#define RED_STACK_SPI_INFO(length)      ((length) -2)
-#define RED_STACK_SPI_CHECKSUM(length)  ((length) -1)
 #define RED_STACK_SPI_MAX_SLAVES        8
-#define RED_STACK_SPI_ROUTING_WAIT      (1000*1000*50) // Give slave 50ms between each routing table setup try
-#define RED_STACK_SPI_ROUTING_TRIES     10             // Try 10 times for each slave to setup routing table
-
-#define RED_STACK_SPI_INFO_SEQUENCE_MASTER_MASK (0x07)
-#define RED_STACK_SPI_INFO_SEQUENCE_SLAVE_MASK  (0x38)
+#define RED_STACK_SPI_DISCOVERY_TIMEOUT 500000         // Give each slave 500ms to answer the stack enumerate request
+#define RED_STACK_SPI_PACKET_FROM_SPI_RING_SIZE 256    // Must be a power of two
+#define RED_STACK_SPI_PACKET_TO_SPI_RING_SIZE   512    // Must be a power of two
+#define RED_STACK_SPI_SLAVE_EVENT_RING_SIZE     16     // Must be a power of two
+#define RED_STACK_SPI_DROP_WARNING_INTERVAL     1000000 // Warn about dropped requests at most once per second
 
 #define RED_STACK_SPI_CONFIG_MODE           SPI_CPOL
 #define RED_STACK_SPI_CONFIG_LSB_FIRST      0
 #define RED_STACK_SPI_CONFIG_BITS_PER_WORD  8
 #define RED_STACK_SPI_CONFIG_MAX_SPEED_HZ   8000000
 
-#define RED_STACK_TRANSCEIVE_DATA_SEND          (1 << 8)   // data has been send
-#define RED_STACK_TRANSCEIVE_DATA_RECEIVED      (1 << 7)   // data has been received
-
-#define RED_STACK_TRANSCEIVE_RESULT_SEND_ERROR  (1 << 0)   // data has not been send because of a problem (malformed packet or similar)
-#define RED_STACK_TRANSCEIVE_RESULT_SEND_NONE   (2 << 0)   // data has not been send because there was no data
-#define RED_STACK_TRANSCEIVE_RESULT_SEND_OK     (3 << 0)   // data has been send
-#define RED_STACK_TRANSCEIVE_RESULT_READ_ERROR  (1 << 3)   // data has not been received because of an problem (wrong checksum or similar)
-#define RED_STACK_TRANSCEIVE_RESULT_READ_NONE   (2 << 3)   // data has not been received because slave had none
-#define RED_STACK_TRANSCEIVE_RESULT_READ_OK     (3 << 3)   // data has been received
-
-#define RED_STACK_TRANSCEIVE_RESULT_MASK_SEND   0x7
-#define RED_STACK_TRANSCEIVE_RESULT_MASK_READ   0x38
-
 #define RED_STACK_RESET_PIN_GPIO_NUM            16           // defined in fex file
 #define RED_STACK_RESET_PIN_GPIO_NAME           "gpio16_pb5" // defined in fex file
 
 static char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 
 static bool _red_stack_spi_thread_running = false;
+static bool _red_stack_spi_thread_stop = false;
 static int _red_stack_spi_fd = -1;
+static REDStackSPITransport _red_stack_spi_transport;
 
 static Thread _red_stack_spi_thread;
-static Semaphore _red_stack_dispatch_packet_from_spi_semaphore;
 
 // We use a proper condition variable with mutex and helper variable (as is suggested by kernel documentation)
 // to synchronize after a reset. If someone else needs this we may want to add
@@ -133,13 +94,47 @@ static int _red_stack_notification_event;
 static int _red_stack_reset_fd;
 static int _red_stack_reset_detected = 0;
 
-// delay between transfers in microseconds. configurable with brickd.conf option poll_delay.spi
+// the SPI thread resets the stack on startup and sets the reset done flag
+// afterwards. then the brickd event thread adds the stack to the hardware
+static uint64_t _red_stack_init_at = 0;
+static int _red_stack_reset_done = 0; // only accessed atomically
+
+// gpio_output_set/clear are read-modify-write operations on the whole PIO
+// port and the stack reset pin shares its port with extension pins. The SPI
+// thread holds this mutex while changing the reset pin, the extension code
+// while probing the EEPROMs and configuring its pins
+static pthread_mutex_t _red_stack_gpio_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool _red_stack_added = false; // only accessed by the brickd event thread
+
+// delay between transfers in microseconds. configurable with brickd.conf option
+// poll_delay.spi and at runtime by the tuning API, only accessed atomically
 static int _red_stack_spi_poll_delay = 50;
 
-typedef enum {
-	RED_STACK_SLAVE_STATUS_ABSENT = 0,
-	RED_STACK_SLAVE_STATUS_AVAILABLE,
-} REDStackSlaveStatus;
+// upper limit for the delay between transfers in microseconds while all slaves
+// are idle. configurable with brickd.conf option poll_delay.spi_idle_max
+static int _red_stack_spi_poll_delay_idle_max = 1000;
+
+// maximum number of consecutive transfers with the same slave while it has
+// data to exchange. configurable with brickd.conf option poll_burst.spi
+static int _red_stack_spi_poll_burst = 8;
+
+// the SPI thread sets the idle flag while it backs off. if it is set the brickd
+// event thread writes to the wakeup event after queuing a request
+static int _red_stack_spi_idle = 0; // only accessed atomically
+static int _red_stack_spi_wakeup_event = -1;
+
+// how late the SPI thread wakes up from the delay between transfers
+static RealtimeJitter _red_stack_spi_jitter;
+
+// slave discovery runs interleaved with the normal data exchange of the slaves
+// that were already found. only accessed by the SPI thread
+static bool _red_stack_spi_discovering = false;
+static uint64_t _red_stack_spi_discovery_started_at = 0;
+static int _red_stack_spi_discovery_uid_count = 0;
+
+// number of slave select lines up to the last slave found, the SPI thread
+// cycles through them. only accessed by the SPI thread
+static uint8_t _red_stack_spi_slave_num = 0;
 
 typedef enum {
 	RED_STACK_PACKET_STATUS_ADDED = 0,
@@ -147,30 +142,55 @@ typedef enum {
 } REDStackPacketStatus;
 
 typedef struct {
-	uint8_t stack_address;
-	uint8_t sequence_number_master;
-	uint8_t sequence_number_slave;
-	REDStackSlaveStatus status;
+	REDStackSPISlave spi;
+	REDStackSPIDiscovery discovery;
 	GPIOPin slave_select_pin;
-	Queue packet_to_spi_queue;
-	Mutex packet_queue_mutex;
-	bool next_packet_empty;
+	// Requests to be send over SPI. Filled by the brickd event thread and
+	// drained by the SPI thread
+	SPSCRing packet_to_spi_ring;
+	// Only accessed by the brickd event thread
+	uint32_t dropped_requests;
+	uint32_t dropped_requests_unwarned; // since the last warning
+	uint64_t drop_warned_at; // microseconds
 } REDStackSlave;
 
 typedef struct {
-	Stack base;
+	Stack base; // its recipients are only accessed by the brickd event thread
 	REDStackSlave slaves[RED_STACK_SPI_MAX_SLAVES];
-	uint8_t slave_num;
+	uint8_t slave_num; // only accessed by the brickd event thread
+
+	// Responses received over SPI. Filled by the SPI thread and drained by
+	// the brickd event thread
+	SPSCRing packet_from_spi_ring;
 
-	Packet packet_from_spi;
+	// Found slaves and resets, so the brickd event thread can update the
+	// routing table. Filled by the SPI thread and drained by the brickd
+	// event thread
+	SPSCRing slave_event_ring;
 } REDStack;
 
+typedef enum {
+	RED_STACK_SLAVE_EVENT_TYPE_FOUND = 0,
+	RED_STACK_SLAVE_EVENT_TYPE_RESET
+} REDStackSlaveEventType;
+
+typedef struct {
+	REDStackSlaveEventType type;
+	uint8_t stack_address; // only for found slaves
+	uint32_t uids[PACKET_MAX_STACK_ENUMERATE_UIDS]; // only for found slaves, 0 terminated if not full
+} REDStackSlaveEvent;
+
 typedef struct {
 	REDStackSlave *slave;
 	Packet packet;
 	REDStackPacketStatus status;
 } REDStackPacket;
 
+typedef struct {
+	Packet packet;
+	uint64_t ingress_timestamp; // 0 if no client wants ingress timestamps
+} REDStackResponse;
+
 static REDStack _red_stack;
 
 static const GPIOPin _red_stack_reset_stack_pin = {GPIO_PORT_B, GPIO_PIN_5};
@@ -195,6 +215,8 @@ static const char *_red_stack_spi_device = "/dev/spidev0.0";
 	clock_nanosleep(CLOCK_MONOTONIC, 0, &t, NULL); \
 } while(0)
 
+#define SLEEP_US(us) SLEEP_NS((us) / 1000000, ((us) % 1000000) * 1000)
+
 #define PRINT_TIME(str) do { \
 	struct timespec t; \
 	clock_gettime(CLOCK_MONOTONIC, &t); \
@@ -202,29 +224,10 @@ static const char *_red_stack_spi_device = "/dev/spidev0.0";
 } while(0)
 
 
-// * Packet structure:
-//  * Byte 0: Preamble = 0xAA
-//  * Byte 1: Length = n+2
-//  * Byte 2 to n: Payload
-//  * Byte n+1: Info (slave sequence, master sequence)
-//   * Bit 0-2: Master sequence number (MSN)
-//   * Bit 3-5: Slave sequence number (SSN)
-//   * Bit 6-7: Currently unused
-//  * Byte n+2: Checksum over bytes 0 to n+1
-
-
 // ----- RED STACK SPI ------
 // These functions run in SPI thread
 
 
-static void red_stack_increase_master_sequence_number(REDStackSlave *slave) {
-	slave->sequence_number_master += 1;
-
-	if (slave->sequence_number_master > RED_STACK_SPI_INFO_SEQUENCE_MASTER_MASK) {
-		slave->sequence_number_master = 0;
-	}
-}
-
 // Get "red_stack_dispatch_from_spi" called from main brickd event thread
 static int red_stack_spi_request_dispatch_response_event(void) {
 	eventfd_t ev = 1;
@@ -239,16 +242,25 @@ static int red_stack_spi_request_dispatch_response_event(void) {
 	return 0;
 }
 
-// Calculates a Pearson Hash for the given data
-static uint8_t red_stack_spi_calculate_pearson_hash(const uint8_t *data, const uint8_t length) {
-	uint8_t i;
-	uint8_t checksum = 0;
+// Hands a slave event over to the brickd event thread. Waits if the ring is
+// full, the event thread has to see every event
+static REDStackSlaveEvent *red_stack_spi_reserve_slave_event(void) {
+	REDStackSlaveEvent *event;
 
-	for (i = 0; i < length; i++) {
-		checksum = _red_stack_spi_pearson_permutation[checksum ^ data[i]];
+	while ((event = spsc_ring_reserve(&_red_stack.slave_event_ring)) == NULL) {
+		if (_red_stack_spi_thread_stop) {
+			return NULL;
+		}
+
+		SLEEP_US(__atomic_load_n(&_red_stack_spi_poll_delay, __ATOMIC_RELAXED));
 	}
 
-	return checksum;
+	return event;
+}
+
+static void red_stack_spi_commit_slave_event(void) {
+	spsc_ring_commit(&_red_stack.slave_event_ring);
+	red_stack_spi_request_dispatch_response_event();
 }
 
 static void red_stack_spi_select(REDStackSlave *slave) {
@@ -259,295 +271,180 @@ static void red_stack_spi_deselect(REDStackSlave *slave) {
 	gpio_output_set(slave->slave_select_pin);
 }
 
-
-// If data should just be polled, set packet_send to NULL.
-//
-// If no packet is received from slave the length in packet_recv will be set to 0,
-// the exact reason for that is encoded in the return value.
-//
-// For the return value see RED_STACK_TRANSCEIVE_RESULT_* at the top of this file.
-static int red_stack_spi_transceive_message(REDStackPacket *packet_send, Packet *packet_recv, REDStackSlave *slave) {
-	int retval = 0;
-	uint8_t length, length_send;
-	uint8_t checksum;
+// Transfers a frame over spidev, framed by the slave select GPIO
+static int red_stack_spi_transfer(void *opaque, uint8_t stack_address,
+                                  const uint8_t *tx, uint8_t *rx, int length) {
+	REDStackSlave *slave = &_red_stack.slaves[stack_address];
 	int rc;
-	uint8_t sequence_number_master = 0xFF;
-	uint8_t sequence_number_slave = 0xFF;
-
-	uint8_t tx[RED_STACK_SPI_PACKET_SIZE] = {0};
-	uint8_t rx[RED_STACK_SPI_PACKET_SIZE] = {0};
-
-	// We assume that we don't receive anything. If we receive a packet the
-	// length will be overwritten again
-	packet_recv->header.length = 0;
-
-	// Preamble is always the same
-	tx[RED_STACK_SPI_PREAMBLE] = RED_STACK_SPI_PREAMBLE_VALUE;
-
-	if (packet_send == NULL) {
-		// If packet_send is NULL
-		// we send a message with empty payload (4 byte)
-		tx[RED_STACK_SPI_LENGTH] = RED_STACK_SPI_PACKET_EMPTY_SIZE;
-		retval = RED_STACK_TRANSCEIVE_RESULT_SEND_NONE;
-	} else if (slave->status == RED_STACK_SLAVE_STATUS_AVAILABLE) {
-		length = packet_send->packet.header.length;
-
-		if (length > sizeof(Packet)) {
-			retval |= RED_STACK_TRANSCEIVE_RESULT_SEND_ERROR;
-			log_error("Send length is greater then allowed (actual: %d > maximum: %d)",
-			          length, (int)sizeof(Packet));
-			goto ret;
-		}
-
-		retval = RED_STACK_TRANSCEIVE_DATA_SEND;
-
-		tx[RED_STACK_SPI_LENGTH] = length + RED_STACK_SPI_PACKET_EMPTY_SIZE;
-		memcpy(tx+2, &packet_send->packet, length);
-	} else {
-		retval = RED_STACK_TRANSCEIVE_RESULT_SEND_ERROR;
-		log_error("Slave with stack address %d is not present in stack", slave->stack_address);
-		goto ret;
-	}
 
-	length = tx[RED_STACK_SPI_LENGTH];
-
-	// Set master and slave sequence number
-	tx[RED_STACK_SPI_INFO(length)] = slave->sequence_number_master | slave->sequence_number_slave;
-
-	// Calculate checksum
-	tx[RED_STACK_SPI_CHECKSUM(length)] = red_stack_spi_calculate_pearson_hash(tx, length-1);
+	(void)opaque;
 
 	struct spi_ioc_transfer spi_transfer = {
-		.tx_buf = (unsigned long)&tx,
-		.rx_buf = (unsigned long)&rx,
-		.len = RED_STACK_SPI_PACKET_SIZE,
+		.tx_buf = (unsigned long)tx,
+		.rx_buf = (unsigned long)rx,
+		.len = length,
 	};
 
 	red_stack_spi_select(slave);
 	rc = ioctl(_red_stack_spi_fd, SPI_IOC_MESSAGE(1), &spi_transfer);
 	red_stack_spi_deselect(slave);
 
-	if (rc < 0) {
-		// Overwrite current return status with error,
-		// it seems ioctl itself didn't work.
-		retval = RED_STACK_TRANSCEIVE_RESULT_SEND_ERROR | RED_STACK_TRANSCEIVE_RESULT_READ_ERROR;
-		if(packet_send == NULL) {
-			slave->next_packet_empty = true;
-		}
-		log_error("ioctl failed: %s (%d)", get_errno_name(errno), errno);
-		goto ret;
-	}
-
-	length_send = rc;
+	return rc;
+}
 
-	if (length_send != RED_STACK_SPI_PACKET_SIZE) {
-		// Overwrite current return status with error,
-		// it seems ioctl itself didn't work.
-		retval = RED_STACK_TRANSCEIVE_RESULT_SEND_ERROR | RED_STACK_TRANSCEIVE_RESULT_READ_ERROR;
-		if(packet_send == NULL) {
-			slave->next_packet_empty = true;
-		}
-		log_error("ioctl has unexpected result (actual: %d != expected: %d)",
-		          length_send, RED_STACK_SPI_PACKET_SIZE);
-		goto ret;
-	}
+// Starts to build the "routing table", which is just the array of
+// REDStackSlave structures. Stack enumerate requests are send to all slave
+// select lines interleaved, so a slave that is slow to answer or absent
+// doesn't hold back the discovery of the other slaves.
+static void red_stack_spi_start_discovery(void) {
+	uint64_t now = microseconds();
+	int i;
 
-	if (rx[RED_STACK_SPI_PREAMBLE] != RED_STACK_SPI_PREAMBLE_VALUE) {
-		// Do not log by default, an "unproper preamble" is part of the protocol
-		// if the slave is too busy to fill the DMA buffers fast enough
-		// log_error("Received packet without proper preamble (actual: %d != expected: %d)",
-		//          rx[RED_STACK_SPI_PREAMBLE], RED_STACK_SPI_PREAMBLE_VALUE);
-		retval = (retval & (~RED_STACK_TRANSCEIVE_RESULT_MASK_READ)) | RED_STACK_TRANSCEIVE_RESULT_READ_ERROR;
-		if(packet_send == NULL) {
-			slave->next_packet_empty = true;
-		}
-		goto ret;
-	}
+	log_debug("Starting to discover SPI stack slaves");
 
-	// Check length
-	length = rx[RED_STACK_SPI_LENGTH];
+	_red_stack_spi_slave_num = 0;
+	_red_stack_spi_discovering = true;
+	_red_stack_spi_discovery_started_at = now;
+	_red_stack_spi_discovery_uid_count = 0;
 
-	if ((length != RED_STACK_SPI_PACKET_EMPTY_SIZE) &&
-	    ((length < (RED_STACK_SPI_PACKET_EMPTY_SIZE + sizeof(PacketHeader))) ||
-	     (length > RED_STACK_SPI_PACKET_SIZE))) {
-		log_error("Received packet with malformed length: %d", length);
-		retval = (retval & (~RED_STACK_TRANSCEIVE_RESULT_MASK_READ)) | RED_STACK_TRANSCEIVE_RESULT_READ_ERROR;
-		if(packet_send == NULL) {
-			slave->next_packet_empty = true;
-		}
-		goto ret;
+	for (i = 0; i < RED_STACK_SPI_MAX_SLAVES; i++) {
+		red_stack_spi_discovery_start(&_red_stack.slaves[i].discovery,
+		                              &_red_stack.slaves[i].spi, now,
+		                              RED_STACK_SPI_DISCOVERY_TIMEOUT);
 	}
+}
 
-	// Calculate and check checksum
-	checksum = red_stack_spi_calculate_pearson_hash(rx, length-1);
+// Makes a slave usable right after it answered the stack enumerate request,
+// the other slaves might still be in discovery. The SPI thread polls the slave
+// from now on, the brickd event thread adds its UIDs to the routing table
+static void red_stack_spi_add_slave(REDStackSlave *slave, StackEnumerateResponse *response) {
+	REDStackSlaveEvent *event;
+	uint8_t stack_address = slave->spi.stack_address;
+	int i;
 
-	if (checksum != rx[RED_STACK_SPI_CHECKSUM(length)]) {
-		log_error("Received packet with wrong checksum (actual: %x != expected: %x)",
-		          checksum, rx[RED_STACK_SPI_CHECKSUM(length)]);
-		retval = (retval & (~RED_STACK_TRANSCEIVE_RESULT_MASK_READ)) | RED_STACK_TRANSCEIVE_RESULT_READ_ERROR;
-		if(packet_send == NULL) {
-			slave->next_packet_empty = true;
-		}
-		goto ret;
+	for (i = 0; i < PACKET_MAX_STACK_ENUMERATE_UIDS && response->uids[i] != 0; i++) {
+		_red_stack_spi_discovery_uid_count++;
 	}
 
-	// If we send data and the master sequence number matches to the one
-	// set in the packet we know that the slave received the packet!
-	if ((packet_send != NULL) /*&& (packet_send->status == RED_STACK_PACKET_STATUS_SEQUENCE_NUMBER_SET)*/) {
-		sequence_number_master = rx[RED_STACK_SPI_INFO(length)] & RED_STACK_SPI_INFO_SEQUENCE_MASTER_MASK;
-
-		if (sequence_number_master == slave->sequence_number_master) {
-			retval = (retval & (~RED_STACK_TRANSCEIVE_RESULT_MASK_SEND)) | RED_STACK_TRANSCEIVE_RESULT_SEND_OK;
-
-			// Increase sequence number for next packet
-			red_stack_increase_master_sequence_number(slave);
-		}
-	} else {
-		// If we didn't send anything we can always increase the sequence number,
-		// it doesn't matter if the slave actually received it.
-		red_stack_increase_master_sequence_number(slave);
+	if (stack_address >= _red_stack_spi_slave_num) {
+		_red_stack_spi_slave_num = stack_address + 1;
 	}
 
-	// If the slave sequence number matches we already processed this packet
-	sequence_number_slave = rx[RED_STACK_SPI_INFO(length)] & RED_STACK_SPI_INFO_SEQUENCE_SLAVE_MASK;
+	event = red_stack_spi_reserve_slave_event();
 
-	if (sequence_number_slave == slave->sequence_number_slave) {
-		retval = (retval & (~RED_STACK_TRANSCEIVE_RESULT_MASK_READ)) | RED_STACK_TRANSCEIVE_RESULT_READ_NONE;
-	} else {
-		// Otherwise we save the new sequence number
-		slave->sequence_number_slave = sequence_number_slave;
+	if (event != NULL) {
+		event->type = RED_STACK_SLAVE_EVENT_TYPE_FOUND;
+		event->stack_address = stack_address;
+		memcpy(event->uids, response->uids, sizeof(event->uids));
 
-		if (length == RED_STACK_SPI_PACKET_EMPTY_SIZE) {
-			// Do not log by default, will produce 2000 log entries per second
-			// log_packet_debug("Received empty packet over SPI (w/ header)");
-			retval = (retval & (~RED_STACK_TRANSCEIVE_RESULT_MASK_READ)) | RED_STACK_TRANSCEIVE_RESULT_READ_NONE;
-		} else {
-			// Everything seems OK, we can copy to buffer
-			memcpy(packet_recv, rx+2, length - RED_STACK_SPI_PACKET_EMPTY_SIZE);
-			log_packet_debug("Received packet over SPI (%s)",
-			                 packet_get_response_signature(packet_signature, packet_recv));
-			retval = (retval & (~RED_STACK_TRANSCEIVE_RESULT_MASK_READ)) | RED_STACK_TRANSCEIVE_RESULT_READ_OK;
-			retval |= RED_STACK_TRANSCEIVE_DATA_RECEIVED;
-		}
+		red_stack_spi_commit_slave_event();
 	}
 
-ret:
-	return retval;
+	log_debug("Found slave %d after %d ms", stack_address,
+	          (int)((microseconds() - _red_stack_spi_discovery_started_at) / 1000));
 }
 
-// Creates the "routing table", which is just the
-// array of REDStackSlave structures.
-static void red_stack_spi_create_routing_table(void) {
-	char base58[BASE58_MAX_LENGTH];
-	int tries, ret, i;
-	uint8_t stack_address = 0;
-	uint8_t uid_counter = 0;
-
-	log_debug("Starting to discover SPI stack slaves");
-
-	while (stack_address < RED_STACK_SPI_MAX_SLAVES) {
-		REDStackSlave *slave = &_red_stack.slaves[stack_address];
+// Polls all slaves that are still in discovery and are due. Returns the time
+// in microseconds until the next poll is due
+static int red_stack_spi_discover(void) {
+	StackEnumerateResponse response;
+	REDStackSlave *slave;
+	REDStackSPIDiscoveryStatus status;
+	uint64_t next_poll_at = UINT64_MAX;
+	uint64_t now;
+	int slave_count = 0;
+	int i;
 
-		Packet packet;
-		StackEnumerateResponse *response;
+	for (i = 0; i < RED_STACK_SPI_MAX_SLAVES; i++) {
+		slave = &_red_stack.slaves[i];
+		status = slave->discovery.status;
+
+		if (status == RED_STACK_SPI_DISCOVERY_STATUS_SEND ||
+		    status == RED_STACK_SPI_DISCOVERY_STATUS_RECEIVE) {
+			status = red_stack_spi_discovery_poll(&_red_stack_spi_transport,
+			                                      &slave->discovery, &slave->spi,
+			                                      &response, microseconds());
+
+			if (status == RED_STACK_SPI_DISCOVERY_STATUS_DONE) {
+				red_stack_spi_add_slave(slave, &response);
+			} else if (status != RED_STACK_SPI_DISCOVERY_STATUS_FAILED) {
+				next_poll_at = MIN(next_poll_at, slave->discovery.next_poll_at);
+			}
+		}
 
-		REDStackPacket red_stack_packet = {
-			slave,
-			{{
-				0,   // UID 0
-				sizeof(StackEnumerateRequest),
-				FUNCTION_STACK_ENUMERATE,
-				0x08, // Return expected
-				0
-			}, {0}, {0}},
-			RED_STACK_PACKET_STATUS_ADDED,
-		};
+		if (status == RED_STACK_SPI_DISCOVERY_STATUS_DONE) {
+			slave_count++;
+		}
+	}
 
-		// We have to assume that the slave is available
-		slave->status = RED_STACK_SLAVE_STATUS_AVAILABLE;
+	now = microseconds();
 
-		// Send stack enumerate request
-		for (tries = 0; tries < RED_STACK_SPI_ROUTING_TRIES; tries++) {
-			ret = red_stack_spi_transceive_message(&red_stack_packet, &packet, slave);
+	if (next_poll_at != UINT64_MAX) {
+		return next_poll_at > now ? (int)(next_poll_at - now) : 0;
+	}
 
-			if ((ret & RED_STACK_TRANSCEIVE_RESULT_MASK_SEND) == RED_STACK_TRANSCEIVE_RESULT_SEND_OK) {
-				break;
-			}
+	// All slaves either answered or timed out
+	_red_stack_spi_discovering = false;
 
-			SLEEP_NS(0, RED_STACK_SPI_ROUTING_WAIT); // Give slave some more time
-		}
+	if (slave_count != _red_stack_spi_slave_num) {
+		log_warn("SPI stack has gaps, only %d of the first %d slave(s) answered",
+		         slave_count, _red_stack_spi_slave_num);
+	}
 
-		if (tries == RED_STACK_SPI_ROUTING_TRIES) {
-			// Slave does not seem to be available,
-			slave->status = RED_STACK_SLAVE_STATUS_ABSENT;
-			// This means that there can't be any more slaves above
-			// and we are actually done here already!
-			break;
-		}
+	log_info("SPI stack slave discovery done. Found %d slave(s) with %d UID(s) in total in %d ms",
+	         slave_count, _red_stack_spi_discovery_uid_count,
+	         (int)((now - _red_stack_spi_discovery_started_at) / 1000));
 
-		// Receive stack enumerate response
-		for (tries = 0; tries < RED_STACK_SPI_ROUTING_TRIES; tries++) {
-			// We first check if we already received an answer before we try again
-			if ((ret & RED_STACK_TRANSCEIVE_RESULT_MASK_READ) == RED_STACK_TRANSCEIVE_RESULT_READ_OK) {
-				break;
-			}
+	return 0;
+}
 
-			// Here we sleep before transceive so that there is some time
-			// between the sending of stack enumerate and the receiving
-			// of the answer
-			SLEEP_NS(0, RED_STACK_SPI_ROUTING_WAIT); // Give slave some more time
+// Resets stack
+static void red_stack_reset(void) {
+	red_stack_lock_gpio();
 
-			ret = red_stack_spi_transceive_message(NULL, &packet, slave);
-		}
+	// Change mux of reset pin to output
+	gpio_mux_configure(_red_stack_reset_stack_pin, GPIO_MUX_OUTPUT);
 
-		if (tries == RED_STACK_SPI_ROUTING_TRIES) {
-			// Slave does not seem to be available,
-			slave->status = RED_STACK_SLAVE_STATUS_ABSENT;
-			// This means that there can't be any more slaves above
-			// and we are actually done here already!
-			break;
-		}
+	gpio_output_clear(_red_stack_reset_stack_pin);
+	SLEEP_NS(0, 1000*1000*100); // Clear reset pin for 100ms to force reset
+	gpio_output_set(_red_stack_reset_stack_pin);
 
-		response = (StackEnumerateResponse *)&packet;
+	red_stack_unlock_gpio();
 
-		for (i = 0; i < PACKET_MAX_STACK_ENUMERATE_UIDS; i++) {
-			if (response->uids[i] != 0) {
-				uid_counter++;
-				stack_add_recipient(&_red_stack.base, response->uids[i], stack_address);
-				log_debug("Found UID number %d of slave %d with UID %s",
-				          i, stack_address,
-				          base58_encode(base58, uint32_from_le(response->uids[i])));
-			} else {
-				break;
-			}
-		}
+	SLEEP_NS(1, 1000*1000*500); // Wait 1.5s so slaves can start properly
 
-		stack_address++;
-	}
+	red_stack_lock_gpio();
 
-	_red_stack.slave_num = stack_address;
+	// Change mux back to interrupt, so we can see if a human presses reset
+	gpio_mux_configure(_red_stack_reset_stack_pin, GPIO_MUX_6);
 
-	log_info("SPI stack slave discovery done. Found %d slave(s) with %d UID(s) in total",
-	         stack_address, uid_counter);
+	red_stack_unlock_gpio();
 }
 
-static void red_stack_spi_insert_position(REDStackSlave *slave) {
-	if (_red_stack.packet_from_spi.header.function_id == CALLBACK_ENUMERATE ||
-	    _red_stack.packet_from_spi.header.function_id == FUNCTION_GET_IDENTITY) {
-		EnumerateCallback *enum_cb = (EnumerateCallback *)&_red_stack.packet_from_spi;
+static void red_stack_spi_insert_position(Packet *packet, REDStackSlave *slave) {
+	if (packet->header.function_id == CALLBACK_ENUMERATE ||
+	    packet->header.function_id == FUNCTION_GET_IDENTITY) {
+		EnumerateCallback *enum_cb = (EnumerateCallback *)packet;
 
 		if (enum_cb->position == '0') {
-			enum_cb->position = '0' + slave->stack_address + 1;
+			enum_cb->position = '0' + slave->spi.stack_address + 1;
 			base58_encode(enum_cb->connected_uid, uint32_from_le(red_usb_gadget_get_uid()));
 		}
 	}
 }
 
 static void red_stack_spi_handle_reset(void) {
+	REDStackSlaveEvent *event;
 	int slave;
 
-	stack_announce_disconnect(&_red_stack.base);
-	_red_stack.base.recipients.count = 0;
+	// Get the routing table cleared by the brickd event thread
+	event = red_stack_spi_reserve_slave_event();
+
+	if (event != NULL) {
+		event->type = RED_STACK_SLAVE_EVENT_TYPE_RESET;
+
+		red_stack_spi_commit_slave_event();
+	}
 
 	log_info("Starting reinitialization of SPI slaves");
 
@@ -560,72 +457,166 @@ static void red_stack_spi_handle_reset(void) {
 	SLEEP_NS(1, 1000*1000*500); // Wait 1.5s so slaves can start properly
 
 	// Reinitialize slaves
-	_red_stack.slave_num = 0;
+	_red_stack_spi_slave_num = 0;
 
 	for (slave = 0; slave < RED_STACK_SPI_MAX_SLAVES; slave++) {
-		_red_stack.slaves[slave].stack_address = slave;
-		_red_stack.slaves[slave].status = RED_STACK_SLAVE_STATUS_ABSENT;
-		_red_stack.slaves[slave].sequence_number_master = 1;
-		_red_stack.slaves[slave].sequence_number_slave = 0;
-		_red_stack.slaves[slave].next_packet_empty = false;
+		red_stack_spi_slave_init(&_red_stack.slaves[slave].spi, slave);
 
 		// Unfortunately we have to discard all of the queued packets.
 		// we can't be sure that the packets are for the correct slave after a reset.
-		while (queue_peek(&_red_stack.slaves[slave].packet_to_spi_queue) != NULL) {
-			queue_pop(&_red_stack.slaves[slave].packet_to_spi_queue, NULL);
+		while (spsc_ring_peek(&_red_stack.slaves[slave].packet_to_spi_ring) != NULL) {
+			spsc_ring_pop(&_red_stack.slaves[slave].packet_to_spi_ring);
 		}
 	}
 }
 
+// Sleeps for the given delay in microseconds. If the delay is longer than the
+// configured poll delay the SPI thread is backing off and the sleep is cut
+// short as soon as the brickd event thread queues a request. Returns true if
+// the sleep was cut short
+static bool red_stack_spi_sleep(int delay) {
+	struct pollfd pollfd;
+	struct timespec timeout;
+	eventfd_t ev;
+	bool woken_up = false;
+	uint64_t start;
+	int i;
+
+	if (delay <= __atomic_load_n(&_red_stack_spi_poll_delay, __ATOMIC_RELAXED)) {
+		start = microseconds();
+
+		SLEEP_US(delay);
+
+		realtime_jitter_add(&_red_stack_spi_jitter, start + delay, microseconds());
+
+		return false;
+	}
+
+	__atomic_store_n(&_red_stack_spi_idle, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	// A request that was queued before the idle flag got visible to the
+	// brickd event thread didn't trigger the wakeup event, check for it here
+	for (i = 0; i < _red_stack_spi_slave_num; i++) {
+		if (spsc_ring_count(&_red_stack.slaves[i].packet_to_spi_ring) > 0) {
+			woken_up = true;
+
+			break;
+		}
+	}
+
+	if (!woken_up) {
+		pollfd.fd = _red_stack_spi_wakeup_event;
+		pollfd.events = POLLIN;
+		pollfd.revents = 0;
+
+		timeout.tv_sec = delay / 1000000;
+		timeout.tv_nsec = (delay % 1000000) * 1000;
+
+		if (ppoll(&pollfd, 1, &timeout, NULL) > 0) {
+			if (eventfd_read(_red_stack_spi_wakeup_event, &ev) < 0) {} // ignore return value
+
+			woken_up = true;
+		}
+	}
+
+	__atomic_store_n(&_red_stack_spi_idle, 0, __ATOMIC_RELAXED);
+
+	return woken_up;
+}
+
 // Main SPI loop. This runs independently from the brickd event thread.
-// Data between RED Brick and SPI slave is exchanged every 500us.
-// If there is no data to be send, we cycle through the slaves and request
-// data. If there is data to be send the slave that ought to receive
-// the data gets priority. This can greatly reduce latency in a big stack.
+// Data between RED Brick and SPI slave is exchanged every poll_delay.spi
+// microseconds. We cycle through the slaves and request data. A slave that
+// had data to exchange is polled again right away, up to poll_burst.spi
+// times in a row, because a slave that just returned data is likely to have
+// more. This can greatly reduce latency for a busy slave in a big stack.
+// If no slave had data to exchange for a whole cycle the delay is doubled,
+// up to poll_delay.spi_idle_max, to reduce the CPU load of an idle stack.
+// While slave discovery is still in progress, slaves that were already found
+// take part in the data exchange.
 static void red_stack_spi_thread(void *opaque) {
 	REDStackPacket *packet_to_spi = NULL;
+	REDStackResponse *packet_from_spi;
 	uint8_t stack_address_cycle;
 	int ret;
+	int poll_delay;
+	int discovery_delay;
+	int burst_count;
+	bool active;
+	bool cycle_active;
 
 	(void)opaque;
 
-	do {
-		stack_address_cycle = 0;
-		_red_stack_reset_detected = 0;
-		_red_stack.slave_num = 0;
-		red_stack_spi_create_routing_table();
+	realtime_setup_thread("spi");
+
+	// Reset slaves and wait for slaves to be ready. This takes more than a
+	// second, so it's done here instead of in red_stack_init to not block the
+	// brickd startup
+	red_stack_reset();
 
-		_red_stack_spi_thread_running = false;
+	log_info("RED Brick SPI stack reset done after %u msec",
+	         (uint32_t)((microseconds() - _red_stack_init_at) / 1000));
 
-		if (_red_stack.slave_num > 0) {
-			_red_stack_spi_thread_running = true;
-		}
+	// Get the stack added to the hardware by the brickd event thread
+	__atomic_store_n(&_red_stack_reset_done, 1, __ATOMIC_RELEASE);
+	red_stack_spi_request_dispatch_response_event();
 
-		// Ignore resets that we received in the meantime to prevent race conditions.
+	while (!_red_stack_spi_thread_stop) {
+		stack_address_cycle = 0;
+		poll_delay = __atomic_load_n(&_red_stack_spi_poll_delay, __ATOMIC_RELAXED);
+		burst_count = 0;
+		cycle_active = false;
 		_red_stack_reset_detected = 0;
+		red_stack_spi_start_discovery();
+
+		_red_stack_spi_thread_running = true;
 
-		while (_red_stack_spi_thread_running) {
-			REDStackSlave *slave = &_red_stack.slaves[stack_address_cycle];
+		while (_red_stack_spi_thread_running && !_red_stack_spi_thread_stop) {
+			REDStackSlave *slave;
 			REDStackPacket *request = NULL;
-			memset(&_red_stack.packet_from_spi, 0, sizeof(Packet));
-
-			// Get packet from queue. The queue contains that are to be
-			// send over SPI. It is filled through from the main brickd
-			// event thread, so we have to make sure that there is not race
-			// condition.
-			if(slave->next_packet_empty) {
-				slave->next_packet_empty = false;
-				packet_to_spi = NULL;
-			} else {
-				mutex_lock(&(slave->packet_queue_mutex));
-				packet_to_spi = queue_peek(&slave->packet_to_spi_queue);
-				mutex_unlock(&(slave->packet_queue_mutex));
+
+			if (_red_stack_spi_discovering) {
+				discovery_delay = red_stack_spi_discover();
+
+				if (_red_stack_spi_slave_num == 0) {
+					if (!_red_stack_spi_discovering) {
+						break; // No slave found, wait for reset
+					}
+
+					SLEEP_US(discovery_delay);
+					continue;
+				}
 			}
 
-			stack_address_cycle++;
+			slave = &_red_stack.slaves[stack_address_cycle];
 
-			if (stack_address_cycle >= _red_stack.slave_num) {
-				stack_address_cycle = 0;
+			// Skip slaves that are still in discovery or absent
+			if (slave->discovery.status != RED_STACK_SPI_DISCOVERY_STATUS_DONE) {
+				stack_address_cycle = (stack_address_cycle + 1) % _red_stack_spi_slave_num;
+				continue;
+			}
+
+			// Get free slot for the next received packet. If the brickd event
+			// thread did not keep up and the ring is full we don't poll the
+			// slaves, otherwise a received packet would have to be dropped.
+			packet_from_spi = spsc_ring_reserve(&_red_stack.packet_from_spi_ring);
+
+			if (packet_from_spi == NULL) {
+				SLEEP_US(__atomic_load_n(&_red_stack_spi_poll_delay, __ATOMIC_RELAXED));
+				continue;
+			}
+
+			memset(&packet_from_spi->packet, 0, sizeof(Packet));
+
+			// Get packet from ring. The ring contains packets that are to be
+			// send over SPI. It is filled from the main brickd event thread.
+			// The SPI thread is the only consumer, so no locking is necessary.
+			if(slave->spi.next_packet_empty) {
+				slave->spi.next_packet_empty = false;
+				packet_to_spi = NULL;
+			} else {
+				packet_to_spi = spsc_ring_peek(&slave->packet_to_spi_ring);
 			}
 
 			// Set request if we have a packet to send
@@ -636,74 +627,112 @@ static void red_stack_spi_thread(void *opaque) {
 				request = packet_to_spi;
 			}
 
-			ret = red_stack_spi_transceive_message(request, &_red_stack.packet_from_spi, slave);
+			ret = red_stack_spi_transceive_message(&_red_stack_spi_transport, &slave->spi,
+			                                       request != NULL ? &request->packet : NULL,
+			                                       &packet_from_spi->packet);
+
+			// Take the timestamp right after the transfer, if a client wants it
+			packet_from_spi->ingress_timestamp = 0;
+
+			if ((ret & RED_STACK_TRANSCEIVE_RESULT_MASK_READ) == RED_STACK_TRANSCEIVE_RESULT_READ_OK &&
+			    network_wants_ingress_timestamps()) {
+				packet_from_spi->ingress_timestamp = network_get_ingress_timestamp();
+			}
 
 			if ((ret & RED_STACK_TRANSCEIVE_RESULT_MASK_SEND) == RED_STACK_TRANSCEIVE_RESULT_SEND_OK) {
 				if ((!((ret & RED_STACK_TRANSCEIVE_RESULT_MASK_READ) == RED_STACK_TRANSCEIVE_RESULT_READ_ERROR))) {
-					// If we send a packet it must have come from the queue, so we can
-					// pop it from the queue now.
+					// If we send a packet it must have come from the ring, so we can
+					// pop it from the ring now.
 					// If the sending didn't work (for whatever reason), we don't pop it
 					// and therefore we will automatically try to send it again in the next cycle.
-					mutex_lock(&(slave->packet_queue_mutex));
-					queue_pop(&slave->packet_to_spi_queue, NULL);
-					mutex_unlock(&(slave->packet_queue_mutex));
+					spsc_ring_pop(&slave->packet_to_spi_ring);
 				}
 			}
 
-			// If we received a packet, we will dispatch it immediately.
-			// We have some time until we try the next SPI communication anyway.
+			// If we received a packet, we hand it over to the brickd event thread.
+			// We don't wait for it to be dispatched, the SPI thread can continue
+			// to poll the slaves while the event thread drains the ring.
 			if ((ret & RED_STACK_TRANSCEIVE_RESULT_MASK_READ) == RED_STACK_TRANSCEIVE_RESULT_READ_OK) {
 				// TODO: Check again if packet is valid?
 				// We did already check the hash.
 
 				// Before the dispatching we insert the stack position into an enumerate message
-				red_stack_spi_insert_position(slave);
+				red_stack_spi_insert_position(&packet_from_spi->packet, slave);
+
+				spsc_ring_commit(&_red_stack.packet_from_spi_ring);
 
 				red_stack_spi_request_dispatch_response_event();
-				// Wait until message is dispatched, so we don't overwrite it
-				// accidentally.
-				semaphore_acquire(&_red_stack_dispatch_packet_from_spi_semaphore);
 			}
 
-			SLEEP_NS(0, 1000*_red_stack_spi_poll_delay);
+			active = (ret & RED_STACK_TRANSCEIVE_RESULT_MASK_SEND) == RED_STACK_TRANSCEIVE_RESULT_SEND_OK ||
+			         (ret & RED_STACK_TRANSCEIVE_RESULT_MASK_READ) == RED_STACK_TRANSCEIVE_RESULT_READ_OK;
+
+			if (active) {
+				cycle_active = true;
+				poll_delay = __atomic_load_n(&_red_stack_spi_poll_delay, __ATOMIC_RELAXED);
+			}
+
+			// Stay with the current slave while it has data to exchange,
+			// but not longer than the burst limit to avoid starving the
+			// other slaves
+			if ((active || spsc_ring_count(&slave->packet_to_spi_ring) > 0) &&
+			    ++burst_count < _red_stack_spi_poll_burst) {
+				// keep stack_address_cycle
+			} else {
+				burst_count = 0;
+				stack_address_cycle++;
+
+				if (stack_address_cycle >= _red_stack_spi_slave_num) {
+					stack_address_cycle = 0;
+
+					// Back off exponentially if no slave had anything to
+					// exchange during the whole cycle. Discovery needs to
+					// poll the remaining slaves, so don't back off yet
+					if (!cycle_active && !_red_stack_spi_discovering) {
+						// The poll delay might have been raised above
+						// the idle maximum at runtime, never back off
+						// below it
+						poll_delay = MIN(poll_delay * 2,
+						                 MAX(_red_stack_spi_poll_delay_idle_max,
+						                     __atomic_load_n(&_red_stack_spi_poll_delay, __ATOMIC_RELAXED)));
+					}
+
+					cycle_active = false;
+				}
+			}
+
+			if (red_stack_spi_sleep(poll_delay)) {
+				poll_delay = __atomic_load_n(&_red_stack_spi_poll_delay, __ATOMIC_RELAXED);
+			}
 		}
 
-		if (_red_stack.slave_num == 0) {
+		if (_red_stack_spi_slave_num == 0) {
 			pthread_mutex_lock(&_red_stack_wait_for_reset_mutex);
 			// Use helper to be save against spurious wakeups
 			_red_stack_wait_for_reset_helper = 0;
 
-			while (_red_stack_wait_for_reset_helper == 0) {
+			// A reset that was detected while discovery was still in
+			// progress might have signaled the condition already
+			while (_red_stack_wait_for_reset_helper == 0 && _red_stack_reset_detected == 0 &&
+			       !_red_stack_spi_thread_stop) {
 				pthread_cond_wait(&_red_stack_wait_for_reset_cond, &_red_stack_wait_for_reset_mutex);
 			}
 
 			pthread_mutex_unlock(&_red_stack_wait_for_reset_mutex);
 		}
 
-		if (_red_stack_reset_detected > 0) {
-			red_stack_spi_handle_reset();
+		if (_red_stack_reset_detected == 0 || _red_stack_spi_thread_stop) {
+			break;
 		}
-	} while (_red_stack_reset_detected > 0);
+
+		red_stack_spi_handle_reset();
+	}
 }
 
 
 // ----- RED STACK -----
 // These functions run in brickd main thread
 
-// Resets stack
-static void red_stack_reset(void) {
-	// Change mux of reset pin to output
-	gpio_mux_configure(_red_stack_reset_stack_pin, GPIO_MUX_OUTPUT);
-
-	gpio_output_clear(_red_stack_reset_stack_pin);
-	SLEEP_NS(0, 1000*1000*100); // Clear reset pin for 100ms to force reset
-	gpio_output_set(_red_stack_reset_stack_pin);
-	SLEEP_NS(1, 1000*1000*500); // Wait 1.5s so slaves can start properly
-
-	// Change mux back to interrupt, so we can see if a human presses reset
-	gpio_mux_configure(_red_stack_reset_stack_pin, GPIO_MUX_6);
-}
-
 static int red_stack_init_spi(void) {
 	uint8_t slave;
 	const uint8_t mode = RED_STACK_SPI_CONFIG_MODE;
@@ -718,19 +747,23 @@ static int red_stack_init_spi(void) {
 
 	// Initialize slaves
 	for (slave = 0; slave < RED_STACK_SPI_MAX_SLAVES; slave++) {
-		_red_stack.slaves[slave].stack_address = slave;
-		_red_stack.slaves[slave].status = RED_STACK_SLAVE_STATUS_ABSENT;
+		red_stack_spi_slave_init(&_red_stack.slaves[slave].spi, slave);
 		_red_stack.slaves[slave].slave_select_pin = _red_stack_slave_select_pins[slave];
-		_red_stack.slaves[slave].sequence_number_master = 1;
-		_red_stack.slaves[slave].sequence_number_slave = 0;
 
 		// Bring slave in initial state (deselected)
 		gpio_mux_configure(_red_stack.slaves[slave].slave_select_pin, GPIO_MUX_OUTPUT);
 		red_stack_spi_deselect(&_red_stack.slaves[slave]);
 	}
 
-	// Reset slaves and wait for slaves to be ready
-	red_stack_reset();
+	// A transport set by red_stack_set_spi_transport replaces spidev
+	if (_red_stack_spi_transport.transfer != NULL) {
+		log_info("Using %s instead of %s for the SPI stack",
+		         _red_stack_spi_transport.name, _red_stack_spi_device);
+
+		thread_create(&_red_stack_spi_thread, red_stack_spi_thread, NULL);
+
+		return 0;
+	}
 
 	// Open spidev
 	_red_stack_spi_fd = open(_red_stack_spi_device, O_RDWR);
@@ -759,6 +792,10 @@ static int red_stack_init_spi(void) {
 		return -1;
 	}
 
+	_red_stack_spi_transport.name = _red_stack_spi_device;
+	_red_stack_spi_transport.transfer = red_stack_spi_transfer;
+	_red_stack_spi_transport.opaque = NULL;
+
 	// Create SPI packet transceive thread
 	// FIXME: maybe handshake thread start?
 	thread_create(&_red_stack_spi_thread, red_stack_spi_thread, NULL);
@@ -766,9 +803,38 @@ static int red_stack_init_spi(void) {
 	return 0;
 }
 
-// New packet from SPI stack is send into brickd event loop
+// New packets from SPI stack are send into brickd event loop
+// Applies a slave event of the SPI thread to the routing table
+static void red_stack_handle_slave_event(REDStackSlaveEvent *event) {
+	char base58[BASE58_MAX_LENGTH];
+	int i;
+
+	if (event->type == RED_STACK_SLAVE_EVENT_TYPE_RESET) {
+		stack_announce_disconnect(&_red_stack.base);
+		_red_stack.base.recipients.count = 0;
+
+		_red_stack.slave_num = 0;
+
+		return;
+	}
+
+	for (i = 0; i < PACKET_MAX_STACK_ENUMERATE_UIDS && event->uids[i] != 0; i++) {
+		stack_add_recipient(&_red_stack.base, event->uids[i], event->stack_address);
+		log_debug("Found UID number %d of slave %d with UID %s",
+		          i, event->stack_address,
+		          base58_encode(base58, uint32_from_le(event->uids[i])));
+	}
+
+	if (event->stack_address >= _red_stack.slave_num) {
+		_red_stack.slave_num = event->stack_address + 1;
+	}
+}
+
 static void red_stack_dispatch_from_spi(void *opaque) {
 	eventfd_t ev;
+	REDStackSlaveEvent *slave_event;
+	REDStackResponse *response;
+	int count = 0;
 
 	(void)opaque;
 
@@ -779,16 +845,91 @@ static void red_stack_dispatch_from_spi(void *opaque) {
 		return;
 	}
 
-	// Send message into brickd dispatcher
-	// and allow SPI thread to run again.
-	network_dispatch_response(&_red_stack.packet_from_spi);
-	semaphore_release(&_red_stack_dispatch_packet_from_spi_semaphore);
+	if (!_red_stack_added && __atomic_load_n(&_red_stack_reset_done, __ATOMIC_ACQUIRE)) {
+		// Retried with the next notification if this fails
+		if (hardware_add_stack(&_red_stack.base) == 0) {
+			_red_stack_added = true;
+
+			log_debug("Added RED Brick SPI stack after %u msec",
+			          (uint32_t)((microseconds() - _red_stack_init_at) / 1000));
+		}
+	}
+
+	// Update the routing table before dispatching responses, so responses of
+	// a slave that was just found can already be answered
+	while ((slave_event = spsc_ring_peek(&_red_stack.slave_event_ring)) != NULL) {
+		red_stack_handle_slave_event(slave_event);
+		spsc_ring_pop(&_red_stack.slave_event_ring);
+	}
+
+	// The eventfd counts the notifications, so one read covers all packets
+	// committed so far. Send all of them into brickd dispatcher at once.
+	while ((response = spsc_ring_peek(&_red_stack.packet_from_spi_ring)) != NULL) {
+		network_dispatch_timestamped_response(&response->packet, response->ingress_timestamp);
+		spsc_ring_pop(&_red_stack.packet_from_spi_ring);
+
+		++count;
+	}
+
+	if (count > 1) {
+		log_packet_debug("Dispatched batch of %d packet(s) received over SPI", count);
+	}
+}
+
+// Wakes up the SPI thread if it is currently backing off
+static void red_stack_spi_wakeup(void) {
+	eventfd_t ev = 1;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&_red_stack_spi_idle, __ATOMIC_RELAXED) == 0) {
+		return;
+	}
+
+	if (eventfd_write(_red_stack_spi_wakeup_event, ev) < 0) {
+		log_error("Could not write to SPI wakeup event: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+}
+
+// Queues a request for a slave. If the ring of the slave is full the request
+// is dropped, only the SPI thread is allowed to pop from the ring
+static void red_stack_queue_to_spi(REDStackSlave *slave, Packet *request) {
+	REDStackPacket *queued_request = spsc_ring_reserve(&slave->packet_to_spi_ring);
+
+	uint64_t now;
+
+	if (queued_request == NULL) {
+		++slave->dropped_requests;
+		++slave->dropped_requests_unwarned;
+
+		// A full queue drops requests as fast as they arrive, don't flood the log
+		now = microseconds();
+
+		if (now - slave->drop_warned_at >= RED_STACK_SPI_DROP_WARNING_INTERVAL) {
+			log_warn("Request queue for slave %d is full, dropped %u request(s) since last warning (last: %s), %u dropped in total",
+			         slave->spi.stack_address, slave->dropped_requests_unwarned,
+			         packet_get_request_signature(packet_signature, request),
+			         slave->dropped_requests);
+
+			slave->dropped_requests_unwarned = 0;
+			slave->drop_warned_at = now;
+		}
+
+		return;
+	}
+
+	queued_request->status = RED_STACK_PACKET_STATUS_ADDED;
+	queued_request->slave = slave;
+	memcpy(&queued_request->packet, request, request->header.length);
+
+	spsc_ring_commit(&slave->packet_to_spi_ring);
+
+	red_stack_spi_wakeup();
 }
 
 // New packet from brickd event loop is queued to be written to stack via SPI
 static int red_stack_dispatch_to_spi(Stack *stack, Packet *request, Recipient *recipient) {
-	REDStackPacket *queued_request;
-
 	(void)stack;
 
 	if (request->header.uid == 0) {
@@ -796,12 +937,7 @@ static int red_stack_dispatch_to_spi(Stack *stack, Packet *request, Recipient *r
 		uint8_t is;
 
 		for (is = 0; is < _red_stack.slave_num; is++) {
-			mutex_lock(&_red_stack.slaves[is].packet_queue_mutex);
-			queued_request = queue_push(&_red_stack.slaves[is].packet_to_spi_queue);
-			queued_request->status = RED_STACK_PACKET_STATUS_ADDED;
-			queued_request->slave = &_red_stack.slaves[is];
-			memcpy(&queued_request->packet, request, request->header.length);
-			mutex_unlock(&_red_stack.slaves[is].packet_queue_mutex);
+			red_stack_queue_to_spi(&_red_stack.slaves[is], request);
 
 			log_packet_debug("Request is queued to be broadcast to slave %d (%s)",
 			                 is, packet_get_request_signature(packet_signature, request));
@@ -810,15 +946,10 @@ static int red_stack_dispatch_to_spi(Stack *stack, Packet *request, Recipient *r
 		// Get slave for recipient opaque (== stack_address)
 		REDStackSlave *slave = &_red_stack.slaves[recipient->opaque];
 
-		mutex_lock(&(slave->packet_queue_mutex));
-		queued_request = queue_push(&(slave->packet_to_spi_queue));
-		queued_request->status = RED_STACK_PACKET_STATUS_ADDED;
-		queued_request->slave = slave;
-		memcpy(&queued_request->packet, request, request->header.length);
-		mutex_unlock(&(slave->packet_queue_mutex));
+		red_stack_queue_to_spi(slave, request);
 
 		log_packet_debug("Packet is queued to be send to slave %d over SPI (%s)",
-		                 slave->stack_address,
+		                 slave->spi.stack_address,
 		                 packet_get_request_signature(packet_signature, request));
 	}
 
@@ -834,18 +965,31 @@ static void red_stack_reset_handler(void *opaque) {
 	lseek(_red_stack_reset_fd, 0, SEEK_SET);
 	if (read(_red_stack_reset_fd, buf, 2) < 0) {} // ignore return value
 
+	// The SPI thread is still doing the startup reset
+	if (!_red_stack_added) {
+		return;
+	}
+
 	_red_stack_reset_detected++;
 	log_debug("Reset button press detected (%d since last reset)", _red_stack_reset_detected);
 
 	_red_stack_spi_thread_running = false;
 
-	// If there is no slave we have to wake up the spi thread
-	if (_red_stack.slave_num == 0) {
-		pthread_mutex_lock(&_red_stack_wait_for_reset_mutex);
-		_red_stack_wait_for_reset_helper = 1;
-		pthread_cond_signal(&_red_stack_wait_for_reset_cond);
-		pthread_mutex_unlock(&_red_stack_wait_for_reset_mutex);
-	}
+	red_stack_spi_wakeup();
+
+	// If there is no slave the SPI thread waits for the reset. Only the SPI
+	// thread knows its current slave count, so always wake it up, the helper
+	// is cleared again before the SPI thread starts to wait
+	pthread_mutex_lock(&_red_stack_wait_for_reset_mutex);
+	_red_stack_wait_for_reset_helper = 1;
+	pthread_cond_signal(&_red_stack_wait_for_reset_cond);
+	pthread_mutex_unlock(&_red_stack_wait_for_reset_mutex);
+}
+
+// Replaces the spidev transport, for example by a simulator to benchmark the
+// SPI thread without hardware. Has to be called before red_stack_init
+void red_stack_set_spi_transport(REDStackSPITransport *transport) {
+	memcpy(&_red_stack_spi_transport, transport, sizeof(REDStackSPITransport));
 }
 
 int red_stack_init(void) {
@@ -854,7 +998,20 @@ int red_stack_init(void) {
 
 	log_debug("Initializing RED Brick SPI Stack subsystem");
 
+	_red_stack_init_at = microseconds();
+
 	_red_stack_spi_poll_delay = config_get_option_value("poll_delay.spi")->integer;
+	_red_stack_spi_poll_delay_idle_max = config_get_option_value("poll_delay.spi_idle_max")->integer;
+	_red_stack_spi_poll_burst = config_get_option_value("poll_burst.spi")->integer;
+
+	realtime_jitter_init(&_red_stack_spi_jitter, "SPI thread");
+
+	if (_red_stack_spi_poll_delay_idle_max < _red_stack_spi_poll_delay) {
+		log_warn("Option poll_delay.spi_idle_max (%d) is less than poll_delay.spi (%d), disabling SPI idle back off",
+		         _red_stack_spi_poll_delay_idle_max, _red_stack_spi_poll_delay);
+
+		_red_stack_spi_poll_delay_idle_max = _red_stack_spi_poll_delay;
+	}
 
 	if (gpio_sysfs_export(RED_STACK_RESET_PIN_GPIO_NUM) < 0) {
 		// Just issue a warning, RED Brick will work without reset interrupt
@@ -882,12 +1039,8 @@ int red_stack_init(void) {
 
 	phase = 1;
 
-	// add to stacks array
-	if (hardware_add_stack(&_red_stack.base) < 0) {
-		goto cleanup;
-	}
-
-	phase = 2;
+	// The stack is added to the stacks array by red_stack_dispatch_from_spi
+	// after the SPI thread reset the slaves
 
 	if ((_red_stack_notification_event = eventfd(0, 0)) < 0) {
 		log_error("Could not create red stack notification event: %s (%d)",
@@ -896,7 +1049,7 @@ int red_stack_init(void) {
 		goto cleanup;
 	}
 
-	phase = 3;
+	phase = 2;
 
 	// Add notification pipe as event source.
 	// Event is used to dispatch packets.
@@ -907,30 +1060,52 @@ int red_stack_init(void) {
 		goto cleanup;
 	}
 
+	phase = 3;
+
+	// The wakeup event is used to interrupt the SPI thread while it backs off
+	if ((_red_stack_spi_wakeup_event = eventfd(0, EFD_NONBLOCK)) < 0) {
+		log_error("Could not create SPI wakeup event: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
 	phase = 4;
 
-	// Initialize SPI packet queues
+	// Initialize SPI packet rings
 	for (i = 0; i < RED_STACK_SPI_MAX_SLAVES; i++) {
-		if (queue_create(&_red_stack.slaves[i].packet_to_spi_queue, sizeof(REDStackPacket)) < 0) {
-			log_error("Could not create SPI queue %d: %s (%d)",
+		_red_stack.slaves[i].dropped_requests = 0;
+		_red_stack.slaves[i].dropped_requests_unwarned = 0;
+		_red_stack.slaves[i].drop_warned_at = 0;
+
+		if (spsc_ring_create(&_red_stack.slaves[i].packet_to_spi_ring,
+		                     RED_STACK_SPI_PACKET_TO_SPI_RING_SIZE, sizeof(REDStackPacket)) < 0) {
+			log_error("Could not create SPI ring %d: %s (%d)",
 			          i, get_errno_name(errno), errno);
 
 			goto cleanup;
 		}
 	}
 
-	if (semaphore_create(&_red_stack_dispatch_packet_from_spi_semaphore) < 0) {
-		log_error("Could not create SPI request semaphore: %s (%d)",
+	if (spsc_ring_create(&_red_stack.packet_from_spi_ring,
+	                     RED_STACK_SPI_PACKET_FROM_SPI_RING_SIZE, sizeof(REDStackResponse)) < 0) {
+		log_error("Could not create SPI receive ring: %s (%d)",
 		          get_errno_name(errno), errno);
 
 		goto cleanup;
 	}
 
-	for (i = 0; i < RED_STACK_SPI_MAX_SLAVES; i++) {
-		mutex_create(&_red_stack.slaves[i].packet_queue_mutex);
+	phase = 5;
+
+	if (spsc_ring_create(&_red_stack.slave_event_ring,
+	                     RED_STACK_SPI_SLAVE_EVENT_RING_SIZE, sizeof(REDStackSlaveEvent)) < 0) {
+		log_error("Could not create SPI slave event ring: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
 	}
 
-	phase = 5;
+	phase = 6;
 
 	if (red_stack_init_spi() < 0) {
 		goto cleanup;
@@ -950,29 +1125,28 @@ int red_stack_init(void) {
 		}
 	}
 
-	phase = 6;
+	phase = 7;
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
-	case 5:
-		for (i = 0; i < RED_STACK_SPI_MAX_SLAVES; i++) {
-			mutex_destroy(&_red_stack.slaves[i].packet_queue_mutex);
-		}
+	case 6:
+		spsc_ring_destroy(&_red_stack.slave_event_ring);
 
-		semaphore_destroy(&_red_stack_dispatch_packet_from_spi_semaphore);
+	case 5:
+		spsc_ring_destroy(&_red_stack.packet_from_spi_ring);
 
 	case 4:
 		for (i--; i >= 0; i--) {
-			queue_destroy(&_red_stack.slaves[i].packet_to_spi_queue, NULL);
+			spsc_ring_destroy(&_red_stack.slaves[i].packet_to_spi_ring);
 		}
 
-		event_remove_source(_red_stack_notification_event, EVENT_SOURCE_TYPE_GENERIC);
+		close(_red_stack_spi_wakeup_event);
 
 	case 3:
-		close(_red_stack_notification_event);
+		event_remove_source(_red_stack_notification_event, EVENT_SOURCE_TYPE_GENERIC);
 
 	case 2:
-		hardware_remove_stack(&_red_stack.base);
+		close(_red_stack_notification_event);
 
 	case 1:
 		stack_destroy(&_red_stack.base);
@@ -981,7 +1155,7 @@ cleanup:
 		break;
 	}
 
-	return phase == 6 ? 0 : -1;
+	return phase == 7 ? 0 : -1;
 }
 
 void red_stack_exit(void) {
@@ -996,35 +1170,87 @@ void red_stack_exit(void) {
 	// Remove event as possible poll source
 	event_remove_source(_red_stack_notification_event, EVENT_SOURCE_TYPE_GENERIC);
 
-	// Make sure that Thread shuts down properly
-	if (_red_stack_spi_thread_running) {
-		_red_stack_spi_thread_running = false;
-		// Write in eventfd to make sure that we are not blocking the Thread
-		eventfd_t ev = 1;
-		eventfd_write(_red_stack_notification_event, ev);
+	// Make sure that Thread shuts down properly. It might still be doing the
+	// startup reset or wait for a reset because no slave was found
+	_red_stack_spi_thread_stop = true;
+	_red_stack_spi_thread_running = false;
 
-		thread_join(&_red_stack_spi_thread);
-		thread_destroy(&_red_stack_spi_thread);
-	}
+	red_stack_spi_wakeup();
+
+	pthread_mutex_lock(&_red_stack_wait_for_reset_mutex);
+	_red_stack_wait_for_reset_helper = 1;
+	pthread_cond_signal(&_red_stack_wait_for_reset_cond);
+	pthread_mutex_unlock(&_red_stack_wait_for_reset_mutex);
+
+	thread_join(&_red_stack_spi_thread);
+	thread_destroy(&_red_stack_spi_thread);
+
+	realtime_jitter_report(&_red_stack_spi_jitter);
 
 	// Thread is not running anymore, we make sure that all slaves are deselected
 	for (slave = 0; slave < RED_STACK_SPI_MAX_SLAVES; slave++) {
 		red_stack_spi_deselect(&_red_stack.slaves[slave]);
 	}
 
-	// We can also free the queue and stack now, nobody will use them anymore
+	// We can also free the rings and stack now, nobody will use them anymore
 	for (i = 0; i < RED_STACK_SPI_MAX_SLAVES; i++) {
-		queue_destroy(&_red_stack.slaves[i].packet_to_spi_queue, NULL);
+		if (_red_stack.slaves[i].dropped_requests > 0) {
+			log_info("Dropped %u request(s) for slave %d in total because its queue was full",
+			         _red_stack.slaves[i].dropped_requests, i);
+		}
+
+		spsc_ring_destroy(&_red_stack.slaves[i].packet_to_spi_ring);
 	}
-	hardware_remove_stack(&_red_stack.base);
+	if (_red_stack_added) {
+		hardware_remove_stack(&_red_stack.base);
+	}
+
 	stack_destroy(&_red_stack.base);
 
-	for (i = 0; i < RED_STACK_SPI_MAX_SLAVES; i++) {
-		mutex_destroy(&_red_stack.slaves[i].packet_queue_mutex);
-	}
-	semaphore_destroy(&_red_stack_dispatch_packet_from_spi_semaphore);
+	spsc_ring_destroy(&_red_stack.packet_from_spi_ring);
+	spsc_ring_destroy(&_red_stack.slave_event_ring);
 
 	// Close file descriptors
 	close(_red_stack_notification_event);
-	close(_red_stack_spi_fd);
+	close(_red_stack_spi_wakeup_event);
+
+	if (_red_stack_spi_fd >= 0) {
+		close(_red_stack_spi_fd);
+	}
+}
+
+// Serializes changes to the PIO ports shared by the stack reset pin and the
+// extension pins. Can be called from any thread
+void red_stack_lock_gpio(void) {
+	pthread_mutex_lock(&_red_stack_gpio_mutex);
+}
+
+void red_stack_unlock_gpio(void) {
+	pthread_mutex_unlock(&_red_stack_gpio_mutex);
+}
+
+// Returns the number of requests dropped since startup because the queue of
+// their slave was full, summed over all slaves
+int red_stack_get_dropped_requests(void) {
+	uint32_t dropped_requests = 0;
+	int i;
+
+	for (i = 0; i < RED_STACK_SPI_MAX_SLAVES; i++) {
+		dropped_requests += _red_stack.slaves[i].dropped_requests;
+	}
+
+	return (int)dropped_requests;
+}
+
+// Returns the delay between transfers in microseconds
+int red_stack_get_poll_delay(void) {
+	return __atomic_load_n(&_red_stack_spi_poll_delay, __ATOMIC_RELAXED);
+}
+
+// Changes the delay between transfers. If the SPI thread is currently backing
+// off it is woken up and continues with the new delay
+void red_stack_set_poll_delay(int poll_delay) {
+	__atomic_store_n(&_red_stack_spi_poll_delay, poll_delay, __ATOMIC_RELAXED);
+
+	red_stack_spi_wakeup();
 }
@@ -22,7 +22,21 @@
 #ifndef BRICKD_RED_STACK_H
 #define BRICKD_RED_STACK_H
 
+#include <stdbool.h>
+
+#include "red_stack_spi.h"
+
+void red_stack_set_spi_transport(REDStackSPITransport *transport);
+
 int red_stack_init(void);
 void red_stack_exit(void);
 
+void red_stack_lock_gpio(void);
+void red_stack_unlock_gpio(void);
+
+int red_stack_get_dropped_requests(void);
+
+int red_stack_get_poll_delay(void);
+void red_stack_set_poll_delay(int poll_delay);
+
 #endif // BRICKD_RED_STACK_H
@@ -0,0 +1,351 @@
+/*
+ * brickd
+ * Copyright (C) 2014 Olaf Lüke <olaf@tinkerforge.com>
+ * Copyright (C) 2014-2015 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * red_stack_spi.c: SPI protocol for RED Brick stack
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <daemonlib/log.h>
+#include <daemonlib/packet.h>
+#include <daemonlib/utils.h>
+
+#include "red_stack_spi.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define RED_STACK_SPI_DISCOVERY_POLL_INTERVAL_MIN 250   // microseconds
+#define RED_STACK_SPI_DISCOVERY_POLL_INTERVAL_MAX 10000 // microseconds
+
+// We use the Pearson Hash for fast hashing
+// See: http://en.wikipedia.org/wiki/Pearson_hashing
+// the permutation table is taken from the original paper:
+// "Fast Hashing of Variable-Length Text Strings" by Peter K. Pearson,
+// pp. 677-680, CACM 33(6), June 1990.
+
+#define RED_STACK_SPI_PEARSON_PERMUTATION_SIZE 256
+static const uint8_t _red_stack_spi_pearson_permutation[RED_STACK_SPI_PEARSON_PERMUTATION_SIZE] = {
+    1, 87, 49, 12, 176, 178, 102, 166, 121, 193, 6, 84, 249, 230, 44, 163,
+    14, 197, 213, 181, 161, 85, 218, 80, 64, 239, 24, 226, 236, 142, 38, 200,
+    110, 177, 104, 103, 141, 253, 255, 50, 77, 101, 81, 18, 45, 96, 31, 222,
+    25, 107, 190, 70, 86, 237, 240, 34, 72, 242, 20, 214, 244, 227, 149, 235,
+    97, 234, 57, 22, 60, 250, 82, 175, 208, 5, 127, 199, 111, 62, 135, 248,
+    174, 169, 211, 58, 66, 154, 106, 195, 245, 171, 17, 187, 182, 179, 0, 243,
+    132, 56, 148, 75, 128, 133, 158, 100, 130, 126, 91, 13, 153, 246, 216, 219,
+    119, 68, 223, 78, 83, 88, 201, 99, 122, 11, 92, 32, 136, 114, 52, 10,
+    138, 30, 48, 183, 156, 35, 61, 26, 143, 74, 251, 94, 129, 162, 63, 152,
+    170, 7, 115, 167, 241, 206, 3, 150, 55, 59, 151, 220, 90, 53, 23, 131,
+    125, 173, 15, 238, 79, 95, 89, 16, 105, 137, 225, 224, 217, 160, 37, 123,
+    118, 73, 2, 157, 46, 116, 9, 145, 134, 228, 207, 212, 202, 215, 69, 229,
+    27, 188, 67, 124, 168, 252, 42, 4, 29, 108, 21, 247, 19, 205, 39, 203,
+    233, 40, 186, 147, 198, 192, 155, 33, 164, 191, 98, 204, 165, 180, 117, 76,
+    140, 36, 210, 172, 41, 54, 159, 8, 185, 232, 113, 196, 231, 47, 146, 120,
+    51, 65, 28, 144, 254, 221, 93, 189, 194, 139, 112, 43, 71, 109, 184, 209
+};
+#define PEARSON(cur, next) do { cur = _red_stack_spi_pearson_permutation[cur ^ next]; } while(0)
+
+static char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+
+static void red_stack_increase_master_sequence_number(REDStackSPISlave *slave) {
+	slave->sequence_number_master += 1;
+
+	if (slave->sequence_number_master > RED_STACK_SPI_INFO_SEQUENCE_MASTER_MASK) {
+		slave->sequence_number_master = 0;
+	}
+}
+
+// Calculates a Pearson Hash for the given data
+uint8_t red_stack_spi_calculate_pearson_hash(const uint8_t *data, const uint8_t length) {
+	uint8_t i;
+	uint8_t checksum = 0;
+
+	for (i = 0; i < length; i++) {
+		checksum = _red_stack_spi_pearson_permutation[checksum ^ data[i]];
+	}
+
+	return checksum;
+}
+
+void red_stack_spi_slave_init(REDStackSPISlave *slave, uint8_t stack_address) {
+	slave->stack_address = stack_address;
+	slave->status = RED_STACK_SLAVE_STATUS_ABSENT;
+	slave->sequence_number_master = 1;
+	slave->sequence_number_slave = 0;
+	slave->next_packet_empty = false;
+}
+
+// If data should just be polled, set packet_send to NULL.
+//
+// If no packet is received from slave the length in packet_recv will be set to 0,
+// the exact reason for that is encoded in the return value.
+//
+// For the return value see RED_STACK_TRANSCEIVE_RESULT_* at the top of this file.
+int red_stack_spi_transceive_message(REDStackSPITransport *transport,
+                                     REDStackSPISlave *slave,
+                                     Packet *packet_send, Packet *packet_recv) {
+	int retval = 0;
+	uint8_t length, length_send;
+	uint8_t checksum;
+	int rc;
+	uint8_t sequence_number_master = 0xFF;
+	uint8_t sequence_number_slave = 0xFF;
+
+	uint8_t tx[RED_STACK_SPI_PACKET_SIZE] = {0};
+	uint8_t rx[RED_STACK_SPI_PACKET_SIZE] = {0};
+
+	// We assume that we don't receive anything. If we receive a packet the
+	// length will be overwritten again
+	packet_recv->header.length = 0;
+
+	// Preamble is always the same
+	tx[RED_STACK_SPI_PREAMBLE] = RED_STACK_SPI_PREAMBLE_VALUE;
+
+	if (packet_send == NULL) {
+		// If packet_send is NULL
+		// we send a message with empty payload (4 byte)
+		tx[RED_STACK_SPI_LENGTH] = RED_STACK_SPI_PACKET_EMPTY_SIZE;
+		retval = RED_STACK_TRANSCEIVE_RESULT_SEND_NONE;
+	} else if (slave->status == RED_STACK_SLAVE_STATUS_AVAILABLE) {
+		length = packet_send->header.length;
+
+		if (length > sizeof(Packet)) {
+			retval |= RED_STACK_TRANSCEIVE_RESULT_SEND_ERROR;
+			log_error("Send length is greater then allowed (actual: %d > maximum: %d)",
+			          length, (int)sizeof(Packet));
+			goto ret;
+		}
+
+		retval = RED_STACK_TRANSCEIVE_DATA_SEND;
+
+		tx[RED_STACK_SPI_LENGTH] = length + RED_STACK_SPI_PACKET_EMPTY_SIZE;
+		memcpy(tx+2, packet_send, length);
+	} else {
+		retval = RED_STACK_TRANSCEIVE_RESULT_SEND_ERROR;
+		log_error("Slave with stack address %d is not present in stack", slave->stack_address);
+		goto ret;
+	}
+
+	length = tx[RED_STACK_SPI_LENGTH];
+
+	// Set master and slave sequence number
+	tx[RED_STACK_SPI_INFO(length)] = slave->sequence_number_master | slave->sequence_number_slave;
+
+	// Calculate checksum
+	tx[RED_STACK_SPI_CHECKSUM(length)] = red_stack_spi_calculate_pearson_hash(tx, length-1);
+
+	rc = transport->transfer(transport->opaque, slave->stack_address,
+	                         tx, rx, RED_STACK_SPI_PACKET_SIZE);
+
+	if (rc < 0) {
+		// Overwrite current return status with error,
+		// it seems the transfer itself didn't work.
+		retval = RED_STACK_TRANSCEIVE_RESULT_SEND_ERROR | RED_STACK_TRANSCEIVE_RESULT_READ_ERROR;
+		if(packet_send == NULL) {
+			slave->next_packet_empty = true;
+		}
+		log_error("Could not transfer data over %s: %s (%d)",
+		          transport->name, get_errno_name(errno), errno);
+		goto ret;
+	}
+
+	length_send = rc;
+
+	if (length_send != RED_STACK_SPI_PACKET_SIZE) {
+		// Overwrite current return status with error,
+		// it seems the transfer itself didn't work.
+		retval = RED_STACK_TRANSCEIVE_RESULT_SEND_ERROR | RED_STACK_TRANSCEIVE_RESULT_READ_ERROR;
+		if(packet_send == NULL) {
+			slave->next_packet_empty = true;
+		}
+		log_error("Transfer over %s has unexpected result (actual: %d != expected: %d)",
+		          transport->name, length_send, RED_STACK_SPI_PACKET_SIZE);
+		goto ret;
+	}
+
+	if (rx[RED_STACK_SPI_PREAMBLE] != RED_STACK_SPI_PREAMBLE_VALUE) {
+		// Do not log by default, an "unproper preamble" is part of the protocol
+		// if the slave is too busy to fill the DMA buffers fast enough
+		// log_error("Received packet without proper preamble (actual: %d != expected: %d)",
+		//          rx[RED_STACK_SPI_PREAMBLE], RED_STACK_SPI_PREAMBLE_VALUE);
+		retval = (retval & (~RED_STACK_TRANSCEIVE_RESULT_MASK_READ)) | RED_STACK_TRANSCEIVE_RESULT_READ_ERROR;
+		if(packet_send == NULL) {
+			slave->next_packet_empty = true;
+		}
+		goto ret;
+	}
+
+	// Check length
+	length = rx[RED_STACK_SPI_LENGTH];
+
+	if ((length != RED_STACK_SPI_PACKET_EMPTY_SIZE) &&
+	    ((length < (RED_STACK_SPI_PACKET_EMPTY_SIZE + sizeof(PacketHeader))) ||
+	     (length > RED_STACK_SPI_PACKET_SIZE))) {
+		log_error("Received packet with malformed length: %d", length);
+		retval = (retval & (~RED_STACK_TRANSCEIVE_RESULT_MASK_READ)) | RED_STACK_TRANSCEIVE_RESULT_READ_ERROR;
+		if(packet_send == NULL) {
+			slave->next_packet_empty = true;
+		}
+		goto ret;
+	}
+
+	// Calculate and check checksum
+	checksum = red_stack_spi_calculate_pearson_hash(rx, length-1);
+
+	if (checksum != rx[RED_STACK_SPI_CHECKSUM(length)]) {
+		log_error("Received packet with wrong checksum (actual: %x != expected: %x)",
+		          checksum, rx[RED_STACK_SPI_CHECKSUM(length)]);
+		retval = (retval & (~RED_STACK_TRANSCEIVE_RESULT_MASK_READ)) | RED_STACK_TRANSCEIVE_RESULT_READ_ERROR;
+		if(packet_send == NULL) {
+			slave->next_packet_empty = true;
+		}
+		goto ret;
+	}
+
+	// If we send data and the master sequence number matches to the one
+	// set in the packet we know that the slave received the packet!
+	if ((packet_send != NULL) /*&& (packet_send->status == RED_STACK_PACKET_STATUS_SEQUENCE_NUMBER_SET)*/) {
+		sequence_number_master = rx[RED_STACK_SPI_INFO(length)] & RED_STACK_SPI_INFO_SEQUENCE_MASTER_MASK;
+
+		if (sequence_number_master == slave->sequence_number_master) {
+			retval = (retval & (~RED_STACK_TRANSCEIVE_RESULT_MASK_SEND)) | RED_STACK_TRANSCEIVE_RESULT_SEND_OK;
+
+			// Increase sequence number for next packet
+			red_stack_increase_master_sequence_number(slave);
+		}
+	} else {
+		// If we didn't send anything we can always increase the sequence number,
+		// it doesn't matter if the slave actually received it.
+		red_stack_increase_master_sequence_number(slave);
+	}
+
+	// If the slave sequence number matches we already processed this packet
+	sequence_number_slave = rx[RED_STACK_SPI_INFO(length)] & RED_STACK_SPI_INFO_SEQUENCE_SLAVE_MASK;
+
+	if (sequence_number_slave == slave->sequence_number_slave) {
+		retval = (retval & (~RED_STACK_TRANSCEIVE_RESULT_MASK_READ)) | RED_STACK_TRANSCEIVE_RESULT_READ_NONE;
+	} else {
+		// Otherwise we save the new sequence number
+		slave->sequence_number_slave = sequence_number_slave;
+
+		if (length == RED_STACK_SPI_PACKET_EMPTY_SIZE) {
+			// Do not log by default, will produce 2000 log entries per second
+			// log_packet_debug("Received empty packet over SPI (w/ header)");
+			retval = (retval & (~RED_STACK_TRANSCEIVE_RESULT_MASK_READ)) | RED_STACK_TRANSCEIVE_RESULT_READ_NONE;
+		} else {
+			// Everything seems OK, we can copy to buffer
+			memcpy(packet_recv, rx+2, length - RED_STACK_SPI_PACKET_EMPTY_SIZE);
+			log_packet_debug("Received packet over SPI (%s)",
+			                 packet_get_response_signature(packet_signature, packet_recv));
+			retval = (retval & (~RED_STACK_TRANSCEIVE_RESULT_MASK_READ)) | RED_STACK_TRANSCEIVE_RESULT_READ_OK;
+			retval |= RED_STACK_TRANSCEIVE_DATA_RECEIVED;
+		}
+	}
+
+ret:
+	return retval;
+}
+
+void red_stack_spi_discovery_start(REDStackSPIDiscovery *discovery,
+                                   REDStackSPISlave *slave,
+                                   uint64_t now, uint32_t timeout) {
+	discovery->status = RED_STACK_SPI_DISCOVERY_STATUS_SEND;
+	discovery->started_at = now;
+	discovery->deadline = now + timeout;
+	discovery->next_poll_at = now;
+	discovery->poll_interval = RED_STACK_SPI_DISCOVERY_POLL_INTERVAL_MIN;
+
+	// We have to assume that the slave is available, otherwise the stack
+	// enumerate request would not be send
+	slave->status = RED_STACK_SLAVE_STATUS_AVAILABLE;
+}
+
+// Does one transfer with the slave if it is still being discovered and its
+// next poll is due. The poll interval starts short and is doubled after each
+// transfer that didn't make progress, so a slave that is quick to answer is
+// found quickly, while an absent or still booting slave doesn't occupy the bus.
+// If the slave didn't answer before the deadline it is marked as absent.
+//
+// Once the returned status is RED_STACK_SPI_DISCOVERY_STATUS_DONE the stack
+// enumerate response of the slave is stored in response.
+REDStackSPIDiscoveryStatus red_stack_spi_discovery_poll(REDStackSPITransport *transport,
+                                                        REDStackSPIDiscovery *discovery,
+                                                        REDStackSPISlave *slave,
+                                                        StackEnumerateResponse *response,
+                                                        uint64_t now) {
+	Packet request;
+	int ret;
+	bool progress = false;
+
+	if ((discovery->status != RED_STACK_SPI_DISCOVERY_STATUS_SEND &&
+	     discovery->status != RED_STACK_SPI_DISCOVERY_STATUS_RECEIVE) ||
+	    now < discovery->next_poll_at) {
+		return discovery->status;
+	}
+
+	if (discovery->status == RED_STACK_SPI_DISCOVERY_STATUS_SEND) {
+		memset(&request, 0, sizeof(Packet));
+
+		request.header.uid = 0;
+		request.header.length = sizeof(StackEnumerateRequest);
+		request.header.function_id = FUNCTION_STACK_ENUMERATE;
+		request.header.sequence_number_and_options = 0x08; // Return expected
+
+		ret = red_stack_spi_transceive_message(transport, slave, &request, (Packet *)response);
+
+		if ((ret & RED_STACK_TRANSCEIVE_RESULT_MASK_SEND) == RED_STACK_TRANSCEIVE_RESULT_SEND_OK) {
+			discovery->status = RED_STACK_SPI_DISCOVERY_STATUS_RECEIVE;
+			progress = true;
+		}
+	} else {
+		ret = red_stack_spi_transceive_message(transport, slave, NULL, (Packet *)response);
+	}
+
+	// The response might already arrive with the transfer that acknowledged
+	// the request
+	if (discovery->status == RED_STACK_SPI_DISCOVERY_STATUS_RECEIVE &&
+	    (ret & RED_STACK_TRANSCEIVE_RESULT_MASK_READ) == RED_STACK_TRANSCEIVE_RESULT_READ_OK &&
+	    response->header.function_id == FUNCTION_STACK_ENUMERATE) {
+		discovery->status = RED_STACK_SPI_DISCOVERY_STATUS_DONE;
+
+		return discovery->status;
+	}
+
+	if (now >= discovery->deadline) {
+		discovery->status = RED_STACK_SPI_DISCOVERY_STATUS_FAILED;
+		slave->status = RED_STACK_SLAVE_STATUS_ABSENT;
+
+		return discovery->status;
+	}
+
+	if (progress) {
+		// The slave answered, it should send the response soon
+		discovery->poll_interval = RED_STACK_SPI_DISCOVERY_POLL_INTERVAL_MIN;
+	}
+
+	discovery->next_poll_at = now + discovery->poll_interval;
+
+	if (!progress) {
+		discovery->poll_interval = MIN(discovery->poll_interval * 2,
+		                               RED_STACK_SPI_DISCOVERY_POLL_INTERVAL_MAX);
+	}
+
+	return discovery->status;
+}
@@ -0,0 +1,130 @@
+/*
+ * brickd
+ * Copyright (C) 2014 Olaf Lüke <olaf@tinkerforge.com>
+ * Copyright (C) 2014-2015 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * red_stack_spi.h: SPI protocol for RED Brick stack
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_RED_STACK_SPI_H
+#define BRICKD_RED_STACK_SPI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <daemonlib/packet.h>
+
+// * Packet structure:
+//  * Byte 0: Preamble = 0xAA
+//  * Byte 1: Length = n+2
+//  * Byte 2 to n: Payload
+//  * Byte n+1: Info (slave sequence, master sequence)
+//   * Bit 0-2: Master sequence number (MSN)
+//   * Bit 3-5: Slave sequence number (SSN)
+//   * Bit 6-7: Currently unused
+//  * Byte n+2: Checksum over bytes 0 to n+1
+
+#define RED_STACK_SPI_PACKET_SIZE       84
+#define RED_STACK_SPI_PACKET_EMPTY_SIZE 4
+#define RED_STACK_SPI_PREAMBLE_VALUE    0xAA
+#define RED_STACK_SPI_PREAMBLE          0
+#define RED_STACK_SPI_LENGTH            1
+#define RED_STACK_SPI_INFO(length)      ((length) -2)
+#define RED_STACK_SPI_CHECKSUM(length)  ((length) -1)
+
+#define RED_STACK_SPI_INFO_SEQUENCE_MASTER_MASK (0x07)
+#define RED_STACK_SPI_INFO_SEQUENCE_SLAVE_MASK  (0x38)
+
+#define RED_STACK_TRANSCEIVE_DATA_SEND          (1 << 8)   // data has been send
+#define RED_STACK_TRANSCEIVE_DATA_RECEIVED      (1 << 7)   // data has been received
+
+#define RED_STACK_TRANSCEIVE_RESULT_SEND_ERROR  (1 << 0)   // data has not been send because of a problem (malformed packet or similar)
+#define RED_STACK_TRANSCEIVE_RESULT_SEND_NONE   (2 << 0)   // data has not been send because there was no data
+#define RED_STACK_TRANSCEIVE_RESULT_SEND_OK     (3 << 0)   // data has been send
+#define RED_STACK_TRANSCEIVE_RESULT_READ_ERROR  (1 << 3)   // data has not been received because of an problem (wrong checksum or similar)
+#define RED_STACK_TRANSCEIVE_RESULT_READ_NONE   (2 << 3)   // data has not been received because slave had none
+#define RED_STACK_TRANSCEIVE_RESULT_READ_OK     (3 << 3)   // data has been received
+
+#define RED_STACK_TRANSCEIVE_RESULT_MASK_SEND   0x7
+#define RED_STACK_TRANSCEIVE_RESULT_MASK_READ   0x38
+
+typedef enum {
+	RED_STACK_SLAVE_STATUS_ABSENT = 0,
+	RED_STACK_SLAVE_STATUS_AVAILABLE,
+} REDStackSlaveStatus;
+
+// Protocol state of a single slave, only accessed by the thread that does
+// the SPI transfers
+typedef struct {
+	uint8_t stack_address;
+	uint8_t sequence_number_master;
+	uint8_t sequence_number_slave;
+	REDStackSlaveStatus status;
+	bool next_packet_empty;
+} REDStackSPISlave;
+
+typedef enum {
+	RED_STACK_SPI_DISCOVERY_STATUS_SEND = 0, // stack enumerate request not received by the slave yet
+	RED_STACK_SPI_DISCOVERY_STATUS_RECEIVE, // waiting for the stack enumerate response
+	RED_STACK_SPI_DISCOVERY_STATUS_DONE,
+	RED_STACK_SPI_DISCOVERY_STATUS_FAILED
+} REDStackSPIDiscoveryStatus;
+
+// Discovery state of a single slave. The slave is polled at a short interval
+// that grows while it doesn't answer, until it answered the stack enumerate
+// request or the deadline passed
+typedef struct {
+	REDStackSPIDiscoveryStatus status;
+	uint64_t started_at; // microseconds
+	uint64_t deadline; // microseconds
+	uint64_t next_poll_at; // microseconds
+	uint32_t poll_interval; // microseconds
+} REDStackSPIDiscovery;
+
+// Exchanges length bytes with the slave at the given stack address in full
+// duplex. Returns the number of bytes exchanged or -1 on error with errno set
+typedef int (*REDStackSPITransferFunction)(void *opaque, uint8_t stack_address,
+                                           const uint8_t *tx, uint8_t *rx, int length);
+
+// The transport moves raw SPI frames between master and slaves. On a RED
+// Brick this is spidev plus the slave select GPIOs, but it can be replaced
+// by a simulator to test and benchmark the protocol without hardware
+typedef struct {
+	const char *name;
+	REDStackSPITransferFunction transfer;
+	void *opaque;
+} REDStackSPITransport;
+
+uint8_t red_stack_spi_calculate_pearson_hash(const uint8_t *data, const uint8_t length);
+
+void red_stack_spi_slave_init(REDStackSPISlave *slave, uint8_t stack_address);
+
+int red_stack_spi_transceive_message(REDStackSPITransport *transport,
+                                     REDStackSPISlave *slave,
+                                     Packet *packet_send, Packet *packet_recv);
+
+void red_stack_spi_discovery_start(REDStackSPIDiscovery *discovery,
+                                   REDStackSPISlave *slave,
+                                   uint64_t now, uint32_t timeout);
+REDStackSPIDiscoveryStatus red_stack_spi_discovery_poll(REDStackSPITransport *transport,
+                                                        REDStackSPIDiscovery *discovery,
+                                                        REDStackSPISlave *slave,
+                                                        StackEnumerateResponse *response,
+                                                        uint64_t now);
+
+#endif // BRICKD_RED_STACK_SPI_H
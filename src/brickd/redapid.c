@@ -21,9 +21,12 @@
 
 #include <errno.h>
 #include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
 #include <sys/un.h>
 
 #include <daemonlib/base58.h>
+#include <daemonlib/config.h>
 #include <daemonlib/event.h>
 #include <daemonlib/log.h>
 #include <daemonlib/queue.h>
@@ -35,11 +38,14 @@
 #include "hardware.h"
 #include "network.h"
 #include "red_usb_gadget.h"
+#include "redapid_shm.h"
 #include "stack.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
 #define RECONNECT_INTERVAL 2000000 // 2 seconds in microseconds
+#define SHM_RETRY_INTERVAL 1000 // 1 millisecond in microseconds
+#define MAX_SHM_BACKLOG 32768 // requests
 #define SOCKET_FILENAME "/var/run/redapid-brickd.socket"
 
 typedef struct {
@@ -50,15 +56,72 @@ typedef struct {
 	int response_used;
 	bool response_header_checked;
 	Writer request_writer;
+
+	// packets are exchanged over shared memory rings once redapid accepted
+	// the offer. the socket stays connected as fallback
+	REDAPIDSHM shm;
+	bool shm_offered;
+	bool shm_active;
+
+	// requests that cannot be committed to the requests ring yet, because
+	// the offer is still pending or the ring is full. they are kept here in
+	// order instead of being sent over the socket, because redapid reads the
+	// socket and the ring independently of each other
+	Queue shm_backlog;
+	bool shm_retrying;
 } REDBrickAPIDaemon;
 
 static REDBrickAPIDaemon _redapid;
 static Timer _reconnect_timer;
+static Timer _shm_retry_timer;
 static bool _connected = false;
 static bool _connect_error_warning = false;
 uint8_t _redapid_version[3] = { 2, 0, 0 };
 
+static void redapid_configure_shm_retry(bool retrying) {
+	uint64_t interval = retrying ? SHM_RETRY_INTERVAL : 0;
+
+	if (_redapid.shm_retrying == retrying) {
+		return;
+	}
+
+	if (timer_configure(&_shm_retry_timer, interval, interval) < 0) {
+		log_error("Could not %s shared memory retry timer for RED Brick API Daemon: %s (%d)",
+		          retrying ? "start" : "stop", get_errno_name(errno), errno);
+
+		return;
+	}
+
+	_redapid.shm_retrying = retrying;
+}
+
+static void redapid_clear_shm_backlog(void) {
+	while (_redapid.shm_backlog.count > 0) {
+		queue_pop(&_redapid.shm_backlog, NULL);
+	}
+}
+
+static void redapid_shm_release(void) {
+	if (!_redapid.shm_offered) {
+		return;
+	}
+
+	redapid_configure_shm_retry(false);
+
+	if (_redapid.shm_active) {
+		event_remove_source(_redapid.shm.response_event, EVENT_SOURCE_TYPE_GENERIC);
+	}
+
+	redapid_shm_destroy(&_redapid.shm);
+
+	_redapid.shm_offered = false;
+	_redapid.shm_active = false;
+}
+
 static void redapid_disconnect(bool reconnect) {
+	redapid_shm_release();
+	redapid_clear_shm_backlog();
+
 	writer_destroy(&_redapid.request_writer);
 
 	event_remove_source(_redapid.socket.base.handle, EVENT_SOURCE_TYPE_GENERIC);
@@ -78,6 +141,246 @@ static void redapid_disconnect(bool reconnect) {
 	}
 }
 
+static void redapid_commit_shm_request(Packet *request, Packet *queued_request) {
+	memcpy(queued_request, request, request->header.length);
+
+	if (redapid_shm_ring_commit(&_redapid.shm.layout->requests, _redapid.shm.request_event) < 0) {
+		log_error("Could not ring shared memory request event of RED Brick API Daemon: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+}
+
+// commits backlogged requests in order until the backlog is empty or the
+// requests ring is full again. redapid does not signal free space in the
+// requests ring, therefore, a timer retries while the backlog is not empty
+static void redapid_flush_shm_backlog(void) {
+	Packet *queued_request;
+
+	while (_redapid.shm_backlog.count > 0 &&
+	       (queued_request = redapid_shm_ring_reserve(&_redapid.shm.layout->requests)) != NULL) {
+		redapid_commit_shm_request(queue_peek(&_redapid.shm_backlog), queued_request);
+		queue_pop(&_redapid.shm_backlog, NULL);
+	}
+
+	redapid_configure_shm_retry(_redapid.shm_backlog.count > 0);
+}
+
+static void redapid_handle_shm_retry(void *opaque) {
+	(void)opaque;
+
+	if (_connected && _redapid.shm_active) {
+		redapid_flush_shm_backlog();
+	}
+}
+
+// sends the backlogged requests in order over the socket, after shared memory
+// was declined. stops if the writer disconnected redapid, which also clears
+// the backlog
+static void redapid_write_shm_backlog(void) {
+	while (_connected && _redapid.shm_backlog.count > 0) {
+		if (writer_write(&_redapid.request_writer, queue_peek(&_redapid.shm_backlog)) < 0) {
+			break;
+		}
+
+		queue_pop(&_redapid.shm_backlog, NULL);
+	}
+}
+
+static void redapid_backlog_shm_request(Packet *request) {
+	Packet *backlogged_request;
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+
+	if (_redapid.shm_backlog.count >= MAX_SHM_BACKLOG) {
+		log_warn("Shared memory backlog of RED Brick API Daemon is full, dropping oldest request (%s)",
+		         packet_get_request_signature(packet_signature, queue_peek(&_redapid.shm_backlog)));
+
+		queue_pop(&_redapid.shm_backlog, NULL);
+	}
+
+	backlogged_request = queue_push(&_redapid.shm_backlog);
+
+	if (backlogged_request == NULL) {
+		log_error("Could not push request (%s) to shared memory backlog of RED Brick API Daemon, dropping request: %s (%d)",
+		          packet_get_request_signature(packet_signature, request),
+		          get_errno_name(errno), errno);
+
+		return;
+	}
+
+	memcpy(backlogged_request, request, request->header.length);
+
+	if (_redapid.shm_active) {
+		redapid_configure_shm_retry(true);
+	}
+
+	log_packet_debug("Backlogged request to RED Brick API Daemon (count: %d)",
+	                 _redapid.shm_backlog.count);
+}
+
+// drains the responses ring after redapid rang the doorbell. each response is
+// copied out of the ring before it is validated, because redapid could still
+// modify the packet in the shared memory afterwards
+static void redapid_handle_shm_read(void *opaque) {
+	Packet *shm_response;
+	Packet response;
+	const char *message = NULL;
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+
+	(void)opaque;
+
+	if (redapid_shm_ring_acknowledge(_redapid.shm.response_event) < 0) {
+		log_error("Could not read from shared memory response event of RED Brick API Daemon: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return;
+	}
+
+	while (_connected && (shm_response = redapid_shm_ring_peek(&_redapid.shm.layout->responses)) != NULL) {
+		memcpy(&response.header, &shm_response->header, sizeof(PacketHeader));
+
+		if (!packet_header_is_valid_response(&response.header, &message)) {
+			log_error("Received invalid response (%s) from RED Brick API Daemon over shared memory, disconnecting redapid: %s",
+			          packet_get_response_signature(packet_signature, &response),
+			          message);
+
+			redapid_disconnect(true);
+
+			return;
+		}
+
+		memcpy(response.payload, shm_response->payload,
+		       response.header.length - sizeof(PacketHeader));
+
+		redapid_shm_ring_pop(&_redapid.shm.layout->responses);
+
+		log_packet_debug("Received %s (%s) from RED Brick API Daemon over shared memory",
+		                 packet_get_response_type(&response),
+		                 packet_get_response_signature(packet_signature, &response));
+
+		stack_add_recipient(&_redapid.base, response.header.uid, 0);
+
+		network_dispatch_response(&response);
+	}
+
+	// redapid made progress, so there might be free space in the requests ring
+	if (_connected && _redapid.shm_active && _redapid.shm_backlog.count > 0) {
+		redapid_flush_shm_backlog();
+	}
+}
+
+// redapid versions without shared memory support respond to the offer with
+// a function-not-supported error. then all packets keep going over the socket
+static void redapid_handle_shm_offer_response(Packet *response) {
+	int error_code = packet_header_get_error_code(&response->header);
+
+	if (error_code != PACKET_E_SUCCESS) {
+		log_info("RED Brick API Daemon declined shared memory (error code %d), using UNIX domain socket",
+		         error_code);
+
+		redapid_shm_release();
+		redapid_write_shm_backlog();
+
+		return;
+	}
+
+	if (_redapid.shm_active) {
+		return;
+	}
+
+	if (event_add_source(_redapid.shm.response_event, EVENT_SOURCE_TYPE_GENERIC,
+	                     EVENT_READ, redapid_handle_shm_read, NULL) < 0) {
+		log_error("Could not add shared memory response event of RED Brick API Daemon as event source, using UNIX domain socket");
+
+		redapid_shm_release();
+		redapid_write_shm_backlog();
+
+		return;
+	}
+
+	_redapid.shm_active = true;
+
+	log_info("Exchanging packets with RED Brick API Daemon over shared memory");
+
+	redapid_flush_shm_backlog();
+
+	// redapid might have committed responses before the offer response
+	// arrived over the socket
+	redapid_handle_shm_read(NULL);
+}
+
+// offers shared memory rings to redapid. the file descriptors are passed
+// along with the offer request over the socket
+static void redapid_offer_shm(void) {
+	REDAPIDSHMOfferRequest request;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	int fds[REDAPID_SHM_OFFER_FD_COUNT];
+	uint8_t control[CMSG_SPACE(sizeof(fds))];
+	ssize_t rc;
+
+	if (redapid_shm_create(&_redapid.shm) < 0) {
+		log_warn("Could not create shared memory for RED Brick API Daemon, using UNIX domain socket: %s (%d)",
+		         get_errno_name(errno), errno);
+
+		return;
+	}
+
+	memset(&request, 0, sizeof(request));
+
+	request.header.uid = red_usb_gadget_get_uid();
+	request.header.length = sizeof(request);
+	request.header.function_id = REDAPID_SHM_FUNCTION_OFFER;
+	packet_header_set_sequence_number(&request.header, 0);
+	packet_header_set_response_expected(&request.header, true);
+
+	request.magic = uint32_to_le(REDAPID_SHM_MAGIC);
+	request.version = uint32_to_le(REDAPID_SHM_VERSION);
+	request.size = uint32_to_le(sizeof(REDAPIDSHMLayout));
+	request.ring_capacity = uint32_to_le(REDAPID_SHM_RING_CAPACITY);
+
+	fds[0] = _redapid.shm.memfd;
+	fds[1] = _redapid.shm.request_event;
+	fds[2] = _redapid.shm.response_event;
+
+	iov.iov_base = &request;
+	iov.iov_len = sizeof(request);
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	// this is the first packet on a new connection, the socket buffer is
+	// empty and the writer has nothing queued yet
+	do {
+		rc = sendmsg(_redapid.socket.base.handle, &msg, MSG_NOSIGNAL);
+	} while (rc < 0 && errno_interrupted());
+
+	if (rc != (ssize_t)sizeof(request)) {
+		log_warn("Could not send shared memory offer to RED Brick API Daemon, using UNIX domain socket: %s (%d)",
+		         get_errno_name(errno), errno);
+
+		redapid_shm_destroy(&_redapid.shm);
+
+		return;
+	}
+
+	_redapid.shm_offered = true;
+
+	log_debug("Offered shared memory to RED Brick API Daemon");
+}
+
 static void redapid_handle_read(void *opaque) {
 	int length;
 	const char *message = NULL;
@@ -143,13 +446,19 @@ static void redapid_handle_read(void *opaque) {
 			break;
 		}
 
-		log_packet_debug("Received %s (%s) from RED Brick API Daemon",
-		                 packet_get_response_type(&_redapid.response),
-		                 packet_get_response_signature(packet_signature, &_redapid.response));
+		if (_redapid.shm_offered &&
+		    _redapid.response.header.function_id == REDAPID_SHM_FUNCTION_OFFER &&
+		    packet_header_get_sequence_number(&_redapid.response.header) == 0) {
+			redapid_handle_shm_offer_response(&_redapid.response);
+		} else {
+			log_packet_debug("Received %s (%s) from RED Brick API Daemon",
+			                 packet_get_response_type(&_redapid.response),
+			                 packet_get_response_signature(packet_signature, &_redapid.response));
 
-		stack_add_recipient(&_redapid.base, _redapid.response.header.uid, 0);
+			stack_add_recipient(&_redapid.base, _redapid.response.header.uid, 0);
 
-		network_dispatch_response(&_redapid.response);
+			network_dispatch_response(&_redapid.response);
+		}
 
 		memmove(&_redapid.response, (uint8_t *)&_redapid.response + length,
 		        _redapid.response_used - length);
@@ -164,6 +473,7 @@ static int redapid_dispatch_request(Stack *stack, Packet *request,
 	char base58[BASE58_MAX_LENGTH];
 	uint32_t uid; // always little endian
 	EnumerateCallback enumerate_callback;
+	Packet *queued_request;
 	int enqueued = 0;
 
 	(void)stack;
@@ -197,6 +507,17 @@ static int redapid_dispatch_request(Stack *stack, Packet *request,
 		enumerate_callback.enumeration_type = ENUMERATION_TYPE_AVAILABLE;
 
 		network_dispatch_response((Packet *)&enumerate_callback);
+	} else if (_connected && _redapid.shm_offered) {
+		// forward to redapid over shared memory. once offered, requests never
+		// go over the socket, otherwise redapid could receive them out of order
+		if (_redapid.shm_active && _redapid.shm_backlog.count == 0 &&
+		    (queued_request = redapid_shm_ring_reserve(&_redapid.shm.layout->requests)) != NULL) {
+			redapid_commit_shm_request(request, queued_request);
+
+			log_packet_debug("Committed request to RED Brick API Daemon over shared memory");
+		} else {
+			redapid_backlog_shm_request(request);
+		}
 	} else if (_connected) {
 		// forward to redapid
 		enqueued = writer_write(&_redapid.request_writer, request);
@@ -308,6 +629,10 @@ static void redapid_handle_reconnect(void *opaque) {
 
 	log_info("Connected to RED Brick API Daemon");
 
+	if (config_get_option_value("redapid.shared_memory")->boolean) {
+		redapid_offer_shm();
+	}
+
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
 	case 3:
@@ -408,6 +733,26 @@ int redapid_init(void) {
 
 	phase = 2;
 
+	// create shared memory retry timer
+	if (timer_create_(&_shm_retry_timer, redapid_handle_shm_retry, NULL) < 0) {
+		log_error("Could not create shared memory retry timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 3;
+
+	// create shared memory backlog
+	if (queue_create(&_redapid.shm_backlog, sizeof(Packet)) < 0) {
+		log_error("Could not create shared memory backlog: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 4;
+
 	if (timer_configure(&_reconnect_timer, 0, RECONNECT_INTERVAL) < 0) {
 		log_error("Could not start reconnect timer: %s (%d)",
 		          get_errno_name(errno), errno);
@@ -422,10 +767,16 @@ int redapid_init(void) {
 		goto cleanup;
 	}
 
-	phase = 3;
+	phase = 5;
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
+	case 4:
+		queue_destroy(&_redapid.shm_backlog, NULL);
+
+	case 3:
+		timer_destroy(&_shm_retry_timer);
+
 	case 2:
 		timer_destroy(&_reconnect_timer);
 
@@ -436,7 +787,7 @@ cleanup:
 		break;
 	}
 
-	return phase == 3 ? 0 : -1;
+	return phase == 5 ? 0 : -1;
 }
 
 void redapid_exit(void) {
@@ -448,6 +799,9 @@ void redapid_exit(void) {
 		redapid_disconnect(false);
 	}
 
+	queue_destroy(&_redapid.shm_backlog, NULL);
+
+	timer_destroy(&_shm_retry_timer);
 	timer_destroy(&_reconnect_timer);
 
 	stack_destroy(&_redapid.base);
@@ -0,0 +1,274 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * redapid_shm.c: Shared memory transport for the RED Brick API Daemon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * brickd creates a shared memory region containing two single-producer,
+ * single-consumer packet rings, one per direction, and two eventfds used as
+ * doorbells. the file descriptors are passed to redapid over the existing
+ * UNIX domain socket. the rings work like the SPSCRing, but the counters are
+ * part of the shared memory and the items are fixed size packets.
+ *
+ * a doorbell is only rung if a packet is committed to an empty ring. the
+ * consumer reads the doorbell and then pops packets until the ring is empty.
+ * this way a burst of packets costs one write and one read syscall instead
+ * of one send and one receive syscall per packet. to make this race free
+ * both sides issue a full memory barrier between updating their own counter
+ * and reading the other counter: either the producer sees that the ring was
+ * drained and rings the doorbell, or the consumer sees the new packet.
+ */
+
+#define _GNU_SOURCE // for mkostemp
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "redapid_shm.h"
+
+#define REDAPID_SHM_LOAD(variable) __atomic_load_n(&(variable), __ATOMIC_ACQUIRE)
+#define REDAPID_SHM_STORE(variable, value) __atomic_store_n(&(variable), (value), __ATOMIC_RELEASE)
+#define REDAPID_SHM_BARRIER() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#define REDAPID_SHM_MASK (REDAPID_SHM_RING_CAPACITY - 1)
+
+#ifndef MFD_CLOEXEC
+	#define MFD_CLOEXEC 0x0001U
+#endif
+
+// the C library of the RED Brick image might not provide memfd_create yet. if
+// the kernel doesn't support it either, then fall back to an unlinked file in
+// /dev/shm, which is equivalent for this purpose
+static int redapid_shm_create_file(void) {
+	char filename[] = "/dev/shm/brickd-redapid-XXXXXX";
+	int fd;
+
+#ifdef __NR_memfd_create
+	fd = syscall(__NR_memfd_create, "brickd-redapid", MFD_CLOEXEC);
+
+	if (fd >= 0 || errno != ENOSYS) {
+		return fd;
+	}
+#endif
+
+	fd = mkostemp(filename, O_CLOEXEC);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	unlink(filename);
+
+	return fd;
+}
+
+static void redapid_shm_close_events(REDAPIDSHM *shm) {
+	if (shm->request_event >= 0) {
+		close(shm->request_event);
+	}
+
+	if (shm->response_event >= 0) {
+		close(shm->response_event);
+	}
+}
+
+// creates the shared memory and the doorbells on the brickd side
+int redapid_shm_create(REDAPIDSHM *shm) {
+	int saved_errno;
+
+	shm->memfd = -1;
+	shm->layout = MAP_FAILED;
+	shm->request_event = -1;
+	shm->response_event = -1;
+
+	shm->memfd = redapid_shm_create_file();
+
+	if (shm->memfd < 0) {
+		goto error;
+	}
+
+	if (ftruncate(shm->memfd, sizeof(REDAPIDSHMLayout)) < 0) {
+		goto error;
+	}
+
+	shm->layout = mmap(NULL, sizeof(REDAPIDSHMLayout), PROT_READ | PROT_WRITE,
+	                   MAP_SHARED, shm->memfd, 0);
+
+	if (shm->layout == MAP_FAILED) {
+		goto error;
+	}
+
+	shm->request_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (shm->request_event < 0) {
+		goto error;
+	}
+
+	shm->response_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (shm->response_event < 0) {
+		goto error;
+	}
+
+	// ftruncate zero filled the memory, so both rings are empty already
+	shm->layout->magic = REDAPID_SHM_MAGIC;
+	shm->layout->version = REDAPID_SHM_VERSION;
+
+	return 0;
+
+error:
+	saved_errno = errno;
+
+	redapid_shm_destroy(shm);
+
+	errno = saved_errno;
+
+	return -1;
+}
+
+// maps shared memory received from brickd on the redapid side. takes
+// ownership of the file descriptors, even on error
+int redapid_shm_attach(REDAPIDSHM *shm, int memfd, int request_event, int response_event) {
+	struct stat st;
+	int saved_errno;
+
+	shm->memfd = memfd;
+	shm->layout = MAP_FAILED;
+	shm->request_event = request_event;
+	shm->response_event = response_event;
+
+	if (fstat(memfd, &st) < 0) {
+		goto error;
+	}
+
+	if (st.st_size != sizeof(REDAPIDSHMLayout)) {
+		errno = EINVAL;
+
+		goto error;
+	}
+
+	shm->layout = mmap(NULL, sizeof(REDAPIDSHMLayout), PROT_READ | PROT_WRITE,
+	                   MAP_SHARED, memfd, 0);
+
+	if (shm->layout == MAP_FAILED) {
+		goto error;
+	}
+
+	if (shm->layout->magic != REDAPID_SHM_MAGIC ||
+	    shm->layout->version != REDAPID_SHM_VERSION) {
+		errno = EPROTO;
+
+		goto error;
+	}
+
+	return 0;
+
+error:
+	saved_errno = errno;
+
+	redapid_shm_destroy(shm);
+
+	errno = saved_errno;
+
+	return -1;
+}
+
+void redapid_shm_destroy(REDAPIDSHM *shm) {
+	if (shm->layout != MAP_FAILED) {
+		munmap(shm->layout, sizeof(REDAPIDSHMLayout));
+	}
+
+	if (shm->memfd >= 0) {
+		close(shm->memfd);
+	}
+
+	redapid_shm_close_events(shm);
+
+	shm->memfd = -1;
+	shm->layout = MAP_FAILED;
+	shm->request_event = -1;
+	shm->response_event = -1;
+}
+
+// returns NULL if the ring is full
+Packet *redapid_shm_ring_reserve(REDAPIDSHMRing *ring) {
+	uint32_t head = ring->head; // only written by the producer itself
+
+	if (head - REDAPID_SHM_LOAD(ring->tail) >= REDAPID_SHM_RING_CAPACITY) {
+		return NULL;
+	}
+
+	return &ring->packets[head & REDAPID_SHM_MASK];
+}
+
+// must only be called after a successful redapid_shm_ring_reserve call.
+// returns 1 if the doorbell was rung, 0 if the consumer is still busy with
+// older packets and -1 if the doorbell could not be rung
+int redapid_shm_ring_commit(REDAPIDSHMRing *ring, int doorbell) {
+	uint32_t head = ring->head;
+	eventfd_t ev = 1;
+
+	REDAPID_SHM_STORE(ring->head, head + 1);
+	REDAPID_SHM_BARRIER();
+
+	if (REDAPID_SHM_LOAD(ring->tail) != head) {
+		return 0;
+	}
+
+	if (eventfd_write(doorbell, ev) < 0) {
+		return -1;
+	}
+
+	return 1;
+}
+
+// returns NULL if the ring is empty
+Packet *redapid_shm_ring_peek(REDAPIDSHMRing *ring) {
+	uint32_t tail = ring->tail; // only written by the consumer itself
+
+	if (REDAPID_SHM_LOAD(ring->head) == tail) {
+		return NULL;
+	}
+
+	return &ring->packets[tail & REDAPID_SHM_MASK];
+}
+
+// must only be called after a successful redapid_shm_ring_peek call
+void redapid_shm_ring_pop(REDAPIDSHMRing *ring) {
+	REDAPID_SHM_STORE(ring->tail, ring->tail + 1);
+	REDAPID_SHM_BARRIER();
+}
+
+// must be called before draining the ring after the doorbell became readable
+int redapid_shm_ring_acknowledge(int doorbell) {
+	eventfd_t ev;
+
+	if (eventfd_read(doorbell, &ev) < 0 && errno != EAGAIN) {
+		return -1;
+	}
+
+	return 0;
+}
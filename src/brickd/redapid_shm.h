@@ -0,0 +1,98 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * redapid_shm.h: Shared memory transport for the RED Brick API Daemon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_REDAPID_SHM_H
+#define BRICKD_REDAPID_SHM_H
+
+#include <stdint.h>
+
+#include <daemonlib/packet.h>
+
+#define REDAPID_SHM_MAGIC 0x4D485352 // "RSHM" in little endian
+#define REDAPID_SHM_VERSION 1
+#define REDAPID_SHM_RING_CAPACITY 256 // packets, power of two
+#define REDAPID_SHM_CACHE_LINE_SIZE 64
+
+// function ID of the offer request that brickd sends over the socket. it is
+// outside the range used by the RED Brick API. the request has sequence
+// number 0, that is never used by clients. redapid accepts the offer by
+// responding with error code success
+#define REDAPID_SHM_FUNCTION_OFFER 230
+
+#define REDAPID_SHM_OFFER_FD_COUNT 3 // memfd, request event, response event
+
+#include <daemonlib/packed_begin.h>
+
+typedef struct {
+	PacketHeader header;
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size; // of the shared memory in bytes
+	uint32_t ring_capacity;
+} ATTRIBUTE_PACKED REDAPIDSHMOfferRequest;
+
+typedef struct {
+	PacketHeader header;
+} ATTRIBUTE_PACKED REDAPIDSHMOfferResponse;
+
+#include <daemonlib/packed_end.h>
+
+// head is only written by the producer and tail is only written by the
+// consumer. keep them in separate cache lines to avoid false sharing
+typedef struct {
+	uint32_t head; // index of the next packet to be committed
+	uint8_t padding1[REDAPID_SHM_CACHE_LINE_SIZE - sizeof(uint32_t)];
+	uint32_t tail; // index of the next packet to be popped
+	uint8_t padding2[REDAPID_SHM_CACHE_LINE_SIZE - sizeof(uint32_t)];
+	Packet packets[REDAPID_SHM_RING_CAPACITY];
+} REDAPIDSHMRing;
+
+// layout of the shared memory. both processes map it at different addresses,
+// so it must not contain pointers
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint8_t padding[REDAPID_SHM_CACHE_LINE_SIZE - sizeof(uint32_t) * 2];
+	REDAPIDSHMRing requests; // brickd to redapid
+	REDAPIDSHMRing responses; // redapid to brickd
+} REDAPIDSHMLayout;
+
+typedef struct {
+	int memfd;
+	REDAPIDSHMLayout *layout;
+	int request_event; // doorbell for the requests ring, read by redapid
+	int response_event; // doorbell for the responses ring, read by brickd
+} REDAPIDSHM;
+
+int redapid_shm_create(REDAPIDSHM *shm);
+int redapid_shm_attach(REDAPIDSHM *shm, int memfd, int request_event, int response_event);
+void redapid_shm_destroy(REDAPIDSHM *shm);
+
+// producer side
+Packet *redapid_shm_ring_reserve(REDAPIDSHMRing *ring);
+int redapid_shm_ring_commit(REDAPIDSHMRing *ring, int doorbell);
+
+// consumer side
+Packet *redapid_shm_ring_peek(REDAPIDSHMRing *ring);
+void redapid_shm_ring_pop(REDAPIDSHMRing *ring);
+int redapid_shm_ring_acknowledge(int doorbell);
+
+#endif // BRICKD_REDAPID_SHM_H
@@ -0,0 +1,793 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * remote_stack.c: Stacks of other Brick Daemons reached over TCP/IP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a remote stack connects to another Brick Daemon as a normal client and
+ * forwards requests to it, like the redapid stack forwards requests to the
+ * RED Brick API Daemon. the UIDs behind the remote Brick Daemon are learned
+ * from its responses and callbacks, an enumerate request is sent after each
+ * connect to learn them all. this way one Brick Daemon can expose the
+ * devices of several hosts to its clients.
+ *
+ * requests are written as soon as they arrive, without waiting for the
+ * responses of earlier requests. the send times of requests that expect a
+ * response are kept to measure the round trip time to the remote host.
+ *
+ * the remote Brick Daemon has to have authentication disabled. two Brick
+ * Daemons must not list each other as remote hosts, because then requests
+ * for unknown UIDs would be forwarded in circles.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <daemonlib/array.h>
+#include <daemonlib/base58.h>
+#include <daemonlib/config.h>
+#include <daemonlib/event.h>
+#include <daemonlib/log.h>
+#include <daemonlib/socket.h>
+#include <daemonlib/timer.h>
+#include <daemonlib/utils.h>
+#include <daemonlib/writer.h>
+
+#include "remote_stack.h"
+
+#include "hardware.h"
+#include "network.h"
+#include "stack.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define RECONNECT_INTERVAL 2000000 // 2 seconds in microseconds
+#define STATISTICS_INTERVAL 60000000 // 60 seconds in microseconds
+#define MAX_REMOTE_STACKS 8
+#define MAX_HOST_LENGTH 256
+#define MAX_PORT_LENGTH 8
+#define MAX_PENDING_REQUESTS 256
+
+typedef struct {
+	PacketHeader header;
+	uint64_t sent_at; // in usec
+	bool answered;
+} RemotePendingRequest;
+
+typedef struct {
+	Stack base;
+
+	char host[MAX_HOST_LENGTH];
+	char port[MAX_PORT_LENGTH];
+	Timer reconnect_timer;
+	Timer statistics_timer; // logs the statistics while connected
+	bool connect_error_warning;
+	bool connecting;
+	bool connected;
+
+	Socket socket;
+	Packet response;
+	int response_used;
+	bool response_header_checked;
+	Writer request_writer;
+
+	// ring of requests that wait for a response, oldest first
+	RemotePendingRequest pending_requests[MAX_PENDING_REQUESTS];
+	int pending_request_first;
+	int pending_request_count;
+
+	// statistics of the current connection
+	uint64_t request_count;
+	uint64_t response_count;
+	uint64_t lost_response_count;
+	uint64_t round_trip_time_sum; // in usec
+	uint32_t round_trip_time_min; // in usec
+	uint32_t round_trip_time_max; // in usec
+} RemoteStack;
+
+static RemoteStack _remote_stacks[MAX_REMOTE_STACKS];
+static int _remote_stack_count = 0;
+
+static void remote_stack_reset_statistics(RemoteStack *remote) {
+	remote->pending_request_first = 0;
+	remote->pending_request_count = 0;
+	remote->request_count = 0;
+	remote->response_count = 0;
+	remote->lost_response_count = 0;
+	remote->round_trip_time_sum = 0;
+	remote->round_trip_time_min = UINT32_MAX;
+	remote->round_trip_time_max = 0;
+}
+
+static void remote_stack_log_statistics(RemoteStack *remote) {
+	uint32_t average = 0;
+
+	if (remote->response_count > 0) {
+		average = (uint32_t)(remote->round_trip_time_sum / remote->response_count);
+	}
+
+	log_info("Remote Brick Daemon at %s:%s: %llu request(s), %llu response(s), %llu lost, round trip time avg/min/max %u/%u/%u usec",
+	         remote->host, remote->port, (unsigned long long)remote->request_count,
+	         (unsigned long long)remote->response_count,
+	         (unsigned long long)remote->lost_response_count, average,
+	         remote->response_count > 0 ? remote->round_trip_time_min : 0,
+	         remote->round_trip_time_max);
+}
+
+static void remote_stack_handle_statistics(void *opaque) {
+	remote_stack_log_statistics(opaque);
+}
+
+static void remote_stack_track_request(RemoteStack *remote, Packet *request) {
+	RemotePendingRequest *pending_request;
+
+	++remote->request_count;
+
+	if (!packet_header_get_response_expected(&request->header)) {
+		return;
+	}
+
+	// forget the oldest request if the remote host is too slow to keep up
+	if (remote->pending_request_count == MAX_PENDING_REQUESTS) {
+		if (!remote->pending_requests[remote->pending_request_first].answered) {
+			++remote->lost_response_count;
+		}
+
+		remote->pending_request_first = (remote->pending_request_first + 1) % MAX_PENDING_REQUESTS;
+		--remote->pending_request_count;
+	}
+
+	pending_request = &remote->pending_requests[(remote->pending_request_first +
+	                                             remote->pending_request_count) % MAX_PENDING_REQUESTS];
+
+	pending_request->header = request->header;
+	pending_request->sent_at = microseconds();
+	pending_request->answered = false;
+
+	++remote->pending_request_count;
+}
+
+static void remote_stack_track_response(RemoteStack *remote, Packet *response) {
+	RemotePendingRequest *pending_request;
+	uint32_t round_trip_time;
+	int i;
+
+	for (i = 0; i < remote->pending_request_count; ++i) {
+		pending_request = &remote->pending_requests[(remote->pending_request_first + i) % MAX_PENDING_REQUESTS];
+
+		if (!pending_request->answered &&
+		    packet_is_matching_response(response, &pending_request->header)) {
+			round_trip_time = (uint32_t)(microseconds() - pending_request->sent_at);
+
+			++remote->response_count;
+			remote->round_trip_time_sum += round_trip_time;
+
+			if (round_trip_time < remote->round_trip_time_min) {
+				remote->round_trip_time_min = round_trip_time;
+			}
+
+			if (round_trip_time > remote->round_trip_time_max) {
+				remote->round_trip_time_max = round_trip_time;
+			}
+
+			pending_request->answered = true;
+
+			break;
+		}
+	}
+
+	// drop answered requests from the front of the ring
+	while (remote->pending_request_count > 0 &&
+	       remote->pending_requests[remote->pending_request_first].answered) {
+		remote->pending_request_first = (remote->pending_request_first + 1) % MAX_PENDING_REQUESTS;
+		--remote->pending_request_count;
+	}
+}
+
+static void remote_stack_disconnect(RemoteStack *remote, bool reconnect) {
+	int i;
+
+	if (remote->connected) {
+		writer_destroy(&remote->request_writer);
+	}
+
+	event_remove_source(remote->socket.base.handle, EVENT_SOURCE_TYPE_GENERIC);
+	socket_destroy(&remote->socket);
+
+	if (remote->connected) {
+		for (i = 0; i < remote->pending_request_count; ++i) {
+			if (!remote->pending_requests[(remote->pending_request_first + i) % MAX_PENDING_REQUESTS].answered) {
+				++remote->lost_response_count;
+			}
+		}
+
+		if (timer_configure(&remote->statistics_timer, 0, 0) < 0) {
+			log_error("Could not stop statistics timer: %s (%d)",
+			          get_errno_name(errno), errno);
+		}
+
+		remote_stack_log_statistics(remote);
+
+		// the devices of the remote host are not reachable anymore
+		stack_announce_disconnect(&remote->base);
+		array_resize(&remote->base.recipients, 0, NULL);
+	}
+
+	remote->connecting = false;
+	remote->connected = false;
+
+	if (reconnect) {
+		// start reconnect timer
+		if (timer_configure(&remote->reconnect_timer, 0, RECONNECT_INTERVAL) < 0) {
+			log_error("Could not start reconnect timer for remote Brick Daemon at %s:%s: %s (%d)",
+			          remote->host, remote->port, get_errno_name(errno), errno);
+
+			return;
+		}
+	}
+}
+
+static void remote_stack_handle_read(void *opaque) {
+	RemoteStack *remote = opaque;
+	int length;
+	const char *message = NULL;
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+
+	length = socket_receive(&remote->socket, (uint8_t *)&remote->response + remote->response_used,
+	                        sizeof(Packet) - remote->response_used);
+
+	if (length == 0) {
+		log_info("Remote Brick Daemon at %s:%s disconnected by peer",
+		         remote->host, remote->port);
+
+		remote_stack_disconnect(remote, true);
+
+		return;
+	}
+
+	if (length < 0) {
+		if (length == IO_CONTINUE) {
+			// no actual data received
+		} else if (errno_interrupted()) {
+			log_debug("Receiving from remote Brick Daemon at %s:%s was interrupted, retrying",
+			          remote->host, remote->port);
+		} else if (errno_would_block()) {
+			log_debug("Receiving from remote Brick Daemon at %s:%s would block, retrying",
+			          remote->host, remote->port);
+		} else {
+			log_error("Could not receive from remote Brick Daemon at %s:%s, disconnecting: %s (%d)",
+			          remote->host, remote->port, get_errno_name(errno), errno);
+
+			remote_stack_disconnect(remote, true);
+		}
+
+		return;
+	}
+
+	remote->response_used += length;
+
+	while (remote->connected && remote->response_used > 0) {
+		if (remote->response_used < (int)sizeof(PacketHeader)) {
+			// wait for complete header
+			break;
+		}
+
+		if (!remote->response_header_checked) {
+			if (!packet_header_is_valid_response(&remote->response.header, &message)) {
+				log_error("Received invalid response (%s) from remote Brick Daemon at %s:%s, disconnecting: %s",
+				          packet_get_response_signature(packet_signature, &remote->response),
+				          remote->host, remote->port, message);
+
+				remote_stack_disconnect(remote, true);
+
+				return;
+			}
+
+			remote->response_header_checked = true;
+		}
+
+		length = remote->response.header.length;
+
+		if (remote->response_used < length) {
+			// wait for complete packet
+			break;
+		}
+
+		log_packet_debug("Received %s (%s) from remote Brick Daemon at %s:%s",
+		                 packet_get_response_type(&remote->response),
+		                 packet_get_response_signature(packet_signature, &remote->response),
+		                 remote->host, remote->port);
+
+		if (packet_header_get_sequence_number(&remote->response.header) != 0) {
+			remote_stack_track_response(remote, &remote->response);
+		}
+
+		stack_add_recipient(&remote->base, remote->response.header.uid, 0);
+
+		network_dispatch_response(&remote->response);
+
+		memmove(&remote->response, (uint8_t *)&remote->response + length,
+		        remote->response_used - length);
+
+		remote->response_used -= length;
+		remote->response_header_checked = false;
+	}
+}
+
+static int remote_stack_dispatch_request(Stack *stack, Packet *request,
+                                         Recipient *recipient) {
+	RemoteStack *remote = containerof(stack, RemoteStack, base);
+	int enqueued = 0;
+
+	(void)recipient;
+
+	if (!remote->connected) {
+		log_packet_debug("Not connected to remote Brick Daemon at %s:%s, ignoring request",
+		                 remote->host, remote->port);
+
+		return 0;
+	}
+
+	enqueued = writer_write(&remote->request_writer, request);
+
+	if (enqueued < 0) {
+		return -1;
+	}
+
+	remote_stack_track_request(remote, request);
+
+	log_packet_debug("%s request to remote Brick Daemon at %s:%s",
+	                 enqueued ? "Enqueued" : "Sent", remote->host, remote->port);
+
+	return 0;
+}
+
+static char *remote_stack_get_recipient_signature(char *signature, bool upper, void *opaque) {
+	RemoteStack *remote = opaque;
+
+	snprintf(signature, WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH,
+	         "%cemote Brick Daemon at %s:%s", upper ? 'R' : 'r',
+	         remote->host, remote->port);
+
+	return signature;
+}
+
+static void remote_stack_recipient_disconnect(void *opaque) {
+	remote_stack_disconnect(opaque, true);
+}
+
+static void remote_stack_handle_connected(RemoteStack *remote) {
+	Packet enumerate_request;
+
+	if (event_modify_source(remote->socket.base.handle, EVENT_SOURCE_TYPE_GENERIC,
+	                        EVENT_WRITE, EVENT_READ, remote_stack_handle_read, remote) < 0) {
+		remote_stack_disconnect(remote, true);
+
+		return;
+	}
+
+	// create request writer
+	if (writer_create(&remote->request_writer, &remote->socket.base,
+	                  "request", packet_get_request_signature,
+	                  "remote", remote_stack_get_recipient_signature,
+	                  remote_stack_recipient_disconnect, remote) < 0) {
+		log_error("Could not create request writer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		remote_stack_disconnect(remote, true);
+
+		return;
+	}
+
+	// stop reconnect timer
+	if (timer_configure(&remote->reconnect_timer, 0, 0) < 0) {
+		log_error("Could not stop reconnect timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		writer_destroy(&remote->request_writer);
+		remote_stack_disconnect(remote, true);
+
+		return;
+	}
+
+	remote->connecting = false;
+	remote->connected = true;
+	remote->connect_error_warning = false;
+
+	remote_stack_reset_statistics(remote);
+
+	log_info("Connected to remote Brick Daemon at %s:%s", remote->host, remote->port);
+
+	// the statistics are logged on disconnect as well, a failure to start
+	// the timer is not fatal
+	if (timer_configure(&remote->statistics_timer, 0, STATISTICS_INTERVAL) < 0) {
+		log_error("Could not start statistics timer: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+
+	// learn the UIDs behind the remote Brick Daemon. the enumerate callbacks
+	// are forwarded to the clients as for any other stack
+	memset(&enumerate_request, 0, sizeof(enumerate_request));
+
+	enumerate_request.header.uid = 0;
+	enumerate_request.header.length = sizeof(PacketHeader);
+	enumerate_request.header.function_id = FUNCTION_ENUMERATE;
+	packet_header_set_sequence_number(&enumerate_request.header, 1);
+	packet_header_set_response_expected(&enumerate_request.header, false);
+
+	remote_stack_dispatch_request(&remote->base, &enumerate_request, NULL);
+}
+
+static void remote_stack_handle_connect(void *opaque) {
+	RemoteStack *remote = opaque;
+	int error = 0;
+	socklen_t length = sizeof(error);
+
+	if (getsockopt(remote->socket.base.handle, SOL_SOCKET, SO_ERROR, &error, &length) < 0) {
+		error = errno;
+	}
+
+	if (error != 0) {
+		if (!remote->connect_error_warning) {
+			log_warn("Could not connect to remote Brick Daemon at %s:%s, retrying with 2 second interval: %s (%d)",
+			         remote->host, remote->port, get_errno_name(error), error);
+		}
+
+		remote->connect_error_warning = true;
+
+		remote_stack_disconnect(remote, false); // reconnect timer is still running
+
+		return;
+	}
+
+	remote_stack_handle_connected(remote);
+}
+
+static void remote_stack_handle_reconnect(void *opaque) {
+	RemoteStack *remote = opaque;
+	int phase = 0;
+	struct addrinfo hints;
+	struct addrinfo *address = NULL;
+	int flags;
+	int nodelay = 1;
+	int rc;
+
+	// a connect attempt that did not finish within the reconnect interval
+	// is given up and started over
+	if (remote->connecting) {
+		remote_stack_disconnect(remote, false);
+	}
+
+	remote->response_used = 0;
+	remote->response_header_checked = false;
+
+	log_debug("Connecting to remote Brick Daemon at %s:%s", remote->host, remote->port);
+
+	memset(&hints, 0, sizeof(hints));
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	rc = getaddrinfo(remote->host, remote->port, &hints, &address);
+
+	if (rc != 0) {
+		if (!remote->connect_error_warning) {
+			log_warn("Could not resolve remote Brick Daemon host '%s', retrying with 2 second interval: %s (%d)",
+			         remote->host, gai_strerror(rc), rc);
+		}
+
+		remote->connect_error_warning = true;
+
+		goto cleanup;
+	}
+
+	// create socket
+	if (socket_create(&remote->socket) < 0) {
+		log_error("Could not create socket: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	if (socket_open(&remote->socket, address->ai_family, address->ai_socktype,
+	                address->ai_protocol) < 0) {
+		log_error("Could not open socket for remote Brick Daemon at %s:%s: %s (%d)",
+		          remote->host, remote->port, get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	// connect without blocking the event loop, an unreachable host can take
+	// minutes to time out
+	flags = fcntl(remote->socket.base.handle, F_GETFL, 0);
+
+	if (flags < 0 || fcntl(remote->socket.base.handle, F_SETFL, flags | O_NONBLOCK) < 0) {
+		log_error("Could not enable non-blocking mode for remote Brick Daemon socket: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	// requests are forwarded one by one, don't delay them
+	setsockopt(remote->socket.base.handle, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+	// add socket as event source, it becomes writable once connected
+	if (event_add_source(remote->socket.base.handle, EVENT_SOURCE_TYPE_GENERIC,
+	                     EVENT_WRITE, remote_stack_handle_connect, remote) < 0) {
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	remote->connecting = true;
+
+	if (connect(remote->socket.base.handle, address->ai_addr, address->ai_addrlen) < 0) {
+		if (errno == EINPROGRESS) {
+			phase = 3;
+
+			goto cleanup;
+		}
+
+		if (!remote->connect_error_warning) {
+			log_warn("Could not connect to remote Brick Daemon at %s:%s, retrying with 2 second interval: %s (%d)",
+			         remote->host, remote->port, get_errno_name(errno), errno);
+		}
+
+		remote->connect_error_warning = true;
+		remote->connecting = false;
+
+		goto cleanup;
+	}
+
+	phase = 3;
+
+	remote_stack_handle_connected(remote);
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 2:
+		event_remove_source(remote->socket.base.handle, EVENT_SOURCE_TYPE_GENERIC);
+
+	case 1:
+		socket_destroy(&remote->socket);
+
+	default:
+		break;
+	}
+
+	if (address != NULL) {
+		freeaddrinfo(address);
+	}
+}
+
+// splits an entry of the remote.hosts option into host and port. the port
+// is optional, IPv6 addresses with port have to be written as [address]:port
+static int remote_stack_parse_host(RemoteStack *remote, const char *entry, int length) {
+	const char *port = NULL;
+	int host_length = length;
+	int port_length = 0;
+	const char *colon = memchr(entry, ':', length);
+
+	if (entry[0] == '[') {
+		colon = memchr(entry, ']', length);
+
+		if (colon == NULL) {
+			return -1;
+		}
+
+		++entry;
+		host_length = (int)(colon - entry);
+
+		if (colon + 1 < entry - 1 + length) {
+			if (colon[1] != ':') {
+				return -1;
+			}
+
+			port = colon + 2;
+			port_length = (int)(entry - 1 + length - port);
+		}
+	} else if (colon != NULL && memchr(colon + 1, ':', length - (colon + 1 - entry)) == NULL) {
+		host_length = (int)(colon - entry);
+		port = colon + 1;
+		port_length = length - host_length - 1;
+	}
+
+	if (host_length < 1 || host_length >= MAX_HOST_LENGTH ||
+	    (port != NULL && (port_length < 1 || port_length >= MAX_PORT_LENGTH))) {
+		return -1;
+	}
+
+	memcpy(remote->host, entry, host_length);
+	remote->host[host_length] = '\0';
+
+	if (port != NULL) {
+		memcpy(remote->port, port, port_length);
+		remote->port[port_length] = '\0';
+	} else {
+		string_copy(remote->port, sizeof(remote->port), "4223");
+	}
+
+	return 0;
+}
+
+static int remote_stack_create(RemoteStack *remote) {
+	int phase = 0;
+	char name[STACK_MAX_NAME_LENGTH];
+
+	snprintf(name, sizeof(name), "remote-%s:%s", remote->host, remote->port);
+
+	// create base stack
+	if (stack_create(&remote->base, name, remote_stack_dispatch_request) < 0) {
+		log_error("Could not create base stack for remote Brick Daemon at %s:%s: %s (%d)",
+		          remote->host, remote->port, get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	// create reconnect timer
+	if (timer_create_(&remote->reconnect_timer, remote_stack_handle_reconnect, remote) < 0) {
+		log_error("Could not create reconnect timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	// create statistics timer
+	if (timer_create_(&remote->statistics_timer, remote_stack_handle_statistics, remote) < 0) {
+		log_error("Could not create statistics timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 3;
+
+	if (timer_configure(&remote->reconnect_timer, 0, RECONNECT_INTERVAL) < 0) {
+		log_error("Could not start reconnect timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	// add to stacks array
+	if (hardware_add_stack(&remote->base) < 0) {
+		goto cleanup;
+	}
+
+	phase = 4;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 3:
+		timer_destroy(&remote->statistics_timer);
+
+	case 2:
+		timer_destroy(&remote->reconnect_timer);
+
+	case 1:
+		stack_destroy(&remote->base);
+
+	default:
+		break;
+	}
+
+	return phase == 4 ? 0 : -1;
+}
+
+static void remote_stack_destroy(RemoteStack *remote) {
+	hardware_remove_stack(&remote->base);
+
+	if (remote->connecting || remote->connected) {
+		remote_stack_disconnect(remote, false);
+	}
+
+	timer_destroy(&remote->statistics_timer);
+	timer_destroy(&remote->reconnect_timer);
+
+	stack_destroy(&remote->base);
+}
+
+int remote_stack_init(void) {
+	const char *hosts = config_get_option_value("remote.hosts")->string;
+	const char *entry;
+	int length;
+	RemoteStack *remote;
+
+	if (hosts == NULL) {
+		return 0;
+	}
+
+	log_debug("Initializing remote stack subsystem");
+
+	// the hosts are separated by spaces or commas
+	while (*hosts != '\0') {
+		length = (int)strcspn(hosts, " ,");
+		entry = hosts;
+		hosts += length;
+
+		if (*hosts != '\0') {
+			++hosts;
+		}
+
+		if (length == 0) {
+			continue;
+		}
+
+		if (_remote_stack_count >= MAX_REMOTE_STACKS) {
+			log_warn("Cannot connect to more than %d remote Brick Daemons, ignoring the rest",
+			         MAX_REMOTE_STACKS);
+
+			break;
+		}
+
+		remote = &_remote_stacks[_remote_stack_count];
+
+		memset(remote, 0, sizeof(*remote));
+
+		if (remote_stack_parse_host(remote, entry, length) < 0) {
+			log_error("Invalid remote Brick Daemon host '%.*s'", length, entry);
+
+			goto error;
+		}
+
+		if (remote_stack_create(remote) < 0) {
+			goto error;
+		}
+
+		log_info("Forwarding requests to remote Brick Daemon at %s:%s",
+		         remote->host, remote->port);
+
+		++_remote_stack_count;
+	}
+
+	return 0;
+
+error:
+	remote_stack_exit();
+
+	return -1;
+}
+
+void remote_stack_exit(void) {
+	int i;
+
+	if (_remote_stack_count == 0) {
+		return;
+	}
+
+	log_debug("Shutting down remote stack subsystem");
+
+	for (i = 0; i < _remote_stack_count; ++i) {
+		remote_stack_destroy(&_remote_stacks[i]);
+	}
+
+	_remote_stack_count = 0;
+}
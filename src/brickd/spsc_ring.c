@@ -0,0 +1,108 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * spsc_ring.c: Lock-free single-producer/single-consumer ring buffer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * the ring has a fixed capacity and stores its items inline. one thread
+ * produces items by calling spsc_ring_reserve to get the next free item,
+ * filling it and making it visible to the consumer with spsc_ring_commit.
+ * another thread consumes items by calling spsc_ring_peek to get the oldest
+ * committed item and releasing it with spsc_ring_pop. head and tail are free
+ * running counters, the item index is obtained by masking them. therefore,
+ * the capacity has to be a power of two.
+ *
+ * synchronization is done with the GCC __atomic builtins (GCC 4.7 or newer).
+ * each side only writes its own counter with release semantic and reads the
+ * other counter with acquire semantic.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "spsc_ring.h"
+
+#define SPSC_RING_LOAD(variable) __atomic_load_n(&(variable), __ATOMIC_ACQUIRE)
+#define SPSC_RING_STORE(variable, value) __atomic_store_n(&(variable), (value), __ATOMIC_RELEASE)
+
+int spsc_ring_create(SPSCRing *ring, uint32_t capacity, int item_size) {
+	if (capacity == 0 || (capacity & (capacity - 1)) != 0 || item_size <= 0) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	ring->items = calloc(capacity, item_size);
+
+	if (ring->items == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	ring->item_size = item_size;
+	ring->capacity = capacity;
+	ring->mask = capacity - 1;
+	ring->head = 0;
+	ring->tail = 0;
+
+	return 0;
+}
+
+void spsc_ring_destroy(SPSCRing *ring) {
+	free(ring->items);
+}
+
+// the result is exact if called by the consumer or the producer while the
+// other side is not active, otherwise it is a snapshot
+uint32_t spsc_ring_count(SPSCRing *ring) {
+	return SPSC_RING_LOAD(ring->head) - SPSC_RING_LOAD(ring->tail);
+}
+
+// returns NULL if the ring is full
+void *spsc_ring_reserve(SPSCRing *ring) {
+	uint32_t head = ring->head; // only written by the producer itself
+
+	if (head - SPSC_RING_LOAD(ring->tail) >= ring->capacity) {
+		return NULL;
+	}
+
+	return ring->items + (head & ring->mask) * ring->item_size;
+}
+
+// must only be called after a successful spsc_ring_reserve call
+void spsc_ring_commit(SPSCRing *ring) {
+	SPSC_RING_STORE(ring->head, ring->head + 1);
+}
+
+// returns NULL if the ring is empty
+void *spsc_ring_peek(SPSCRing *ring) {
+	uint32_t tail = ring->tail; // only written by the consumer itself
+
+	if (SPSC_RING_LOAD(ring->head) == tail) {
+		return NULL;
+	}
+
+	return ring->items + (tail & ring->mask) * ring->item_size;
+}
+
+// must only be called after a successful spsc_ring_peek call
+void spsc_ring_pop(SPSCRing *ring) {
+	SPSC_RING_STORE(ring->tail, ring->tail + 1);
+}
@@ -0,0 +1,57 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * spsc_ring.h: Lock-free single-producer/single-consumer ring buffer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_SPSC_RING_H
+#define BRICKD_SPSC_RING_H
+
+#include <stdint.h>
+
+#define SPSC_RING_CACHE_LINE_SIZE 64
+
+typedef struct {
+	uint8_t *items;
+	int item_size;
+	uint32_t capacity; // power of two
+	uint32_t mask;
+
+	// head is only written by the producer and tail is only written by the
+	// consumer. keep them in separate cache lines to avoid false sharing
+	uint8_t padding1[SPSC_RING_CACHE_LINE_SIZE];
+	uint32_t head; // index of the next item to be committed
+	uint8_t padding2[SPSC_RING_CACHE_LINE_SIZE - sizeof(uint32_t)];
+	uint32_t tail; // index of the next item to be popped
+	uint8_t padding3[SPSC_RING_CACHE_LINE_SIZE - sizeof(uint32_t)];
+} SPSCRing;
+
+int spsc_ring_create(SPSCRing *ring, uint32_t capacity, int item_size);
+void spsc_ring_destroy(SPSCRing *ring);
+
+uint32_t spsc_ring_count(SPSCRing *ring);
+
+// producer side
+void *spsc_ring_reserve(SPSCRing *ring);
+void spsc_ring_commit(SPSCRing *ring);
+
+// consumer side
+void *spsc_ring_peek(SPSCRing *ring);
+void spsc_ring_pop(SPSCRing *ring);
+
+#endif // BRICKD_SPSC_RING_H
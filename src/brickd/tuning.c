@@ -0,0 +1,195 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * tuning.c: Runtime tuning of performance parameters
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * each tuning parameter is backed by a brickd.conf option. the option defines
+ * the valid range and its value is updated on change, so the config always
+ * reflects the current value. the subsystem owning the parameter applies a
+ * new value immediately. optionally the value is written to the config file,
+ * so it survives a restart of brickd.
+ *
+ * read-only parameters report statistics. they have no config option and no
+ * set function.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <daemonlib/conf_file.h>
+#include <daemonlib/config.h>
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "tuning.h"
+
+#include "network.h"
+#ifdef BRICKD_WITH_RED_BRICK
+	#include "red_rs485_extension.h"
+	#include "red_stack.h"
+#endif
+#include "usb_stack.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+typedef struct {
+	const char *option;
+	int (*get)(void);
+	void (*set)(int value);
+} TuningParameterInfo;
+
+// indexed by TuningParameter. parameters of subsystems that are not part of
+// this build have no get and set functions
+static TuningParameterInfo _parameters[TUNING_PARAMETER_COUNT] = {
+#ifdef BRICKD_WITH_RED_BRICK
+	{ "poll_delay.spi", red_stack_get_poll_delay, red_stack_set_poll_delay },
+	{ "poll_delay.rs485", red_rs485_extension_get_poll_delay, red_rs485_extension_set_poll_delay },
+#else
+	{ "poll_delay.spi", NULL, NULL },
+	{ "poll_delay.rs485", NULL, NULL },
+#endif
+	{ "queue_limit.usb_writes", usb_stack_get_max_queued_writes, usb_stack_set_max_queued_writes },
+	{ "queue_limit.client_pending_requests", network_get_max_pending_requests, network_set_max_pending_requests },
+#ifdef BRICKD_WITH_RED_BRICK
+	{ NULL, red_stack_get_dropped_requests, NULL }
+#else
+	{ NULL, NULL, NULL }
+#endif
+};
+
+static const char *_config_filename = NULL;
+
+static ConfigOption *tuning_get_config_option(const char *name) {
+	int i;
+
+	for (i = 0; config_options[i].name != NULL; ++i) {
+		if (strcmp(config_options[i].name, name) == 0) {
+			return &config_options[i];
+		}
+	}
+
+	return NULL;
+}
+
+static int tuning_write_config_file(const char *name, int value) {
+	ConfFile conf_file;
+	char buffer[32];
+	int rc = -1;
+
+	if (conf_file_create(&conf_file) < 0) {
+		log_error("Could not create config file object: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	// a missing config file is created with just this option in it
+	if (conf_file_read(&conf_file, _config_filename, NULL, NULL) < 0 && errno != ENOENT) {
+		log_error("Could not read config file '%s': %s (%d)",
+		          _config_filename, get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	snprintf(buffer, sizeof(buffer), "%d", value);
+
+	if (conf_file_set_option_value(&conf_file, name, buffer) < 0) {
+		log_error("Could not set option %s in config file object: %s (%d)",
+		          name, get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	if (conf_file_write(&conf_file, _config_filename) < 0) {
+		log_error("Could not write config file '%s': %s (%d)",
+		          _config_filename, get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	rc = 0;
+
+cleanup:
+	conf_file_destroy(&conf_file);
+
+	return rc;
+}
+
+void tuning_init(const char *config_filename) {
+	_config_filename = config_filename;
+}
+
+PacketE tuning_get_parameter(int parameter, uint32_t *value) {
+	if (parameter < 0 || parameter >= TUNING_PARAMETER_COUNT ||
+	    _parameters[parameter].get == NULL) {
+		return PACKET_E_INVALID_PARAMETER;
+	}
+
+	*value = (uint32_t)_parameters[parameter].get();
+
+	return PACKET_E_SUCCESS;
+}
+
+PacketE tuning_set_parameter(int parameter, uint32_t value, bool persist) {
+	TuningParameterInfo *info;
+	ConfigOption *option;
+
+	if (parameter < 0 || parameter >= TUNING_PARAMETER_COUNT ||
+	    _parameters[parameter].set == NULL) {
+		return PACKET_E_INVALID_PARAMETER;
+	}
+
+	info = &_parameters[parameter];
+	option = tuning_get_config_option(info->option);
+
+	if (option == NULL) {
+		log_error("Config option %s for tuning parameter %d is missing",
+		          info->option, parameter);
+
+		return PACKET_E_UNKNOWN_ERROR;
+	}
+
+	if (value > INT32_MAX || (int32_t)value < option->integer_min ||
+	    (int32_t)value > option->integer_max) {
+		log_warn("Value %u for %s is out of range [%d..%d], ignoring it",
+		         value, info->option, option->integer_min, option->integer_max);
+
+		return PACKET_E_INVALID_PARAMETER;
+	}
+
+	log_info("Changing %s from %d to %u", info->option, info->get(), value);
+
+	info->set((int)value);
+	option->value.integer = (int32_t)value;
+
+	if (persist) {
+		if (_config_filename == NULL || tuning_write_config_file(info->option, (int)value) < 0) {
+			log_error("Could not write %s to config file, the change will be lost on restart",
+			          info->option);
+
+			return PACKET_E_UNKNOWN_ERROR;
+		}
+
+		log_info("Wrote %s = %u to config file '%s'", info->option, value, _config_filename);
+	}
+
+	return PACKET_E_SUCCESS;
+}
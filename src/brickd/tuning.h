@@ -0,0 +1,74 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * tuning.h: Runtime tuning of performance parameters
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_TUNING_H
+#define BRICKD_TUNING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <daemonlib/packet.h>
+
+// brickd functions, called with UID 1
+#define FUNCTION_GET_TUNING_PARAMETER 3
+#define FUNCTION_SET_TUNING_PARAMETER 4
+
+typedef enum {
+	TUNING_PARAMETER_POLL_DELAY_SPI = 0, // microseconds
+	TUNING_PARAMETER_POLL_DELAY_RS485, // microseconds
+	TUNING_PARAMETER_USB_MAX_QUEUED_WRITES, // requests per USB stack
+	TUNING_PARAMETER_CLIENT_MAX_PENDING_REQUESTS, // requests per client
+	TUNING_PARAMETER_SPI_DROPPED_REQUESTS // read-only, requests dropped because a SPI slave queue was full
+} TuningParameter;
+
+#define TUNING_PARAMETER_COUNT 5
+
+#include <daemonlib/packed_begin.h>
+
+typedef struct {
+	PacketHeader header;
+	uint8_t parameter;
+} ATTRIBUTE_PACKED GetTuningParameterRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint32_t value;
+} ATTRIBUTE_PACKED GetTuningParameterResponse;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t parameter;
+	uint32_t value;
+	uint8_t persist; // write the value to the config file as well
+} ATTRIBUTE_PACKED SetTuningParameterRequest;
+
+typedef struct {
+	PacketHeader header;
+} ATTRIBUTE_PACKED SetTuningParameterResponse;
+
+#include <daemonlib/packed_end.h>
+
+void tuning_init(const char *config_filename);
+
+PacketE tuning_get_parameter(int parameter, uint32_t *value);
+PacketE tuning_set_parameter(int parameter, uint32_t value, bool persist);
+
+#endif // BRICKD_TUNING_H
@@ -22,9 +22,17 @@
 /*
  * libudev is used to detect USB hot(un)plug in case the available libusb
  * version doesn't support this. libudev provides a fd that can be polled for
- * incoming events. the fd is directly polled by the main event loop. on
- * incoming USB add and remove events usb_update is called. it scans the bus
- * for added or removed devices.
+ * incoming events. the fd is directly polled by the main event loop.
+ *
+ * a single plug or unplug can result in a burst of uevents. therefore, incoming
+ * USB add and remove events are collected and only handled after no further
+ * uevent arrived for UDEV_DEBOUNCE_DELAY. the bus number and device address
+ * are parsed from the dev node (/dev/bus/usb/BBB/DDD) so only the affected USB
+ * device has to be added or removed. the sys name only contains the port path
+ * (e.g. 1-1.2) and not the device address, therefore, if the dev node cannot
+ * be parsed a full rescan of the bus is done instead. an additional full
+ * rescan is done every UDEV_CONSISTENCY_RESCAN_INTERVAL to catch any changes
+ * that might have been missed.
  *
  * libudev comes with two different SONAMEs: libudev.so.0 and libudev.so.1.
  * Ubuntu 12.10 ships libudev.so.0 and Ubuntu 13.04 ships libudev.so.1. To
@@ -60,11 +68,15 @@
 	#include <libudev.h>
 #endif
 #include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 
+#include <daemonlib/array.h>
 #include <daemonlib/event.h>
 #include <daemonlib/log.h>
 #include <daemonlib/macros.h>
+#include <daemonlib/timer.h>
+#include <daemonlib/utils.h>
 
 #include "udev.h"
 
@@ -72,6 +84,15 @@
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
+#define UDEV_DEBOUNCE_DELAY 100000 // microseconds
+#define UDEV_CONSISTENCY_RESCAN_INTERVAL 60000000 // microseconds
+
+typedef struct {
+	bool added;
+	uint8_t bus_number;
+	uint8_t device_address;
+} UDevPendingEvent;
+
 #ifdef BRICKD_WITH_LIBUDEV_DLOPEN
 
 struct udev;
@@ -109,6 +130,10 @@ static udev_unref_t udev_unref = NULL;
 static struct udev *_udev_context = NULL;
 static struct udev_monitor *_udev_monitor = NULL;
 static int _udev_monitor_fd = -1;
+static Array _pending_events;
+static bool _pending_rescan = false;
+static Timer _debounce_timer;
+static Timer _rescan_timer;
 
 #ifdef BRICKD_WITH_LIBUDEV_DLOPEN
 
@@ -220,6 +245,89 @@ static void udev_dlclose(void) {
 
 #endif
 
+static void udev_handle_debounce(void *opaque) {
+	int i;
+	UDevPendingEvent *pending_event;
+
+	(void)opaque;
+
+	if (_pending_rescan) {
+		// a full rescan covers all pending events
+		_pending_rescan = false;
+
+		usb_rescan();
+	} else {
+		for (i = 0; i < _pending_events.count; ++i) {
+			pending_event = array_get(&_pending_events, i);
+
+			if (pending_event->added) {
+				usb_add_device(pending_event->bus_number, pending_event->device_address);
+			} else {
+				usb_remove_device(pending_event->bus_number, pending_event->device_address);
+			}
+		}
+	}
+
+	array_resize(&_pending_events, 0, NULL);
+}
+
+static void udev_handle_rescan(void *opaque) {
+	(void)opaque;
+
+	log_debug("Doing periodic USB consistency rescan");
+
+	usb_rescan();
+}
+
+static void udev_queue_event(bool added, const char *dev_node) {
+	unsigned int bus_number;
+	unsigned int device_address;
+	int i;
+	UDevPendingEvent *pending_event;
+
+	if (sscanf(dev_node, "/dev/bus/usb/%u/%u", &bus_number, &device_address) != 2 ||
+	    bus_number > UINT8_MAX || device_address > UINT8_MAX) {
+		log_debug("Could not get bus number and device address from dev node '%s', doing full rescan",
+		          dev_node);
+
+		_pending_rescan = true;
+	} else if (!_pending_rescan) {
+		// drop duplicate events for the same USB device. the last event for a
+		// USB device decides if it is going to be added or removed
+		for (i = _pending_events.count - 1; i >= 0; --i) {
+			pending_event = array_get(&_pending_events, i);
+
+			if (pending_event->bus_number == bus_number &&
+			    pending_event->device_address == device_address) {
+				break;
+			}
+		}
+
+		if (i < 0 || pending_event->added != added) {
+			pending_event = array_append(&_pending_events);
+
+			if (pending_event == NULL) {
+				log_error("Could not append to pending udev events array, doing full rescan: %s (%d)",
+				          get_errno_name(errno), errno);
+
+				_pending_rescan = true;
+			} else {
+				pending_event->added = added;
+				pending_event->bus_number = (uint8_t)bus_number;
+				pending_event->device_address = (uint8_t)device_address;
+			}
+		}
+	}
+
+	// (re)start debounce timer
+	if (timer_configure(&_debounce_timer, UDEV_DEBOUNCE_DELAY, 0) < 0) {
+		log_error("Could not start udev debounce timer, handling event immediately: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		udev_handle_debounce(NULL);
+	}
+}
+
 static void udev_handle_event(void *opaque) {
 	struct udev_device* device;
 	const char *action;
@@ -258,7 +366,7 @@ static void udev_handle_event(void *opaque) {
 		log_debug("Received udev event (action: %s, dev node: %s, sys name: %s)",
 		          action, dev_node, sys_name);
 
-		usb_rescan();
+		udev_queue_event(action[0] == 'a', dev_node);
 	} else {
 		log_debug("Ignoring udev event (action: %s, dev node: %s, sys name: %s)",
 		          action, dev_node, sys_name);
@@ -304,11 +412,12 @@ int udev_init(void) {
 
 	phase = 3;
 
-	// create filter for USB
-	rc = udev_monitor_filter_add_match_subsystem_devtype(_udev_monitor, "usb", 0);
+	// create filter for USB devices, USB interfaces have no dev node and
+	// would just add more uevents per plug and unplug
+	rc = udev_monitor_filter_add_match_subsystem_devtype(_udev_monitor, "usb", "usb_device");
 
 	if (rc != 0) {
-		log_error("Could not initialize udev monitor filter for 'usb' subsystem: %d", rc);
+		log_error("Could not initialize udev monitor filter for 'usb' subsystem and 'usb_device' type: %d", rc);
 
 		goto cleanup;
 	}
@@ -331,8 +440,60 @@ int udev_init(void) {
 
 	phase = 4;
 
+	// create pending events array
+	if (array_create(&_pending_events, 32, sizeof(UDevPendingEvent), true) < 0) {
+		log_error("Could not create pending udev events array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 5;
+
+	// create debounce timer
+	if (timer_create_(&_debounce_timer, udev_handle_debounce, NULL) < 0) {
+		log_error("Could not create udev debounce timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 6;
+
+	// create and start consistency rescan timer
+	if (timer_create_(&_rescan_timer, udev_handle_rescan, NULL) < 0) {
+		log_error("Could not create USB rescan timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 7;
+
+	if (timer_configure(&_rescan_timer, UDEV_CONSISTENCY_RESCAN_INTERVAL,
+	                    UDEV_CONSISTENCY_RESCAN_INTERVAL) < 0) {
+		log_error("Could not start USB rescan timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 8;
+
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
+	case 7:
+		timer_destroy(&_rescan_timer);
+
+	case 6:
+		timer_destroy(&_debounce_timer);
+
+	case 5:
+		array_destroy(&_pending_events, NULL);
+
+	case 4:
+		event_remove_source(_udev_monitor_fd, EVENT_SOURCE_TYPE_GENERIC);
+
 	case 3:
 		udev_monitor_unref(_udev_monitor);
 
@@ -348,12 +509,17 @@ cleanup:
 		break;
 	}
 
-	return phase == 4 ? 0 : -1;
+	return phase == 8 ? 0 : -1;
 }
 
 void udev_exit(void) {
 	log_debug("Shutting down udev subsystem");
 
+	timer_destroy(&_rescan_timer);
+	timer_destroy(&_debounce_timer);
+
+	array_destroy(&_pending_events, NULL);
+
 	event_remove_source(_udev_monitor_fd, EVENT_SOURCE_TYPE_GENERIC);
 
 	udev_monitor_unref(_udev_monitor);
@@ -25,133 +25,510 @@
 #include <string.h>
 
 #include <daemonlib/array.h>
+#include <daemonlib/config.h>
 #include <daemonlib/event.h>
 #include <daemonlib/log.h>
+#include <daemonlib/pipe.h>
+#include <daemonlib/threads.h>
 #include <daemonlib/utils.h>
 
 #include "usb.h"
 
 #include "stack.h"
 #include "network.h"
+#include "usb_stack.h"
 #include "usb_transfer.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
+#define MAX_OPEN_THREADS 8
+
+typedef struct {
+	Array usb_stacks; // USBStack pointers to be opened
+	int next_index; // index of the next USBStack to be opened
+	int *results; // usb_stack_open return value per USBStack
+	int *opened; // indices of the opened USBStacks in the order they finished
+	int opened_count;
+	Mutex mutex; // protects next_index, results, opened and opened_count
+	int finished_count; // only accessed by the main thread
+	Thread threads[MAX_OPEN_THREADS];
+	int thread_count;
+	uint64_t started_at;
+} USBOpenPool;
+
 static bool _libusb_debug = false;
 static libusb_context *_context = NULL;
 static Array _usb_stacks;
 static bool _initialized_hotplug = false;
+static Array _open_pools; // USBOpenPool pointers, only accessed by the main thread
+static Pipe _open_pipe; // a byte is written to it per opened USBStack
 
 extern int usb_init_platform(void);
 extern void usb_exit_platform(void);
 extern int usb_init_hotplug(libusb_context *context);
 extern void usb_exit_hotplug(libusb_context *context);
 
-static int usb_enumerate(void) {
-	int result = -1;
-	libusb_device **devices;
-	libusb_device *device;
+// returns -1 on fatal error, 0 otherwise. USB devices that are not Bricks
+// or that cannot be prepared are ignored. for new Bricks a prepared USBStack
+// is added to the USB stacks array and to the given new USB stacks array. it
+// still has to be opened and activated by usb_open_stacks
+static int usb_probe_device(libusb_device *device, Array *new_usb_stacks) {
 	int rc;
-	int i = 0;
 	struct libusb_device_descriptor descriptor;
-	uint8_t bus_number;
-	uint8_t device_address;
-	bool known;
-	int k;
+	uint8_t bus_number = libusb_get_bus_number(device);
+	uint8_t device_address = libusb_get_device_address(device);
+	int i;
 	USBStack *usb_stack;
+	USBStack **new_usb_stack;
 
-	// get all devices
-	rc = libusb_get_device_list(_context, &devices);
+	rc = libusb_get_device_descriptor(device, &descriptor);
 
 	if (rc < 0) {
-		log_error("Could not get USB device list: %s (%d)",
-		          usb_get_error_name(rc), rc);
+		log_warn("Could not get device descriptor for USB device (bus: %u, device: %u), ignoring USB device: %s (%d)",
+		         bus_number, device_address, usb_get_error_name(rc), rc);
+
+		return 0;
+	}
+
+	if (descriptor.idVendor == USB_BRICK_VENDOR_ID &&
+	    descriptor.idProduct == USB_BRICK_PRODUCT_ID) {
+		if (descriptor.bcdDevice < USB_BRICK_DEVICE_RELEASE) {
+			log_warn("USB device (bus: %u, device: %u) has protocol 1.0 firmware, ignoring USB device",
+			         bus_number, device_address);
+
+			return 0;
+		}
+	} else if (descriptor.idVendor == USB_RED_BRICK_VENDOR_ID &&
+	           descriptor.idProduct == USB_RED_BRICK_PRODUCT_ID) {
+		if (descriptor.bcdDevice < USB_RED_BRICK_DEVICE_RELEASE) {
+			log_warn("USB device (bus: %u, device: %u) has unexpected release version, ignoring USB device",
+			         bus_number, device_address);
+
+			return 0;
+		}
+	} else {
+		return 0;
+	}
+
+	// check all known stacks
+	for (i = 0; i < _usb_stacks.count; ++i) {
+		usb_stack = array_get(&_usb_stacks, i);
+
+		if (usb_stack->bus_number == bus_number &&
+		    usb_stack->device_address == device_address) {
+			// mark known USBStack as connected
+			usb_stack->connected = true;
+
+			return 0;
+		}
+	}
+
+	// create new USBStack object
+	log_debug("Found new USB device (bus: %u, device: %u)",
+	          bus_number, device_address);
+
+	new_usb_stack = array_append(new_usb_stacks);
+
+	if (new_usb_stack == NULL) {
+		log_error("Could not append to new USB stacks array: %s (%d)",
+		          get_errno_name(errno), errno);
 
 		return -1;
 	}
 
-	// check for stacks
-	for (device = devices[0]; device != NULL; device = devices[++i]) {
-		bus_number = libusb_get_bus_number(device);
-		device_address = libusb_get_device_address(device);
+	usb_stack = array_append(&_usb_stacks);
 
-		rc = libusb_get_device_descriptor(device, &descriptor);
+	if (usb_stack == NULL) {
+		log_error("Could not append to USB stacks array: %s (%d)",
+		          get_errno_name(errno), errno);
 
-		if (rc < 0) {
-			log_warn("Could not get device descriptor for USB device (bus: %u, device: %u), ignoring USB device: %s (%d)",
-			         bus_number, device_address, usb_get_error_name(rc), rc);
+		array_remove(new_usb_stacks, new_usb_stacks->count - 1, NULL);
 
-			continue;
+		return -1;
+	}
+
+	if (usb_stack_prepare(usb_stack, bus_number, device_address) < 0) {
+		array_remove(&_usb_stacks, _usb_stacks.count - 1, NULL);
+		array_remove(new_usb_stacks, new_usb_stacks->count - 1, NULL);
+
+		log_warn("Ignoring USB device (bus: %u, device: %u) due to an error",
+		         bus_number, device_address);
+
+		return 0;
+	}
+
+	*new_usb_stack = usb_stack;
+
+	return 0;
+}
+
+static int usb_get_stack_index(USBStack *usb_stack) {
+	int i;
+
+	for (i = 0; i < _usb_stacks.count; ++i) {
+		if (array_get(&_usb_stacks, i) == usb_stack) {
+			return i;
 		}
+	}
 
-		if (descriptor.idVendor == USB_BRICK_VENDOR_ID &&
-		    descriptor.idProduct == USB_BRICK_PRODUCT_ID) {
-			if (descriptor.bcdDevice < USB_BRICK_DEVICE_RELEASE) {
-				log_warn("USB device (bus: %u, device: %u) has protocol 1.0 firmware, ignoring USB device",
-				         bus_number, device_address);
+	return -1;
+}
 
-				continue;
-			}
-		} else if (descriptor.idVendor == USB_RED_BRICK_VENDOR_ID &&
-		           descriptor.idProduct == USB_RED_BRICK_PRODUCT_ID) {
-			if (descriptor.bcdDevice < USB_RED_BRICK_DEVICE_RELEASE) {
-				log_warn("USB device (bus: %u, device: %u) has unexpected release version, ignoring USB device",
-				         bus_number, device_address);
+// activates an opened USBStack or forgets about it if opening it failed.
+// this has to be done in the main thread, because releasing the USBStack after
+// usb_stack_open failed and activating it both change the libusb pollfds.
+// usb_stack_activate releases the USBStack on error
+static void usb_finish_stack(USBStack *usb_stack, int rc) {
+	uint8_t bus_number = usb_stack->bus_number;
+	uint8_t device_address = usb_stack->device_address;
+	int index;
 
-				continue;
-			}
+	usb_stack->opening = false;
+
+	if (!usb_stack->connected) {
+		log_debug("USB device (bus: %u, device: %u) was removed while being opened, releasing it",
+		          bus_number, device_address);
+
+		if (rc >= 0) {
+			libusb_release_interface(usb_stack->device_handle, usb_stack->interface_number);
+		}
+
+		usb_stack_unprepare(usb_stack);
+
+		index = usb_get_stack_index(usb_stack);
+
+		if (index >= 0) {
+			array_remove(&_usb_stacks, index, NULL);
+		}
+
+		return;
+	}
+
+	if (rc < 0) {
+		usb_stack_unprepare(usb_stack);
+	} else {
+		rc = usb_stack_activate(usb_stack);
+	}
+
+	index = usb_get_stack_index(usb_stack);
+
+	if (rc < 0) {
+		if (index >= 0) {
+			array_remove(&_usb_stacks, index, NULL);
+		}
+
+		log_warn("Ignoring USB device (bus: %u, device: %u) due to an error",
+		         bus_number, device_address);
+
+		return;
+	}
+
+	log_info("Added USB device (bus: %u, device: %u) at index %d: %s",
+	         usb_stack->bus_number, usb_stack->device_address,
+	         index, usb_stack->base.name);
+}
+
+static void usb_open_thread(void *opaque) {
+	USBOpenPool *pool = opaque;
+	uint8_t byte = 0;
+	int index;
+	int rc;
+
+	for (;;) {
+		mutex_lock(&pool->mutex);
+
+		index = pool->next_index;
+
+		if (index < pool->usb_stacks.count) {
+			++pool->next_index;
+		}
+
+		mutex_unlock(&pool->mutex);
+
+		if (index >= pool->usb_stacks.count) {
+			break;
+		}
+
+		rc = usb_stack_open(*(USBStack **)array_get(&pool->usb_stacks, index));
+
+		mutex_lock(&pool->mutex);
+
+		pool->results[index] = rc;
+		pool->opened[pool->opened_count++] = index;
+
+		mutex_unlock(&pool->mutex);
+
+		if (pipe_write(&_open_pipe, &byte, sizeof(byte)) < 0) {
+			log_error("Could not write to USB open pipe: %s (%d)",
+			          get_errno_name(errno), errno);
+		}
+	}
+}
+
+// activates the USBStacks of the pool that finished opening since the last
+// call, in the order they finished. returns true if all USBStacks of the pool
+// are done
+static bool usb_finish_opened_stacks(USBOpenPool *pool) {
+	int index;
+	int rc;
+	USBStack *usb_stack;
+
+	for (;;) {
+		mutex_lock(&pool->mutex);
+
+		if (pool->finished_count >= pool->opened_count) {
+			mutex_unlock(&pool->mutex);
+
+			break;
+		}
+
+		index = pool->opened[pool->finished_count];
+		rc = pool->results[index];
+
+		mutex_unlock(&pool->mutex);
+
+		++pool->finished_count;
+
+		usb_stack = *(USBStack **)array_get(&pool->usb_stacks, index);
+
+		if (rc < 0) {
+			log_debug("Could not open USB device (bus: %u, device: %u), gave up after %u msec",
+			          usb_stack->bus_number, usb_stack->device_address,
+			          (uint32_t)((microseconds() - pool->started_at) / 1000));
 		} else {
-			continue;
+			log_debug("Opened USB device (bus: %u, device: %u) after %u msec",
+			          usb_stack->bus_number, usb_stack->device_address,
+			          (uint32_t)((microseconds() - pool->started_at) / 1000));
 		}
 
-		// check all known stacks
-		known = false;
+		usb_finish_stack(usb_stack, rc);
+	}
 
-		for (k = 0; k < _usb_stacks.count; ++k) {
-			usb_stack = array_get(&_usb_stacks, k);
+	return pool->finished_count == pool->usb_stacks.count;
+}
 
-			if (usb_stack->bus_number == bus_number &&
-			    usb_stack->device_address == device_address) {
-				// mark known USBStack as connected
-				usb_stack->connected = true;
-				known = true;
+static void usb_destroy_open_pool(USBOpenPool *pool) {
+	int i;
 
-				break;
-			}
+	for (i = 0; i < pool->thread_count; ++i) {
+		thread_join(&pool->threads[i]);
+		thread_destroy(&pool->threads[i]);
+	}
+
+	mutex_destroy(&pool->mutex);
+	free(pool->results);
+	array_destroy(&pool->usb_stacks, NULL);
+	free(pool);
+}
+
+static void usb_handle_open_pipe(void *opaque) {
+	uint8_t byte;
+	int i;
+	USBOpenPool *pool;
+
+	(void)opaque;
+
+	if (pipe_read(&_open_pipe, &byte, sizeof(byte)) < 0) {
+		log_error("Could not read from USB open pipe: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return;
+	}
+
+	// there is one byte per opened USBStack, but each call handles all
+	// USBStacks opened so far. the remaining bytes find nothing left to do
+	for (i = _open_pools.count - 1; i >= 0; --i) {
+		pool = *(USBOpenPool **)array_get(&_open_pools, i);
+
+		if (usb_finish_opened_stacks(pool)) {
+			array_remove(&_open_pools, i, NULL);
+			usb_destroy_open_pool(pool);
 		}
+	}
+}
 
-		if (known) {
-			continue;
+// waits for all worker threads and releases the USBStacks they opened without
+// activating them
+static void usb_stop_open_pools(void) {
+	int i;
+	int k;
+	USBOpenPool *pool;
+
+	for (i = _open_pools.count - 1; i >= 0; --i) {
+		pool = *(USBOpenPool **)array_get(&_open_pools, i);
+
+		for (k = 0; k < pool->thread_count; ++k) {
+			thread_join(&pool->threads[k]);
+			thread_destroy(&pool->threads[k]);
 		}
 
-		// create new USBStack object
-		log_debug("Found new USB device (bus: %u, device: %u)",
-		          bus_number, device_address);
+		pool->thread_count = 0;
+
+		for (k = 0; k < pool->usb_stacks.count; ++k) {
+			(*(USBStack **)array_get(&pool->usb_stacks, k))->connected = false;
+		}
 
-		usb_stack = array_append(&_usb_stacks);
+		usb_finish_opened_stacks(pool);
 
-		if (usb_stack == NULL) {
-			log_error("Could not append to USB stacks array: %s (%d)",
+		array_remove(&_open_pools, i, NULL);
+		usb_destroy_open_pool(pool);
+	}
+}
+
+// opens the prepared USBStacks concurrently on a pool of worker threads. this
+// doesn't wait for the worker threads, each USBStack is activated by the main
+// thread as soon as its worker signals that it has been opened
+static void usb_open_stacks(Array *new_usb_stacks) {
+	int phase = 0;
+	USBOpenPool *pool;
+	USBOpenPool **pool_ptr;
+	USBStack *usb_stack;
+	int i;
+
+	if (new_usb_stacks->count == 0) {
+		return;
+	}
+
+	pool = calloc(1, sizeof(USBOpenPool));
+
+	if (pool == NULL) {
+		log_error("Could not allocate USB open pool: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		goto cleanup;
+	}
+
+	pool->started_at = microseconds();
+
+	phase = 1;
+
+	if (array_create(&pool->usb_stacks, new_usb_stacks->count, sizeof(USBStack *), true) < 0) {
+		log_error("Could not create USB open pool array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	for (i = 0; i < new_usb_stacks->count; ++i) {
+		if (array_append(&pool->usb_stacks) == NULL) {
+			log_error("Could not append to USB open pool array: %s (%d)",
 			          get_errno_name(errno), errno);
 
 			goto cleanup;
 		}
 
-		if (usb_stack_create(usb_stack, bus_number, device_address) < 0) {
-			array_remove(&_usb_stacks, _usb_stacks.count - 1, NULL);
+		*(USBStack **)array_get(&pool->usb_stacks, i) = *(USBStack **)array_get(new_usb_stacks, i);
+	}
 
-			log_warn("Ignoring USB device (bus: %u, device: %u) due to an error",
-			         bus_number, device_address);
+	pool->results = calloc(new_usb_stacks->count * 2, sizeof(int));
 
-			continue;
+	if (pool->results == NULL) {
+		log_error("Could not allocate USB open results: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		goto cleanup;
+	}
+
+	pool->opened = pool->results + new_usb_stacks->count;
+
+	phase = 3;
+
+	mutex_create(&pool->mutex);
+
+	phase = 4;
+
+	pool_ptr = array_append(&_open_pools);
+
+	if (pool_ptr == NULL) {
+		log_error("Could not append to USB open pools array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	*pool_ptr = pool;
+
+	phase = 5;
+
+	// the worker threads only touch the USBStacks marked as opening. the main
+	// thread doesn't release them until they are done
+	for (i = 0; i < pool->usb_stacks.count; ++i) {
+		(*(USBStack **)array_get(&pool->usb_stacks, i))->opening = true;
+	}
+
+	pool->thread_count = MIN(pool->usb_stacks.count, MAX_OPEN_THREADS);
+
+	log_debug("Opening %d USB device(s) using %d thread(s)",
+	          pool->usb_stacks.count, pool->thread_count);
+
+	for (i = 0; i < pool->thread_count; ++i) {
+		thread_create(&pool->threads[i], usb_open_thread, pool);
+	}
+
+	phase = 6;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 4:
+		mutex_destroy(&pool->mutex);
+
+	case 3:
+		free(pool->results);
+
+	case 2:
+		array_destroy(&pool->usb_stacks, NULL);
+
+	case 1:
+		free(pool);
+
+	default:
+		break;
+	}
+
+	if (phase < 5) {
+		// open the USBStacks one after another instead
+		for (i = 0; i < new_usb_stacks->count; ++i) {
+			usb_stack = *(USBStack **)array_get(new_usb_stacks, i);
+
+			usb_finish_stack(usb_stack, usb_stack_open(usb_stack));
 		}
+	}
+}
+
+static int usb_enumerate(void) {
+	int result = -1;
+	libusb_device **devices;
+	libusb_device *device;
+	int rc;
+	int i = 0;
+	Array new_usb_stacks;
+
+	if (array_create(&new_usb_stacks, 32, sizeof(USBStack *), true) < 0) {
+		log_error("Could not create new USB stacks array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
 
-		// mark new stack as connected
-		usb_stack->connected = true;
+	// get all devices
+	rc = libusb_get_device_list(_context, &devices);
+
+	if (rc < 0) {
+		log_error("Could not get USB device list: %s (%d)",
+		          usb_get_error_name(rc), rc);
 
-		log_info("Added USB device (bus: %u, device: %u) at index %d: %s",
-		         usb_stack->bus_number, usb_stack->device_address,
-		         _usb_stacks.count - 1, usb_stack->base.name);
+		array_destroy(&new_usb_stacks, NULL);
+
+		return -1;
+	}
+
+	// check for stacks
+	for (device = devices[0]; device != NULL; device = devices[++i]) {
+		if (usb_probe_device(device, &new_usb_stacks) < 0) {
+			goto cleanup;
+		}
 	}
 
 	result = 0;
@@ -159,6 +536,11 @@ static int usb_enumerate(void) {
 cleanup:
 	libusb_free_device_list(devices, 1);
 
+	// the prepared USBStacks have to be opened even if probing failed
+	usb_open_stacks(&new_usb_stacks);
+
+	array_destroy(&new_usb_stacks, NULL);
+
 	return result;
 }
 
@@ -197,11 +579,14 @@ static void LIBUSB_CALL usb_remove_pollfd(int fd, void *opaque) {
 
 int usb_init(bool libusb_debug) {
 	int phase = 0;
+	uint64_t start = microseconds();
 
 	log_debug("Initializing USB subsystem");
 
 	_libusb_debug = libusb_debug;
 
+	usb_stack_set_max_queued_writes(config_get_option_value("queue_limit.usb_writes")->integer);
+
 	if (_libusb_debug) {
 		putenv("LIBUSB_DEBUG=5");
 
@@ -240,6 +625,33 @@ int usb_init(bool libusb_debug) {
 
 	phase = 3;
 
+	// the USB open pools of the worker threads are tracked until all their
+	// USBStacks are activated
+	if (array_create(&_open_pools, 8, sizeof(USBOpenPool *), true) < 0) {
+		log_error("Could not create USB open pools array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 4;
+
+	if (pipe_create(&_open_pipe, 0) < 0) {
+		log_error("Could not create USB open pipe: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 5;
+
+	if (event_add_source(_open_pipe.read_end, EVENT_SOURCE_TYPE_GENERIC,
+	                     EVENT_READ, usb_handle_open_pipe, NULL) < 0) {
+		goto cleanup;
+	}
+
+	phase = 6;
+
 	if (usb_has_hotplug()) {
 		log_debug("libusb supports hotplug");
 
@@ -256,10 +668,23 @@ int usb_init(bool libusb_debug) {
 		goto cleanup;
 	}
 
-	phase = 4;
+	log_info("USB subsystem ready with %d USB device(s) after %u msec",
+	         _usb_stacks.count, (uint32_t)((microseconds() - start) / 1000));
+
+	phase = 7;
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
+	case 6:
+		usb_stop_open_pools();
+		event_remove_source(_open_pipe.read_end, EVENT_SOURCE_TYPE_GENERIC);
+
+	case 5:
+		pipe_destroy(&_open_pipe);
+
+	case 4:
+		array_destroy(&_open_pools, NULL);
+
 	case 3:
 		array_destroy(&_usb_stacks, (ItemDestroyFunction)usb_stack_destroy);
 
@@ -273,7 +698,7 @@ cleanup:
 		break;
 	}
 
-	return phase == 4 ? 0 : -1;
+	return phase == 7 ? 0 : -1;
 }
 
 void usb_exit(void) {
@@ -283,6 +708,13 @@ void usb_exit(void) {
 		usb_exit_hotplug(_context);
 	}
 
+	usb_stop_open_pools();
+
+	event_remove_source(_open_pipe.read_end, EVENT_SOURCE_TYPE_GENERIC);
+	pipe_destroy(&_open_pipe);
+
+	array_destroy(&_open_pools, NULL);
+
 	array_destroy(&_usb_stacks, (ItemDestroyFunction)usb_stack_destroy);
 
 	usb_destroy_context(_context);
@@ -318,6 +750,11 @@ int usb_rescan(void) {
 			continue;
 		}
 
+		if (usb_stack->opening) {
+			// released by usb_finish_stack once its worker thread is done
+			continue;
+		}
+
 		log_info("Removing USB device (bus: %u, device: %u) at index %d: %s ",
 		         usb_stack->bus_number, usb_stack->device_address, i,
 		         usb_stack->base.name);
@@ -330,6 +767,101 @@ int usb_rescan(void) {
 	return 0;
 }
 
+int usb_add_device(uint8_t bus_number, uint8_t device_address) {
+	int result = -1;
+	libusb_device **devices;
+	libusb_device *device;
+	int rc;
+	int i = 0;
+	Array new_usb_stacks;
+
+	log_debug("Looking for added USB device (bus: %u, device: %u)",
+	          bus_number, device_address);
+
+	if (array_create(&new_usb_stacks, 1, sizeof(USBStack *), true) < 0) {
+		log_error("Could not create new USB stacks array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	rc = libusb_get_device_list(_context, &devices);
+
+	if (rc < 0) {
+		log_error("Could not get USB device list: %s (%d)",
+		          usb_get_error_name(rc), rc);
+
+		array_destroy(&new_usb_stacks, NULL);
+
+		return -1;
+	}
+
+	// only the matching device is probed, the descriptors of all other
+	// devices are not read
+	for (device = devices[0]; device != NULL; device = devices[++i]) {
+		if (libusb_get_bus_number(device) != bus_number ||
+		    libusb_get_device_address(device) != device_address) {
+			continue;
+		}
+
+		if (usb_probe_device(device, &new_usb_stacks) < 0) {
+			goto cleanup;
+		}
+
+		break;
+	}
+
+	if (device == NULL) {
+		log_debug("Added USB device (bus: %u, device: %u) is not in the device list (anymore)",
+		          bus_number, device_address);
+	}
+
+	result = 0;
+
+cleanup:
+	libusb_free_device_list(devices, 1);
+
+	usb_open_stacks(&new_usb_stacks);
+
+	array_destroy(&new_usb_stacks, NULL);
+
+	return result;
+}
+
+void usb_remove_device(uint8_t bus_number, uint8_t device_address) {
+	int i;
+	USBStack *usb_stack;
+
+	for (i = 0; i < _usb_stacks.count; ++i) {
+		usb_stack = array_get(&_usb_stacks, i);
+
+		if (usb_stack->bus_number != bus_number ||
+		    usb_stack->device_address != device_address) {
+			continue;
+		}
+
+		if (usb_stack->opening) {
+			// released by usb_finish_stack once its worker thread is done
+			usb_stack->connected = false;
+
+			return;
+		}
+
+		log_info("Removing USB device (bus: %u, device: %u) at index %d: %s ",
+		         usb_stack->bus_number, usb_stack->device_address, i,
+		         usb_stack->base.name);
+
+		stack_announce_disconnect(&usb_stack->base);
+
+		array_remove(&_usb_stacks, i, (ItemDestroyFunction)usb_stack_destroy);
+
+		return;
+	}
+
+	log_debug("Removed USB device (bus: %u, device: %u) is not a known USB device, ignoring it",
+	          bus_number, device_address);
+}
+
 int usb_reopen(void) {
 	int i;
 	USBStack *usb_stack;
@@ -341,6 +873,11 @@ int usb_reopen(void) {
 	for (i = _usb_stacks.count - 1; i >= 0; --i) {
 		usb_stack = array_get(&_usb_stacks, i);
 
+		if (usb_stack->opening) {
+			// just being opened, no need to reopen it
+			continue;
+		}
+
 		log_info("Temporarily removing USB device (bus: %u, device: %u) at index %d: %s ",
 		         usb_stack->bus_number, usb_stack->device_address, i,
 		         usb_stack->base.name);
@@ -46,6 +46,8 @@ void usb_exit(void);
 bool usb_has_hotplug(void);
 
 int usb_rescan(void);
+int usb_add_device(uint8_t bus_number, uint8_t device_address);
+void usb_remove_device(uint8_t bus_number, uint8_t device_address);
 int usb_reopen(void);
 
 int usb_create_context(libusb_context **context);
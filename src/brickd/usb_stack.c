@@ -43,12 +43,21 @@ static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
 #define MAX_READ_TRANSFERS 10
 #define MAX_WRITE_TRANSFERS 10
-#define MAX_QUEUED_WRITES 32768
+
+// configurable with brickd.conf option queue_limit.usb_writes and at runtime
+// by the tuning API
+static int _max_queued_writes = 32768;
 
 static void usb_stack_read_callback(USBTransfer *usb_transfer) {
 	const char *message = NULL;
 	char packet_content_dump[PACKET_MAX_CONTENT_DUMP_LENGTH];
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+	uint64_t ingress_timestamp = 0;
+
+	// take the timestamp before anything else, only if a client wants it
+	if (network_wants_ingress_timestamps()) {
+		ingress_timestamp = network_get_ingress_timestamp();
+	}
 
 	// check if packet is too short
 	if (usb_transfer->handle->actual_length < (int)sizeof(PacketHeader)) {
@@ -125,7 +134,7 @@ static void usb_stack_read_callback(USBTransfer *usb_transfer) {
 		return;
 	}
 
-	network_dispatch_response(&usb_transfer->packet);
+	network_dispatch_timestamped_response(&usb_transfer->packet, ingress_timestamp);
 }
 
 static void usb_stack_write_callback(USBTransfer *usb_transfer) {
@@ -198,8 +207,8 @@ static int usb_stack_dispatch_request(Stack *stack, Packet *request,
 	log_packet_debug("Could not find a free write transfer for %s, pushing request to write queue (count: %d +1)",
 	                 usb_stack->base.name, usb_stack->write_queue.count);
 
-	if (usb_stack->write_queue.count >= MAX_QUEUED_WRITES) {
-		requests_to_drop = usb_stack->write_queue.count - MAX_QUEUED_WRITES + 1;
+	if (usb_stack->write_queue.count >= _max_queued_writes) {
+		requests_to_drop = usb_stack->write_queue.count - _max_queued_writes + 1;
 
 		log_warn("Write queue for %s is full, dropping %u queued request(s), %u + %u dropped in total",
 		         usb_stack->base.name, requests_to_drop,
@@ -207,7 +216,7 @@ static int usb_stack_dispatch_request(Stack *stack, Packet *request,
 
 		usb_stack->dropped_requests += requests_to_drop;
 
-		while (usb_stack->write_queue.count >= MAX_QUEUED_WRITES) {
+		while (usb_stack->write_queue.count >= _max_queued_writes) {
 			queue_pop(&usb_stack->write_queue, NULL);
 		}
 	}
@@ -228,7 +237,20 @@ static int usb_stack_dispatch_request(Stack *stack, Packet *request,
 	return 0;
 }
 
-int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_address) {
+int usb_stack_get_max_queued_writes(void) {
+	return _max_queued_writes;
+}
+
+// a lower limit is applied to a USB stack the next time a request gets pushed
+// to its write queue
+void usb_stack_set_max_queued_writes(int max_queued_writes) {
+	_max_queued_writes = max_queued_writes;
+}
+
+// creates the base stack and the per-device libusb context and opens the USB
+// device. this adds libusb pollfds to the event loop and has to be done in
+// the main thread. on error the USB stack is completely released
+int usb_stack_prepare(USBStack *usb_stack, uint8_t bus_number, uint8_t device_address) {
 	int phase = 0;
 	int rc;
 	libusb_device **devices;
@@ -236,8 +258,6 @@ int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_add
 	struct libusb_device_descriptor descriptor;
 	int i = 0;
 	char preliminary_name[STACK_MAX_NAME_LENGTH];
-	int retries = 0;
-	USBTransfer *usb_transfer;
 
 	log_debug("Acquiring USB device (bus: %u, device: %u)",
 	          bus_number, device_address);
@@ -249,6 +269,7 @@ int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_add
 	usb_stack->device_handle = NULL;
 	usb_stack->dropped_requests = 0;
 	usb_stack->connected = true;
+	usb_stack->opening = false;
 	usb_stack->active = false;
 	usb_stack->expecting_short_A1_response = false;
 	usb_stack->expecting_read_stall_before_removal = false;
@@ -358,6 +379,43 @@ int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_add
 
 	phase = 3;
 
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 2:
+		usb_destroy_context(usb_stack->context);
+
+	case 1:
+		stack_destroy(&usb_stack->base);
+
+	default:
+		break;
+	}
+
+	return phase == 3 ? 0 : -1;
+}
+
+// closes the USB device of a prepared USB stack and releases it. this removes
+// libusb pollfds from the event loop and has to be done in the main thread
+void usb_stack_unprepare(USBStack *usb_stack) {
+	libusb_close(usb_stack->device_handle);
+	usb_destroy_context(usb_stack->context);
+
+	stack_destroy(&usb_stack->base);
+}
+
+// claims the interface of the USB device and reads its display name. this
+// only does blocking transfers on the already opened device, which does not
+// change the libusb pollfds, and can be done in a worker thread. on error the
+// caller has to release the USB stack using usb_stack_unprepare in the main
+// thread
+int usb_stack_open(USBStack *usb_stack) {
+	int phase = 0;
+	int rc;
+	char preliminary_name[STACK_MAX_NAME_LENGTH];
+	int retries = 0;
+
+	string_copy(preliminary_name, sizeof(preliminary_name), usb_stack->base.name);
+
 	// get interface endpoints
 	rc = usb_get_interface_endpoints(usb_stack->device_handle, usb_stack->interface_number,
 	                                 &usb_stack->endpoint_in, &usb_stack->endpoint_out);
@@ -406,7 +464,7 @@ int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_add
 		          usb_stack->interface_number, usb_stack->base.name);
 	}
 
-	phase = 4;
+	phase = 1;
 
 	// update stack name
 	if (usb_get_device_name(usb_stack->device_handle, usb_stack->base.name,
@@ -417,6 +475,28 @@ int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_add
 	log_debug("Got display name for %s: %s",
 	          preliminary_name, usb_stack->base.name);
 
+	phase = 2;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 1:
+		libusb_release_interface(usb_stack->device_handle, usb_stack->interface_number);
+
+	default:
+		break;
+	}
+
+	return phase == 2 ? 0 : -1;
+}
+
+// allocates and submits the USB transfers and adds the USB stack to the
+// hardware. this has to be done in the main thread. on error the USB stack is
+// completely released
+int usb_stack_activate(USBStack *usb_stack) {
+	int phase = 0;
+	int i;
+	USBTransfer *usb_transfer;
+
 	// allocate and submit read transfers
 	if (array_create(&usb_stack->read_transfers, MAX_READ_TRANSFERS,
 	                 sizeof(USBTransfer), true) < 0) {
@@ -426,7 +506,7 @@ int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_add
 		goto cleanup;
 	}
 
-	phase = 5;
+	phase = 1;
 
 	log_debug("Submitting read transfers to %s", usb_stack->base.name);
 
@@ -461,7 +541,7 @@ int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_add
 		goto cleanup;
 	}
 
-	phase = 6;
+	phase = 2;
 
 	// allocate write transfers
 	if (array_create(&usb_stack->write_transfers, MAX_WRITE_TRANSFERS,
@@ -472,7 +552,7 @@ int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_add
 		goto cleanup;
 	}
 
-	phase = 7;
+	phase = 3;
 
 	for (i = 0; i < MAX_WRITE_TRANSFERS; ++i) {
 		usb_transfer = array_append(&usb_stack->write_transfers);
@@ -500,36 +580,28 @@ int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_add
 		goto cleanup;
 	}
 
-	phase = 8;
+	phase = 4;
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
-	case 7:
+	case 3:
 		array_destroy(&usb_stack->write_transfers, (ItemDestroyFunction)usb_transfer_destroy);
 
-	case 6:
+	case 2:
 		queue_destroy(&usb_stack->write_queue, NULL);
 
-	case 5:
+	case 1:
 		array_destroy(&usb_stack->read_transfers, (ItemDestroyFunction)usb_transfer_destroy);
 
-	case 4:
+	case 0:
 		libusb_release_interface(usb_stack->device_handle, usb_stack->interface_number);
-
-	case 3:
-		libusb_close(usb_stack->device_handle);
-
-	case 2:
-		usb_destroy_context(usb_stack->context);
-
-	case 1:
-		stack_destroy(&usb_stack->base);
+		usb_stack_unprepare(usb_stack);
 
 	default:
 		break;
 	}
 
-	return phase == 8 ? 0 : -1;
+	return phase == 4 ? 0 : -1;
 }
 
 void usb_stack_destroy(USBStack *usb_stack) {
@@ -45,12 +45,19 @@ typedef struct {
 	Queue write_queue;
 	uint32_t dropped_requests;
 	bool connected;
+	bool opening; // being opened by a worker thread, not active yet
 	bool active; // only active USB stacks can handle USB transfers
 	bool expecting_short_A1_response;
 	bool expecting_read_stall_before_removal;
 } USBStack;
 
-int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_address);
+int usb_stack_prepare(USBStack *usb_stack, uint8_t bus_number, uint8_t device_address);
+void usb_stack_unprepare(USBStack *usb_stack);
+int usb_stack_open(USBStack *usb_stack);
+int usb_stack_activate(USBStack *usb_stack);
 void usb_stack_destroy(USBStack *usb_stack);
 
+int usb_stack_get_max_queued_writes(void);
+void usb_stack_set_max_queued_writes(int max_queued_writes);
+
 #endif // BRICKD_USB_STACK_H
@@ -24,7 +24,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <daemonlib/event.h>
 #include <daemonlib/log.h>
+#include <daemonlib/node.h>
 #include <daemonlib/socket.h>
 #include <daemonlib/utils.h>
 
@@ -50,27 +52,328 @@ static void websocket_free_queued_data(void *item) {
 	free(queued_data->buffer);
 }
 
+// the frame header is written when the frame is closed. until then space for
+// the longest header used here is reserved in front of the payload
+#define WEBSOCKET_FRAME_HEADER_RESERVE ((int)(sizeof(WebsocketFrameHeader) + sizeof(uint16_t)))
+
+static Node _websocket_send_sentinel;
+static bool _websocket_send_sentinel_initialized = false;
+
+static int _compression_level = 0; // 0 disables permessage-deflate
+static int _compression_min_frame_size = 0;
+
+static void websocket_handle_write(void *opaque);
+static int websocket_reserve_send_buffer(Websocket *websocket, int length);
+
+static bool websocket_is_compressing(Websocket *websocket) {
+#ifdef BRICKD_WITH_ZLIB
+	return websocket->deflate.started;
+#else
+	(void)websocket;
+
+	return false;
+#endif
+}
+
+// writes an unmasked frame header with the payload length encoded in the
+// minimal number of bytes. returns the header length
+static int websocket_write_frame_header(uint8_t *frame, int opcode, int rsv, int payload_length) {
+	WebsocketFrameHeader *header = (WebsocketFrameHeader *)frame;
+	int i;
+
+	header->opcode_rsv_fin = (rsv & 0x7) << 4;
+	header->payload_length_mask = 0;
+	websocket_frame_set_fin(header, 1);
+	websocket_frame_set_opcode(header, opcode);
+	websocket_frame_set_mask(header, 0);
+
+	if (payload_length <= WEBSOCKET_MAX_UNEXTENDED_PAYLOAD_DATA_LENGTH) {
+		websocket_frame_set_payload_length(header, payload_length);
+
+		return sizeof(WebsocketFrameHeader);
+	}
+
+	// extended payload lengths are in network byte order
+	if (payload_length <= WEBSOCKET_MAX_EXTENDED_PAYLOAD_DATA_LENGTH) {
+		websocket_frame_set_payload_length(header, 126);
+		frame[sizeof(WebsocketFrameHeader)] = (payload_length >> 8) & 0xFF;
+		frame[sizeof(WebsocketFrameHeader) + 1] = payload_length & 0xFF;
+
+		return sizeof(WebsocketFrameHeader) + sizeof(uint16_t);
+	}
+
+	websocket_frame_set_payload_length(header, 127);
+
+	for (i = 0; i < 8; ++i) {
+		frame[sizeof(WebsocketFrameHeader) + i] = (uint8_t)(((uint64_t)payload_length >> (56 - i * 8)) & 0xFF);
+	}
+
+	return sizeof(WebsocketFrameHeader) + sizeof(uint64_t);
+}
+
+#ifdef BRICKD_WITH_ZLIB
+
+// replaces the payload of the open frame with its compressed form. the
+// compressed payload can be longer than the original one
+static int websocket_compress_frame(Websocket *websocket, int payload_length) {
+	uint8_t *compressed_payload;
+	int compressed_length;
+	uint8_t *frame;
+	int header_length;
+
+	compressed_length = websocket_deflate_compress(&websocket->deflate,
+	                                               websocket->send_buffer + websocket->frame_start + WEBSOCKET_FRAME_HEADER_RESERVE,
+	                                               payload_length, &compressed_payload);
+
+	if (compressed_length < 0) {
+		return -1;
+	}
+
+	websocket->send_buffer_used = websocket->frame_start;
+
+	if (websocket_reserve_send_buffer(websocket, WEBSOCKET_MAX_FRAME_HEADER_LENGTH + compressed_length) < 0) {
+		return -1;
+	}
+
+	frame = websocket->send_buffer + websocket->frame_start;
+	header_length = websocket_write_frame_header(frame, WEBSOCKET_OPCODE_BINARY_FRAME,
+	                                             WEBSOCKET_RSV_COMPRESSED, compressed_length);
+
+	memcpy(frame + header_length, compressed_payload, compressed_length);
+
+	websocket->send_buffer_used += header_length + compressed_length;
+
+	return 0;
+}
+
+#endif
+
+static void websocket_close_frame(Websocket *websocket) {
+	uint8_t *frame;
+	int payload_length;
+	int header_length;
+
+	if (websocket->frame_start < 0) {
+		return;
+	}
+
+	payload_length = websocket->send_buffer_used - websocket->frame_start - WEBSOCKET_FRAME_HEADER_RESERVE;
+
+#ifdef BRICKD_WITH_ZLIB
+	if (websocket->deflate.started && payload_length >= _compression_min_frame_size) {
+		if (websocket_compress_frame(websocket, payload_length) < 0) {
+			// the compressor state doesn't match the client's decompressor
+			// state anymore, no further frame can be sent
+			log_error("Could not compress WebSocket frame (handle: %d): %s (%d)",
+			          websocket->base.base.handle, get_errno_name(errno), errno);
+
+			websocket->send_error = errno;
+			websocket->send_buffer_used = websocket->frame_start;
+		}
+
+		websocket->frame_start = -1;
+
+		return;
+	}
+#endif
+
+	frame = websocket->send_buffer + websocket->frame_start;
+	header_length = websocket_write_frame_header(frame, WEBSOCKET_OPCODE_BINARY_FRAME, 0, payload_length);
+
+	if (header_length < WEBSOCKET_FRAME_HEADER_RESERVE) {
+		// the length has to be encoded in the minimal number of bytes, so
+		// the reserved extended length is not used. move the payload over it
+		memmove(frame + header_length, frame + WEBSOCKET_FRAME_HEADER_RESERVE, payload_length);
+
+		websocket->send_buffer_used -= WEBSOCKET_FRAME_HEADER_RESERVE - header_length;
+	}
+
+	websocket->frame_start = -1;
+}
+
+// sends the send buffer as far as the socket accepts it without blocking. if
+// a remainder is left then the rest is sent once the socket becomes writable
+static void websocket_flush(Websocket *websocket) {
+	int offset = 0;
+	int rc;
+
+	if (websocket->send_node_linked) {
+		node_remove(&websocket->send_node);
+
+		websocket->send_node_linked = false;
+	}
+
+	websocket_close_frame(websocket);
+
+	while (offset < websocket->send_buffer_used) {
+		rc = socket_send_platform(&websocket->base, websocket->send_buffer + offset,
+		                          websocket->send_buffer_used - offset);
+
+		if (rc < 0) {
+			if (errno_interrupted()) {
+				continue;
+			}
+
+			if (errno_would_block()) {
+				break;
+			}
+
+			// the client notices the error on its next write. the buffered
+			// data cannot be delivered anymore
+			websocket->send_error = errno;
+			offset = websocket->send_buffer_used;
+
+			break;
+		}
+
+		offset += rc;
+	}
+
+	if (offset > 0) {
+		memmove(websocket->send_buffer, websocket->send_buffer + offset,
+		        websocket->send_buffer_used - offset);
+
+		websocket->send_buffer_used -= offset;
+	}
+
+	if (websocket->send_buffer_used > 0) {
+		if (!websocket->send_event_added) {
+			if (event_modify_source(websocket->base.base.handle, EVENT_SOURCE_TYPE_GENERIC,
+			                        0, EVENT_WRITE, websocket_handle_write, websocket) < 0) {
+				websocket->send_error = errno;
+				websocket->send_buffer_used = 0;
+
+				return;
+			}
+
+			websocket->send_event_added = true;
+		}
+	} else if (websocket->send_event_added) {
+		event_modify_source(websocket->base.base.handle, EVENT_SOURCE_TYPE_GENERIC,
+		                    EVENT_WRITE, 0, NULL, NULL);
+
+		websocket->send_event_added = false;
+	}
+}
+
+static void websocket_handle_write(void *opaque) {
+	websocket_flush((Websocket *)opaque);
+}
+
+static int websocket_reserve_send_buffer(Websocket *websocket, int length) {
+	int allocated = websocket->send_buffer_allocated;
+	uint8_t *send_buffer;
+
+	if (websocket->send_buffer_used + length <= allocated) {
+		return 0;
+	}
+
+	if (allocated == 0) {
+		allocated = 1024;
+	}
+
+	while (allocated < websocket->send_buffer_used + length) {
+		allocated *= 2;
+	}
+
+	send_buffer = realloc(websocket->send_buffer, allocated);
+
+	if (send_buffer == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	websocket->send_buffer = send_buffer;
+	websocket->send_buffer_allocated = allocated;
+
+	return 0;
+}
+
+// a websocket that is waiting for the socket to become writable sends new
+// frames together with the remainder
+static void websocket_request_flush(Websocket *websocket) {
+	if (!websocket->send_node_linked && !websocket->send_event_added) {
+		node_insert_before(&_websocket_send_sentinel, &websocket->send_node);
+
+		websocket->send_node_linked = true;
+	}
+}
+
+// appends the packet to the open binary frame. the frame is sent at the end
+// of the current event loop iteration together with all other packets that
+// got dispatched to this websocket in the meantime
 static int websocket_send_frame(Websocket *websocket, void *buffer, int length) {
-	WebsocketFrameWithPayload frame;
+	if (websocket->send_error != 0) {
+		errno = websocket->send_error;
 
-	if (length > WEBSOCKET_MAX_UNEXTENDED_PAYLOAD_DATA_LENGTH) {
-		// currently length should never exceed 80 (the current maximum packet
-		// size). so this is just a safeguard for possible later changes to the
-		// maximum packet size that might require adjustments here.
-		errno = E2BIG;
+		return -1;
+	}
+
+	if (websocket->send_buffer_used + WEBSOCKET_FRAME_HEADER_RESERVE + length > WEBSOCKET_MAX_SEND_BUFFER_LENGTH) {
+		++websocket->dropped_packets;
+
+		log_warn("Send buffer for WebSocket (handle: %d) is full, dropping packet, %u dropped in total",
+		         websocket->base.base.handle, websocket->dropped_packets);
+
+		return length;
+	}
 
+	// start a new frame if the packet doesn't fit into the open one anymore
+	if (websocket->frame_start >= 0 &&
+	    websocket->send_buffer_used - websocket->frame_start - WEBSOCKET_FRAME_HEADER_RESERVE + length >
+	    WEBSOCKET_MAX_EXTENDED_PAYLOAD_DATA_LENGTH) {
+		websocket_close_frame(websocket);
+	}
+
+	if (websocket_reserve_send_buffer(websocket, WEBSOCKET_FRAME_HEADER_RESERVE + length) < 0) {
 		return -1;
 	}
 
-	frame.header.opcode_rsv_fin = 0;
-	frame.header.payload_length_mask = 0;
-	websocket_frame_set_fin(&frame.header, 1);
-	websocket_frame_set_opcode(&frame.header, 2);
-	websocket_frame_set_mask(&frame.header, 0);
-	websocket_frame_set_payload_length(&frame.header, length);
-	memcpy(frame.payload_data, buffer, length);
+	if (websocket->frame_start < 0) {
+		websocket->frame_start = websocket->send_buffer_used;
+		websocket->send_buffer_used += WEBSOCKET_FRAME_HEADER_RESERVE;
+	}
+
+	memcpy(websocket->send_buffer + websocket->send_buffer_used, buffer, length);
+
+	websocket->send_buffer_used += length;
+
+	websocket_request_flush(websocket);
+
+	return length;
+}
+
+// queues a complete control frame behind the frames queued so far
+static void websocket_send_control_frame(Websocket *websocket, int opcode, uint8_t *payload, int length) {
+	WebsocketFrameHeader header;
+
+	if (websocket->send_error != 0) {
+		return;
+	}
+
+	websocket_close_frame(websocket);
+
+	if (websocket_reserve_send_buffer(websocket, sizeof(header) + length) < 0) {
+		log_error("Could not queue WebSocket control frame (opcode: %d): %s (%d)",
+		          opcode, get_errno_name(errno), errno);
+
+		return;
+	}
+
+	header.opcode_rsv_fin = 0;
+	header.payload_length_mask = 0;
+	websocket_frame_set_fin(&header, 1);
+	websocket_frame_set_opcode(&header, opcode);
+	websocket_frame_set_mask(&header, 0);
+	websocket_frame_set_payload_length(&header, length);
 
-	return socket_send_platform((Socket *)websocket, &frame, sizeof(WebsocketFrameHeader) + length);
+	memcpy(websocket->send_buffer + websocket->send_buffer_used, &header, sizeof(header));
+	memcpy(websocket->send_buffer + websocket->send_buffer_used + sizeof(header), payload, length);
+
+	websocket->send_buffer_used += sizeof(header) + length;
+
+	websocket_request_flush(websocket);
 }
 
 static void websocket_send_queued_data(Websocket *websocket) {
@@ -85,6 +388,113 @@ static void websocket_send_queued_data(Websocket *websocket) {
 	}
 }
 
+static int websocket_reserve_receive_buffer(Websocket *websocket, int length) {
+	int allocated = websocket->receive_buffer_allocated;
+	uint8_t *receive_buffer;
+
+	if (websocket->receive_buffer_used + length <= allocated) {
+		return 0;
+	}
+
+	if (websocket->receive_buffer_used + length > WEBSOCKET_MAX_RECEIVE_BUFFER_LENGTH) {
+		log_error("Receive buffer for WebSocket (handle: %d) is full",
+		          websocket->base.base.handle);
+
+		errno = ENOBUFS;
+
+		return -1;
+	}
+
+	if (allocated == 0) {
+		allocated = 4096;
+	}
+
+	while (allocated < websocket->receive_buffer_used + length) {
+		allocated *= 2;
+	}
+
+	receive_buffer = realloc(websocket->receive_buffer, allocated);
+
+	if (receive_buffer == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	websocket->receive_buffer = receive_buffer;
+	websocket->receive_buffer_allocated = allocated;
+
+	return 0;
+}
+
+static int websocket_buffer_received(Websocket *websocket, uint8_t *buffer, int length) {
+	if (websocket_reserve_receive_buffer(websocket, length) < 0) {
+		return -1;
+	}
+
+	memcpy(websocket->receive_buffer + websocket->receive_buffer_used, buffer, length);
+
+	websocket->receive_buffer_used += length;
+
+	return 0;
+}
+
+static int websocket_take_received(Websocket *websocket, uint8_t *buffer, int length) {
+	length = MIN(length, websocket->receive_buffer_used - websocket->receive_buffer_offset);
+
+	memcpy(buffer, websocket->receive_buffer + websocket->receive_buffer_offset, length);
+
+	websocket->receive_buffer_offset += length;
+
+	if (websocket->receive_buffer_offset == websocket->receive_buffer_used) {
+		websocket->receive_buffer_offset = 0;
+		websocket->receive_buffer_used = 0;
+	}
+
+	return length;
+}
+
+#ifdef BRICKD_WITH_ZLIB
+
+// decompresses the input and appends the result to the receive buffer
+static int websocket_decompress(Websocket *websocket, const uint8_t *input, int length) {
+	int consumed;
+	int produced;
+
+	for (;;) {
+		if (websocket_reserve_receive_buffer(websocket, 1024) < 0) {
+			return -1;
+		}
+
+		produced = websocket_deflate_decompress(&websocket->deflate, input, length, &consumed,
+		                                        websocket->receive_buffer + websocket->receive_buffer_used,
+		                                        websocket->receive_buffer_allocated - websocket->receive_buffer_used);
+
+		if (produced < 0) {
+			return -1;
+		}
+
+		input += consumed;
+		length -= consumed;
+		websocket->receive_buffer_used += produced;
+
+		// the decompressor might hold back output if the output was full
+		if (length == 0 && websocket->receive_buffer_used < websocket->receive_buffer_allocated) {
+			return 0;
+		}
+
+		if (consumed == 0 && produced == 0) {
+			log_error("Could not decompress WebSocket message, no progress");
+
+			errno = EINVAL;
+
+			return -1;
+		}
+	}
+}
+
+#endif
+
 int websocket_frame_get_opcode(WebsocketFrameHeader *header) {
 	return header->opcode_rsv_fin & 0xF;
 }
@@ -94,6 +504,10 @@ void websocket_frame_set_opcode(WebsocketFrameHeader *header, int opcode) {
 	header->opcode_rsv_fin |= opcode & 0xF;
 }
 
+int websocket_frame_get_rsv(WebsocketFrameHeader *header) {
+	return (header->opcode_rsv_fin >> 4) & 0x7;
+}
+
 int websocket_frame_get_fin(WebsocketFrameHeader *header) {
 	return (header->opcode_rsv_fin >> 7) & 0x1;
 }
@@ -129,6 +543,10 @@ int websocket_answer_handshake_error(Websocket *websocket) {
 
 int websocket_answer_handshake_ok(Websocket *websocket, char *key, int length) {
 	int ret;
+#ifdef BRICKD_WITH_ZLIB
+	char extensions[WEBSOCKET_DEFLATE_MAX_RESPONSE_LENGTH];
+	int extensions_length;
+#endif
 
 	ret = socket_send_platform(&websocket->base, WEBSOCKET_ANSWER_STRING_1, strlen(WEBSOCKET_ANSWER_STRING_1));
 
@@ -148,6 +566,31 @@ int websocket_answer_handshake_ok(Websocket *websocket, char *key, int length) {
 		return ret;
 	}
 
+#ifdef BRICKD_WITH_ZLIB
+	// without a working compressor the extension is not confirmed, then the
+	// connection continues uncompressed
+	if (websocket->deflate.negotiated &&
+	    websocket_deflate_start(&websocket->deflate, _compression_level) >= 0) {
+		extensions_length = websocket_deflate_format_response(&websocket->deflate, extensions,
+		                                                      sizeof(extensions));
+
+		ret = socket_send_platform(&websocket->base, extensions, extensions_length);
+
+		if (ret < 0) {
+			return ret;
+		}
+
+		log_debug("Using permessage-deflate for WebSocket (handle: %d)",
+		          websocket->base.base.handle);
+	}
+#endif
+
+	ret = socket_send_platform(&websocket->base, WEBSOCKET_ANSWER_STRING_3, strlen(WEBSOCKET_ANSWER_STRING_3));
+
+	if (ret < 0) {
+		return ret;
+	}
+
 	return IO_CONTINUE;
 }
 
@@ -203,6 +646,16 @@ int websocket_parse_handshake_line(Websocket *websocket, char *line, int length)
 		}
 	}
 
+#ifdef BRICKD_WITH_ZLIB
+	// Find "Sec-WebSocket-Extensions", the header can be given multiple times
+	if (_compression_level > 0 &&
+	    strncasecmp(line, WEBSOCKET_DEFLATE_EXTENSIONS_STRING, strlen(WEBSOCKET_DEFLATE_EXTENSIONS_STRING)) == 0) {
+		websocket_deflate_negotiate(&websocket->deflate, line + strlen(WEBSOCKET_DEFLATE_EXTENSIONS_STRING));
+
+		return IO_CONTINUE;
+	}
+#endif
+
 	// Find "Sec-WebSocket-Key"
 	if (strcasestr(line, WEBSOCKET_CLIENT_KEY_STRING) != NULL) {
 		memset(websocket->client_key, 0, WEBSOCKET_CLIENT_KEY_LENGTH);
@@ -221,13 +674,10 @@ int websocket_parse_handshake_line(Websocket *websocket, char *line, int length)
 	return IO_CONTINUE;
 }
 
+// returns the number of consumed bytes
 int websocket_parse_handshake(Websocket *websocket, char *handshake_part, int length) {
 	int i;
 
-	if (length <= 0) {
-		return length;
-	}
-
 	for (i = 0; i < length; i++) {
 		// If line > WEBSOCKET_MAX_LINE_LENGTH we just read over it until we find '\n'
 		// The lines we are interested in can't be that long
@@ -245,150 +695,334 @@ int websocket_parse_handshake(Websocket *websocket, char *handshake_part, int le
 			if (ret == -1) {
 				return ret;
 			}
+
+			// frames might follow the handshake in the same read
+			if (websocket->state == WEBSOCKET_STATE_HANDSHAKE_DONE) {
+				return i + 1;
+			}
 		}
 	}
 
-	return IO_CONTINUE;
+	return length;
 }
 
-int websocket_parse_header(Websocket *websocket, uint8_t *buffer, int length) {
-	int websocket_frame_length = sizeof(WebsocketFrame);
-	int to_copy = MIN(length, websocket_frame_length - websocket->frame_index);
+static int websocket_finish_frame(Websocket *websocket) {
+	websocket->state = WEBSOCKET_STATE_HANDSHAKE_DONE;
 
-	if (to_copy <= 0) {
-		log_error("WebSocket frame index has invalid value (%d)", websocket->frame_index);
-		return -1;
+	switch (websocket->frame_opcode) {
+	case WEBSOCKET_OPCODE_CONTINUATION_FRAME:
+	case WEBSOCKET_OPCODE_BINARY_FRAME:
+#ifdef BRICKD_WITH_ZLIB
+		if (websocket->compressed_message && !websocket->fragmented_message) {
+			websocket->compressed_message = false;
+
+			return websocket_decompress(websocket, websocket_deflate_trailer,
+			                            WEBSOCKET_DEFLATE_TRAILER_LENGTH);
+		}
+#endif
+
+		break;
+
+	case WEBSOCKET_OPCODE_CLOSE_FRAME:
+		log_debug("WebSocket opcode 'close frame'");
+
+		// echo the status code, if any. the close frame is sent before the
+		// client gets removed, because the send buffers are flushed first
+		websocket_send_control_frame(websocket, WEBSOCKET_OPCODE_CLOSE_FRAME,
+		                             websocket->control_payload,
+		                             MIN(websocket->control_payload_length, 2));
+
+		websocket->close_received = true;
+
+		break;
+
+	case WEBSOCKET_OPCODE_PING_FRAME:
+		log_debug("Answering WebSocket ping (length: %d) with pong",
+		          websocket->control_payload_length);
+
+		websocket_send_control_frame(websocket, WEBSOCKET_OPCODE_PONG_FRAME,
+		                             websocket->control_payload,
+		                             websocket->control_payload_length);
+
+		break;
+
+	case WEBSOCKET_OPCODE_PONG_FRAME:
+		log_debug("Ignoring WebSocket pong");
+
+		break;
 	}
 
-	memcpy(((char*)&websocket->frame) + websocket->frame_index, buffer, to_copy);
-	if (to_copy + websocket->frame_index < websocket_frame_length) {
+	return 0;
+}
+
+// returns the number of consumed bytes
+int websocket_parse_header(Websocket *websocket, uint8_t *buffer, int length) {
+	WebsocketFrameHeader *header = (WebsocketFrameHeader *)websocket->frame_header;
+	int consumed = 0;
+	int to_copy;
+	int fin;
+	int rsv;
+	int opcode;
+	int payload_length;
+	uint64_t extended_payload_length;
+	int i;
+
+	for (;;) {
+		to_copy = MIN(length - consumed, websocket->frame_header_length - websocket->frame_index);
+
+		memcpy(websocket->frame_header + websocket->frame_index, buffer + consumed, to_copy);
+
 		websocket->frame_index += to_copy;
-		return IO_CONTINUE;
-	} else {
-		int fin = websocket_frame_get_fin(&websocket->frame.header);
-		int opcode = websocket_frame_get_opcode(&websocket->frame.header);
-		int payload_length = websocket_frame_get_payload_length(&websocket->frame.header);
-		int mask = websocket_frame_get_mask(&websocket->frame.header);
+		consumed += to_copy;
 
-		log_packet_debug("WebSocket header received (fin: %d, opc: %d, len: %d, key: [%d %d %d %d])",
-		                 fin, opcode, payload_length,
-		                 websocket->frame.masking_key[0],
-		                 websocket->frame.masking_key[1],
-		                 websocket->frame.masking_key[2],
-		                 websocket->frame.masking_key[3]);
+		if (websocket->frame_index < websocket->frame_header_length) {
+			return consumed;
+		}
 
-		if (mask != 1) {
-			log_error("WebSocket frame has invalid mask (%d)", mask);
+		if (websocket->frame_header_length > (int)sizeof(WebsocketFrameHeader)) {
+			break;
+		}
+
+		// the first 2 bytes tell how long the complete header is
+		if (websocket_frame_get_mask(header) != 1) {
+			log_error("WebSocket frame has invalid mask (%d)", websocket_frame_get_mask(header));
 
 			return -1;
 		}
 
-		if (payload_length == 126 || payload_length == 127) {
-			log_error("WebSocket frame with extended payload length not supported (%d)", payload_length);
+		websocket->frame_header_length = sizeof(WebsocketFrameHeader) + WEBSOCKET_MASK_LENGTH;
+		payload_length = websocket_frame_get_payload_length(header);
 
-			return -1;
+		if (payload_length == 126) {
+			websocket->frame_header_length += sizeof(uint16_t);
+		} else if (payload_length == 127) {
+			websocket->frame_header_length += sizeof(uint64_t);
 		}
+	}
 
-		switch (opcode) {
-		case WEBSOCKET_OPCODE_CONTINUATION_FRAME:
-		case WEBSOCKET_OPCODE_TEXT_FRAME:
-			log_error("WebSocket opcodes 'continuation' and 'text' not supported");
+	fin = websocket_frame_get_fin(header);
+	rsv = websocket_frame_get_rsv(header);
+	opcode = websocket_frame_get_opcode(header);
+	payload_length = websocket_frame_get_payload_length(header);
 
-			return -1;
+	// extended payload lengths are in network byte order
+	if (payload_length == 126) {
+		extended_payload_length = ((uint64_t)websocket->frame_header[2] << 8) | websocket->frame_header[3];
+	} else if (payload_length == 127) {
+		extended_payload_length = 0;
 
-		case WEBSOCKET_OPCODE_BINARY_FRAME:
-			websocket->mask_index = 0;
-			websocket->frame_index = 0;
-			websocket->to_read = payload_length;
-			websocket->state = WEBSOCKET_STATE_HEADER_DONE;
+		for (i = 0; i < 8; ++i) {
+			extended_payload_length = (extended_payload_length << 8) | websocket->frame_header[2 + i];
+		}
+	} else {
+		extended_payload_length = payload_length;
+	}
 
-			if (length - to_copy > 0) {
-				memmove(buffer, buffer + to_copy, length - to_copy);
+	memcpy(websocket->masking_key,
+	       websocket->frame_header + websocket->frame_header_length - WEBSOCKET_MASK_LENGTH,
+	       WEBSOCKET_MASK_LENGTH);
 
-				return websocket_parse_data(websocket, buffer, length - to_copy);
-			}
+	log_packet_debug("WebSocket header received (fin: %d, opc: %d, len: %d, key: [%d %d %d %d])",
+	                 fin, opcode, payload_length,
+	                 websocket->masking_key[0],
+	                 websocket->masking_key[1],
+	                 websocket->masking_key[2],
+	                 websocket->masking_key[3]);
 
-			return IO_CONTINUE;
+	websocket->frame_index = 0;
+	websocket->frame_header_length = sizeof(WebsocketFrameHeader);
 
-		case WEBSOCKET_OPCODE_CLOSE_FRAME:
-			log_debug("WebSocket opcode 'close frame'");
+	if ((extended_payload_length >> 63) != 0) {
+		log_error("WebSocket frame has invalid payload length");
 
-			return 0;
+		return -1;
+	}
+
+	// only the first frame of a compressed message has rsv1 set
+	if (rsv != 0 && (rsv != WEBSOCKET_RSV_COMPRESSED ||
+	                 opcode != WEBSOCKET_OPCODE_BINARY_FRAME ||
+	                 !websocket_is_compressing(websocket))) {
+		log_error("WebSocket frame has reserved bits set (%d)", rsv);
+
+		return -1;
+	}
 
-		case WEBSOCKET_OPCODE_PING_FRAME:
-			log_error("WebSocket opcode 'ping' not supported");
+	switch (opcode) {
+	case WEBSOCKET_OPCODE_CONTINUATION_FRAME:
+		if (!websocket->fragmented_message) {
+			log_error("WebSocket continuation frame without preceding fragment");
 
 			return -1;
+		}
 
-		case WEBSOCKET_OPCODE_PONG_FRAME:
-			log_error("WebSocket opcode 'pong' not supported");
+		websocket->fragmented_message = fin == 0;
+
+		break;
+
+	case WEBSOCKET_OPCODE_BINARY_FRAME:
+		if (websocket->fragmented_message) {
+			log_error("WebSocket binary frame inside of a fragmented message");
 
 			return -1;
 		}
-	}
 
-	log_error("Unknown WebSocket opcode (%d)", websocket_frame_get_opcode(&websocket->frame.header));
+		websocket->fragmented_message = fin == 0;
+		websocket->compressed_message = rsv != 0;
 
-	return -1;
-}
+		break;
 
-int websocket_parse_data(Websocket *websocket, uint8_t *buffer, int length) {
-	int i;
-	int length_recursive_add = 0;
-	int to_read = MIN(length, websocket->to_read);
+	case WEBSOCKET_OPCODE_TEXT_FRAME:
+		log_error("WebSocket opcode 'text' not supported");
+
+		return -1;
 
-	for (i = 0; i < to_read; i++) {
-		buffer[i] ^= websocket->frame.masking_key[websocket->mask_index];
-		websocket->mask_index++;
+	case WEBSOCKET_OPCODE_CLOSE_FRAME:
+	case WEBSOCKET_OPCODE_PING_FRAME:
+	case WEBSOCKET_OPCODE_PONG_FRAME:
+		// control frames can be interleaved with the fragments of a message,
+		// but cannot be fragmented themselves
+		if (fin != 1 || extended_payload_length > WEBSOCKET_MAX_CONTROL_PAYLOAD_DATA_LENGTH) {
+			log_error("WebSocket control frame (opcode: %d) is fragmented or too long", opcode);
 
-		if (websocket->mask_index >= WEBSOCKET_MASK_LENGTH) {
-			websocket->mask_index = 0;
+			return -1;
 		}
-	}
 
-	websocket->to_read -= to_read;
+		break;
 
-	if (websocket->to_read < 0) {
-		log_error("WebSocket length mismatch (%d)", websocket->to_read);
+	default:
+		log_error("Unknown WebSocket opcode (%d)", opcode);
 
 		return -1;
-	} else if (websocket->to_read == 0) {
-		websocket->state = WEBSOCKET_STATE_HANDSHAKE_DONE;
-		websocket->mask_index = 0;
-		websocket->frame_index = 0;
 	}
 
-	if (length > to_read) {
-		length_recursive_add = websocket_parse(websocket, buffer + to_read, length - to_read);
+	websocket->frame_opcode = opcode;
+	websocket->mask_index = 0;
+	websocket->to_read = extended_payload_length;
+	websocket->control_payload_length = 0;
+	websocket->state = WEBSOCKET_STATE_HEADER_DONE;
 
-		if (length_recursive_add < 0) {
-			if (length_recursive_add == IO_CONTINUE) {
-				length_recursive_add = 0;
-			} else {
-				return length_recursive_add;
-			}
+	if (websocket->to_read == 0 && websocket_finish_frame(websocket) < 0) {
+		return -1;
+	}
+
+	return consumed;
+}
+
+// unmasks length bytes of payload, length must not exceed to_read. the payload
+// of data frames is moved to the output position, that is never behind the
+// input position. compressed payload is decompressed into the receive buffer,
+// then all following payload is appended there too, to keep the order. the
+// payload of control frames is collected and not passed on. returns the
+// number of bytes written to the output
+int websocket_parse_data(Websocket *websocket, uint8_t *buffer, int length, uint8_t *output) {
+	int output_length = 0;
+
+	if (websocket->frame_opcode >= WEBSOCKET_OPCODE_CLOSE_FRAME) {
+		memcpy(websocket->control_payload + websocket->control_payload_length, buffer, length);
+
+		websocket->mask_index = websocket_unmask(websocket->control_payload + websocket->control_payload_length,
+		                                         length, websocket->masking_key, websocket->mask_index);
+		websocket->control_payload_length += length;
+#ifdef BRICKD_WITH_ZLIB
+	} else if (websocket->compressed_message) {
+		websocket->mask_index = websocket_unmask(buffer, length, websocket->masking_key,
+		                                         websocket->mask_index);
+
+		if (websocket_decompress(websocket, buffer, length) < 0) {
+			return -1;
+		}
+#endif
+	} else if (websocket->receive_buffer_used > websocket->receive_buffer_offset) {
+		websocket->mask_index = websocket_unmask(buffer, length, websocket->masking_key,
+		                                         websocket->mask_index);
+
+		if (websocket_buffer_received(websocket, buffer, length) < 0) {
+			return -1;
 		}
+	} else {
+		if (output != buffer) {
+			memmove(output, buffer, length);
+		}
+
+		websocket->mask_index = websocket_unmask(output, length, websocket->masking_key,
+		                                         websocket->mask_index);
+		output_length = length;
 	}
 
-	return to_read + length_recursive_add;
+	websocket->to_read -= length;
+
+	if (websocket->to_read == 0 && websocket_finish_frame(websocket) < 0) {
+		return -1;
+	}
+
+	return output_length;
 }
 
+// parses the received data in a single pass. the unmasked payload of all
+// frames in the buffer is moved to the start of the buffer, so each byte is
+// moved at most once. returns the number of payload bytes
 int websocket_parse(Websocket *websocket, void *buffer, int length) {
-	switch (websocket->state) {
-	case WEBSOCKET_STATE_WAIT_FOR_HANDSHAKE:
-	case WEBSOCKET_STATE_FOUND_HANDSHAKE_KEY:
-		return websocket_parse_handshake(websocket, buffer, length);
+	uint8_t *data = buffer;
+	int read_index = 0;
+	int write_index = 0;
+	int chunk;
+	int rc;
 
-	case WEBSOCKET_STATE_HANDSHAKE_DONE:
-		return websocket_parse_header(websocket, buffer, length);
+	while (read_index < length && !websocket->close_received) {
+		switch (websocket->state) {
+		case WEBSOCKET_STATE_WAIT_FOR_HANDSHAKE:
+		case WEBSOCKET_STATE_FOUND_HANDSHAKE_KEY:
+			rc = websocket_parse_handshake(websocket, (char *)data + read_index, length - read_index);
 
-	case WEBSOCKET_STATE_HEADER_DONE:
-		return websocket_parse_data(websocket, buffer, length);
+			if (rc < 0) {
+				return rc;
+			}
+
+			read_index += rc;
+
+			break;
+
+		case WEBSOCKET_STATE_HANDSHAKE_DONE:
+			rc = websocket_parse_header(websocket, data + read_index, length - read_index);
+
+			if (rc < 0) {
+				return rc;
+			}
+
+			read_index += rc;
+
+			break;
+
+		case WEBSOCKET_STATE_HEADER_DONE:
+			chunk = (int)MIN((uint64_t)(length - read_index), websocket->to_read);
+			rc = websocket_parse_data(websocket, data + read_index, chunk, data + write_index);
+
+			if (rc < 0) {
+				return rc;
+			}
+
+			write_index += rc;
+			read_index += chunk;
+
+			break;
+
+		default:
+			log_error("In invalid WebSocket state (%d)", websocket->state);
+
+			return -1;
+		}
 	}
 
-	log_error("In invalid WebSocket state (%d)", websocket->state);
+	if (write_index > 0) {
+		return write_index;
+	}
 
-	return -1;
+	// a close frame ends the connection
+	if (websocket->close_received) {
+		return 0;
+	}
+
+	return IO_CONTINUE;
 }
 
 // sets errno on error
@@ -399,19 +1033,52 @@ int websocket_create(Websocket *websocket) {
 		return rc;
 	}
 
-	websocket->base.base.type = "WebSocket";
+	websocket->base.base.type = WEBSOCKET_IO_TYPE;
 	websocket->base.destroy = websocket_destroy;
 	websocket->base.receive = websocket_receive;
 	websocket->base.send = websocket_send;
 
-	websocket->frame_index = 0;
 	websocket->line_index = 0;
 	websocket->state = WEBSOCKET_STATE_WAIT_FOR_HANDSHAKE;
 
-	memset(&websocket->frame, 0, sizeof(WebsocketFrame));
+	memset(websocket->frame_header, 0, WEBSOCKET_MAX_FRAME_HEADER_LENGTH);
+	websocket->frame_index = 0;
+	websocket->frame_header_length = sizeof(WebsocketFrameHeader);
+	websocket->frame_opcode = 0;
+	websocket->mask_index = 0;
+	websocket->to_read = 0;
+	websocket->fragmented_message = false;
+	websocket->control_payload_length = 0;
+	websocket->close_received = false;
+	websocket->compressed_message = false;
+
+	websocket->receive_buffer = NULL;
+	websocket->receive_buffer_allocated = 0;
+	websocket->receive_buffer_used = 0;
+	websocket->receive_buffer_offset = 0;
+
+#ifdef BRICKD_WITH_ZLIB
+	websocket_deflate_create(&websocket->deflate);
+#endif
+
 	memset(websocket->line, 0, WEBSOCKET_MAX_LINE_LENGTH);
 	memset(websocket->client_key, 0, WEBSOCKET_CLIENT_KEY_LENGTH);
 
+	websocket->send_buffer = NULL;
+	websocket->send_buffer_allocated = 0;
+	websocket->send_buffer_used = 0;
+	websocket->frame_start = -1;
+	websocket->send_event_added = false;
+	websocket->send_error = 0;
+	websocket->dropped_packets = 0;
+	websocket->send_node_linked = false;
+
+	if (!_websocket_send_sentinel_initialized) {
+		node_reset(&_websocket_send_sentinel);
+
+		_websocket_send_sentinel_initialized = true;
+	}
+
 	if (queue_create(&websocket->send_queue, sizeof(WebsocketQueuedData)) < 0) {
 		return -1;
 	}
@@ -441,7 +1108,30 @@ Socket *websocket_create_allocated(void) {
 void websocket_destroy(Socket *socket) {
 	Websocket *websocket = (Websocket *)socket;
 
+	if (websocket->send_node_linked) {
+		node_remove(&websocket->send_node);
+	}
+
+#ifdef BRICKD_WITH_ZLIB
+	if (websocket->deflate.started) {
+		log_info("WebSocket (handle: %d) compressed %llu byte(s) to %llu byte(s) (%.1f%%) in %llu msec and decompressed %llu byte(s) to %llu byte(s) in %llu msec",
+		         websocket->base.base.handle,
+		         (unsigned long long)websocket->deflate.uncompressed_sent,
+		         (unsigned long long)websocket->deflate.compressed_sent,
+		         websocket->deflate.uncompressed_sent > 0
+		         ? 100.0 * websocket->deflate.compressed_sent / websocket->deflate.uncompressed_sent : 100.0,
+		         (unsigned long long)(websocket->deflate.compress_time / 1000),
+		         (unsigned long long)websocket->deflate.compressed_received,
+		         (unsigned long long)websocket->deflate.uncompressed_received,
+		         (unsigned long long)(websocket->deflate.decompress_time / 1000));
+	}
+
+	websocket_deflate_destroy(&websocket->deflate);
+#endif
+
 	queue_destroy(&websocket->send_queue, websocket_free_queued_data);
+	free(websocket->send_buffer);
+	free(websocket->receive_buffer);
 
 	socket_destroy_platform(socket);
 }
@@ -449,14 +1139,46 @@ void websocket_destroy(Socket *socket) {
 // sets errno on error
 int websocket_receive(Socket *socket, void *buffer, int length) {
 	Websocket *websocket = (Websocket *)socket;
+	int received;
+	int rc;
 
-	length = socket_receive_platform(socket, buffer, length);
+	// buffered payload comes before anything that is still in the socket
+	if (websocket->receive_buffer_used > websocket->receive_buffer_offset) {
+		return websocket_take_received(websocket, buffer, length);
+	}
 
-	if (length <= 0) {
-		return length;
+	if (websocket->close_received) {
+		return 0;
+	}
+
+	received = socket_receive_platform(socket, buffer, length);
+
+	if (received <= 0) {
+		return received;
+	}
+
+	rc = websocket_parse(websocket, buffer, received);
+
+	// all payload of this read went to the receive buffer, for example
+	// because it was compressed
+	if ((rc == 0 || rc == IO_CONTINUE) &&
+	    websocket->receive_buffer_used > websocket->receive_buffer_offset) {
+		return websocket_take_received(websocket, buffer, length);
 	}
 
-	return websocket_parse(websocket, buffer, length);
+	return rc;
+}
+
+// returns true if the IO is a WebSocket that has received payload buffered
+// which was not handed out by websocket_receive yet
+bool websocket_has_received_data(IO *io) {
+	Websocket *websocket = (Websocket *)io;
+
+	if (strcmp(io->type, WEBSOCKET_IO_TYPE) != 0) {
+		return false;
+	}
+
+	return websocket->receive_buffer_used > websocket->receive_buffer_offset;
 }
 
 // sets errno on error
@@ -491,3 +1213,35 @@ int websocket_send(Socket *socket, void *buffer, int length) {
 
 	return length;
 }
+
+// a compression level of 0 disables the permessage-deflate extension. frames
+// with less payload than the minimum frame size are sent uncompressed
+void websocket_set_compression(int level, int min_frame_size) {
+#ifndef BRICKD_WITH_ZLIB
+	if (level > 0) {
+		log_debug("WebSocket compression is not available in this build, ignoring compression level %d",
+		          level);
+
+		level = 0;
+	}
+#endif
+
+	_compression_level = level;
+	_compression_min_frame_size = min_frame_size;
+}
+
+// sends the batches of all websockets that got packets during the current
+// event loop iteration. called after each event loop iteration
+void websocket_flush_all(void) {
+	Websocket *websocket;
+
+	if (!_websocket_send_sentinel_initialized) {
+		return;
+	}
+
+	while (_websocket_send_sentinel.next != &_websocket_send_sentinel) {
+		websocket = containerof(_websocket_send_sentinel.next, Websocket, send_node);
+
+		websocket_flush(websocket);
+	}
+}
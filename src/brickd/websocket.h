@@ -23,12 +23,21 @@
 #ifndef BRICKD_WEBSOCKET_H
 #define BRICKD_WEBSOCKET_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include <daemonlib/node.h>
 #include <daemonlib/queue.h>
 #include <daemonlib/socket.h>
 
-#define WEBSOCKET_MAX_LINE_LENGTH 100 // Line length > 100 are not interesting for us
+#ifdef BRICKD_WITH_ZLIB
+	#include "websocket_deflate.h"
+#endif
+#include "websocket_mask.h"
+
+#define WEBSOCKET_IO_TYPE "WebSocket"
+
+#define WEBSOCKET_MAX_LINE_LENGTH 256 // Longer lines are not interesting for us
 #define WEBSOCKET_CLIENT_KEY_LENGTH 37 // Can be max 36
 #define WEBSOCKET_BASE64_DIGEST_LENGTH 30 // Can be max 30 for a 20 byte digest
 
@@ -36,7 +45,8 @@
 #define WEBSOCKET_SERVER_KEY "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
 
 #define WEBSOCKET_ANSWER_STRING_1 "HTTP/1.1 101 Switching Protocols\r\nAccess-Control-Allow-Origin: *\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: "
-#define WEBSOCKET_ANSWER_STRING_2 "\r\nSec-WebSocket-Protocol: tfp\r\n\r\n"
+#define WEBSOCKET_ANSWER_STRING_2 "\r\nSec-WebSocket-Protocol: tfp\r\n"
+#define WEBSOCKET_ANSWER_STRING_3 "\r\n"
 
 #define WEBSOCKET_ERROR_STRING "HTTP/1.1 200 OK\r\nContent-Length: 270\r\nContent-Type: text/html\r\n\r\n<html><head><title>This is a Websocket</title></head><body>Dear Sir or Madam,<br/><br/>I regret to inform you that there is no webserver here.<br/>This port is exclusively used for Websockets.<br/><br/>Yours faithfully,<blockquote>Brick Daemon</blockquote></body></html>"
 
@@ -47,9 +57,19 @@
 #define WEBSOCKET_OPCODE_PING_FRAME          9
 #define WEBSOCKET_OPCODE_PONG_FRAME         10
 
-#define WEBSOCKET_MASK_LENGTH 4
-
 #define WEBSOCKET_MAX_UNEXTENDED_PAYLOAD_DATA_LENGTH 125
+#define WEBSOCKET_MAX_EXTENDED_PAYLOAD_DATA_LENGTH 65535 // with 16-bit extended payload length
+
+#define WEBSOCKET_MAX_SEND_BUFFER_LENGTH (1024 * 1024)
+
+#define WEBSOCKET_MAX_RECEIVE_BUFFER_LENGTH (1024 * 1024)
+
+#define WEBSOCKET_MAX_CONTROL_PAYLOAD_DATA_LENGTH 125
+
+#define WEBSOCKET_RSV_COMPRESSED 0x4 // rsv1, used by permessage-deflate
+
+// header, 64-bit extended payload length and masking key
+#define WEBSOCKET_MAX_FRAME_HEADER_LENGTH (2 + 8 + WEBSOCKET_MASK_LENGTH)
 
 #include <daemonlib/packed_begin.h>
 
@@ -58,11 +78,6 @@ typedef struct {
 	uint8_t payload_length_mask; // payload_length: 7, mask: 1
 } ATTRIBUTE_PACKED WebsocketFrameHeader;
 
-typedef struct {
-	WebsocketFrameHeader header;
-	uint8_t payload_data[WEBSOCKET_MAX_UNEXTENDED_PAYLOAD_DATA_LENGTH];
-} ATTRIBUTE_PACKED WebsocketFrameWithPayload;
-
 typedef struct {
 	WebsocketFrameHeader header;
 	uint8_t masking_key[WEBSOCKET_MASK_LENGTH]; // only used if mask = 1
@@ -101,17 +116,50 @@ typedef struct {
 	char line[WEBSOCKET_MAX_LINE_LENGTH];
 	int line_index;
 
-	WebsocketFrame frame;
-	int frame_index;
+	// the frame parser works on the received data in place. the header of
+	// the current frame is collected here, it can span multiple reads
+	uint8_t frame_header[WEBSOCKET_MAX_FRAME_HEADER_LENGTH];
+	int frame_index; // number of header bytes received so far
+	int frame_header_length; // 2 until the first 2 header bytes are received
+	int frame_opcode;
+	uint8_t masking_key[WEBSOCKET_MASK_LENGTH];
 	int mask_index;
-
-	int to_read;
+	uint64_t to_read; // payload bytes of the current frame not received yet
+	bool fragmented_message; // a binary message continues in the next frame
+	uint8_t control_payload[WEBSOCKET_MAX_CONTROL_PAYLOAD_DATA_LENGTH];
+	int control_payload_length;
+	bool close_received;
+	bool compressed_message; // the current message has to be decompressed
+
+	// received payload that didn't fit into the buffer given to
+	// websocket_receive, such as decompressed messages
+	uint8_t *receive_buffer;
+	int receive_buffer_allocated;
+	int receive_buffer_used;
+	int receive_buffer_offset;
+
+#ifdef BRICKD_WITH_ZLIB
+	WebsocketDeflate deflate;
+#endif
 
 	Queue send_queue;
+
+	// outgoing packets are gathered in the send buffer as the payload of a
+	// binary frame. the frames are sent once per event loop iteration
+	uint8_t *send_buffer;
+	int send_buffer_allocated;
+	int send_buffer_used;
+	int frame_start; // offset of the open frame in the send buffer, -1 if none
+	bool send_event_added; // waiting for the socket to become writable
+	int send_error; // errno of a failed send, reported by the next websocket_send call
+	uint32_t dropped_packets;
+	Node send_node; // in the list of websockets with an unsent batch
+	bool send_node_linked;
 } Websocket;
 
 int websocket_frame_get_opcode(WebsocketFrameHeader *header);
 void websocket_frame_set_opcode(WebsocketFrameHeader *header, int opcode);
+int websocket_frame_get_rsv(WebsocketFrameHeader *header);
 int websocket_frame_get_fin(WebsocketFrameHeader *header);
 void websocket_frame_set_fin(WebsocketFrameHeader *header, int fin);
 int websocket_frame_get_payload_length(WebsocketFrameHeader *header);
@@ -124,7 +172,7 @@ int websocket_answer_handshake_ok(Websocket *websocket, char *key, int length);
 int websocket_parse_handshake_line(Websocket *websocket, char *line, int length);
 int websocket_parse_handshake(Websocket *websocket, char *handshake_part, int length);
 int websocket_parse_header(Websocket *websocket, uint8_t *buffer, int length);
-int websocket_parse_data(Websocket *websocket, uint8_t *buffer, int length);
+int websocket_parse_data(Websocket *websocket, uint8_t *buffer, int length, uint8_t *output);
 int websocket_parse(Websocket *websocket, void *buffer, int length);
 
 int websocket_create(Websocket *websocket);
@@ -133,4 +181,10 @@ void websocket_destroy(Socket *socket);
 int websocket_receive(Socket *socket, void *buffer, int length);
 int websocket_send(Socket *socket, void *buffer, int length);
 
+bool websocket_has_received_data(IO *io);
+
+void websocket_flush_all(void);
+
+void websocket_set_compression(int level, int min_frame_size);
+
 #endif // BRICKD_WEBSOCKET_H
@@ -0,0 +1,407 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * websocket_deflate.c: WebSocket permessage-deflate extension
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * implements the permessage-deflate extension as specified in RFC 7692. the
+ * compressor and decompressor keep their sliding window across messages
+ * (context takeover), unless the client asks the server not to do this for
+ * the compressor. repeated packet headers and UIDs are then compressed to
+ * back-references into earlier messages, this makes most of the gain for the
+ * small packets of callback streams.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "websocket_deflate.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define WEBSOCKET_DEFLATE_EXTENSION_NAME "permessage-deflate"
+#define WEBSOCKET_DEFLATE_MAX_WINDOW_BITS 15
+#define WEBSOCKET_DEFLATE_MIN_WINDOW_BITS 9 // zlib doesn't support 8 for raw deflate streams
+#define WEBSOCKET_DEFLATE_MEMORY_LEVEL 8
+
+const uint8_t websocket_deflate_trailer[WEBSOCKET_DEFLATE_TRAILER_LENGTH] = { 0x00, 0x00, 0xFF, 0xFF };
+
+static bool websocket_deflate_is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// compares the token [begin, end) to a string, ignoring case
+static bool websocket_deflate_token_equals(const char *begin, const char *end, const char *string) {
+	int length = strlen(string);
+
+	return end - begin == length && strncasecmp(begin, string, length) == 0;
+}
+
+// strips whitespace and quotes around the token [*begin, *end)
+static void websocket_deflate_trim(const char **begin, const char **end) {
+	while (*begin < *end && websocket_deflate_is_space(**begin)) {
+		++*begin;
+	}
+
+	while (*end > *begin && websocket_deflate_is_space(*(*end - 1))) {
+		--*end;
+	}
+
+	if (*end - *begin >= 2 && **begin == '"' && *(*end - 1) == '"') {
+		++*begin;
+		--*end;
+	}
+}
+
+// parses a window bits value, returns -1 if the value is invalid
+static int websocket_deflate_parse_window_bits(const char *begin, const char *end) {
+	int value = 0;
+
+	if (begin == end || end - begin > 2) {
+		return -1;
+	}
+
+	for (; begin < end; ++begin) {
+		if (*begin < '0' || *begin > '9') {
+			return -1;
+		}
+
+		value = value * 10 + *begin - '0';
+	}
+
+	return value;
+}
+
+// checks a single offer [begin, end) and records its parameters, if the offer
+// is acceptable. returns -1 if the offer is not acceptable
+static int websocket_deflate_accept_offer(WebsocketDeflate *extension, const char *begin, const char *end) {
+	const char *parameter_begin;
+	const char *parameter_end;
+	const char *value_begin;
+	const char *value_end;
+	bool server_no_context_takeover = false;
+	bool client_no_context_takeover = false;
+	bool client_max_window_bits = false;
+	int server_max_window_bits = 0;
+	int window_bits;
+	bool first = true;
+
+	while (begin < end) {
+		parameter_begin = begin;
+		parameter_end = memchr(begin, ';', end - begin);
+
+		if (parameter_end == NULL) {
+			parameter_end = end;
+		}
+
+		begin = parameter_end + 1;
+
+		value_begin = memchr(parameter_begin, '=', parameter_end - parameter_begin);
+
+		if (value_begin != NULL) {
+			value_end = parameter_end;
+			parameter_end = value_begin++;
+
+			websocket_deflate_trim(&value_begin, &value_end);
+		} else {
+			value_end = NULL;
+		}
+
+		websocket_deflate_trim(&parameter_begin, &parameter_end);
+
+		if (first) {
+			if (value_end != NULL ||
+			    !websocket_deflate_token_equals(parameter_begin, parameter_end, WEBSOCKET_DEFLATE_EXTENSION_NAME)) {
+				return -1;
+			}
+
+			first = false;
+		} else if (websocket_deflate_token_equals(parameter_begin, parameter_end, "server_no_context_takeover")) {
+			if (value_end != NULL || server_no_context_takeover) {
+				return -1;
+			}
+
+			server_no_context_takeover = true;
+		} else if (websocket_deflate_token_equals(parameter_begin, parameter_end, "client_no_context_takeover")) {
+			if (value_end != NULL || client_no_context_takeover) {
+				return -1;
+			}
+
+			client_no_context_takeover = true;
+		} else if (websocket_deflate_token_equals(parameter_begin, parameter_end, "server_max_window_bits")) {
+			if (value_end == NULL || server_max_window_bits != 0) {
+				return -1;
+			}
+
+			window_bits = websocket_deflate_parse_window_bits(value_begin, value_end);
+
+			if (window_bits < WEBSOCKET_DEFLATE_MIN_WINDOW_BITS ||
+			    window_bits > WEBSOCKET_DEFLATE_MAX_WINDOW_BITS) {
+				return -1;
+			}
+
+			server_max_window_bits = window_bits;
+		} else if (websocket_deflate_token_equals(parameter_begin, parameter_end, "client_max_window_bits")) {
+			// the decompressor always uses the maximum window size, so the
+			// client can use any window size
+			if (client_max_window_bits) {
+				return -1;
+			}
+
+			if (value_end != NULL) {
+				window_bits = websocket_deflate_parse_window_bits(value_begin, value_end);
+
+				if (window_bits < 8 || window_bits > WEBSOCKET_DEFLATE_MAX_WINDOW_BITS) {
+					return -1;
+				}
+			}
+
+			client_max_window_bits = true;
+		} else {
+			return -1;
+		}
+	}
+
+	if (first) {
+		return -1;
+	}
+
+	extension->negotiated = true;
+	extension->server_no_context_takeover = server_no_context_takeover;
+	extension->client_no_context_takeover = client_no_context_takeover;
+	extension->server_max_window_bits = server_max_window_bits;
+
+	return 0;
+}
+
+void websocket_deflate_create(WebsocketDeflate *extension) {
+	memset(extension, 0, sizeof(WebsocketDeflate));
+}
+
+void websocket_deflate_destroy(WebsocketDeflate *extension) {
+	if (extension->started) {
+		deflateEnd(&extension->compressor);
+		inflateEnd(&extension->decompressor);
+	}
+
+	free(extension->output);
+}
+
+// accepts the first acceptable permessage-deflate offer from the value of a
+// Sec-WebSocket-Extensions header. returns -1 if there is none
+int websocket_deflate_negotiate(WebsocketDeflate *extension, const char *offers) {
+	const char *end;
+
+	if (extension->negotiated) {
+		return 0;
+	}
+
+	for (;;) {
+		end = strchr(offers, ',');
+
+		if (end == NULL) {
+			end = offers + strlen(offers);
+		}
+
+		if (websocket_deflate_accept_offer(extension, offers, end) >= 0) {
+			log_debug("Accepted WebSocket permessage-deflate offer (server_no_context_takeover: %d, client_no_context_takeover: %d, server_max_window_bits: %d)",
+			          extension->server_no_context_takeover ? 1 : 0,
+			          extension->client_no_context_takeover ? 1 : 0,
+			          extension->server_max_window_bits);
+
+			return 0;
+		}
+
+		if (*end == '\0') {
+			return -1;
+		}
+
+		offers = end + 1;
+	}
+}
+
+// formats the Sec-WebSocket-Extensions header line for the handshake answer
+int websocket_deflate_format_response(WebsocketDeflate *extension, char *buffer, int length) {
+	char window_bits[48] = "";
+
+	if (extension->server_max_window_bits > 0) {
+		snprintf(window_bits, sizeof(window_bits), "; server_max_window_bits=%d",
+		         extension->server_max_window_bits);
+	}
+
+	return snprintf(buffer, length, "%s %s%s%s\r\n",
+	                WEBSOCKET_DEFLATE_EXTENSIONS_STRING,
+	                WEBSOCKET_DEFLATE_EXTENSION_NAME,
+	                extension->server_no_context_takeover ? "; server_no_context_takeover" : "",
+	                window_bits);
+}
+
+int websocket_deflate_start(WebsocketDeflate *extension, int level) {
+	int window_bits = WEBSOCKET_DEFLATE_MAX_WINDOW_BITS;
+	int rc;
+
+	if (extension->server_max_window_bits > 0) {
+		window_bits = extension->server_max_window_bits;
+	}
+
+	// negative window bits select a raw deflate stream without zlib header
+	rc = deflateInit2(&extension->compressor, level, Z_DEFLATED, -window_bits,
+	                  WEBSOCKET_DEFLATE_MEMORY_LEVEL, Z_DEFAULT_STRATEGY);
+
+	if (rc != Z_OK) {
+		log_error("Could not initialize WebSocket compressor: %s (%d)",
+		          extension->compressor.msg != NULL ? extension->compressor.msg : "<unknown>", rc);
+
+		return -1;
+	}
+
+	rc = inflateInit2(&extension->decompressor, -WEBSOCKET_DEFLATE_MAX_WINDOW_BITS);
+
+	if (rc != Z_OK) {
+		log_error("Could not initialize WebSocket decompressor: %s (%d)",
+		          extension->decompressor.msg != NULL ? extension->decompressor.msg : "<unknown>", rc);
+
+		deflateEnd(&extension->compressor);
+
+		return -1;
+	}
+
+	extension->started = true;
+
+	return 0;
+}
+
+// compresses a complete message. returns the compressed length and stores a
+// pointer to the compressed data, that stays valid until the next call
+int websocket_deflate_compress(WebsocketDeflate *extension, uint8_t *input,
+                               int length, uint8_t **output) {
+	uint64_t start = microseconds();
+	int used = 0;
+	int allocated;
+	uint8_t *bytes;
+	int rc;
+
+	// a sync flush appends an empty stored block, reserve room for it
+	allocated = (int)deflateBound(&extension->compressor, length) + 16;
+
+	extension->compressor.next_in = input;
+	extension->compressor.avail_in = length;
+
+	do {
+		if (extension->output_allocated < allocated) {
+			bytes = realloc(extension->output, allocated);
+
+			if (bytes == NULL) {
+				errno = ENOMEM;
+
+				return -1;
+			}
+
+			extension->output = bytes;
+			extension->output_allocated = allocated;
+		}
+
+		extension->compressor.next_out = extension->output + used;
+		extension->compressor.avail_out = extension->output_allocated - used;
+
+		rc = deflate(&extension->compressor, Z_SYNC_FLUSH);
+
+		if (rc != Z_OK && rc != Z_BUF_ERROR) {
+			log_error("Could not compress WebSocket message: %s (%d)",
+			          extension->compressor.msg != NULL ? extension->compressor.msg : "<unknown>", rc);
+
+			errno = EINVAL;
+
+			return -1;
+		}
+
+		used = extension->output_allocated - extension->compressor.avail_out;
+		allocated = extension->output_allocated * 2;
+	} while (extension->compressor.avail_out == 0);
+
+	// the receiver appends the tail of the empty stored block again
+	if (used < WEBSOCKET_DEFLATE_TRAILER_LENGTH ||
+	    memcmp(extension->output + used - WEBSOCKET_DEFLATE_TRAILER_LENGTH,
+	           websocket_deflate_trailer, WEBSOCKET_DEFLATE_TRAILER_LENGTH) != 0) {
+		log_error("Compressed WebSocket message has no sync flush trailer");
+
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	used -= WEBSOCKET_DEFLATE_TRAILER_LENGTH;
+
+	if (extension->server_no_context_takeover) {
+		deflateReset(&extension->compressor);
+	}
+
+	*output = extension->output;
+
+	extension->uncompressed_sent += length;
+	extension->compressed_sent += used;
+	extension->compress_time += microseconds() - start;
+
+	return used;
+}
+
+// decompresses as much of the input as fits into the output. returns the
+// number of bytes written to the output and stores the number of consumed
+// input bytes. the end of a message is marked by passing the trailer
+int websocket_deflate_decompress(WebsocketDeflate *extension, const uint8_t *input,
+                                 int length, int *consumed, uint8_t *output,
+                                 int output_length) {
+	uint64_t start = microseconds();
+	int produced;
+	int rc;
+
+	extension->decompressor.next_in = (Bytef *)input;
+	extension->decompressor.avail_in = length;
+	extension->decompressor.next_out = output;
+	extension->decompressor.avail_out = output_length;
+
+	rc = inflate(&extension->decompressor, Z_SYNC_FLUSH);
+
+	if (rc == Z_STREAM_END) {
+		// the client ended the deflate stream with a final block. the
+		// next message starts a new stream
+		inflateReset(&extension->decompressor);
+	} else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+		log_error("Could not decompress WebSocket message: %s (%d)",
+		          extension->decompressor.msg != NULL ? extension->decompressor.msg : "<unknown>", rc);
+
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	*consumed = length - extension->decompressor.avail_in;
+	produced = output_length - extension->decompressor.avail_out;
+
+	extension->compressed_received += *consumed;
+	extension->uncompressed_received += produced;
+	extension->decompress_time += microseconds() - start;
+
+	return produced;
+}
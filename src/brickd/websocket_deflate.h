@@ -0,0 +1,74 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * websocket_deflate.h: WebSocket permessage-deflate extension
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_WEBSOCKET_DEFLATE_H
+#define BRICKD_WEBSOCKET_DEFLATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zlib.h>
+
+#define WEBSOCKET_DEFLATE_EXTENSIONS_STRING "Sec-WebSocket-Extensions:"
+#define WEBSOCKET_DEFLATE_MAX_RESPONSE_LENGTH 128
+
+// a compressed message is a raw deflate stream flushed with Z_SYNC_FLUSH. the
+// flush ends with these 4 bytes, they are not sent and the receiver appends
+// them again
+#define WEBSOCKET_DEFLATE_TRAILER_LENGTH 4
+
+extern const uint8_t websocket_deflate_trailer[WEBSOCKET_DEFLATE_TRAILER_LENGTH];
+
+typedef struct {
+	// negotiated parameters
+	bool negotiated;
+	bool server_no_context_takeover;
+	bool client_no_context_takeover;
+	int server_max_window_bits; // 0 if not requested by the client
+
+	bool started;
+	z_stream compressor;
+	z_stream decompressor;
+	uint8_t *output; // compressed message
+	int output_allocated;
+
+	// statistics
+	uint64_t uncompressed_sent;
+	uint64_t compressed_sent;
+	uint64_t compressed_received;
+	uint64_t uncompressed_received;
+	uint64_t compress_time; // microseconds
+	uint64_t decompress_time; // microseconds
+} WebsocketDeflate;
+
+void websocket_deflate_create(WebsocketDeflate *extension);
+void websocket_deflate_destroy(WebsocketDeflate *extension);
+
+int websocket_deflate_negotiate(WebsocketDeflate *extension, const char *offers);
+int websocket_deflate_format_response(WebsocketDeflate *extension, char *buffer, int length);
+int websocket_deflate_start(WebsocketDeflate *extension, int level);
+
+int websocket_deflate_compress(WebsocketDeflate *extension, uint8_t *input,
+                               int length, uint8_t **output);
+int websocket_deflate_decompress(WebsocketDeflate *extension, const uint8_t *input,
+                                 int length, int *consumed, uint8_t *output,
+                                 int output_length);
+
+#endif // BRICKD_WEBSOCKET_DEFLATE_H
@@ -0,0 +1,136 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * websocket_mask.c: WebSocket payload unmasking
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * the payload of a frame from a client is XORed with a 4 byte masking key,
+ * the key repeats every 4 bytes. the key rotated to start at the current mask
+ * index and repeated to the width of a word or vector can be XORed onto the
+ * payload in one step. this leaves the mask index unchanged, because the width
+ * is a multiple of 4. only the unaligned head and the tail of the payload are
+ * unmasked bytewise and advance the mask index. the returned mask index is
+ * passed in again for the next part of the payload, so a frame split across
+ * multiple reads is unmasked correctly.
+ */
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+
+	#define WEBSOCKET_UNMASK_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#include <arm_neon.h>
+
+	#define WEBSOCKET_UNMASK_NEON
+#endif
+
+#include "websocket_mask.h"
+
+#define WEBSOCKET_UNMASK_ALIGNMENT 16
+
+const char *websocket_unmask_get_implementation(void) {
+#if defined WEBSOCKET_UNMASK_SSE2
+	return "sse2";
+#elif defined WEBSOCKET_UNMASK_NEON
+	return "neon";
+#else
+	return "word";
+#endif
+}
+
+// reference implementation, also used for the head and the tail
+int websocket_unmask_bytewise(uint8_t *buffer, int length,
+                              const uint8_t *masking_key, int mask_index) {
+	int i;
+
+	for (i = 0; i < length; ++i) {
+		buffer[i] ^= masking_key[mask_index];
+		mask_index = (mask_index + 1) % WEBSOCKET_MASK_LENGTH;
+	}
+
+	return mask_index;
+}
+
+// XORs the buffer with the masking key, starting at the given mask index.
+// returns the mask index for the byte following the buffer
+int websocket_unmask(uint8_t *buffer, int length,
+                     const uint8_t *masking_key, int mask_index) {
+	uint8_t expanded_key[WEBSOCKET_UNMASK_ALIGNMENT];
+	uint64_t key_word;
+	uint64_t word;
+	int head;
+	int i;
+#if defined WEBSOCKET_UNMASK_SSE2
+	__m128i key_vector;
+#elif defined WEBSOCKET_UNMASK_NEON
+	uint8x16_t key_vector;
+#endif
+
+	head = (int)((WEBSOCKET_UNMASK_ALIGNMENT - ((uintptr_t)buffer % WEBSOCKET_UNMASK_ALIGNMENT)) % WEBSOCKET_UNMASK_ALIGNMENT);
+
+	if (head > length) {
+		head = length;
+	}
+
+	mask_index = websocket_unmask_bytewise(buffer, head, masking_key, mask_index);
+	buffer += head;
+	length -= head;
+
+	for (i = 0; i < WEBSOCKET_UNMASK_ALIGNMENT; ++i) {
+		expanded_key[i] = masking_key[(mask_index + i) % WEBSOCKET_MASK_LENGTH];
+	}
+
+#if defined WEBSOCKET_UNMASK_SSE2
+	key_vector = _mm_loadu_si128((const __m128i *)expanded_key);
+
+	while (length >= WEBSOCKET_UNMASK_ALIGNMENT) {
+		_mm_store_si128((__m128i *)buffer,
+		                _mm_xor_si128(_mm_load_si128((const __m128i *)buffer), key_vector));
+
+		buffer += WEBSOCKET_UNMASK_ALIGNMENT;
+		length -= WEBSOCKET_UNMASK_ALIGNMENT;
+	}
+#elif defined WEBSOCKET_UNMASK_NEON
+	key_vector = vld1q_u8(expanded_key);
+
+	while (length >= WEBSOCKET_UNMASK_ALIGNMENT) {
+		vst1q_u8(buffer, veorq_u8(vld1q_u8(buffer), key_vector));
+
+		buffer += WEBSOCKET_UNMASK_ALIGNMENT;
+		length -= WEBSOCKET_UNMASK_ALIGNMENT;
+	}
+#endif
+
+	// the compiler turns these memcpy calls into plain loads and stores,
+	// but unlike a pointer cast they don't violate strict aliasing
+	memcpy(&key_word, expanded_key, sizeof(key_word));
+
+	while (length >= (int)sizeof(word)) {
+		memcpy(&word, buffer, sizeof(word));
+		word ^= key_word;
+		memcpy(buffer, &word, sizeof(word));
+
+		buffer += sizeof(word);
+		length -= sizeof(word);
+	}
+
+	return websocket_unmask_bytewise(buffer, length, masking_key, mask_index);
+}
@@ -0,0 +1,36 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * websocket_mask.h: WebSocket payload unmasking
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_WEBSOCKET_MASK_H
+#define BRICKD_WEBSOCKET_MASK_H
+
+#include <stdint.h>
+
+#define WEBSOCKET_MASK_LENGTH 4
+
+const char *websocket_unmask_get_implementation(void);
+
+int websocket_unmask_bytewise(uint8_t *buffer, int length,
+                              const uint8_t *masking_key, int mask_index);
+int websocket_unmask(uint8_t *buffer, int length,
+                     const uint8_t *masking_key, int mask_index);
+
+#endif // BRICKD_WEBSOCKET_MASK_H
@@ -0,0 +1,259 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * callback_history_test.c: Tests for the callback history
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Records callbacks of several devices in random order and checks that the
+ * replay returns the last callbacks of each (UID, function ID) pair, oldest
+ * first, and that a forgotten device is not replayed anymore. The replays
+ * are split into pages. Then records more (UID, function ID) pairs than the
+ * history can hold and checks that the pairs whose last callback is the
+ * oldest are evicted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "../brickd/callback_history.h"
+
+#define HISTORY_LENGTH 4
+#define DEVICE_COUNT 50
+#define FUNCTION_COUNT 3
+#define CALLBACK_COUNT 10000
+
+typedef struct {
+	uint32_t uid; // 0 for all devices
+	int count;
+	int foreign; // callbacks of other devices
+} Replay;
+
+// index of the last recorded callback per (device, function)
+static int _indices[DEVICE_COUNT][FUNCTION_COUNT];
+
+static uint32_t get_uid(int device) {
+	// not in sorted order to exercise the insertion
+	return uint32_to_le((uint32_t)((device * 7919) % 1009 + 2));
+}
+
+static void fill_callback(Packet *callback, int device, int function, int index) {
+	memset(callback, 0, sizeof(*callback));
+
+	callback->header.uid = get_uid(device);
+	callback->header.length = sizeof(PacketHeader) + 4;
+	callback->header.function_id = (uint8_t)(function + 10);
+
+	memcpy(callback->payload, &index, sizeof(index));
+}
+
+static void check_callback(Packet *callback, void *opaque) {
+	Replay *replay = opaque;
+
+	if (replay->uid != 0 && callback->header.uid != replay->uid) {
+		++replay->foreign;
+	}
+
+	++replay->count;
+}
+
+// replays all pages, returns the number of replayed callbacks or -1 if a
+// page is too big or the remaining count is wrong
+static int replay_pages(uint32_t uid, CallbackHistoryFunction function, void *opaque) {
+	uint32_t remaining;
+	uint32_t expected_remaining = 0;
+	int count = 0;
+	int page = 0;
+	int page_count;
+
+	do {
+		page_count = callback_history_replay(uid, (uint32_t)count, function, opaque, &remaining);
+
+		if (page_count > CALLBACK_HISTORY_MAX_REPLAY_COUNT ||
+		    (page > 0 && (uint32_t)page_count + remaining != expected_remaining)) {
+			printf("page %d of UID %u has %d callback(s) and %u remaining\n",
+			       page, uint32_from_le(uid), page_count, remaining);
+
+			return -1;
+		}
+
+		count += page_count;
+		expected_remaining = remaining;
+		++page;
+	} while (remaining > 0);
+
+	return count;
+}
+
+static int test_replay(uint32_t uid, int expected_count) {
+	Replay replay;
+	int count;
+
+	memset(&replay, 0, sizeof(replay));
+
+	replay.uid = uid;
+
+	count = replay_pages(uid, check_callback, &replay);
+
+	if (count != expected_count || replay.count != expected_count || replay.foreign > 0) {
+		printf("replay of UID %u returned %d callback(s), expected %d\n",
+		       uint32_from_le(uid), count, expected_count);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+typedef struct {
+	int last_index;
+	int failed;
+} OrderCheck;
+
+// the callbacks of one pair are replayed oldest first and end with the last
+// recorded one
+static void check_order(Packet *callback, void *opaque) {
+	OrderCheck *check = opaque;
+	int index;
+	int device;
+	int function = callback->header.function_id - 10;
+
+	memcpy(&index, callback->payload, sizeof(index));
+
+	for (device = 0; device < DEVICE_COUNT; ++device) {
+		if (get_uid(device) == callback->header.uid) {
+			break;
+		}
+	}
+
+	if (device == DEVICE_COUNT || function < 0 || function >= FUNCTION_COUNT ||
+	    index > _indices[device][function]) {
+		check->failed = 1;
+	}
+
+	if (index == _indices[device][function]) {
+		check->last_index = -1;
+	} else if (check->last_index >= 0 && index <= check->last_index) {
+		check->failed = 1;
+	} else {
+		check->last_index = index;
+	}
+}
+
+int main(void) {
+	Packet callback;
+	OrderCheck check;
+	int device;
+	int function;
+	int i;
+
+	log_init();
+
+	if (callback_history_init(HISTORY_LENGTH) < 0) {
+		printf("could not initialize callback history\n");
+
+		return EXIT_FAILURE;
+	}
+
+	if (test_replay(0, 0) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	srand(42);
+
+	for (i = 0; i < CALLBACK_COUNT; ++i) {
+		device = rand() % DEVICE_COUNT;
+		function = rand() % FUNCTION_COUNT;
+
+		fill_callback(&callback, device, function, i);
+		callback_history_record(&callback);
+
+		_indices[device][function] = i;
+	}
+
+	// with this many callbacks each ring is full
+	if (test_replay(0, DEVICE_COUNT * FUNCTION_COUNT * HISTORY_LENGTH) < 0 ||
+	    test_replay(get_uid(7), FUNCTION_COUNT * HISTORY_LENGTH) < 0 ||
+	    test_replay(uint32_to_le(1), 0) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	memset(&check, 0, sizeof(check));
+
+	check.last_index = -1;
+
+	if (replay_pages(0, check_order, &check) < 0 || check.failed) {
+		printf("replay returned callbacks in unexpected order\n");
+
+		return EXIT_FAILURE;
+	}
+
+	callback_history_forget(get_uid(7));
+
+	if (test_replay(get_uid(7), 0) < 0 ||
+	    test_replay(get_uid(8), FUNCTION_COUNT * HISTORY_LENGTH) < 0 ||
+	    test_replay(0, (DEVICE_COUNT - 1) * FUNCTION_COUNT * HISTORY_LENGTH) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	callback_history_exit();
+
+	// fill the history with pairs of one callback each, then record the first
+	// pair again, so the second pair has the oldest last callback
+	if (callback_history_init(HISTORY_LENGTH) < 0) {
+		printf("could not initialize callback history\n");
+
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < CALLBACK_HISTORY_MAX_ENTRIES; ++i) {
+		fill_callback(&callback, 0, 0, i);
+		callback.header.uid = uint32_to_le((uint32_t)i + 2);
+		callback_history_record(&callback);
+	}
+
+	callback.header.uid = uint32_to_le(2);
+	callback_history_record(&callback);
+
+	for (i = 0; i < 10; ++i) {
+		fill_callback(&callback, 0, 0, i);
+		callback.header.uid = uint32_to_le((uint32_t)(CALLBACK_HISTORY_MAX_ENTRIES + i) + 2);
+		callback_history_record(&callback);
+	}
+
+	if (test_replay(uint32_to_le(2), 2) < 0 ||
+	    test_replay(uint32_to_le(3), 0) < 0 ||
+	    test_replay(uint32_to_le(12), 0) < 0 ||
+	    test_replay(uint32_to_le(13), 1) < 0 ||
+	    test_replay(uint32_to_le(CALLBACK_HISTORY_MAX_ENTRIES + 11), 1) < 0 ||
+	    test_replay(0, CALLBACK_HISTORY_MAX_ENTRIES + 1) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	callback_history_exit();
+
+	log_exit();
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,226 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * callback_stream_test.c: Tests for the UDP callback stream
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Streams callbacks to a UDP socket on the loopback interface and checks
+ * that they arrive in order with consecutive sequence numbers, that the UID
+ * filter works and that enumerate callbacks are not streamed. Every other
+ * callback is streamed with a timestamp callback, that has to arrive in the
+ * same datagram in front of it.
+ */
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "../brickd/callback_stream.h"
+
+#define CALLBACK_COUNT 1000
+#define STREAMED_UID 0x12345678
+#define TIMESTAMP_UID 1
+#define TIMESTAMP_FUNCTION_ID 7
+
+static void fill_callback(Packet *callback, uint32_t uid, uint8_t function_id, int index) {
+	memset(callback, 0, sizeof(*callback));
+
+	callback->header.uid = uint32_to_le(uid);
+	callback->header.length = sizeof(PacketHeader) + 4 + index % 32;
+	callback->header.function_id = function_id;
+
+	memcpy(callback->payload, &index, sizeof(index));
+}
+
+static int open_receiver(uint16_t *port) {
+	struct sockaddr_in address;
+	socklen_t length = sizeof(address);
+	int fd;
+	int size = 4 * 1024 * 1024;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	// large enough for all datagrams of the test
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	memset(&address, 0, sizeof(address));
+
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+	    getsockname(fd, (struct sockaddr *)&address, &length) < 0) {
+		close(fd);
+
+		return -1;
+	}
+
+	*port = ntohs(address.sin_port);
+
+	return fd;
+}
+
+int main(void) {
+	SetCallbackStreamRequest request;
+	PacketE error_code;
+	CallbackStream *stream;
+	Packet callback;
+	Packet timestamp_callback;
+	Packet *received_callback;
+	CallbackStreamDatagram datagram;
+	uint16_t port;
+	int fd;
+	int expected_index = 0;
+	int received = 0;
+	int index;
+	int length;
+	int i;
+
+	log_init();
+
+	fd = open_receiver(&port);
+
+	if (fd < 0) {
+		printf("could not open receiver: %s (%d)\n", strerror(errno), errno);
+
+		return EXIT_FAILURE;
+	}
+
+	memset(&request, 0, sizeof(request));
+
+	// 127.0.0.1 as IPv4-mapped IPv6 address
+	request.address[10] = 0xFF;
+	request.address[11] = 0xFF;
+	request.address[12] = 127;
+	request.address[15] = 1;
+	request.port = uint16_to_le(port);
+	request.uid = uint32_to_le(STREAMED_UID);
+
+	stream = callback_stream_create(&request, &error_code);
+
+	if (stream == NULL) {
+		printf("could not create stream (error code: %d)\n", error_code);
+
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < CALLBACK_COUNT; ++i) {
+		fill_callback(&callback, STREAMED_UID, 10, i);
+
+		if (!callback_stream_is_matching(stream, &callback)) {
+			printf("callback %d is not matching\n", i);
+
+			return EXIT_FAILURE;
+		}
+
+		if (i % 2 == 1) {
+			fill_callback(&timestamp_callback, TIMESTAMP_UID, TIMESTAMP_FUNCTION_ID, i);
+			callback_stream_enqueue(stream, &callback, &timestamp_callback);
+		} else {
+			callback_stream_enqueue(stream, &callback, NULL);
+		}
+
+		if (i % 100 == 99) {
+			callback_stream_flush_all();
+		}
+	}
+
+	callback_stream_flush_all();
+
+	fill_callback(&callback, STREAMED_UID + 1, 10, 0);
+
+	if (callback_stream_is_matching(stream, &callback)) {
+		printf("callback of other UID is matching\n");
+
+		return EXIT_FAILURE;
+	}
+
+	fill_callback(&callback, STREAMED_UID, CALLBACK_ENUMERATE, 0);
+
+	if (callback_stream_is_matching(stream, &callback)) {
+		printf("enumerate callback is matching\n");
+
+		return EXIT_FAILURE;
+	}
+
+	if (stream->sent + stream->dropped != CALLBACK_COUNT) {
+		printf("sent and dropped datagrams don't add up\n");
+
+		return EXIT_FAILURE;
+	}
+
+	for (;;) {
+		length = recv(fd, &datagram, sizeof(datagram), MSG_DONTWAIT);
+
+		if (length < 0) {
+			break;
+		}
+
+		received_callback = &datagram.packet;
+
+		if (datagram.packet.header.uid == uint32_to_le(TIMESTAMP_UID)) {
+			received_callback = (Packet *)((uint8_t *)&datagram.packet + datagram.packet.header.length);
+		}
+
+		memcpy(&index, received_callback->payload, sizeof(index));
+
+		if (uint32_from_le(datagram.sequence_number) != (uint32_t)index ||
+		    length != (int)((uint8_t *)received_callback - (uint8_t *)&datagram) + received_callback->header.length ||
+		    (index % 2 == 1) != (received_callback != &datagram.packet) ||
+		    index < expected_index) {
+			printf("received unexpected datagram (sequence number: %u, index: %d)\n",
+			       uint32_from_le(datagram.sequence_number), index);
+
+			return EXIT_FAILURE;
+		}
+
+		expected_index = index + 1;
+		++received;
+	}
+
+	// loopback should not lose datagrams, but the sequence numbers tell
+	printf("received %d of %d datagram(s), %llu dropped by the sender\n",
+	       received, CALLBACK_COUNT, (unsigned long long)stream->dropped);
+
+	if (received != (int)stream->sent) {
+		printf("received datagram count does not match sent count\n");
+
+		return EXIT_FAILURE;
+	}
+
+	callback_stream_destroy(stream);
+	close(fd);
+
+	log_exit();
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}
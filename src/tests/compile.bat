@@ -150,5 +150,17 @@ rem @set LD=link /nologo /debug
 @del *.obj *.res *.bin *.exp *.manifest
 
 
+%CC% websocket_mask_test.c^
+ ..\brickd\fixes_msvc.c^
+ ..\brickd\websocket_mask.c
+
+%LD% /out:websocket_mask_test.exe *.obj
+
+@if exist websocket_mask_test.exe.manifest^
+ %MT% /manifest websocket_mask_test.exe.manifest -outputresource:websocket_mask_test.exe
+
+@del *.obj *.res *.bin *.exp *.manifest
+
+
 :done
 @endlocal
@@ -0,0 +1,243 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * local_socket_latency_test.c: Round-trip latency of the local listeners
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Sends get-tuning-parameter requests to a running brickd, once over TCP/IP
+ * loopback and once over the Unix domain socket, and reports the average
+ * round-trip time of each. brickd answers these requests itself, therefore,
+ * no Bricks are required. Authentication has to be disabled. Usage:
+ *
+ *   local_socket_latency_test [<unix-socket-path> [<plain-port> [<requests>]]]
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <daemonlib/utils.h>
+
+#include "../brickd/tuning.h"
+
+#define BRICKD_UID 1
+
+static int connect_tcp(const char *port) {
+	struct addrinfo hints;
+	struct addrinfo *address;
+	int fd;
+	int flag = 1;
+
+	memset(&hints, 0, sizeof(hints));
+
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo("localhost", port, &hints, &address) != 0) {
+		printf("could not resolve localhost\n");
+
+		return -1;
+	}
+
+	fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+	if (fd < 0) {
+		freeaddrinfo(address);
+
+		return -1;
+	}
+
+	// the IP Connection of the bindings disables Nagle's algorithm as well
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+	if (connect(fd, address->ai_addr, address->ai_addrlen) < 0) {
+		printf("could not connect to localhost:%s: %s (%d)\n", port, strerror(errno), errno);
+
+		close(fd);
+		freeaddrinfo(address);
+
+		return -1;
+	}
+
+	freeaddrinfo(address);
+
+	return fd;
+}
+
+static int connect_unix(const char *path) {
+	struct sockaddr_un address;
+	int fd;
+
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		printf("socket path '%s' is too long\n", path);
+
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	memset(&address, 0, sizeof(address));
+
+	address.sun_family = AF_UNIX;
+
+	strcpy(address.sun_path, path);
+
+	if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		printf("could not connect to '%s': %s (%d)\n", path, strerror(errno), errno);
+
+		close(fd);
+
+		return -1;
+	}
+
+	return fd;
+}
+
+static int receive_exactly(int fd, void *buffer, int length) {
+	int offset = 0;
+	int rc;
+
+	while (offset < length) {
+		rc = recv(fd, (uint8_t *)buffer + offset, length - offset, 0);
+
+		if (rc < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (rc <= 0) {
+			return -1;
+		}
+
+		offset += rc;
+	}
+
+	return 0;
+}
+
+// returns the average round-trip time in microseconds or a negative value on
+// error
+static double measure(const char *name, int fd, int requests) {
+	GetTuningParameterRequest request;
+	GetTuningParameterResponse response;
+	uint8_t sequence_number;
+	uint64_t start;
+	uint64_t stop;
+	int i;
+
+	memset(&request, 0, sizeof(request));
+
+	request.header.uid = uint32_to_le(BRICKD_UID);
+	request.header.length = sizeof(request);
+	request.header.function_id = FUNCTION_GET_TUNING_PARAMETER;
+	request.parameter = TUNING_PARAMETER_CLIENT_MAX_PENDING_REQUESTS;
+
+	start = microseconds();
+
+	for (i = 0; i < requests; ++i) {
+		sequence_number = (uint8_t)(i % 15 + 1);
+
+		// sequence number in the upper 4 bits, response expected bit
+		request.header.sequence_number_and_options = (uint8_t)((sequence_number << 4) | 0x08);
+
+		if (send(fd, &request, sizeof(request), 0) != (int)sizeof(request)) {
+			printf("%s: could not send request %d\n", name, i);
+
+			return -1;
+		}
+
+		if (receive_exactly(fd, &response, sizeof(response)) < 0) {
+			printf("%s: could not receive response %d, is authentication enabled?\n", name, i);
+
+			return -1;
+		}
+
+		if (response.header.function_id != FUNCTION_GET_TUNING_PARAMETER ||
+		    response.header.sequence_number_and_options >> 4 != sequence_number) {
+			printf("%s: received unexpected response %d\n", name, i);
+
+			return -1;
+		}
+	}
+
+	stop = microseconds();
+
+	return (double)(stop - start) / requests;
+}
+
+int main(int argc, char **argv) {
+	const char *path = argc > 1 ? argv[1] : "/var/run/brickd.sock";
+	const char *port = argc > 2 ? argv[2] : "4223";
+	int requests = argc > 3 ? atoi(argv[3]) : 100000;
+	int tcp_fd;
+	int unix_fd;
+	double tcp_latency;
+	double unix_latency;
+
+	if (requests < 1) {
+		printf("invalid request count\n");
+
+		return EXIT_FAILURE;
+	}
+
+	tcp_fd = connect_tcp(port);
+
+	if (tcp_fd < 0) {
+		return EXIT_FAILURE;
+	}
+
+	unix_fd = connect_unix(path);
+
+	if (unix_fd < 0) {
+		close(tcp_fd);
+
+		return EXIT_FAILURE;
+	}
+
+	// warm up both connections before measuring
+	if (measure("tcp", tcp_fd, 100) < 0 || measure("unix", unix_fd, 100) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	tcp_latency = measure("tcp", tcp_fd, requests);
+	unix_latency = measure("unix", unix_fd, requests);
+
+	close(tcp_fd);
+	close(unix_fd);
+
+	if (tcp_latency < 0 || unix_latency < 0) {
+		return EXIT_FAILURE;
+	}
+
+	printf("TCP/IP loopback:    %8.2f usec per round-trip\n", tcp_latency);
+	printf("Unix domain socket: %8.2f usec per round-trip (%.1f%% of TCP/IP)\n",
+	       unix_latency, unix_latency * 100.0 / tcp_latency);
+
+	return EXIT_SUCCESS;
+}
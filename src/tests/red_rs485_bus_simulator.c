@@ -0,0 +1,383 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * red_rs485_bus_simulator.c: Pseudo terminal based simulator for RS485 slaves
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * The simulator takes the slave side of the RS485 protocol of the RED Brick
+ * RS485 Extension on the master side of a pseudo terminal. The RS485 master
+ * opens the slave side of the pseudo terminal as its serial device.
+ *
+ * Like on a real RS485 bus the master receives each of its frames back, which
+ * it uses to verify that the frame was sent correctly. Each slave replies to a
+ * frame with its oldest response or with an empty packet, with the sequence
+ * number of the frame. The master acknowledges a response with an empty packet
+ * with the same sequence number, that is not replied. A request is answered by
+ * an echo of itself, retried requests are recognized by their sequence number.
+ * The time frames take on the bus at the configured baudrate is simulated,
+ * and replies with a wrong CRC16 checksum can be injected at a given rate.
+ */
+
+#define _GNU_SOURCE // for posix_openpt and ptsname
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <daemonlib/utils.h>
+
+#include "red_rs485_bus_simulator.h"
+
+#define FRAME_HEADER_LENGTH       3
+#define FRAME_FOOTER_LENGTH       2
+#define FRAME_OVERHEAD            (FRAME_HEADER_LENGTH + FRAME_FOOTER_LENGTH)
+#define FRAME_PACKET_LENGTH_INDEX 7
+#define FRAME_FUNCTION_CODE       100
+#define FRAME_BITS_PER_BYTE       10 // start bit, 8 data bits, stop bit
+
+static uint32_t red_rs485_bus_simulator_random(REDRS485BusSimulator *simulator) {
+	// xorshift32, good enough for error injection and deterministic
+	simulator->random ^= simulator->random << 13;
+	simulator->random ^= simulator->random >> 17;
+	simulator->random ^= simulator->random << 5;
+
+	return simulator->random;
+}
+
+static bool red_rs485_bus_simulator_inject(REDRS485BusSimulator *simulator, int rate) {
+	return rate > 0 && red_rs485_bus_simulator_random(simulator) % rate == 0;
+}
+
+// Modbus CRC16. The RS485 master transmits the high byte of the returned
+// value first
+static uint16_t red_rs485_bus_simulator_crc16(const uint8_t *buffer, int length) {
+	uint16_t crc = 0xFFFF;
+	int i, k;
+
+	for (i = 0; i < length; ++i) {
+		crc ^= buffer[i];
+
+		for (k = 0; k < 8; ++k) {
+			if ((crc & 1) != 0) {
+				crc = (crc >> 1) ^ 0xA001;
+			} else {
+				crc >>= 1;
+			}
+		}
+	}
+
+	// Modbus sends the low byte first
+	return (uint16_t)((crc << 8) | (crc >> 8));
+}
+
+static void red_rs485_bus_simulator_sleep(uint32_t duration) {
+	struct timespec delay;
+
+	if (duration == 0) {
+		return;
+	}
+
+	delay.tv_sec = duration / 1000000;
+	delay.tv_nsec = (duration % 1000000) * 1000;
+
+	nanosleep(&delay, NULL);
+}
+
+// Simulates the time a frame takes on the bus and writes it to the master
+static void red_rs485_bus_simulator_transmit(REDRS485BusSimulator *simulator,
+                                             const uint8_t *frame, int length) {
+	uint32_t duration = red_rs485_bus_simulator_get_frame_duration(simulator, length);
+	int offset = 0;
+	int rc;
+
+	red_rs485_bus_simulator_sleep(duration);
+
+	simulator->bus_busy += duration;
+
+	while (offset < length) {
+		rc = write(simulator->master_fd, frame + offset, length - offset);
+
+		if (rc < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return; // the master closed its side
+		}
+
+		offset += rc;
+	}
+}
+
+static REDRS485BusSimulatorSlave *red_rs485_bus_simulator_get_slave(REDRS485BusSimulator *simulator,
+                                                                   uint8_t address) {
+	int i;
+
+	for (i = 0; i < simulator->slave_num; ++i) {
+		if (simulator->slaves[i].address == address) {
+			return &simulator->slaves[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void red_rs485_bus_simulator_handle_frame(REDRS485BusSimulator *simulator,
+                                                 const uint8_t *frame, int length) {
+	REDRS485BusSimulatorSlave *slave;
+	Packet packet;
+	uint8_t reply[RED_RS485_BUS_SIMULATOR_FRAME_MAX_LENGTH];
+	int reply_length;
+	uint8_t sequence = frame[2];
+	uint16_t crc16;
+	bool empty;
+
+	++simulator->frames;
+
+	// The frame was sent by the master. It receives its own frame back
+	red_rs485_bus_simulator_transmit(simulator, frame, length);
+
+	crc16 = red_rs485_bus_simulator_crc16(frame, length - FRAME_FOOTER_LENGTH);
+	slave = red_rs485_bus_simulator_get_slave(simulator, frame[0]);
+
+	if (slave == NULL || frame[1] != FRAME_FUNCTION_CODE ||
+	    crc16 != ((frame[length - 2] << 8) | frame[length - 1])) {
+		++simulator->unanswered;
+
+		return;
+	}
+
+	memset(&packet, 0, sizeof(packet));
+	memcpy(&packet, frame + FRAME_HEADER_LENGTH, length - FRAME_OVERHEAD);
+
+	empty = packet.header.uid == 0 && packet.header.length == 8 && packet.header.function_id == 0;
+
+	if (empty) {
+		if (slave->response_pending && sequence == slave->response_sequence) {
+			// The master acknowledges the current response, it expects no reply
+			slave->response_pending = false;
+			slave->response_start = (slave->response_start + 1) % RED_RS485_BUS_SIMULATOR_MAX_RESPONSES;
+			--slave->response_count;
+			++slave->responses_acknowledged;
+
+			slave->last_sequence = sequence;
+			slave->last_frame_was_request = false;
+
+			return;
+		}
+
+		++slave->polls;
+	} else if (!slave->last_frame_was_request || sequence != slave->last_sequence) {
+		++slave->requests;
+
+		// Echo requests that expect a response back as their own response.
+		// If the slave runs out of buffer space the request is lost
+		if ((packet.header.sequence_number_and_options & 0x08) != 0 &&
+		    slave->response_count < RED_RS485_BUS_SIMULATOR_MAX_RESPONSES) {
+			memcpy(&slave->responses[(slave->response_start + slave->response_count) %
+			                         RED_RS485_BUS_SIMULATOR_MAX_RESPONSES],
+			       &packet, sizeof(packet));
+
+			++slave->response_count;
+		}
+	} // else the master retries a request that was already accepted, because
+	  // it didn't receive the reply
+
+	slave->last_sequence = sequence;
+	slave->last_frame_was_request = !empty;
+
+	// Reply with the oldest response, or with an empty packet
+	reply[0] = slave->address;
+	reply[1] = FRAME_FUNCTION_CODE;
+	reply[2] = sequence;
+
+	if (slave->response_count > 0) {
+		memcpy(reply + FRAME_HEADER_LENGTH, &slave->responses[slave->response_start],
+		       slave->responses[slave->response_start].header.length);
+
+		reply_length = FRAME_HEADER_LENGTH + slave->responses[slave->response_start].header.length;
+
+		slave->response_pending = true;
+		slave->response_sequence = sequence;
+	} else {
+		memset(reply + FRAME_HEADER_LENGTH, 0, 8);
+
+		reply[FRAME_PACKET_LENGTH_INDEX] = 8;
+		reply_length = FRAME_HEADER_LENGTH + 8;
+	}
+
+	crc16 = red_rs485_bus_simulator_crc16(reply, reply_length);
+
+	reply[reply_length++] = crc16 >> 8;
+	reply[reply_length++] = crc16 & 0xFF;
+
+	if (red_rs485_bus_simulator_inject(simulator, simulator->corrupt_rate)) {
+		++simulator->corrupt_injected;
+
+		reply[reply_length - 1] ^= 0xFF;
+	}
+
+	red_rs485_bus_simulator_sleep(simulator->response_delay);
+	red_rs485_bus_simulator_transmit(simulator, reply, reply_length);
+}
+
+static void red_rs485_bus_simulator_thread(void *opaque) {
+	REDRS485BusSimulator *simulator = opaque;
+	struct pollfd pollfds[2];
+	int length;
+	int rc;
+
+	pollfds[0].fd = simulator->stop_event;
+	pollfds[0].events = POLLIN;
+	pollfds[1].fd = simulator->master_fd;
+	pollfds[1].events = POLLIN;
+
+	for (;;) {
+		rc = poll(pollfds, 2, -1);
+
+		if (rc < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			break;
+		}
+
+		if ((pollfds[0].revents & POLLIN) != 0) {
+			break;
+		}
+
+		if ((pollfds[1].revents & (POLLIN | POLLHUP | POLLERR)) == 0) {
+			continue;
+		}
+
+		rc = read(simulator->master_fd, simulator->frame + simulator->frame_length,
+		          sizeof(simulator->frame) - simulator->frame_length);
+
+		if (rc <= 0) {
+			if (rc < 0 && errno == EINTR) {
+				continue;
+			}
+
+			// The master closed its side, wait for the stop event
+			pollfds[1].fd = -1;
+
+			continue;
+		}
+
+		simulator->frame_length += rc;
+
+		while (simulator->frame_length > FRAME_PACKET_LENGTH_INDEX) {
+			length = simulator->frame[FRAME_PACKET_LENGTH_INDEX] + FRAME_OVERHEAD;
+
+			if (simulator->frame[FRAME_PACKET_LENGTH_INDEX] < 8 ||
+			    length > RED_RS485_BUS_SIMULATOR_FRAME_MAX_LENGTH) {
+				// Not the start of a frame, resynchronize
+				length = 1;
+				++simulator->unanswered;
+			} else if (simulator->frame_length < length) {
+				break;
+			} else {
+				red_rs485_bus_simulator_handle_frame(simulator, simulator->frame, length);
+			}
+
+			memmove(simulator->frame, simulator->frame + length, simulator->frame_length - length);
+
+			simulator->frame_length -= length;
+		}
+	}
+}
+
+int red_rs485_bus_simulator_create(REDRS485BusSimulator *simulator, int slave_num,
+                                   uint32_t baudrate) {
+	struct termios termios;
+	char *device;
+	int i;
+
+	memset(simulator, 0, sizeof(REDRS485BusSimulator));
+
+	simulator->slave_num = slave_num;
+	simulator->baudrate = baudrate;
+	simulator->random = 2463534242u;
+
+	for (i = 0; i < RED_RS485_BUS_SIMULATOR_MAX_SLAVES; ++i) {
+		simulator->slaves[i].address = i + 1;
+	}
+
+	simulator->master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+	if (simulator->master_fd < 0) {
+		return -1;
+	}
+
+	if (grantpt(simulator->master_fd) < 0 || unlockpt(simulator->master_fd) < 0 ||
+	    (device = ptsname(simulator->master_fd)) == NULL) {
+		close(simulator->master_fd);
+
+		return -1;
+	}
+
+	string_copy(simulator->device, sizeof(simulator->device), device);
+
+	// The bus carries binary frames, no line discipline processing
+	if (tcgetattr(simulator->master_fd, &termios) == 0) {
+		cfmakeraw(&termios);
+		tcsetattr(simulator->master_fd, TCSANOW, &termios);
+	}
+
+	simulator->stop_event = eventfd(0, EFD_NONBLOCK);
+
+	if (simulator->stop_event < 0) {
+		close(simulator->master_fd);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void red_rs485_bus_simulator_destroy(REDRS485BusSimulator *simulator) {
+	close(simulator->stop_event);
+	close(simulator->master_fd);
+}
+
+void red_rs485_bus_simulator_start(REDRS485BusSimulator *simulator) {
+	thread_create(&simulator->thread, red_rs485_bus_simulator_thread, simulator);
+}
+
+void red_rs485_bus_simulator_stop(REDRS485BusSimulator *simulator) {
+	eventfd_t ev = 1;
+
+	if (eventfd_write(simulator->stop_event, ev) < 0) {} // ignore return value
+
+	thread_join(&simulator->thread);
+	thread_destroy(&simulator->thread);
+}
+
+// Returns the time in microseconds a frame of the given length takes on the bus
+uint32_t red_rs485_bus_simulator_get_frame_duration(REDRS485BusSimulator *simulator,
+                                                    int length) {
+	return (uint32_t)((uint64_t)length * FRAME_BITS_PER_BYTE * 1000000 / simulator->baudrate);
+}
@@ -0,0 +1,82 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * red_rs485_bus_simulator.h: Pseudo terminal based simulator for RS485 slaves
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_RED_RS485_BUS_SIMULATOR_H
+#define BRICKD_RED_RS485_BUS_SIMULATOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <daemonlib/packet.h>
+#include <daemonlib/threads.h>
+
+#define RED_RS485_BUS_SIMULATOR_MAX_SLAVES 32
+#define RED_RS485_BUS_SIMULATOR_MAX_RESPONSES 16
+#define RED_RS485_BUS_SIMULATOR_FRAME_MAX_LENGTH 90 // 3 header, 80 packet, 2 CRC16 bytes, rounded up
+
+typedef struct {
+	uint8_t address;
+	uint8_t last_sequence; // of the last frame received
+	bool last_frame_was_request; // last frame received was a data request
+	bool response_pending; // current response is sent, but not acknowledged yet
+	uint8_t response_sequence; // of the frame the current response was sent with
+	Packet responses[RED_RS485_BUS_SIMULATOR_MAX_RESPONSES];
+	int response_start;
+	int response_count;
+	uint32_t requests;
+	uint32_t polls;
+	uint32_t responses_acknowledged;
+} REDRS485BusSimulatorSlave;
+
+typedef struct {
+	REDRS485BusSimulatorSlave slaves[RED_RS485_BUS_SIMULATOR_MAX_SLAVES];
+	int slave_num;
+
+	uint32_t baudrate; // only used to calculate the transfer time of frames
+	int response_delay; // microseconds between a frame and the reply of a slave
+	int corrupt_rate; // one in corrupt_rate replies has a wrong CRC16, 0 disables it
+
+	int master_fd; // master side of the pseudo terminal
+	char device[64]; // slave side of the pseudo terminal, used by the RS485 master
+	int stop_event;
+	Thread thread;
+
+	uint8_t frame[RED_RS485_BUS_SIMULATOR_FRAME_MAX_LENGTH * 2];
+	int frame_length;
+
+	uint32_t random;
+	uint64_t bus_busy; // microseconds frames were on the bus
+	uint32_t frames;
+	uint32_t unanswered; // frames to unknown slaves or with wrong CRC16
+	uint32_t corrupt_injected;
+} REDRS485BusSimulator;
+
+int red_rs485_bus_simulator_create(REDRS485BusSimulator *simulator, int slave_num,
+                                   uint32_t baudrate);
+void red_rs485_bus_simulator_destroy(REDRS485BusSimulator *simulator);
+
+void red_rs485_bus_simulator_start(REDRS485BusSimulator *simulator);
+void red_rs485_bus_simulator_stop(REDRS485BusSimulator *simulator);
+
+uint32_t red_rs485_bus_simulator_get_frame_duration(REDRS485BusSimulator *simulator,
+                                                    int length);
+
+#endif // BRICKD_RED_RS485_BUS_SIMULATOR_H
@@ -0,0 +1,398 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * red_rs485_extension_test.c: Benchmark for the RED Brick RS485 Extension
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Runs the RS485 master of brickd against simulated slaves on a pseudo
+ * terminal and reports throughput, request latency and bus utilization. The
+ * simulator injects corrupted checksums, so some "wrong CRC16 checksum" errors
+ * in the log are expected. Usage:
+ *
+ *   red_rs485_extension_test [<slaves> [<requests-per-slave> [<baudrate>
+ *                            [<response-delay-us> [<corrupt-rate>
+ *                            [<poll-delay-us> [<idle-max-us>]]]]]]]
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/config.h>
+#include <daemonlib/event.h>
+#include <daemonlib/log.h>
+#include <daemonlib/red_gpio.h>
+#include <daemonlib/utils.h>
+
+#include "red_rs485_bus_simulator.h"
+
+#include "../brickd/hardware.h"
+#include "../brickd/network.h"
+#include "../brickd/realtime.h"
+#include "../brickd/red_rs485_extension.h"
+#include "../brickd/stack.h"
+
+#define MAX_REQUESTS_IN_FLIGHT 4
+#define PROGRESS_TIMEOUT 5000000 // microseconds
+
+typedef struct {
+	uint32_t uid;
+	uint8_t address;
+	uint32_t next_request; // index of the next request to send
+	uint32_t next_response; // index of the next expected response
+	uint64_t queued_at[MAX_REQUESTS_IN_FLIGHT];
+	uint32_t *latencies;
+	uint32_t latency_count;
+} Slave;
+
+typedef struct {
+	const char *name;
+	ConfigOptionValue value;
+} Option;
+
+static Option _options[] = {
+	{ "poll_delay.rs485", { .integer = 4000 } },
+	{ "poll_delay.rs485_idle_max", { .integer = 20000 } },
+	{ "rs485.serial_device.0", { .string = NULL } },
+	{ "rs485.rx_enable_gpio.0", { .boolean = false } },
+	{ "realtime.lock_memory", { .boolean = false } },
+	{ "realtime.rs485.policy", { .symbol = REALTIME_POLICY_OTHER } },
+	{ "realtime.rs485.priority", { .integer = 50 } },
+	{ "realtime.rs485.cpu", { .integer = -1 } },
+	{ NULL, { .string = NULL } }
+};
+
+static Slave _slaves[RED_RS485_BUS_SIMULATOR_MAX_SLAVES];
+static int _slave_num;
+static uint32_t _done = 0;
+static int _unexpected_responses = 0;
+
+static Stack *_stack = NULL;
+static IOHandle _response_event = -1;
+static EventFunction _response_function = NULL;
+static void *_response_opaque = NULL;
+
+// The RS485 Extension code is linked as is. The parts of brickd it depends on
+// are replaced by the following functions
+
+const ConfigOptionValue *config_get_option_value(const char *name) {
+	int i;
+
+	for (i = 0; _options[i].name != NULL; ++i) {
+		if (strcmp(_options[i].name, name) == 0) {
+			return &_options[i].value;
+		}
+	}
+
+	fprintf(stderr, "unknown config option %s\n", name);
+	abort();
+}
+
+int hardware_add_stack(Stack *stack) {
+	_stack = stack;
+
+	return 0;
+}
+
+int hardware_remove_stack(Stack *stack) {
+	(void)stack;
+
+	_stack = NULL;
+
+	return 0;
+}
+
+int event_add_source(IOHandle handle, EventSourceType type, uint32_t events,
+                     EventFunction function, void *opaque) {
+	(void)type;
+	(void)events;
+
+	_response_event = handle;
+	_response_function = function;
+	_response_opaque = opaque;
+
+	return 0;
+}
+
+void event_remove_source(IOHandle handle, EventSourceType type) {
+	(void)handle;
+	(void)type;
+
+	_response_event = -1;
+}
+
+void gpio_mux_configure(const GPIOPin pin, const GPIOMux mux_config) {
+	(void)pin;
+	(void)mux_config;
+}
+
+void gpio_output_clear(const GPIOPin pin) {
+	(void)pin;
+}
+
+bool network_wants_ingress_timestamps(void) {
+	return false;
+}
+
+uint64_t network_get_ingress_timestamp(void) {
+	return 0;
+}
+
+void network_dispatch_timestamped_response(Packet *response, uint64_t ingress_timestamp) {
+	Slave *slave = NULL;
+	uint32_t index;
+	int i;
+
+	(void)ingress_timestamp;
+
+	for (i = 0; i < _slave_num; ++i) {
+		if (_slaves[i].uid == response->header.uid) {
+			slave = &_slaves[i];
+
+			break;
+		}
+	}
+
+	memcpy(&index, response->payload, sizeof(uint32_t));
+
+	if (slave == NULL || index != slave->next_response) {
+		printf("unexpected response %u for UID %u\n", index, response->header.uid);
+
+		++_unexpected_responses;
+
+		return;
+	}
+
+	slave->latencies[slave->latency_count++] =
+		(uint32_t)(microseconds() - slave->queued_at[index % MAX_REQUESTS_IN_FLIGHT]);
+	++slave->next_response;
+	++_done;
+}
+
+void network_dispatch_response(Packet *response) {
+	network_dispatch_timestamped_response(response, 0);
+}
+
+static int compare_latency(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void dispatch_request(Slave *slave) {
+	Packet request;
+	Recipient recipient;
+
+	memset(&request, 0, sizeof(Packet));
+
+	request.header.uid = slave->uid;
+	request.header.length = sizeof(PacketHeader) + sizeof(uint32_t);
+	request.header.function_id = 1;
+	// sequence number 1 to 15 and response expected flag
+	request.header.sequence_number_and_options = (((slave->next_request % 15) + 1) << 4) | 0x08;
+
+	memcpy(request.payload, &slave->next_request, sizeof(uint32_t));
+
+	recipient.uid = slave->uid;
+	recipient.opaque = slave->address;
+
+	slave->queued_at[slave->next_request % MAX_REQUESTS_IN_FLIGHT] = microseconds();
+	++slave->next_request;
+
+	_stack->dispatch_request(_stack, &request, &recipient);
+}
+
+int main(int argc, char **argv) {
+	REDRS485BusSimulator simulator;
+	ExtensionRS485Config config;
+	RS485ExtensionSlaveStatistics statistics[RED_RS485_BUS_SIMULATOR_MAX_SLAVES];
+	struct pollfd pollfd;
+	Slave *slave;
+	int slave_num = argc > 1 ? atoi(argv[1]) : 4;
+	uint32_t requests_per_slave = argc > 2 ? (uint32_t)atoi(argv[2]) : 200;
+	uint32_t baudrate = argc > 3 ? (uint32_t)atoi(argv[3]) : 500000;
+	uint32_t latency_total;
+	uint32_t done;
+	uint32_t frames;
+	uint64_t bus_busy;
+	uint64_t start, stop, progress_at;
+	double seconds;
+	int statistics_count;
+	int ret = EXIT_FAILURE;
+	int rc;
+	int i;
+
+	if (slave_num < 1 || slave_num > RED_RS485_BUS_SIMULATOR_MAX_SLAVES) {
+		printf("slave count has to be between 1 and %d\n", RED_RS485_BUS_SIMULATOR_MAX_SLAVES);
+
+		return EXIT_FAILURE;
+	}
+
+	log_init();
+
+	if (red_rs485_bus_simulator_create(&simulator, slave_num, baudrate) < 0) {
+		printf("could not create pseudo terminal: %s (%d)\n", get_errno_name(errno), errno);
+
+		return EXIT_FAILURE;
+	}
+
+	simulator.response_delay = argc > 4 ? atoi(argv[4]) : 100;
+	simulator.corrupt_rate = argc > 5 ? atoi(argv[5]) : 1000;
+
+	_options[0].value.integer = argc > 6 ? atoi(argv[6]) : 50;
+	_options[1].value.integer = argc > 7 ? atoi(argv[7]) : 20000;
+	_options[2].value.string = simulator.device;
+
+	_slave_num = slave_num;
+	latency_total = requests_per_slave * slave_num;
+
+	memset(&config, 0, sizeof(config));
+
+	config.extension = 0;
+	config.baudrate = baudrate;
+	config.parity = RS485_EXTENSION_SERIAL_PARITY_NONE;
+	config.stopbits = 1;
+	config.address = 0;
+	config.slave_num = slave_num;
+
+	for (i = 0; i < slave_num; ++i) {
+		memset(&_slaves[i], 0, sizeof(Slave));
+
+		_slaves[i].uid = 1000 + i;
+		_slaves[i].address = simulator.slaves[i].address;
+		_slaves[i].latencies = calloc(requests_per_slave, sizeof(uint32_t));
+
+		if (_slaves[i].latencies == NULL) {
+			printf("out of memory\n");
+
+			return EXIT_FAILURE;
+		}
+
+		config.slave_address[i] = _slaves[i].address;
+	}
+
+	red_rs485_bus_simulator_start(&simulator);
+
+	if (red_rs485_extension_init(&config) < 0 || _stack == NULL || _response_function == NULL) {
+		printf("could not initialize RS485 Extension\n");
+
+		goto cleanup;
+	}
+
+	start = microseconds();
+	progress_at = start;
+	done = 0;
+
+	pollfd.fd = _response_event;
+	pollfd.events = POLLIN;
+
+	// keep up to MAX_REQUESTS_IN_FLIGHT requests per slave in flight and
+	// dispatch responses like the event loop of brickd does
+	while (_done < latency_total) {
+		for (i = 0; i < slave_num; ++i) {
+			slave = &_slaves[i];
+
+			while (slave->next_request < requests_per_slave &&
+			       slave->next_request - slave->next_response < MAX_REQUESTS_IN_FLIGHT) {
+				dispatch_request(slave);
+			}
+		}
+
+		rc = poll(&pollfd, 1, 100);
+
+		if (rc < 0 && errno != EINTR) {
+			printf("could not poll response event: %s (%d)\n", get_errno_name(errno), errno);
+
+			goto exit;
+		}
+
+		if (rc > 0) {
+			_response_function(_response_opaque);
+		}
+
+		if (_done != done) {
+			done = _done;
+			progress_at = microseconds();
+		} else if (microseconds() - progress_at > PROGRESS_TIMEOUT) {
+			// a request was dropped after all its tries failed
+			printf("no response for %.1f sec, %u of %u response(s) received\n",
+			       PROGRESS_TIMEOUT / 1000000.0, _done, latency_total);
+
+			goto exit;
+		}
+	}
+
+	stop = microseconds();
+	frames = simulator.frames;
+	bus_busy = simulator.bus_busy;
+	seconds = (stop - start) / 1000000.0;
+
+	printf("%d slave(s), %u request(s), %u frame(s) at %u baud in %.3f sec\n",
+	       slave_num, latency_total, frames, baudrate, seconds);
+	printf("throughput: %.0f packets/sec, bus utilization %.1f%%\n",
+	       latency_total / seconds, bus_busy * 100.0 / (stop - start));
+
+	statistics_count = red_rs485_extension_get_slave_statistics(0, statistics, RED_RS485_BUS_SIMULATOR_MAX_SLAVES);
+
+	for (i = 0; i < slave_num; ++i) {
+		slave = &_slaves[i];
+
+		qsort(slave->latencies, slave->latency_count, sizeof(uint32_t), compare_latency);
+
+		printf("slave %u: latency p50 %u usec, p99 %u usec, max %u usec",
+		       slave->address, slave->latencies[slave->latency_count * 50 / 100],
+		       slave->latencies[slave->latency_count * 99 / 100],
+		       slave->latencies[slave->latency_count - 1]);
+
+		if (i < statistics_count) {
+			printf(", timeout %u usec, rtt %u usec, %u timeout(s), %u retry(s)",
+			       statistics[i].timeout, statistics[i].round_trip_time,
+			       statistics[i].timeouts, statistics[i].retries);
+		}
+
+		printf("\n");
+	}
+
+	printf("errors: %u reply(s) with injected error, %u frame(s) unanswered\n",
+	       simulator.corrupt_injected, simulator.unanswered);
+
+	if (_unexpected_responses > 0) {
+		printf("error: %d unexpected response(s)\n", _unexpected_responses);
+	} else {
+		ret = EXIT_SUCCESS;
+	}
+
+exit:
+	red_rs485_extension_exit(0);
+
+cleanup:
+	red_rs485_bus_simulator_stop(&simulator);
+	red_rs485_bus_simulator_destroy(&simulator);
+
+	for (i = 0; i < slave_num; ++i) {
+		free(_slaves[i].latencies);
+	}
+
+	log_exit();
+
+	return ret;
+}
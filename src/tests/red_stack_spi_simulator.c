@@ -0,0 +1,209 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * red_stack_spi_simulator.c: In-process simulator for RED Brick SPI slaves
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * The simulator takes the slave side of the RED Brick SPI protocol, as
+ * implemented by the Master Brick firmware. Each slave accepts a request
+ * once per master sequence number, queues a response for it that becomes
+ * ready after the configured response delay, and keeps sending its current
+ * response until the master acknowledges the slave sequence number. Busy
+ * slaves (no preamble) and corrupted checksums can be injected at a given
+ * rate to exercise the retry paths of the master.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include <daemonlib/utils.h>
+
+#include "red_stack_spi_simulator.h"
+
+static uint32_t red_stack_spi_simulator_random(REDStackSPISimulator *simulator) {
+	// xorshift32, good enough for error injection and deterministic
+	simulator->random ^= simulator->random << 13;
+	simulator->random ^= simulator->random >> 17;
+	simulator->random ^= simulator->random << 5;
+
+	return simulator->random;
+}
+
+static bool red_stack_spi_simulator_inject(REDStackSPISimulator *simulator, int rate) {
+	return rate > 0 && red_stack_spi_simulator_random(simulator) % rate == 0;
+}
+
+static void red_stack_spi_simulator_handle_request(REDStackSPISimulatorSlave *slave,
+                                                   Packet *request, uint64_t now,
+                                                   int response_delay) {
+	REDStackSPISimulatorResponse *response;
+	StackEnumerateResponse *stack_enumerate_response;
+
+	++slave->requests;
+
+	if ((request->header.sequence_number_and_options & 0x08) == 0) {
+		return; // no response expected
+	}
+
+	response = &slave->responses[(slave->response_start + slave->response_count) %
+	                             RED_STACK_SPI_SIMULATOR_MAX_RESPONSES];
+	response->ready_at = now + response_delay;
+
+	if (request->header.function_id == FUNCTION_STACK_ENUMERATE) {
+		stack_enumerate_response = (StackEnumerateResponse *)&response->packet;
+
+		memset(stack_enumerate_response, 0, sizeof(StackEnumerateResponse));
+
+		stack_enumerate_response->header = request->header;
+		stack_enumerate_response->header.length = sizeof(StackEnumerateResponse);
+		stack_enumerate_response->uids[0] = slave->uid;
+	} else {
+		// echo all other requests back as their own response
+		memcpy(&response->packet, request, request->header.length);
+	}
+
+	++slave->response_count;
+}
+
+static int red_stack_spi_simulator_transfer(void *opaque, uint8_t stack_address,
+                                            const uint8_t *tx, uint8_t *rx, int length) {
+	REDStackSPISimulator *simulator = opaque;
+	REDStackSPISimulatorSlave *slave;
+	REDStackSPISimulatorResponse *response = NULL;
+	struct timespec delay;
+	uint64_t now;
+	uint8_t tx_length;
+	uint8_t rx_length;
+	uint8_t sequence_number_master;
+	uint8_t sequence_number_slave;
+
+	++simulator->transfers;
+
+	if (simulator->transfer_delay > 0) {
+		delay.tv_sec = simulator->transfer_delay / 1000000;
+		delay.tv_nsec = (simulator->transfer_delay % 1000000) * 1000;
+
+		nanosleep(&delay, NULL);
+	}
+
+	memset(rx, 0, length);
+
+	// an absent slave doesn't drive MISO, the master sees no preamble
+	if (stack_address >= simulator->slave_num) {
+		return length;
+	}
+
+	// a busy slave didn't set up its DMA buffers in time, it neither
+	// receives the request nor sends a preamble
+	if (red_stack_spi_simulator_inject(simulator, simulator->busy_rate)) {
+		++simulator->busy_injected;
+
+		return length;
+	}
+
+	slave = &simulator->slaves[stack_address];
+	now = microseconds();
+
+	// receive request
+	tx_length = tx[RED_STACK_SPI_LENGTH];
+
+	if (tx[RED_STACK_SPI_PREAMBLE] == RED_STACK_SPI_PREAMBLE_VALUE &&
+	    tx_length >= RED_STACK_SPI_PACKET_EMPTY_SIZE && tx_length <= length &&
+	    red_stack_spi_calculate_pearson_hash(tx, tx_length - 1) == tx[RED_STACK_SPI_CHECKSUM(tx_length)]) {
+		sequence_number_master = tx[RED_STACK_SPI_INFO(tx_length)] & RED_STACK_SPI_INFO_SEQUENCE_MASTER_MASK;
+		sequence_number_slave = tx[RED_STACK_SPI_INFO(tx_length)] & RED_STACK_SPI_INFO_SEQUENCE_SLAVE_MASK;
+
+		// the master acknowledges the current response by echoing its
+		// sequence number
+		if (slave->response_pending && sequence_number_slave == slave->sequence_number_slave) {
+			slave->response_pending = false;
+			slave->response_start = (slave->response_start + 1) % RED_STACK_SPI_SIMULATOR_MAX_RESPONSES;
+			--slave->response_count;
+		}
+
+		if (tx_length == RED_STACK_SPI_PACKET_EMPTY_SIZE) {
+			slave->sequence_number_master = sequence_number_master;
+			slave->sequence_number_request = 0xFF;
+		} else if (sequence_number_master != slave->sequence_number_request) {
+			// only accept the request if there is room for its response,
+			// otherwise the master will retry with the same sequence number
+			if (slave->response_count < RED_STACK_SPI_SIMULATOR_MAX_RESPONSES) {
+				red_stack_spi_simulator_handle_request(slave, (Packet *)(tx + 2), now,
+				                                       simulator->response_delay);
+
+				slave->sequence_number_master = sequence_number_master;
+				slave->sequence_number_request = sequence_number_master;
+			}
+		} // else the master retries a request that was already accepted, because
+		  // it didn't receive the acknowledgement
+	}
+
+	// send response
+	if (!slave->response_pending && slave->response_count > 0 &&
+	    slave->responses[slave->response_start].ready_at <= now) {
+		slave->response_pending = true;
+		slave->sequence_number_slave = (slave->sequence_number_slave + (1 << 3)) &
+		                               RED_STACK_SPI_INFO_SEQUENCE_SLAVE_MASK;
+	}
+
+	if (slave->response_pending) {
+		response = &slave->responses[slave->response_start];
+		rx_length = response->packet.header.length + RED_STACK_SPI_PACKET_EMPTY_SIZE;
+
+		memcpy(rx + 2, &response->packet, response->packet.header.length);
+	} else {
+		rx_length = RED_STACK_SPI_PACKET_EMPTY_SIZE;
+	}
+
+	rx[RED_STACK_SPI_PREAMBLE] = RED_STACK_SPI_PREAMBLE_VALUE;
+	rx[RED_STACK_SPI_LENGTH] = rx_length;
+	rx[RED_STACK_SPI_INFO(rx_length)] = (slave->sequence_number_master & RED_STACK_SPI_INFO_SEQUENCE_MASTER_MASK) |
+	                                    slave->sequence_number_slave;
+	rx[RED_STACK_SPI_CHECKSUM(rx_length)] = red_stack_spi_calculate_pearson_hash(rx, rx_length - 1);
+
+	if (red_stack_spi_simulator_inject(simulator, simulator->corrupt_rate)) {
+		++simulator->corrupt_injected;
+
+		rx[RED_STACK_SPI_CHECKSUM(rx_length)] ^= 0xFF;
+	}
+
+	return length;
+}
+
+void red_stack_spi_simulator_create(REDStackSPISimulator *simulator, int slave_num) {
+	int i;
+
+	memset(simulator, 0, sizeof(REDStackSPISimulator));
+
+	simulator->slave_num = slave_num;
+	simulator->random = 2463534242u;
+
+	for (i = 0; i < RED_STACK_SPI_SIMULATOR_MAX_SLAVES; ++i) {
+		simulator->slaves[i].uid = 1000 + i;
+		simulator->slaves[i].sequence_number_master = 0xFF;
+		simulator->slaves[i].sequence_number_request = 0xFF;
+	}
+}
+
+void red_stack_spi_simulator_get_transport(REDStackSPISimulator *simulator,
+                                           REDStackSPITransport *transport) {
+	transport->name = "simulator";
+	transport->transfer = red_stack_spi_simulator_transfer;
+	transport->opaque = simulator;
+}
@@ -0,0 +1,72 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * red_stack_spi_simulator.h: In-process simulator for RED Brick SPI slaves
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_RED_STACK_SPI_SIMULATOR_H
+#define BRICKD_RED_STACK_SPI_SIMULATOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <daemonlib/packet.h>
+
+#include "../brickd/red_stack_spi.h"
+
+#define RED_STACK_SPI_SIMULATOR_MAX_SLAVES 8
+#define RED_STACK_SPI_SIMULATOR_MAX_RESPONSES 16
+
+typedef struct {
+	Packet packet;
+	uint64_t ready_at; // microseconds
+} REDStackSPISimulatorResponse;
+
+typedef struct {
+	uint32_t uid;
+	uint8_t sequence_number_master; // last accepted, 0xFF if none yet
+	uint8_t sequence_number_request; // last accepted request, 0xFF if followed by an empty packet
+	uint8_t sequence_number_slave; // of the current response
+	bool response_pending; // current response is not acknowledged yet
+	REDStackSPISimulatorResponse responses[RED_STACK_SPI_SIMULATOR_MAX_RESPONSES];
+	int response_start;
+	int response_count;
+	uint32_t requests;
+} REDStackSPISimulatorSlave;
+
+typedef struct {
+	REDStackSPISimulatorSlave slaves[RED_STACK_SPI_SIMULATOR_MAX_SLAVES];
+	int slave_num;
+
+	int transfer_delay; // microseconds each transfer blocks
+	int response_delay; // microseconds until a response is ready
+	int busy_rate; // one in busy_rate transfers has no preamble, 0 disables it
+	int corrupt_rate; // one in corrupt_rate transfers has a wrong checksum, 0 disables it
+
+	uint32_t random;
+	uint32_t transfers;
+	uint32_t busy_injected;
+	uint32_t corrupt_injected;
+} REDStackSPISimulator;
+
+void red_stack_spi_simulator_create(REDStackSPISimulator *simulator, int slave_num);
+
+void red_stack_spi_simulator_get_transport(REDStackSPISimulator *simulator,
+                                           REDStackSPITransport *transport);
+
+#endif // BRICKD_RED_STACK_SPI_SIMULATOR_H
@@ -0,0 +1,433 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * red_stack_spi_test.c: Benchmark for the RED Brick SPI protocol
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * Runs the SPI thread of brickd against simulated slaves and reports
+ * throughput and request latency. The SPI stack code is linked as is, only
+ * the SPI transfers are replaced by the simulator. The simulator injects busy
+ * slaves and corrupted checksums, so some "wrong checksum" errors in the log
+ * are expected. Usage:
+ *
+ *   red_stack_spi_test [<slaves> [<requests-per-slave> [<transfer-delay-us>
+ *                      [<response-delay-us> [<busy-rate> [<corrupt-rate>
+ *                      [<poll-delay-us> [<poll-burst>]]]]]]]]
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/config.h>
+#include <daemonlib/event.h>
+#include <daemonlib/log.h>
+#include <daemonlib/red_gpio.h>
+#include <daemonlib/utils.h>
+
+#include "red_stack_spi_simulator.h"
+
+#include "../brickd/hardware.h"
+#include "../brickd/network.h"
+#include "../brickd/realtime.h"
+#include "../brickd/red_stack.h"
+#include "../brickd/red_usb_gadget.h"
+#include "../brickd/stack.h"
+
+#define MAX_REQUESTS_IN_FLIGHT 4
+#define PROGRESS_TIMEOUT 5000000 // microseconds
+#define STARTUP_TIMEOUT 5000000 // microseconds, includes the 1.6 sec stack reset
+
+typedef struct {
+	uint32_t uid;
+	uint8_t stack_address;
+	uint32_t next_request; // index of the next request to send
+	uint32_t next_response; // index of the next expected response
+	uint64_t queued_at[MAX_REQUESTS_IN_FLIGHT];
+} Slave;
+
+typedef struct {
+	const char *name;
+	ConfigOptionValue value;
+} Option;
+
+static Option _options[] = {
+	{ "poll_delay.spi", { .integer = 50 } },
+	{ "poll_delay.spi_idle_max", { .integer = 1000 } },
+	{ "poll_burst.spi", { .integer = 8 } },
+	{ "realtime.lock_memory", { .boolean = false } },
+	{ "realtime.spi.policy", { .symbol = REALTIME_POLICY_OTHER } },
+	{ "realtime.spi.priority", { .integer = 50 } },
+	{ "realtime.spi.cpu", { .integer = -1 } },
+	{ NULL, { .string = NULL } }
+};
+
+static Slave _slaves[RED_STACK_SPI_SIMULATOR_MAX_SLAVES];
+static int _slave_num;
+static uint32_t *_latencies = NULL;
+static uint32_t _latency_count = 0;
+static int _unexpected_responses = 0;
+
+static Stack *_stack = NULL;
+static IOHandle _response_event = -1;
+static EventFunction _response_function = NULL;
+static void *_response_opaque = NULL;
+
+// The SPI stack code is linked as is. The parts of brickd it depends on are
+// replaced by the following functions
+
+const ConfigOptionValue *config_get_option_value(const char *name) {
+	int i;
+
+	for (i = 0; _options[i].name != NULL; ++i) {
+		if (strcmp(_options[i].name, name) == 0) {
+			return &_options[i].value;
+		}
+	}
+
+	fprintf(stderr, "unknown config option %s\n", name);
+	abort();
+}
+
+int hardware_add_stack(Stack *stack) {
+	_stack = stack;
+
+	return 0;
+}
+
+int hardware_remove_stack(Stack *stack) {
+	(void)stack;
+
+	_stack = NULL;
+
+	return 0;
+}
+
+int event_add_source(IOHandle handle, EventSourceType type, uint32_t events,
+                     EventFunction function, void *opaque) {
+	(void)type;
+	(void)events;
+
+	_response_event = handle;
+	_response_function = function;
+	_response_opaque = opaque;
+
+	return 0;
+}
+
+void event_remove_source(IOHandle handle, EventSourceType type) {
+	(void)handle;
+	(void)type;
+
+	_response_event = -1;
+}
+
+void gpio_mux_configure(const GPIOPin pin, const GPIOMux mux_config) {
+	(void)pin;
+	(void)mux_config;
+}
+
+void gpio_output_set(const GPIOPin pin) {
+	(void)pin;
+}
+
+void gpio_output_clear(const GPIOPin pin) {
+	(void)pin;
+}
+
+uint32_t gpio_input(const GPIOPin pin) {
+	(void)pin;
+
+	return 1; // reset button is not pressed
+}
+
+int gpio_sysfs_export(int gpio_num) {
+	(void)gpio_num;
+
+	errno = ENOENT;
+
+	return -1; // disables the reset interrupt
+}
+
+int gpio_sysfs_set_edge(const char *gpio_name, const char *edge) {
+	(void)gpio_name;
+	(void)edge;
+
+	return -1;
+}
+
+int gpio_sysfs_get_value_fd(const char *gpio_name) {
+	(void)gpio_name;
+
+	return -1;
+}
+
+uint32_t red_usb_gadget_get_uid(void) {
+	return 1;
+}
+
+bool network_wants_ingress_timestamps(void) {
+	return false;
+}
+
+uint64_t network_get_ingress_timestamp(void) {
+	return 0;
+}
+
+void network_dispatch_timestamped_response(Packet *response, uint64_t ingress_timestamp) {
+	Slave *slave = NULL;
+	uint32_t index;
+	int i;
+
+	(void)ingress_timestamp;
+
+	for (i = 0; i < _slave_num; ++i) {
+		if (_slaves[i].uid == response->header.uid) {
+			slave = &_slaves[i];
+
+			break;
+		}
+	}
+
+	memcpy(&index, response->payload, sizeof(uint32_t));
+
+	if (slave == NULL || index != slave->next_response) {
+		printf("unexpected response %u for UID %u\n", index, response->header.uid);
+
+		++_unexpected_responses;
+
+		return;
+	}
+
+	_latencies[_latency_count++] =
+		(uint32_t)(microseconds() - slave->queued_at[index % MAX_REQUESTS_IN_FLIGHT]);
+	++slave->next_response;
+}
+
+void network_dispatch_response(Packet *response) {
+	network_dispatch_timestamped_response(response, 0);
+}
+
+static int compare_latency(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void dispatch_request(Slave *slave) {
+	Packet request;
+	Recipient recipient;
+
+	memset(&request, 0, sizeof(Packet));
+
+	request.header.uid = slave->uid;
+	request.header.length = sizeof(PacketHeader) + sizeof(uint32_t);
+	request.header.function_id = 1;
+	// sequence number 1 to 15 and response expected flag
+	request.header.sequence_number_and_options = (((slave->next_request % 15) + 1) << 4) | 0x08;
+
+	memcpy(request.payload, &slave->next_request, sizeof(uint32_t));
+
+	recipient.uid = slave->uid;
+	recipient.opaque = slave->stack_address;
+
+	slave->queued_at[slave->next_request % MAX_REQUESTS_IN_FLIGHT] = microseconds();
+	++slave->next_request;
+
+	_stack->dispatch_request(_stack, &request, &recipient);
+}
+
+// Waits up to timeout microseconds for the response event and dispatches the
+// responses like the event loop of brickd does. Returns -1 on error
+static int dispatch_responses(int timeout) {
+	struct pollfd pollfd;
+	int rc;
+
+	pollfd.fd = _response_event;
+	pollfd.events = POLLIN;
+
+	rc = poll(&pollfd, 1, timeout / 1000);
+
+	if (rc < 0 && errno != EINTR) {
+		printf("could not poll response event: %s (%d)\n", get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	if (rc > 0) {
+		_response_function(_response_opaque);
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	REDStackSPISimulator simulator;
+	REDStackSPITransport transport;
+	Slave *slave;
+	int slave_num = argc > 1 ? atoi(argv[1]) : 4;
+	uint32_t requests_per_slave = argc > 2 ? (uint32_t)atoi(argv[2]) : 1000;
+	uint32_t latency_total;
+	uint32_t latency_count;
+	uint32_t transfers;
+	uint32_t busy_injected;
+	uint32_t corrupt_injected;
+	uint64_t start, stop, progress_at;
+	double seconds;
+	int ret = EXIT_FAILURE;
+	int i;
+
+	if (slave_num < 1 || slave_num > RED_STACK_SPI_SIMULATOR_MAX_SLAVES) {
+		printf("slave count has to be between 1 and %d\n", RED_STACK_SPI_SIMULATOR_MAX_SLAVES);
+
+		return EXIT_FAILURE;
+	}
+
+	log_init();
+
+	red_stack_spi_simulator_create(&simulator, slave_num);
+
+	simulator.transfer_delay = argc > 3 ? atoi(argv[3]) : 84; // 84 bytes at 8 MHz
+	simulator.response_delay = argc > 4 ? atoi(argv[4]) : 500;
+	simulator.busy_rate = argc > 5 ? atoi(argv[5]) : 100;
+	simulator.corrupt_rate = argc > 6 ? atoi(argv[6]) : 1000;
+
+	_options[0].value.integer = argc > 7 ? atoi(argv[7]) : 50;
+	_options[2].value.integer = argc > 8 ? atoi(argv[8]) : 8;
+
+	_slave_num = slave_num;
+	latency_total = requests_per_slave * slave_num;
+	_latencies = calloc(latency_total, sizeof(uint32_t));
+
+	if (_latencies == NULL) {
+		printf("out of memory\n");
+
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < slave_num; ++i) {
+		memset(&_slaves[i], 0, sizeof(Slave));
+
+		_slaves[i].uid = simulator.slaves[i].uid;
+		_slaves[i].stack_address = i;
+	}
+
+	red_stack_spi_simulator_get_transport(&simulator, &transport);
+	red_stack_set_spi_transport(&transport);
+
+	start = microseconds();
+
+	if (red_stack_init() < 0 || _response_function == NULL) {
+		printf("could not initialize SPI stack\n");
+
+		goto cleanup;
+	}
+
+	// the SPI thread resets the stack and discovers the slaves, the stack is
+	// usable as soon as all slaves were found
+	while (_stack == NULL || (int)_stack->recipients.count < slave_num) {
+		if (microseconds() - start > STARTUP_TIMEOUT) {
+			printf("discover: found %d of %d slave(s) in %.1f sec\n",
+			       _stack != NULL ? _stack->recipients.count : 0, slave_num,
+			       STARTUP_TIMEOUT / 1000000.0);
+
+			goto exit;
+		}
+
+		if (dispatch_responses(100000) < 0) {
+			goto exit;
+		}
+	}
+
+	printf("discover: found %d slave(s) after %.1f msec\n",
+	       slave_num, (microseconds() - start) / 1000.0);
+
+	transfers = __atomic_load_n(&simulator.transfers, __ATOMIC_RELAXED);
+	busy_injected = __atomic_load_n(&simulator.busy_injected, __ATOMIC_RELAXED);
+	corrupt_injected = __atomic_load_n(&simulator.corrupt_injected, __ATOMIC_RELAXED);
+	start = microseconds();
+	progress_at = start;
+	latency_count = 0;
+
+	// keep up to MAX_REQUESTS_IN_FLIGHT requests per slave in flight
+	while (_latency_count < latency_total && _unexpected_responses == 0) {
+		for (i = 0; i < slave_num; ++i) {
+			slave = &_slaves[i];
+
+			while (slave->next_request < requests_per_slave &&
+			       slave->next_request - slave->next_response < MAX_REQUESTS_IN_FLIGHT) {
+				dispatch_request(slave);
+			}
+		}
+
+		if (dispatch_responses(100000) < 0) {
+			goto exit;
+		}
+
+		if (_latency_count != latency_count) {
+			latency_count = _latency_count;
+			progress_at = microseconds();
+		} else if (microseconds() - progress_at > PROGRESS_TIMEOUT) {
+			printf("no response for %.1f sec, %u of %u response(s) received\n",
+			       PROGRESS_TIMEOUT / 1000000.0, _latency_count, latency_total);
+
+			goto exit;
+		}
+	}
+
+	stop = microseconds();
+	transfers = __atomic_load_n(&simulator.transfers, __ATOMIC_RELAXED) - transfers;
+	busy_injected = __atomic_load_n(&simulator.busy_injected, __ATOMIC_RELAXED) - busy_injected;
+	corrupt_injected = __atomic_load_n(&simulator.corrupt_injected, __ATOMIC_RELAXED) - corrupt_injected;
+	seconds = (stop - start) / 1000000.0;
+
+	if (_unexpected_responses > 0) {
+		printf("error: %d unexpected response(s)\n", _unexpected_responses);
+
+		goto exit;
+	}
+
+	qsort(_latencies, _latency_count, sizeof(uint32_t), compare_latency);
+
+	printf("%d slave(s), %u request(s), %u transfer(s) in %.3f sec\n",
+	       slave_num, latency_total, transfers, seconds);
+	printf("throughput: %.0f packets/sec, %.0f transfers/sec\n",
+	       _latency_count / seconds, transfers / seconds);
+	printf("latency: p50 %u usec, p90 %u usec, p99 %u usec, max %u usec\n",
+	       _latencies[_latency_count * 50 / 100], _latencies[_latency_count * 90 / 100],
+	       _latencies[_latency_count * 99 / 100], _latencies[_latency_count - 1]);
+	printf("errors: %u busy and %u corrupted transfer(s) injected\n",
+	       busy_injected, corrupt_injected);
+
+	ret = EXIT_SUCCESS;
+
+exit:
+	red_stack_exit();
+
+cleanup:
+	free(_latencies);
+
+	log_exit();
+
+	return ret;
+}
@@ -0,0 +1,482 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * redapid_shm_test.c: Benchmark for the RED Brick API Daemon transports
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Sends requests from the brickd side to an echoing redapid side, once over
+ * a UNIX domain socket pair the way redapid.c does it (one send per packet,
+ * receive into a one packet buffer) and once over the shared memory rings.
+ * The shared memory file descriptors are passed over the socket pair like
+ * brickd does it. Reports throughput, round-trip time and syscalls per
+ * packet. Usage:
+ *
+ *   redapid_shm_test [<requests> [<requests-in-flight>]]
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <daemonlib/threads.h>
+#include <daemonlib/utils.h>
+
+#include "../brickd/redapid_shm.h"
+
+#define PACKET_LENGTH (sizeof(PacketHeader) + sizeof(uint32_t))
+#define MAX_PACKETS_PER_BUFFER (sizeof(Packet) / sizeof(PacketHeader))
+
+typedef struct {
+	int socket; // redapid side of the socket pair
+	int stop_event;
+	REDAPIDSHM shm;
+	uint32_t syscalls;
+} Peer;
+
+typedef struct {
+	uint32_t requests;
+	uint32_t in_flight;
+	uint64_t *sent_at;
+	uint64_t round_trip_sum;
+	uint32_t syscalls;
+} Run;
+
+static void prepare_request(Packet *request, uint32_t index) {
+	memset(request, 0, PACKET_LENGTH);
+
+	request->header.uid = 1;
+	request->header.length = PACKET_LENGTH;
+	request->header.function_id = 1;
+	request->header.sequence_number_and_options = (((index % 15) + 1) << 4) | 0x08;
+
+	memcpy(request->payload, &index, sizeof(uint32_t));
+}
+
+// consumes complete packets from the start of the buffer, returns the number
+// of packets consumed. mimics redapid_handle_read
+static int consume_packets(uint8_t *buffer, int *used, Packet *packets, int max_count) {
+	int count = 0;
+	int length;
+
+	while (count < max_count && *used >= (int)sizeof(PacketHeader)) {
+		length = ((PacketHeader *)buffer)->length;
+
+		if (*used < length) {
+			break;
+		}
+
+		memcpy(&packets[count++], buffer, length);
+		memmove(buffer, buffer + length, *used - length);
+
+		*used -= length;
+	}
+
+	return count;
+}
+
+static void socket_peer(void *opaque) {
+	Peer *peer = opaque;
+	struct pollfd pollfds[2];
+	Packet buffer;
+	Packet packets[MAX_PACKETS_PER_BUFFER];
+	int used = 0;
+	int count;
+	int rc;
+	int i;
+
+	pollfds[0].fd = peer->stop_event;
+	pollfds[0].events = POLLIN;
+	pollfds[1].fd = peer->socket;
+	pollfds[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(pollfds, 2, -1) < 0) {
+			break;
+		}
+
+		++peer->syscalls;
+
+		if ((pollfds[0].revents & POLLIN) != 0) {
+			break;
+		}
+
+		rc = read(peer->socket, (uint8_t *)&buffer + used, sizeof(Packet) - used);
+
+		++peer->syscalls;
+
+		if (rc <= 0) {
+			break;
+		}
+
+		used += rc;
+		count = consume_packets((uint8_t *)&buffer, &used, packets, MAX_PACKETS_PER_BUFFER);
+
+		for (i = 0; i < count; ++i) {
+			if (write(peer->socket, &packets[i], packets[i].header.length) < 0) {
+				return;
+			}
+
+			++peer->syscalls;
+		}
+	}
+}
+
+static void shm_peer(void *opaque) {
+	Peer *peer = opaque;
+	struct pollfd pollfds[2];
+	Packet *request;
+	Packet *response;
+
+	pollfds[0].fd = peer->stop_event;
+	pollfds[0].events = POLLIN;
+	pollfds[1].fd = peer->shm.request_event;
+	pollfds[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(pollfds, 2, -1) < 0) {
+			break;
+		}
+
+		++peer->syscalls;
+
+		if ((pollfds[0].revents & POLLIN) != 0) {
+			break;
+		}
+
+		redapid_shm_ring_acknowledge(peer->shm.request_event);
+
+		++peer->syscalls;
+
+		while ((request = redapid_shm_ring_peek(&peer->shm.layout->requests)) != NULL) {
+			// the requester never has more than a ring full in flight
+			response = redapid_shm_ring_reserve(&peer->shm.layout->responses);
+
+			memcpy(response, request, request->header.length);
+			redapid_shm_ring_pop(&peer->shm.layout->requests);
+
+			if (redapid_shm_ring_commit(&peer->shm.layout->responses, peer->shm.response_event) != 0) {
+				++peer->syscalls;
+			}
+		}
+	}
+}
+
+static int check_response(Run *run, Packet *response, uint32_t expected) {
+	uint32_t index;
+
+	memcpy(&index, response->payload, sizeof(uint32_t));
+
+	if (index != expected) {
+		printf("unexpected response %u, expected %u\n", index, expected);
+
+		return -1;
+	}
+
+	run->round_trip_sum += microseconds() - run->sent_at[index];
+
+	return 0;
+}
+
+static int run_socket(Run *run, int fd) {
+	struct pollfd pollfd;
+	Packet request;
+	Packet buffer;
+	Packet responses[MAX_PACKETS_PER_BUFFER];
+	uint32_t sent = 0;
+	uint32_t received = 0;
+	int used = 0;
+	int count;
+	int rc;
+	int i;
+
+	pollfd.fd = fd;
+	pollfd.events = POLLIN;
+
+	while (received < run->requests) {
+		while (sent < run->requests && sent - received < run->in_flight) {
+			prepare_request(&request, sent);
+
+			run->sent_at[sent++] = microseconds();
+
+			if (write(fd, &request, request.header.length) < 0) {
+				return -1;
+			}
+
+			++run->syscalls;
+		}
+
+		if (poll(&pollfd, 1, -1) < 0) {
+			return -1;
+		}
+
+		rc = read(fd, (uint8_t *)&buffer + used, sizeof(Packet) - used);
+
+		run->syscalls += 2;
+
+		if (rc <= 0) {
+			return -1;
+		}
+
+		used += rc;
+		count = consume_packets((uint8_t *)&buffer, &used, responses, MAX_PACKETS_PER_BUFFER);
+
+		for (i = 0; i < count; ++i) {
+			if (check_response(run, &responses[i], received++) < 0) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int run_shm(Run *run, REDAPIDSHM *shm) {
+	struct pollfd pollfd;
+	Packet *request;
+	Packet *response;
+	uint32_t sent = 0;
+	uint32_t received = 0;
+	int rc;
+
+	pollfd.fd = shm->response_event;
+	pollfd.events = POLLIN;
+
+	while (received < run->requests) {
+		while (sent < run->requests && sent - received < run->in_flight) {
+			request = redapid_shm_ring_reserve(&shm->layout->requests);
+
+			if (request == NULL) {
+				break;
+			}
+
+			prepare_request(request, sent);
+
+			run->sent_at[sent++] = microseconds();
+			rc = redapid_shm_ring_commit(&shm->layout->requests, shm->request_event);
+
+			if (rc < 0) {
+				return -1;
+			}
+
+			run->syscalls += rc;
+		}
+
+		if (poll(&pollfd, 1, -1) < 0) {
+			return -1;
+		}
+
+		if (redapid_shm_ring_acknowledge(shm->response_event) < 0) {
+			return -1;
+		}
+
+		run->syscalls += 2;
+
+		while ((response = redapid_shm_ring_peek(&shm->layout->responses)) != NULL) {
+			if (check_response(run, response, received++) < 0) {
+				return -1;
+			}
+
+			redapid_shm_ring_pop(&shm->layout->responses);
+		}
+	}
+
+	return 0;
+}
+
+// passes the file descriptors over the socket like redapid.c does
+static int pass_shm(REDAPIDSHM *shm, int sender, REDAPIDSHM *attached, int receiver) {
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	int fds[REDAPID_SHM_OFFER_FD_COUNT];
+	uint8_t control[CMSG_SPACE(sizeof(fds))];
+	REDAPIDSHMOfferRequest offer;
+
+	memset(&offer, 0, sizeof(offer));
+
+	offer.header.length = sizeof(offer);
+	offer.header.function_id = REDAPID_SHM_FUNCTION_OFFER;
+
+	fds[0] = shm->memfd;
+	fds[1] = shm->request_event;
+	fds[2] = shm->response_event;
+
+	iov.iov_base = &offer;
+	iov.iov_len = sizeof(offer);
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	if (sendmsg(sender, &msg, 0) != sizeof(offer)) {
+		return -1;
+	}
+
+	memset(control, 0, sizeof(control));
+
+	msg.msg_controllen = sizeof(control);
+
+	if (recvmsg(receiver, &msg, 0) != sizeof(offer)) {
+		return -1;
+	}
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+
+	if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+		return -1;
+	}
+
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+	return redapid_shm_attach(attached, fds[0], fds[1], fds[2]);
+}
+
+static void report(const char *name, Run *run, uint32_t peer_syscalls, double seconds) {
+	printf("%s: %u request(s) in %.3f sec, %.0f packets/sec, avg round-trip %.1f usec, %.2f syscalls/packet\n",
+	       name, run->requests, seconds, run->requests / seconds,
+	       (double)run->round_trip_sum / run->requests,
+	       (double)(run->syscalls + peer_syscalls) / run->requests);
+}
+
+int main(int argc, char **argv) {
+	uint32_t requests = argc > 1 ? (uint32_t)atoi(argv[1]) : 100000;
+	uint32_t in_flight = argc > 2 ? (uint32_t)atoi(argv[2]) : 16;
+	int sockets[2];
+	Peer peer;
+	Thread thread;
+	REDAPIDSHM shm;
+	Run run;
+	uint64_t start;
+	double seconds;
+	eventfd_t ev = 1;
+	int rc;
+
+	if (requests < 1 || in_flight < 1 || in_flight > REDAPID_SHM_RING_CAPACITY) {
+		printf("requests in flight has to be between 1 and %d\n", REDAPID_SHM_RING_CAPACITY);
+
+		return EXIT_FAILURE;
+	}
+
+	memset(&run, 0, sizeof(run));
+
+	run.requests = requests;
+	run.in_flight = in_flight;
+	run.sent_at = calloc(requests, sizeof(uint64_t));
+
+	if (run.sent_at == NULL) {
+		printf("out of memory\n");
+
+		return EXIT_FAILURE;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0) {
+		printf("could not create socket pair: %s (%d)\n", get_errno_name(errno), errno);
+
+		return EXIT_FAILURE;
+	}
+
+	memset(&peer, 0, sizeof(peer));
+
+	peer.socket = sockets[1];
+	peer.stop_event = eventfd(0, 0);
+
+	// UNIX domain socket
+	thread_create(&thread, socket_peer, &peer);
+
+	start = microseconds();
+	rc = run_socket(&run, sockets[0]);
+	seconds = (microseconds() - start) / 1000000.0;
+
+	if (eventfd_write(peer.stop_event, ev) < 0) {} // ignore return value
+
+	thread_join(&thread);
+	thread_destroy(&thread);
+
+	if (rc < 0) {
+		printf("socket run failed\n");
+
+		return EXIT_FAILURE;
+	}
+
+	report("socket", &run, peer.syscalls, seconds);
+
+	// shared memory
+	if (eventfd_read(peer.stop_event, &ev) < 0) {} // ignore return value
+
+	if (redapid_shm_create(&shm) < 0) {
+		printf("could not create shared memory: %s (%d)\n", get_errno_name(errno), errno);
+
+		return EXIT_FAILURE;
+	}
+
+	if (pass_shm(&shm, sockets[0], &peer.shm, sockets[1]) < 0) {
+		printf("could not pass shared memory: %s (%d)\n", get_errno_name(errno), errno);
+
+		return EXIT_FAILURE;
+	}
+
+	run.round_trip_sum = 0;
+	run.syscalls = 0;
+	peer.syscalls = 0;
+
+	thread_create(&thread, shm_peer, &peer);
+
+	start = microseconds();
+	rc = run_shm(&run, &shm);
+	seconds = (microseconds() - start) / 1000000.0;
+
+	if (eventfd_write(peer.stop_event, ev) < 0) {} // ignore return value
+
+	thread_join(&thread);
+	thread_destroy(&thread);
+
+	if (rc < 0) {
+		printf("shared memory run failed\n");
+
+		return EXIT_FAILURE;
+	}
+
+	report("shared memory", &run, peer.syscalls, seconds);
+
+	redapid_shm_destroy(&peer.shm);
+	redapid_shm_destroy(&shm);
+
+	close(peer.stop_event);
+	close(sockets[0]);
+	close(sockets[1]);
+	free(run.sent_at);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,338 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * remote_stack_test.c: Tests for the remote stack of a running brickd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Plays a second brickd with one device for a running brickd that has
+ * localhost:<remote-port> in its remote.hosts option, and connects to it as
+ * a client. Checks that requests for the device are forwarded, that responses
+ * and callbacks come back and that the device is announced as disconnected
+ * once the second brickd goes away. Reports the average round-trip time
+ * through both hops. No Bricks are required. Authentication has to be
+ * disabled. Usage:
+ *
+ *   remote_stack_test [<plain-port> [<remote-port> [<requests>]]]
+ */
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <daemonlib/base58.h>
+#include <daemonlib/packet.h>
+#include <daemonlib/utils.h>
+
+#define DEVICE_UID 0x0BADC0DE
+#define DEVICE_FUNCTION_ID 42
+#define DEVICE_CALLBACK_ID 43
+#define ACCEPT_TIMEOUT 10000 // milliseconds, brickd retries every 2 seconds
+#define RECEIVE_TIMEOUT 5000 // milliseconds
+
+static int open_listener(uint16_t port) {
+	struct sockaddr_in address;
+	int fd;
+	int flag = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+
+	memset(&address, 0, sizeof(address));
+
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+	    listen(fd, 1) < 0) {
+		printf("could not listen on port %u: %s (%d)\n", port, strerror(errno), errno);
+
+		close(fd);
+
+		return -1;
+	}
+
+	return fd;
+}
+
+static int connect_to(uint16_t port) {
+	struct sockaddr_in address;
+	int fd;
+	int flag = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+	memset(&address, 0, sizeof(address));
+
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		printf("could not connect to port %u: %s (%d)\n", port, strerror(errno), errno);
+
+		close(fd);
+
+		return -1;
+	}
+
+	return fd;
+}
+
+static int wait_readable(int fd, int timeout) {
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	return poll(&pfd, 1, timeout) == 1 ? 0 : -1;
+}
+
+static int receive_exactly(int fd, void *buffer, int length) {
+	int offset = 0;
+	int rc;
+
+	while (offset < length) {
+		if (wait_readable(fd, RECEIVE_TIMEOUT) < 0) {
+			return -1;
+		}
+
+		rc = recv(fd, (uint8_t *)buffer + offset, length - offset, 0);
+
+		if (rc < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (rc <= 0) {
+			return -1;
+		}
+
+		offset += rc;
+	}
+
+	return 0;
+}
+
+static int receive_packet(int fd, Packet *packet) {
+	if (receive_exactly(fd, &packet->header, sizeof(PacketHeader)) < 0 ||
+	    packet->header.length < sizeof(PacketHeader) ||
+	    packet->header.length > sizeof(Packet)) {
+		return -1;
+	}
+
+	return receive_exactly(fd, packet->payload, packet->header.length - sizeof(PacketHeader));
+}
+
+static int send_packet(int fd, Packet *packet) {
+	return send(fd, packet, packet->header.length, 0) == packet->header.length ? 0 : -1;
+}
+
+// skips callbacks of other devices that might be connected to brickd
+static int receive_from_device(int fd, Packet *packet, uint8_t function_id) {
+	for (;;) {
+		if (receive_packet(fd, packet) < 0) {
+			return -1;
+		}
+
+		if (packet->header.uid == uint32_to_le(DEVICE_UID) &&
+		    packet->header.function_id == function_id) {
+			return 0;
+		}
+	}
+}
+
+static void fill_enumerate_callback(EnumerateCallback *callback, EnumerationType type) {
+	memset(callback, 0, sizeof(*callback));
+
+	callback->header.uid = uint32_to_le(DEVICE_UID);
+	callback->header.length = sizeof(*callback);
+	callback->header.function_id = CALLBACK_ENUMERATE;
+	packet_header_set_sequence_number(&callback->header, 0);
+	packet_header_set_response_expected(&callback->header, true);
+
+	base58_encode(callback->uid, DEVICE_UID);
+	callback->connected_uid[0] = '0';
+	callback->position = '0';
+	callback->enumeration_type = type;
+}
+
+int main(int argc, char **argv) {
+	uint16_t plain_port = (uint16_t)(argc > 1 ? atoi(argv[1]) : 4223);
+	uint16_t remote_port = (uint16_t)(argc > 2 ? atoi(argv[2]) : 4224);
+	int requests = argc > 3 ? atoi(argv[3]) : 10000;
+	int listen_fd;
+	int remote_fd;
+	int client_fd;
+	Packet packet;
+	Packet request;
+	EnumerateCallback enumerate_callback;
+	uint8_t sequence_number;
+	uint64_t start;
+	uint64_t stop;
+	int i;
+
+	if (requests < 1) {
+		printf("invalid request count\n");
+
+		return EXIT_FAILURE;
+	}
+
+	listen_fd = open_listener(remote_port);
+
+	if (listen_fd < 0) {
+		return EXIT_FAILURE;
+	}
+
+	printf("waiting for brickd to connect to port %u\n", remote_port);
+
+	if (wait_readable(listen_fd, ACCEPT_TIMEOUT) < 0) {
+		printf("brickd did not connect, is localhost:%u in its remote.hosts option?\n", remote_port);
+
+		return EXIT_FAILURE;
+	}
+
+	remote_fd = accept(listen_fd, NULL, NULL);
+
+	close(listen_fd);
+
+	if (remote_fd < 0) {
+		printf("could not accept brickd: %s (%d)\n", strerror(errno), errno);
+
+		return EXIT_FAILURE;
+	}
+
+	// brickd enumerates the devices behind the remote brickd after connecting
+	if (receive_packet(remote_fd, &packet) < 0 || packet.header.uid != 0 ||
+	    packet.header.function_id != FUNCTION_ENUMERATE) {
+		printf("did not receive enumerate request from brickd\n");
+
+		return EXIT_FAILURE;
+	}
+
+	fill_enumerate_callback(&enumerate_callback, ENUMERATION_TYPE_AVAILABLE);
+
+	if (send_packet(remote_fd, (Packet *)&enumerate_callback) < 0) {
+		printf("could not send enumerate callback\n");
+
+		return EXIT_FAILURE;
+	}
+
+	client_fd = connect_to(plain_port);
+
+	if (client_fd < 0) {
+		return EXIT_FAILURE;
+	}
+
+	memset(&request, 0, sizeof(request));
+
+	request.header.uid = uint32_to_le(DEVICE_UID);
+	request.header.length = sizeof(PacketHeader) + 4;
+	request.header.function_id = DEVICE_FUNCTION_ID;
+
+	start = microseconds();
+
+	for (i = 0; i < requests; ++i) {
+		sequence_number = (uint8_t)(i % 15 + 1);
+
+		packet_header_set_sequence_number(&request.header, sequence_number);
+		packet_header_set_response_expected(&request.header, true);
+		memcpy(request.payload, &i, sizeof(i));
+
+		if (send_packet(client_fd, &request) < 0) {
+			printf("could not send request %d\n", i);
+
+			return EXIT_FAILURE;
+		}
+
+		// the remote side answers with the request itself
+		if (receive_from_device(remote_fd, &packet, DEVICE_FUNCTION_ID) < 0 ||
+		    memcmp(&packet, &request, request.header.length) != 0) {
+			printf("request %d was not forwarded\n", i);
+
+			return EXIT_FAILURE;
+		}
+
+		if (send_packet(remote_fd, &packet) < 0) {
+			printf("could not send response %d\n", i);
+
+			return EXIT_FAILURE;
+		}
+
+		if (receive_from_device(client_fd, &packet, DEVICE_FUNCTION_ID) < 0 ||
+		    memcmp(&packet, &request, request.header.length) != 0) {
+			printf("response %d was not forwarded, is authentication enabled?\n", i);
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	stop = microseconds();
+
+	// a callback of the device
+	request.header.function_id = DEVICE_CALLBACK_ID;
+	packet_header_set_sequence_number(&request.header, 0);
+
+	if (send_packet(remote_fd, &request) < 0 ||
+	    receive_from_device(client_fd, &packet, DEVICE_CALLBACK_ID) < 0) {
+		printf("callback was not forwarded\n");
+
+		return EXIT_FAILURE;
+	}
+
+	// once the remote brickd is gone its device has to be announced as
+	// disconnected
+	close(remote_fd);
+
+	for (;;) {
+		if (receive_from_device(client_fd, &packet, CALLBACK_ENUMERATE) < 0) {
+			printf("device was not announced as disconnected\n");
+
+			return EXIT_FAILURE;
+		}
+
+		if (((EnumerateCallback *)&packet)->enumeration_type == ENUMERATION_TYPE_DISCONNECTED) {
+			break;
+		}
+	}
+
+	close(client_fd);
+
+	printf("%.2f usec per round-trip through brickd and the remote stack\n",
+	       (double)(stop - start) / requests);
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}
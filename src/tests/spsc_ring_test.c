@@ -0,0 +1,199 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * spsc_ring_test.c: Tests for the SPSCRing type
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _WIN32
+	#include <pthread.h>
+	#include <sched.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../brickd/spsc_ring.h"
+
+int test1(void) {
+	SPSCRing ring;
+	uint32_t i;
+	uint32_t *item;
+
+	if (spsc_ring_create(&ring, 3, sizeof(uint32_t)) == 0) {
+		printf("test1: spsc_ring_create accepted non-power-of-two capacity\n");
+
+		return -1;
+	}
+
+	if (spsc_ring_create(&ring, 4, sizeof(uint32_t)) < 0) {
+		printf("test1: spsc_ring_create failed\n");
+
+		return -1;
+	}
+
+	if (spsc_ring_peek(&ring) != NULL) {
+		printf("test1: unexpected result from spsc_ring_peek on empty ring\n");
+
+		return -1;
+	}
+
+	// fill and drain the ring multiple times to test wrap-around
+	for (i = 0; i < 10; ++i) {
+		*(uint32_t *)spsc_ring_reserve(&ring) = i * 4 + 0; spsc_ring_commit(&ring);
+		*(uint32_t *)spsc_ring_reserve(&ring) = i * 4 + 1; spsc_ring_commit(&ring);
+		*(uint32_t *)spsc_ring_reserve(&ring) = i * 4 + 2; spsc_ring_commit(&ring);
+		*(uint32_t *)spsc_ring_reserve(&ring) = i * 4 + 3; spsc_ring_commit(&ring);
+
+		if (spsc_ring_count(&ring) != 4) {
+			printf("test1: unexpected result from spsc_ring_count\n");
+
+			return -1;
+		}
+
+		if (spsc_ring_reserve(&ring) != NULL) {
+			printf("test1: unexpected result from spsc_ring_reserve on full ring\n");
+
+			return -1;
+		}
+
+		item = spsc_ring_peek(&ring);
+
+		if (item == NULL || *item != i * 4 + 0) {
+			printf("test1: unexpected result from spsc_ring_peek\n");
+
+			return -1;
+		}
+
+		spsc_ring_pop(&ring);
+
+		// one item was popped, one can be reserved again
+		*(uint32_t *)spsc_ring_reserve(&ring) = 1000; spsc_ring_commit(&ring);
+
+		spsc_ring_pop(&ring);
+		spsc_ring_pop(&ring);
+		spsc_ring_pop(&ring);
+
+		item = spsc_ring_peek(&ring);
+
+		if (item == NULL || *item != 1000) {
+			printf("test1: unexpected result from spsc_ring_peek\n");
+
+			return -1;
+		}
+
+		spsc_ring_pop(&ring);
+
+		if (spsc_ring_peek(&ring) != NULL) {
+			printf("test1: unexpected result from spsc_ring_peek on empty ring\n");
+
+			return -1;
+		}
+	}
+
+	spsc_ring_destroy(&ring);
+
+	return 0;
+}
+
+#ifndef _WIN32
+
+#define TEST2_ITEM_COUNT 100000
+
+static void *test2_producer(void *opaque) {
+	SPSCRing *ring = opaque;
+	uint32_t i = 0;
+	uint32_t *item;
+
+	while (i < TEST2_ITEM_COUNT) {
+		item = spsc_ring_reserve(ring);
+
+		if (item == NULL) {
+			sched_yield();
+
+			continue;
+		}
+
+		*item = i++;
+
+		spsc_ring_commit(ring);
+	}
+
+	return NULL;
+}
+
+int test2(void) {
+	SPSCRing ring;
+	pthread_t producer;
+	uint32_t i = 0;
+	uint32_t *item;
+
+	if (spsc_ring_create(&ring, 64, sizeof(uint32_t)) < 0) {
+		printf("test2: spsc_ring_create failed\n");
+
+		return -1;
+	}
+
+	if (pthread_create(&producer, NULL, test2_producer, &ring) != 0) {
+		printf("test2: pthread_create failed\n");
+
+		return -1;
+	}
+
+	while (i < TEST2_ITEM_COUNT) {
+		item = spsc_ring_peek(&ring);
+
+		if (item == NULL) {
+			sched_yield();
+
+			continue;
+		}
+
+		if (*item != i) {
+			printf("test2: unexpected item %u, expected %u\n", *item, i);
+
+			return -1;
+		}
+
+		spsc_ring_pop(&ring);
+
+		++i;
+	}
+
+	pthread_join(producer, NULL);
+
+	spsc_ring_destroy(&ring);
+
+	return 0;
+}
+
+#endif
+
+int main(void) {
+	if (test1() < 0) {
+		return EXIT_FAILURE;
+	}
+
+#ifndef _WIN32
+	if (test2() < 0) {
+		return EXIT_FAILURE;
+	}
+#endif
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,184 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * websocket_mask_test.c: Tests and benchmark for the WebSocket unmasking
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../brickd/websocket_mask.h"
+
+#define MAX_TEST_LENGTH 100
+#define BENCHMARK_LENGTH (64 * 1024)
+#define BENCHMARK_BYTES (256 * 1024 * 1024)
+
+typedef int (*UnmaskFunction)(uint8_t *buffer, int length,
+                              const uint8_t *masking_key, int mask_index);
+
+static const uint8_t masking_key[WEBSOCKET_MASK_LENGTH] = { 0x37, 0xFA, 0x21, 0x3D };
+
+static void fill(uint8_t *buffer, int length, uint32_t seed) {
+	int i;
+
+	for (i = 0; i < length; ++i) {
+		seed = seed * 1103515245 + 12345;
+		buffer[i] = (uint8_t)(seed >> 16);
+	}
+}
+
+// compare against the bytewise reference for all combinations of alignment,
+// length and start mask index
+int test1(void) {
+	uint8_t storage[MAX_TEST_LENGTH + 32];
+	uint8_t expected[MAX_TEST_LENGTH + 32];
+	int offset;
+	int length;
+	int mask_index;
+	int expected_mask_index;
+	int result_mask_index;
+
+	for (offset = 0; offset < 16; ++offset) {
+		for (length = 0; length <= MAX_TEST_LENGTH; ++length) {
+			for (mask_index = 0; mask_index < WEBSOCKET_MASK_LENGTH; ++mask_index) {
+				fill(storage, sizeof(storage), offset * 1000 + length);
+				memcpy(expected, storage, sizeof(storage));
+
+				expected_mask_index = websocket_unmask_bytewise(expected + offset, length, masking_key, mask_index);
+				result_mask_index = websocket_unmask(storage + offset, length, masking_key, mask_index);
+
+				if (memcmp(storage, expected, sizeof(storage)) != 0) {
+					printf("test1: wrong result for offset %d, length %d, mask index %d\n",
+					       offset, length, mask_index);
+
+					return -1;
+				}
+
+				if (result_mask_index != expected_mask_index) {
+					printf("test1: wrong mask index %d (expected %d) for offset %d, length %d, mask index %d\n",
+					       result_mask_index, expected_mask_index, offset, length, mask_index);
+
+					return -1;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+// unmask a payload in two parts, as if it was split across two reads
+int test2(void) {
+	uint8_t payload[MAX_TEST_LENGTH];
+	uint8_t expected[MAX_TEST_LENGTH];
+	int split;
+	int mask_index;
+
+	for (split = 0; split <= MAX_TEST_LENGTH; ++split) {
+		fill(payload, sizeof(payload), split);
+		memcpy(expected, payload, sizeof(payload));
+
+		websocket_unmask_bytewise(expected, sizeof(expected), masking_key, 0);
+
+		mask_index = websocket_unmask(payload, split, masking_key, 0);
+		mask_index = websocket_unmask(payload + split, sizeof(payload) - split, masking_key, mask_index);
+
+		if (memcmp(payload, expected, sizeof(payload)) != 0) {
+			printf("test2: wrong result for split at %d\n", split);
+
+			return -1;
+		}
+
+		if (mask_index != (int)(sizeof(payload) % WEBSOCKET_MASK_LENGTH)) {
+			printf("test2: wrong final mask index %d for split at %d\n", mask_index, split);
+
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static double benchmark(const char *name, UnmaskFunction unmask, uint8_t *buffer, int length) {
+	clock_t start;
+	double duration;
+	int rounds = BENCHMARK_BYTES / length;
+	int mask_index = 0;
+	int i;
+
+	start = clock();
+
+	for (i = 0; i < rounds; ++i) {
+		mask_index = unmask(buffer, length, masking_key, mask_index);
+	}
+
+	duration = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	if (duration <= 0) {
+		duration = 1.0 / CLOCKS_PER_SEC;
+	}
+
+	printf("%-10s %6d byte(s): %8.1f MiB/s\n", name, length,
+	       (double)rounds * length / duration / (1024 * 1024));
+
+	return duration;
+}
+
+int main(void) {
+	uint8_t *buffer;
+	int lengths[] = { 80, 1024, BENCHMARK_LENGTH };
+	int i;
+
+#ifdef _WIN32
+	fixes_init();
+#endif
+
+	if (test1() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test2() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	buffer = malloc(BENCHMARK_LENGTH + 1);
+
+	if (buffer == NULL) {
+		printf("could not allocate benchmark buffer\n");
+
+		return EXIT_FAILURE;
+	}
+
+	fill(buffer, BENCHMARK_LENGTH + 1, 0);
+
+	printf("implementation: %s\n", websocket_unmask_get_implementation());
+
+	// the odd offset forces the unaligned head and tail handling
+	for (i = 0; i < (int)(sizeof(lengths) / sizeof(lengths[0])); ++i) {
+		benchmark("bytewise", websocket_unmask_bytewise, buffer + 1, lengths[i]);
+		benchmark("unmask", websocket_unmask, buffer + 1, lengths[i]);
+	}
+
+	free(buffer);
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}
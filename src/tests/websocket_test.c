@@ -0,0 +1,944 @@
+/*
+ * brickd
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * websocket_test.c: Tests and benchmark for the WebSocket frame parser
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Encodes random message streams as masked frames like a client would send
+ * them and feeds them to the parser in random chunk sizes. The socket and
+ * event functions are replaced by test doubles that capture everything the
+ * websocket sends, so the answers to pings and closes can be checked. Then
+ * feeds random and mutated input to the parser that must be rejected without
+ * crashing, and measures the parser throughput.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <daemonlib/event.h>
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "../brickd/websocket.h"
+
+#define MAX_STREAM_LENGTH (4 * 1024 * 1024)
+#define MAX_CAPTURE_LENGTH (1024 * 1024)
+#define FUZZ_ROUNDS 20000
+#define BENCHMARK_BYTES (256 * 1024 * 1024)
+#define BENCHMARK_READ_LENGTH (64 * 1024)
+
+// not a valid result of websocket_parse
+#define PARSER_MISBEHAVED -100
+
+#define HANDSHAKE_REQUEST \
+	"GET / HTTP/1.1\r\n" \
+	"Host: localhost\r\n" \
+	"Upgrade: websocket\r\n" \
+	"Connection: Upgrade\r\n" \
+	"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n" \
+	"Sec-WebSocket-Version: 13\r\n" \
+	"\r\n"
+
+// the accept key for the key in HANDSHAKE_REQUEST as given in RFC 6455
+#define HANDSHAKE_ACCEPT_KEY "s3pPLMBiTxaQ9kYGzzhZRbK+xOo="
+
+typedef struct {
+	uint8_t *data;
+	int length;
+} Buffer;
+
+static uint32_t _random_state = 1;
+
+static Buffer _captured; // everything the websocket sent
+
+static Buffer _stream; // encoded frames, parser input
+static Buffer _expected; // concatenated payload of the data frames
+static Buffer _expected_pongs; // concatenated payload of the ping frames
+static Buffer _output; // what the parser returned
+static uint8_t *_chunk;
+
+// test doubles for the functions websocket.c uses from socket.c, the
+// platform specific socket code and event.c
+int socket_create(Socket *socket) {
+	memset(socket, 0, sizeof(*socket));
+
+	return 0;
+}
+
+void socket_destroy_platform(Socket *socket) {
+	(void)socket;
+}
+
+int socket_receive_platform(Socket *socket, void *buffer, int length) {
+	(void)socket;
+	(void)buffer;
+	(void)length;
+
+	errno = EWOULDBLOCK;
+
+	return -1;
+}
+
+int socket_send_platform(Socket *socket, void *buffer, int length) {
+	(void)socket;
+
+	if (_captured.length + length > MAX_CAPTURE_LENGTH) {
+		errno = ENOBUFS;
+
+		return -1;
+	}
+
+	memcpy(_captured.data + _captured.length, buffer, length);
+
+	_captured.length += length;
+
+	return length;
+}
+
+int event_modify_source(IOHandle handle, EventSourceType type, uint32_t events_to_remove,
+                        uint32_t events_to_add, EventFunction function, void *opaque) {
+	(void)handle;
+	(void)type;
+	(void)events_to_remove;
+	(void)events_to_add;
+	(void)function;
+	(void)opaque;
+
+	return 0;
+}
+
+static uint32_t random_next(void) {
+	_random_state = _random_state * 1103515245 + 12345;
+
+	return _random_state >> 8;
+}
+
+static int random_range(int min, int max) {
+	return min + (int)(random_next() % (uint32_t)(max - min + 1));
+}
+
+static void random_fill(uint8_t *buffer, int length) {
+	int i;
+
+	for (i = 0; i < length; ++i) {
+		buffer[i] = (uint8_t)random_next();
+	}
+}
+
+static int buffer_append(Buffer *buffer, const void *data, int length) {
+	if (buffer->length + length > MAX_STREAM_LENGTH) {
+		return -1;
+	}
+
+	memcpy(buffer->data + buffer->length, data, length);
+
+	buffer->length += length;
+
+	return 0;
+}
+
+// appends a masked frame using the shortest payload length encoding
+static int encode_frame(Buffer *stream, int fin, int opcode,
+                        const uint8_t *payload, int length) {
+	uint8_t header[WEBSOCKET_MAX_FRAME_HEADER_LENGTH];
+	uint8_t *masking_key;
+	int header_length = 2;
+	int i;
+
+	header[0] = (uint8_t)((fin << 7) | opcode);
+
+	if (length <= 125) {
+		header[1] = 0x80 | (uint8_t)length;
+	} else if (length <= 65535) {
+		header[1] = 0x80 | 126;
+		header[2] = (uint8_t)(length >> 8);
+		header[3] = (uint8_t)length;
+		header_length += 2;
+	} else {
+		header[1] = 0x80 | 127;
+
+		for (i = 0; i < 8; ++i) {
+			header[2 + i] = (uint8_t)((uint64_t)length >> (56 - i * 8));
+		}
+
+		header_length += 8;
+	}
+
+	masking_key = header + header_length;
+	random_fill(masking_key, WEBSOCKET_MASK_LENGTH);
+	header_length += WEBSOCKET_MASK_LENGTH;
+
+	if (buffer_append(stream, header, header_length) < 0 ||
+	    buffer_append(stream, payload, length) < 0) {
+		return -1;
+	}
+
+	websocket_unmask_bytewise(stream->data + stream->length - length, length, masking_key, 0);
+
+	return 0;
+}
+
+static void prepare_websocket(Websocket *websocket, bool handshake_done) {
+	websocket_create(websocket);
+
+	if (handshake_done) {
+		websocket->state = WEBSOCKET_STATE_HANDSHAKE_DONE;
+	}
+
+	_captured.length = 0;
+	_output.length = 0;
+}
+
+// feeds the stream to the parser in chunks of random length, the parser works
+// on a copy, because it modifies the data in place. returns the last result
+// of websocket_parse that was not a positive length
+static int feed_stream(Websocket *websocket, const uint8_t *stream, int length,
+                       int max_chunk_length) {
+	int offset = 0;
+	int chunk_length;
+	int rc = IO_CONTINUE;
+
+	while (offset < length) {
+		chunk_length = random_range(1, max_chunk_length);
+
+		if (chunk_length > length - offset) {
+			chunk_length = length - offset;
+		}
+
+		memcpy(_chunk, stream + offset, chunk_length);
+
+		rc = websocket_parse(websocket, _chunk, chunk_length);
+
+		if (rc > chunk_length) {
+			printf("parser returned %d byte(s) for a %d byte chunk\n", rc, chunk_length);
+
+			return PARSER_MISBEHAVED;
+		}
+
+		if (rc > 0) {
+			buffer_append(&_output, _chunk, rc);
+
+			rc = IO_CONTINUE;
+		} else if (rc != IO_CONTINUE) {
+			return rc;
+		}
+
+		offset += chunk_length;
+	}
+
+	return rc;
+}
+
+// checks that the websocket sent exactly one unmasked pong per ping and that
+// each pong echoes the ping payload
+static int check_pongs(void) {
+	int offset = 0;
+	int pong_offset = 0;
+	int length;
+
+	websocket_flush_all();
+
+	while (offset < _captured.length) {
+		if (_captured.length - offset < 2 || _captured.data[offset] != 0x8A ||
+		    (_captured.data[offset + 1] & 0x80) != 0) {
+			printf("unexpected frame header at offset %d\n", offset);
+
+			return -1;
+		}
+
+		length = _captured.data[offset + 1];
+		offset += 2;
+
+		if (length > _expected_pongs.length - pong_offset ||
+		    memcmp(_captured.data + offset, _expected_pongs.data + pong_offset, length) != 0) {
+			printf("pong at offset %d does not match ping\n", offset);
+
+			return -1;
+		}
+
+		offset += length;
+		pong_offset += length;
+	}
+
+	if (pong_offset != _expected_pongs.length) {
+		printf("missing pongs, got %d of %d byte(s)\n", pong_offset, _expected_pongs.length);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// random messages of all payload length encodings, fragmented and with pings
+// between the fragments, in random chunk sizes
+int test1(void) {
+	static const int lengths[] = { 0, 1, 80, 125, 126, 127, 1000, 65535, 65536, 100000 };
+	Websocket websocket;
+	uint8_t *payload;
+	uint8_t ping[WEBSOCKET_MAX_CONTROL_PAYLOAD_DATA_LENGTH];
+	int ping_length;
+	int round;
+	int message;
+	int length;
+	int fragments;
+	int fragment;
+	int offset;
+	int fragment_length;
+	int rc;
+
+	payload = malloc(MAX_STREAM_LENGTH);
+
+	if (payload == NULL) {
+		printf("test1: could not allocate payload buffer\n");
+
+		return -1;
+	}
+
+	for (round = 0; round < 50; ++round) {
+		_stream.length = 0;
+		_expected.length = 0;
+		_expected_pongs.length = 0;
+
+		for (message = 0; message < 8; ++message) {
+			length = lengths[random_range(0, sizeof(lengths) / sizeof(lengths[0]) - 1)];
+			fragments = random_range(1, 3);
+			offset = 0;
+
+			random_fill(payload, length);
+			buffer_append(&_expected, payload, length);
+
+			for (fragment = 0; fragment < fragments; ++fragment) {
+				if (fragment == fragments - 1) {
+					fragment_length = length - offset;
+				} else {
+					fragment_length = random_range(0, length - offset);
+				}
+
+				encode_frame(&_stream, fragment == fragments - 1 ? 1 : 0,
+				             fragment == 0 ? WEBSOCKET_OPCODE_BINARY_FRAME
+				                           : WEBSOCKET_OPCODE_CONTINUATION_FRAME,
+				             payload + offset, fragment_length);
+
+				offset += fragment_length;
+
+				if (random_range(0, 2) == 0) {
+					ping_length = random_range(0, sizeof(ping));
+
+					random_fill(ping, ping_length);
+					buffer_append(&_expected_pongs, ping, ping_length);
+					encode_frame(&_stream, 1, WEBSOCKET_OPCODE_PING_FRAME, ping, ping_length);
+				}
+
+				if (random_range(0, 4) == 0) {
+					encode_frame(&_stream, 1, WEBSOCKET_OPCODE_PONG_FRAME, ping, 3);
+				}
+			}
+		}
+
+		prepare_websocket(&websocket, true);
+
+		rc = feed_stream(&websocket, _stream.data, _stream.length,
+		                 round % 2 == 0 ? 16 : BENCHMARK_READ_LENGTH);
+
+		if (rc != IO_CONTINUE) {
+			printf("test1: parser failed in round %d (%d)\n", round, rc);
+
+			goto error;
+		}
+
+		if (_output.length != _expected.length ||
+		    memcmp(_output.data, _expected.data, _expected.length) != 0) {
+			printf("test1: wrong payload in round %d, got %d of %d byte(s)\n",
+			       round, _output.length, _expected.length);
+
+			goto error;
+		}
+
+		if (check_pongs() < 0) {
+			printf("test1: wrong pongs in round %d\n", round);
+
+			goto error;
+		}
+
+		websocket_destroy(&websocket.base);
+	}
+
+	free(payload);
+
+	return 0;
+
+error:
+	websocket_destroy(&websocket.base);
+	free(payload);
+
+	return -1;
+}
+
+// the handshake and the first frames arrive in the same read
+int test2(void) {
+	Websocket websocket;
+	uint8_t payload[80];
+	int rc;
+
+	_stream.length = 0;
+
+	random_fill(payload, sizeof(payload));
+	buffer_append(&_stream, HANDSHAKE_REQUEST, strlen(HANDSHAKE_REQUEST));
+	encode_frame(&_stream, 1, WEBSOCKET_OPCODE_BINARY_FRAME, payload, sizeof(payload));
+	encode_frame(&_stream, 1, WEBSOCKET_OPCODE_BINARY_FRAME, payload, sizeof(payload));
+
+	prepare_websocket(&websocket, false);
+
+	memcpy(_chunk, _stream.data, _stream.length);
+
+	rc = websocket_parse(&websocket, _chunk, _stream.length);
+
+	if (rc != 2 * (int)sizeof(payload) ||
+	    memcmp(_chunk, payload, sizeof(payload)) != 0 ||
+	    memcmp(_chunk + sizeof(payload), payload, sizeof(payload)) != 0) {
+		printf("test2: wrong payload after handshake (%d)\n", rc);
+
+		goto error;
+	}
+
+	if (_captured.length < 12 || memcmp(_captured.data, "HTTP/1.1 101", 12) != 0 ||
+	    strstr((char *)_captured.data, HANDSHAKE_ACCEPT_KEY) == NULL) {
+		printf("test2: wrong handshake answer\n");
+
+		goto error;
+	}
+
+	websocket_destroy(&websocket.base);
+
+	return 0;
+
+error:
+	websocket_destroy(&websocket.base);
+
+	return -1;
+}
+
+// a close frame is echoed with its status code and ends the parsing
+int test3(void) {
+	static const uint8_t status[] = { 0x03, 0xE8, 'b', 'y', 'e' };
+	static const uint8_t answer[] = { 0x88, 0x02, 0x03, 0xE8 };
+	Websocket websocket;
+	uint8_t payload[10];
+	int rc;
+
+	_stream.length = 0;
+
+	random_fill(payload, sizeof(payload));
+	encode_frame(&_stream, 1, WEBSOCKET_OPCODE_BINARY_FRAME, payload, sizeof(payload));
+	encode_frame(&_stream, 1, WEBSOCKET_OPCODE_CLOSE_FRAME, status, sizeof(status));
+	encode_frame(&_stream, 1, WEBSOCKET_OPCODE_BINARY_FRAME, payload, sizeof(payload));
+
+	prepare_websocket(&websocket, true);
+
+	memcpy(_chunk, _stream.data, _stream.length);
+
+	rc = websocket_parse(&websocket, _chunk, _stream.length);
+
+	if (rc != (int)sizeof(payload) || memcmp(_chunk, payload, sizeof(payload)) != 0) {
+		printf("test3: wrong payload before close (%d)\n", rc);
+
+		goto error;
+	}
+
+	memcpy(_chunk, _stream.data, _stream.length);
+
+	if (websocket_parse(&websocket, _chunk, _stream.length) != 0) {
+		printf("test3: parser did not stop after close\n");
+
+		goto error;
+	}
+
+	websocket_flush_all();
+
+	if (_captured.length != sizeof(answer) || memcmp(_captured.data, answer, sizeof(answer)) != 0) {
+		printf("test3: wrong close answer\n");
+
+		goto error;
+	}
+
+	websocket_destroy(&websocket.base);
+
+	return 0;
+
+error:
+	websocket_destroy(&websocket.base);
+
+	return -1;
+}
+
+// protocol violations are rejected
+int test4(void) {
+	static const struct {
+		const char *name;
+		uint8_t data[14];
+		int length;
+	} cases[] = {
+		{ "unmasked frame",              { 0x82, 0x01, 0x00 }, 3 },
+		{ "text frame",                  { 0x81, 0x80, 0, 0, 0, 0 }, 6 },
+		{ "reserved bit",                { 0xC2, 0x80, 0, 0, 0, 0 }, 6 },
+		{ "unknown opcode",              { 0x83, 0x80, 0, 0, 0, 0 }, 6 },
+		{ "lone continuation",           { 0x80, 0x80, 0, 0, 0, 0 }, 6 },
+		{ "fragmented ping",             { 0x09, 0x80, 0, 0, 0, 0 }, 6 },
+		{ "long ping",                   { 0x89, 0xFE, 0x00, 0x7E, 0, 0, 0, 0 }, 8 },
+		{ "64 bit length with MSB set",  { 0x82, 0xFF, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }, 14 },
+		{ "binary inside fragment",      { 0x02, 0x80, 0, 0, 0, 0, 0x82, 0x80, 0, 0, 0, 0 }, 12 }
+	};
+	Websocket websocket;
+	int i;
+	int rc;
+
+	for (i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); ++i) {
+		prepare_websocket(&websocket, true);
+
+		memcpy(_chunk, cases[i].data, cases[i].length);
+
+		rc = websocket_parse(&websocket, _chunk, cases[i].length);
+
+		websocket_destroy(&websocket.base);
+
+		if (rc != -1) {
+			printf("test4: %s was not rejected (%d)\n", cases[i].name, rc);
+
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// random input and randomly mutated valid streams must not crash the parser
+// or make it return more bytes than it was given
+int test5(void) {
+	Websocket websocket;
+	uint8_t payload[300];
+	int round;
+	int mutations;
+	int i;
+	int rc;
+
+	for (round = 0; round < FUZZ_ROUNDS; ++round) {
+		_stream.length = 0;
+
+		if (round % 2 == 0) {
+			_stream.length = random_range(1, 1000);
+
+			random_fill(_stream.data, _stream.length);
+		} else {
+			for (i = random_range(1, 5); i > 0; --i) {
+				random_fill(payload, sizeof(payload));
+				encode_frame(&_stream, random_range(0, 1), random_range(0, 10),
+				             payload, random_range(0, sizeof(payload)));
+			}
+
+			for (mutations = random_range(1, 4); mutations > 0; --mutations) {
+				_stream.data[random_range(0, _stream.length - 1)] ^= (uint8_t)(1 << random_range(0, 7));
+			}
+		}
+
+		prepare_websocket(&websocket, round % 16 != 0);
+
+		rc = feed_stream(&websocket, _stream.data, _stream.length, 64);
+
+		websocket_flush_all();
+		websocket_destroy(&websocket.base);
+
+		if (rc == PARSER_MISBEHAVED) {
+			printf("test5: parser misbehaved in round %d\n", round);
+
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+#ifdef BRICKD_WITH_ZLIB
+
+#define HANDSHAKE_REQUEST_DEFLATE \
+	"GET / HTTP/1.1\r\n" \
+	"Host: localhost\r\n" \
+	"Upgrade: websocket\r\n" \
+	"Connection: Upgrade\r\n" \
+	"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n" \
+	"Sec-WebSocket-Extensions: x-unknown, permessage-deflate; client_max_window_bits\r\n" \
+	"Sec-WebSocket-Version: 13\r\n" \
+	"\r\n"
+
+// compresses a message with context takeover the way a client does and
+// appends it as two fragments, the first one carries the RSV1 bit
+static int encode_compressed_message(z_stream *compressor, const uint8_t *message,
+                                     int length) {
+	uint8_t compressed[4096];
+	int compressed_length;
+	int split;
+
+	compressor->next_in = (uint8_t *)message;
+	compressor->avail_in = length;
+	compressor->next_out = compressed;
+	compressor->avail_out = sizeof(compressed);
+
+	if (deflate(compressor, Z_SYNC_FLUSH) != Z_OK || compressor->avail_in != 0) {
+		return -1;
+	}
+
+	compressed_length = sizeof(compressed) - compressor->avail_out - WEBSOCKET_DEFLATE_TRAILER_LENGTH;
+	split = compressed_length / 2;
+
+	if (encode_frame(&_stream, 0, WEBSOCKET_OPCODE_BINARY_FRAME | (WEBSOCKET_RSV_COMPRESSED << 4),
+	                 compressed, split) < 0 ||
+	    encode_frame(&_stream, 1, WEBSOCKET_OPCODE_CONTINUATION_FRAME,
+	                 compressed + split, compressed_length - split) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+// inflates the payload of all frames the websocket sent after the handshake
+// answer. each frame is a complete message
+static int decode_compressed_frames(const uint8_t *data, int length) {
+	z_stream decompressor;
+	uint8_t payload[4096 + WEBSOCKET_DEFLATE_TRAILER_LENGTH];
+	int offset = 0;
+	int header_length;
+	int payload_length;
+	int rc = -1;
+
+	memset(&decompressor, 0, sizeof(decompressor));
+
+	if (inflateInit2(&decompressor, -15) != Z_OK) {
+		return -1;
+	}
+
+	while (offset < length) {
+		if (length - offset < 2 || data[offset] != (0x80 | (WEBSOCKET_RSV_COMPRESSED << 4) | WEBSOCKET_OPCODE_BINARY_FRAME)) {
+			printf("test6: sent frame is not a compressed binary frame\n");
+
+			goto cleanup;
+		}
+
+		payload_length = data[offset + 1];
+		header_length = 2;
+
+		if (payload_length == 126) {
+			payload_length = (data[offset + 2] << 8) | data[offset + 3];
+			header_length = 4;
+		}
+
+		if (payload_length > 4096 || offset + header_length + payload_length > length) {
+			printf("test6: sent frame is malformed\n");
+
+			goto cleanup;
+		}
+
+		memcpy(payload, data + offset + header_length, payload_length);
+		memcpy(payload + payload_length, websocket_deflate_trailer, WEBSOCKET_DEFLATE_TRAILER_LENGTH);
+
+		decompressor.next_in = payload;
+		decompressor.avail_in = payload_length + WEBSOCKET_DEFLATE_TRAILER_LENGTH;
+		decompressor.next_out = _output.data + _output.length;
+		decompressor.avail_out = MAX_STREAM_LENGTH - _output.length;
+
+		if (inflate(&decompressor, Z_SYNC_FLUSH) != Z_OK || decompressor.avail_in != 0) {
+			printf("test6: could not inflate sent frame\n");
+
+			goto cleanup;
+		}
+
+		_output.length = MAX_STREAM_LENGTH - decompressor.avail_out;
+		offset += header_length + payload_length;
+	}
+
+	rc = 0;
+
+cleanup:
+	inflateEnd(&decompressor);
+
+	return rc;
+}
+
+// permessage-deflate gets negotiated, compressed messages from the client are
+// inflated and handed out in request sized pieces, and sent packets are
+// deflated
+int test6(void) {
+	Websocket websocket;
+	z_stream compressor;
+	uint8_t message[240];
+	uint8_t packet[80];
+	char *answer_end;
+	int answer_length;
+	int rc;
+	int i;
+
+	memset(&compressor, 0, sizeof(compressor));
+
+	if (deflateInit2(&compressor, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		printf("test6: could not create compressor\n");
+
+		return -1;
+	}
+
+	websocket_set_compression(1, 0);
+
+	_stream.length = 0;
+	_expected.length = 0;
+
+	buffer_append(&_stream, HANDSHAKE_REQUEST_DEFLATE, strlen(HANDSHAKE_REQUEST_DEFLATE));
+
+	for (i = 0; i < 3; ++i) {
+		// packets of the same device look alike
+		memset(message, 0, sizeof(message));
+		random_fill(message + i * 8, 8);
+
+		if (encode_compressed_message(&compressor, message, sizeof(message)) < 0) {
+			printf("test6: could not compress message\n");
+
+			goto error;
+		}
+
+		buffer_append(&_expected, message, sizeof(message));
+	}
+
+	deflateEnd(&compressor);
+
+	prepare_websocket(&websocket, false);
+
+	memcpy(_chunk, _stream.data, _stream.length);
+
+	rc = websocket_parse(&websocket, _chunk, _stream.length);
+
+	if (rc > 0) {
+		buffer_append(&_output, _chunk, rc);
+	} else if (rc != IO_CONTINUE) {
+		printf("test6: parser failed (%d)\n", rc);
+
+		goto error;
+	}
+
+	while (websocket_has_received_data(&websocket.base.base)) {
+		rc = websocket_receive(&websocket.base, _chunk, sizeof(packet));
+
+		if (rc <= 0 || rc > (int)sizeof(packet)) {
+			printf("test6: could not receive buffered data (%d)\n", rc);
+
+			goto error;
+		}
+
+		buffer_append(&_output, _chunk, rc);
+	}
+
+	if (_output.length != _expected.length ||
+	    memcmp(_output.data, _expected.data, _expected.length) != 0) {
+		printf("test6: wrong decompressed payload\n");
+
+		goto error;
+	}
+
+	answer_end = strstr((char *)_captured.data, "\r\n\r\n");
+
+	if (answer_end == NULL ||
+	    strstr((char *)_captured.data, "Sec-WebSocket-Extensions: permessage-deflate") == NULL) {
+		printf("test6: extension not negotiated\n");
+
+		goto error;
+	}
+
+	answer_length = answer_end + 4 - (char *)_captured.data;
+	_output.length = 0;
+	_expected.length = 0;
+
+	for (i = 0; i < 4; ++i) {
+		memset(packet, 0, sizeof(packet));
+		random_fill(packet, 4);
+
+		if (websocket_send(&websocket.base, packet, sizeof(packet)) < 0) {
+			printf("test6: could not send packet\n");
+
+			goto error;
+		}
+
+		buffer_append(&_expected, packet, sizeof(packet));
+
+		if (i % 2 == 1) {
+			websocket_flush_all();
+		}
+	}
+
+	if (decode_compressed_frames(_captured.data + answer_length,
+	                             _captured.length - answer_length) < 0) {
+		goto error;
+	}
+
+	if (_output.length != _expected.length ||
+	    memcmp(_output.data, _expected.data, _expected.length) != 0) {
+		printf("test6: wrong compressed payload\n");
+
+		goto error;
+	}
+
+	websocket_destroy(&websocket.base);
+	websocket_set_compression(0, 0);
+
+	return 0;
+
+error:
+	deflateEnd(&compressor);
+	websocket_destroy(&websocket.base);
+	websocket_set_compression(0, 0);
+
+	return -1;
+}
+
+#endif
+
+static int benchmark(int payload_length) {
+	Websocket websocket;
+	uint8_t *payload;
+	clock_t start;
+	double duration;
+	uint64_t total = 0;
+	int offset;
+	int chunk_length;
+	int rc;
+
+	payload = calloc(1, payload_length);
+
+	if (payload == NULL) {
+		printf("could not allocate benchmark payload\n");
+
+		return -1;
+	}
+
+	_stream.length = 0;
+
+	while (_stream.length + payload_length + WEBSOCKET_MAX_FRAME_HEADER_LENGTH <= MAX_STREAM_LENGTH) {
+		encode_frame(&_stream, 1, WEBSOCKET_OPCODE_BINARY_FRAME, payload, payload_length);
+	}
+
+	free(payload);
+	prepare_websocket(&websocket, true);
+
+	start = clock();
+
+	while (total < BENCHMARK_BYTES) {
+		for (offset = 0; offset < _stream.length; offset += chunk_length) {
+			chunk_length = MIN(BENCHMARK_READ_LENGTH, _stream.length - offset);
+
+			memcpy(_chunk, _stream.data + offset, chunk_length);
+
+			rc = websocket_parse(&websocket, _chunk, chunk_length);
+
+			if (rc < 0 && rc != IO_CONTINUE) {
+				printf("benchmark: parser failed (%d)\n", rc);
+				websocket_destroy(&websocket.base);
+
+				return -1;
+			}
+		}
+
+		total += _stream.length;
+	}
+
+	duration = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	if (duration <= 0) {
+		duration = 1.0 / CLOCKS_PER_SEC;
+	}
+
+	printf("%6d byte(s) per frame: %8.1f MiB/s\n", payload_length,
+	       (double)total / duration / (1024 * 1024));
+
+	websocket_destroy(&websocket.base);
+
+	return 0;
+}
+
+int main(void) {
+	int lengths[] = { 80, 1024, 65535 };
+	int i;
+
+	log_init();
+
+	_captured.data = malloc(MAX_CAPTURE_LENGTH);
+	_stream.data = malloc(MAX_STREAM_LENGTH);
+	_expected.data = malloc(MAX_STREAM_LENGTH);
+	_expected_pongs.data = malloc(MAX_STREAM_LENGTH);
+	_output.data = malloc(MAX_STREAM_LENGTH);
+	_chunk = malloc(MAX_STREAM_LENGTH);
+
+	if (_captured.data == NULL || _stream.data == NULL || _expected.data == NULL ||
+	    _expected_pongs.data == NULL || _output.data == NULL || _chunk == NULL) {
+		printf("could not allocate buffers\n");
+
+		return EXIT_FAILURE;
+	}
+
+	if (test1() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test2() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test3() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test4() < 0) {
+		return EXIT_FAILURE;
+	}
+
+#ifdef BRICKD_WITH_ZLIB
+	if (test6() < 0) {
+		return EXIT_FAILURE;
+	}
+#endif
+
+	// the fuzz input makes the parser log lots of errors to stderr
+	if (freopen("/dev/null", "w", stderr) == NULL) {
+		printf("could not silence stderr\n");
+
+		return EXIT_FAILURE;
+	}
+
+	if (test5() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < (int)(sizeof(lengths) / sizeof(lengths[0])); ++i) {
+		if (benchmark(lengths[i]) < 0) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	log_exit();
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}